@@ -36,6 +36,8 @@ class BaseCustomizer:
         self.fw_inc_source_path = os.path.join(self.fw_path, "inc")
         self.fw_src_source_path = os.path.join(self.fw_path, "src")
         self.sw_testtool_dest = os.path.join(self.project_dir, "software/testtool")
+        self.sw_broker_dest = os.path.join(self.project_dir, "software/broker")
+        self.sw_capture2csv_dest = os.path.join(self.project_dir, "software/capture2csv")
         self.hlekio_ioctl = "hlekio_ioctl.h"
         self.hlekio_dir = os.path.join(get_project_root(), "hlekio")
 
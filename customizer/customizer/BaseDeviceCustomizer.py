@@ -48,6 +48,8 @@ class BaseDeviceCustomizer(BaseCustomizer):
         #self.sw_inc_dest = os.path.join(self.project_dir, "software/inc")
         #self.sw_src_dest = os.path.join(self.project_dir, "software/src")
         self.sw_testtool_templ = os.path.join(self.template_dir, "software/testtool")
+        self.sw_broker_templ = os.path.join(self.template_dir, "software/broker")
+        self.sw_capture2csv_templ = os.path.join(self.template_dir, "software/capture2csv")
 
         self.sw_lib_path = common_config[FW_FIRMWARE]['libconfig_path']
         self.sw_lib_inc_dest = common_config[FW_FIRMWARE]['libconfig_inc_path']
@@ -86,6 +86,12 @@ class FirmwareCustomizer(BaseDeviceCustomizer):
         self.add_template(os.path.join(self.sw_testtool_templ, self.cmake_script),
                           [os.path.join(self.sw_testtool_dest, self.cmake_script)])
 
+        self.add_template(os.path.join(self.sw_broker_templ, self.cmake_script),
+                          [os.path.join(self.sw_broker_dest, self.cmake_script)])
+
+        self.add_template(os.path.join(self.sw_capture2csv_templ, self.cmake_script),
+                          [os.path.join(self.sw_capture2csv_dest, self.cmake_script)])
+
 
     def customize(self):
 
@@ -43,6 +43,8 @@ class LibhlekCustomizer(BaseCustomizer):
         self.add_copy(os.path.join(self.fw_src_source_path, FILE_CIRC_BUF_SRC), [os.path.join(self.sw_testtool_dest, FILE_CIRC_BUF_SRC)])
         self.add_copy(os.path.join(self.fw_inc_source_path, FILE_UTOOLS_BUF_HDR), [os.path.join(self.sw_testtool_dest, FILE_UTOOLS_BUF_HDR)])
         self.add_copy(os.path.join(self.fw_src_source_path, FILE_UTOOLS_BUF_SRC), [os.path.join(self.sw_testtool_dest, FILE_UTOOLS_BUF_SRC)])
+        self.add_copy(os.path.join(self.fw_inc_source_path, FILE_I2C_BUS_HDR), [os.path.join(self.sw_testtool_dest, FILE_I2C_BUS_HDR)])
+        self.add_copy(os.path.join(self.fw_src_source_path, FILE_I2C_BUS_SRC), [os.path.join(self.sw_testtool_dest, FILE_I2C_BUS_SRC)])
 
     def add_common_headers(self):
         for customizer, info in self.shared_headers.items():
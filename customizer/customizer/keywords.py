@@ -90,6 +90,8 @@ FILE_CIRC_BUF_HDR = "circbuffer.h"
 FILE_CIRC_BUF_SRC = "circbuffer.c"
 FILE_UTOOLS_BUF_HDR = "utools.h"
 FILE_UTOOLS_BUF_SRC = "utools.c"
+FILE_I2C_BUS_HDR = "i2c_bus.h"
+FILE_I2C_BUS_SRC = "i2c_bus.c"
 
 
 KW_FEATURE_DEFINES = "feature_defines"
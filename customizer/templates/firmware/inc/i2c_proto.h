@@ -65,6 +65,24 @@
 /// Software reads are checked with use of CommResponseHeader#last_crc . To check control sum software should issue two read operations, the first to read data, and the second to read previous operation control sum.
 /// Thus, data integrity is verified on both paths.
 ///
+/// Optionally, frames may be protected by CRC-16 (CRC-16/CCITT-FALSE: polynomial #COMM_CRC16_POLY, initial value
+/// #COMM_CRC16_INIT_VALUE, no reflection, no final XOR) which is much stronger for long transfers. Such a command is
+/// marked by #COMM_CRC16_FLAG set in CommCommandHeader#length and is followed by #COMM_CRC16_SIZE bytes of CRC-16 of
+/// the whole frame (header including CommCommandHeader#control_crc and data), most significant byte first. The length
+/// field still specifies length of the data without CRC-16, so such a command may not exceed #COMM_BUFFER_LENGTH minus
+/// #COMM_CRC16_SIZE bytes of data. Firmware calculates CRC-16 of all the bytes received, including CRC-16 itself, and
+/// accepts command if result is zero, otherwise #COMM_STATUS_CRC is set.
+///
+/// Every accepted command selects control sum mode of the firmware: command with #COMM_CRC16_FLAG switches firmware to
+/// CRC-16 mode, command without it switches back. In CRC-16 mode CommResponseHeader#last_crc and
+/// CommResponseHeader#dummy carry CRC-16 of the previous operation (least significant byte first) instead of control
+/// sum and #COMM_DUMMY_BYTE. For command it is CRC-16 of the frame without CRC-16 bytes, for read it is CRC-16 of all
+/// the bytes sent, for synchronization it is CRC-16 of the bytes received.
+///
+/// CRC-16 mode is negotiated by software: the first command with #COMM_CRC16_FLAG is acknowledged by firmware with
+/// CRC-16 of this command in the response header. Firmware without CRC-16 support rejects such a command because of
+/// the length mismatch, so if command is not acknowledged after several attempts software falls back to control sum.
+///
 /// \section sect_communication_details_03 Communication workflow
 /// \image html communication.png
 /// \image latex communication.eps
@@ -135,11 +153,59 @@
 /// \brief This structure represent command being sent from software to firmware
 struct CommCommandHeader{{
 	uint8_t  command_byte; ///< Command byte, contains device ID and may have several device specific flags set.
-	uint16_t length;	///< Length of the data that follows this structure, may be equal to 0
+	uint16_t length;	///< Length of the data that follows this structure, may be equal to 0. #COMM_BATCH_FLAG is set for batch frame, #COMM_CRC16_FLAG for frame protected by CRC-16.
 	uint8_t  control_crc; ///< Is a control sum. All the bytes, including this header (but excluding this value) are XORed and must be equal to this value, otherwise command will not be accepted and #COMM_STATUS_CRC will be set.
 }};
 
 #pragma pack(pop)
+
+/// \section sect_communication_command_02 Batch
+///
+/// Several commands for different virtual devices may be sent by single write (batch frame). Batch frame is marked by
+/// #COMM_BATCH_FLAG set in CommCommandHeader#length, the rest of the length field is a length of the data as usual.
+/// Data consist of #CommBatchRecord structures, each one is followed by the command data and padding up to
+/// #COMM_BATCH_ALIGN bytes boundary (see #COMM_BATCH_RECORD_SIZE). Control sum is calculated for the whole frame
+/// as for regular command.
+///
+/// CommCommandHeader#command_byte must contain ID of the registered virtual device, this device is selected after
+/// batch frame is received, so communication status read by software refers to it (device specific flags are ignored).
+/// Firmware validates all the records first, if any record exceeds data or addresses virtual device without
+/// ON_COMMAND callback, no command is executed and #COMM_STATUS_FAIL is set. Otherwise, ON_COMMAND callbacks are
+/// called in the order of records, and communication status is a combination of values returned by callbacks.
+///
+
+/// \def COMM_BATCH_FLAG
+/// \brief Flag in CommCommandHeader#length which indicates batch frame.
+#define COMM_BATCH_FLAG               (uint16_t)(0x8000)
+
+/// \def COMM_CRC16_FLAG
+/// \brief Flag in CommCommandHeader#length which indicates frame protected by CRC-16 (see \ref sect_communication_details_02).
+#define COMM_CRC16_FLAG               (uint16_t)(0x4000)
+
+/// \def COMM_LENGTH_MASK
+/// \brief Mask for data length in CommCommandHeader#length.
+#define COMM_LENGTH_MASK              (uint16_t)(~(COMM_BATCH_FLAG | COMM_CRC16_FLAG))
+
+/// \def COMM_BATCH_ALIGN
+/// \brief Alignment of the batch records. Each record data starts at the same alignment as receive buffer.
+#define COMM_BATCH_ALIGN              4
+
+#pragma pack(push, 1)
+
+/// \struct CommBatchRecord
+/// \brief This structure precedes command data of every virtual device command in the batch frame.
+struct CommBatchRecord{{
+	uint8_t  command_byte; ///< Command byte, contains device ID and may have several device specific flags set.
+	uint8_t  reserved;     ///< Reserved, must be zero.
+	uint16_t length;       ///< Length of the command data that follows this structure, may be equal to 0.
+}};
+
+#pragma pack(pop)
+
+/// \def COMM_BATCH_RECORD_SIZE
+/// \brief Size of the batch record with command data of the specified length, including padding.
+#define COMM_BATCH_RECORD_SIZE(len)   (((uint32_t)sizeof(struct CommBatchRecord) + (uint32_t)(len) + COMM_BATCH_ALIGN - 1) & \
+                                       ~(uint32_t)(COMM_BATCH_ALIGN - 1))
 /// @}}
 
 /// \defgroup group_communication_response Response
@@ -154,6 +220,19 @@ struct CommCommandHeader{{
 /// less or more data then selected virtual device has or even just single byte. Firmware should carefully handle all such
 /// situations. When transmission is over virtual device ON_READDONE callback is called.
 ///
+/// \section sect_communication_response_02 Streaming read
+/// Virtual devices with circular buffer may enable streaming reads. In this case read is committed by firmware on stop
+/// condition (ON_READDONE callback is not called and device doesn't become busy), so the next read continues right after
+/// the data already read. Software may drain such device by back to back reads of "up to N bytes": each read returns
+/// #CommResponseHeader followed by N bytes, where first min(N, CommResponseHeader#length) bytes are valid and the rest are
+/// #COMM_BAD_BYTE. There is no need to synchronize device or to read status separately for every chunk: control sum of a
+/// read is returned as CommResponseHeader#last_crc by the next read. Software should read whole blocks of the circular
+/// buffer, because data available is always a multiple of the block size; firmware commits whole blocks only, so
+/// partially read block is sent again by the next read. Status bytes of the circular buffer are sent by every read. They
+/// are updated by synchronization, or, if device provides live status, when read starts: status is taken before length
+/// of the data, so single read returns status, and all the data sampled before status was taken. In this case device
+/// may be drained by single read per drain (ADCDev does this).
+///
 
 /// \def COMM_STATUS_MASK
 /// \brief Defines bitmask for communication status bits
@@ -218,6 +297,19 @@ struct CommResponseHeader{{
 /// \brief Defines dummy byte used to sent second byte as soon as possible
 #define COMM_DUMMY_BYTE               0xDB
 
+// CRC-16 parameters
+/// \def COMM_CRC16_INIT_VALUE
+/// \brief Defines initial value for CRC-16 calculation
+#define COMM_CRC16_INIT_VALUE         0xFFFF
+
+/// \def COMM_CRC16_POLY
+/// \brief Defines CRC-16 polynomial (CCITT)
+#define COMM_CRC16_POLY               0x1021
+
+/// \def COMM_CRC16_SIZE
+/// \brief Defines number of CRC-16 bytes that follow command data if #COMM_CRC16_FLAG is set
+#define COMM_CRC16_SIZE               2
+
 /// \def COMM_CRC_OFFSET
 /// \brief Defines offset (in bytes) of the CommCommandHeader#control_crc
 #define COMM_CRC_OFFSET               3
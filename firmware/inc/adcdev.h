@@ -158,11 +158,5 @@ void adc_init();
 /// \return Communication status to be applied after command execution.
 uint8_t adc_dev_execute(uint8_t cmd_byte, uint8_t* data, uint16_t length);
 
-/// \brief #ON_READDONE callback for all ADCDev devices
-/// \param device_id - Device ID of the virtual device which data was read
-/// \param length - amount of bytes read.
-/// \return Communication status to be applied after read completion.
-uint8_t adc_read_done(uint8_t device_id, uint16_t length);
-
 /// @}
 #endif
\ No newline at end of file
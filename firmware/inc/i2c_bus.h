@@ -70,6 +70,7 @@
 ///      - tag_DeviceContext#on_command() - Command callback. It is used to pass a command to the device. Note, that
 ///        buffer being used by all devices for command data is shared (#g_recv_buffer, #COMM_BUFFER_LENGTH bytes in length)
 ///      - tag_DeviceContext#on_read_done() - Read callback. Notifies device that data from it's buffer is read by software.
+///        It is not called for devices with streaming reads enabled (tag_DeviceContext#i2c_stream_read).
 ///      - tag_DeviceContext#on_polling() - Device may schedule simple pooling with specified period of time. This callback
 ///        provide ability for device to be called periodically.
 ///
@@ -146,6 +147,17 @@ struct __attribute__ ((aligned (8))) DeviceContext {
 
     int8_t i2c_circular_buffer;         ///< 0 if linear buffer, 1 if circular buffer. Note these two values must be identical to the
                                         ///< i2c bus finite state machine values (
+
+    uint8_t i2c_stream_read;            ///< Non-zero enables streaming reads of the circular buffer (see \ref sect_communication_response_02):
+                                        ///< read is committed by communication on stop condition, so the next read continues
+                                        ///< right after data already read. on_read_done() is not called and device doesn't
+                                        ///< become busy after read. Only whole blocks of the circular buffer are
+                                        ///< committed. Must be zero for devices with linear buffer.
+
+    volatile uint8_t* i2c_stream_status;  ///< Optional source of the circular buffer status for streaming reads. If not
+                                        ///< zero, status bytes are copied from here when read starts, before length of
+                                        ///< the data is taken, so streaming read returns up to date status without
+                                        ///< synchronization.
 };
 
 /// \brief Virtual device calls this function in order to register device for communication with software
@@ -71,11 +71,5 @@ void timetrackerdev_init();
 /// \return Communication status to be applied after command execution.
 uint8_t timetrackerdev_execute(uint8_t cmd_byte, uint8_t* data, uint16_t length);
 
-/// \brief #ON_READDONE callback for all TimeTrackerDev devices
-/// \param device_id - Device ID of the virtual device which data was read
-/// \param length - amount of bytes read.
-/// \return Communication status to be applied after read completion.
-uint8_t timetrackerdev_read_done(uint8_t device_id, uint16_t length);
-
 /// @}
 #endif
\ No newline at end of file
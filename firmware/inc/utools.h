@@ -106,82 +106,6 @@ extern uint16_t g_dummy_reg16;
 extern volatile uint8_t g_irq_disabled;
 #endif
 
-/// \brief Check if all bits specified by f are set in x.
-/// \param x - value to be tested.
-/// \param f - bitmask where 1 indicates bit that should be tested for 1, bits with 0 are ignored.
-#define IS_SET(x,f)     (((x) & (f))==(f))
-
-/// \brief Check if bits specified by f are actually cleared in x.
-/// \param x - value to be tested.
-/// \param f - bitmask where 1 indicates bit that should be tested for 0, bits with 0 are ignored.
-#define IS_CLEARED(x,f) (((x) & (f))==0)
-
-/// \brief Clears bits specified by f in x.
-/// \param x - value to be modified.
-/// \param f - bitmask where 1 indicates bit that should be cleared, bits with 0 are ignored.
-/// \note This macro will check statically that variables being passed are the same in type size.
-///       If static assert doesn't allow compilation, make sure types have the same size or use explicit type casting.
-#define CLEAR_FLAGS(x,f) { _Static_assert(sizeof(x) == sizeof(f), "Types size are not the same"); } \
-                         ((x) = (x) & (~(f)))
-
-/// \brief Sets bits specified by f in x.
-/// \param x - value to be modified.
-/// \param f - bitmask where 1 indicates bit that should be set, bits with 0 are ignored.
-/// \note This macro will check statically that variables being passed are the same in type size.
-///       If static assert doesn't allow compilation, make sure types have the same size or use explicit type casting.
-#define SET_FLAGS(x,f)  { _Static_assert(sizeof(x) == sizeof(f), "Types size are not the same") ; } \
-                        ((x) = (x) | (f))
-
-/// \brief Sets bits specified by value in x using mask.
-/// \param x - value to be modified.
-/// \param mask - bitmask where 1 indicates bit of interest that will be modified as specified by value, bits with 0 are
-///        ignored.
-/// \param value - value that specifies new bit values.
-/// \note This macro will check statically that variables being passed are the same in type size.
-///       If static assert doesn't allow compilation, make sure types have the same size or use explicit type casting.
-#define SET_BIT_FIELD(x, mask, value) { _Static_assert(sizeof(x) == sizeof(mask), "Types size are not the same");   \
-                                        _Static_assert(sizeof(x) == sizeof(value), "Types size are not the same"); }\
-                                      (x) = (((x) & (~(mask))) | ((value)&(mask)))
-
-/// \brief Checks if flags specified by mask are set as specified
-/// \param x - value to be inspected
-/// \param mask - a mask that specify bits (flags) of interest
-/// \param flags - expected flags
-/// \return non-zero if flags specified by mask are set as described by flags
-#define CHECK_FLAGS(x, mask, flags) ( ((x) & (mask)) == ((flags) & (mask)) )
-
-/// \brief Checks if flags are not set in the register
-/// \param x - value to be inspected
-/// \param mask - a mask that specify bits (flags) of interest
-/// \param flags - expected flags combinations
-/// \return non-zero if flags specified by mask are NOT set as expected
-#define FLAGS_ARE_NOT_SET(x, mask, flags) ( ((x) & (mask)) != ((flags) & (mask)) )
-
-/// Converts bit in flag into 0 or 1 using bit offset.
-/// \param flag - value with bit of interest.
-/// \param bit_offset - offset of the bit of interest.
-#define TO_ZERO_OR_ONE(flag, bit_offset) (((flag) >> (bit_offset)) & 1)
-
-/// \brief This macro check if single bit is set in unsiged value
-/// \param x - Parameter to check
-#define IS_SINGLE_BIT(x) ( ((x)!=0) && (((x) & ((x) - 1))==0) )
-
-/// \brief This macro produce function without parameters with name specified by func_name.
-/// \param empty - do not specify it, just leave blank like: MAKE_VOID_FUNCTION_VOID_NAME(, foo)
-/// \param func_name - name of the function to be defined
-#define MAKE_VOID_FUNCTION_VOID_NAME(empty, func_name) void empty##func_name (void)
-
-/// \brief This macro produces interrupt handler.
-/// \param isr_name - name of the function to be defined
-#define MAKE_ISR(isr_name) MAKE_VOID_FUNCTION_VOID_NAME(,isr_name)
-
-/// \brief This macro produces indexed interrupt handler.
-/// \param isr_name - irq handler name to be defined.
-/// \param callee - function to be called by isr_name. This function must accept index parameter.
-/// \param index - value to be passed into callee as parameter.
-#define MAKE_ISR_WITH_INDEX(isr_name,callee, index) MAKE_ISR(isr_name)	{	\
-																callee(index);			\
-															}
 /// \brief This macro start gpio definition by declaring gpio structure (see GPIO_InitTypeDef in CMSIS).
 #define START_PIN_DECLARATION 				GPIO_InitTypeDef gpio;
 
@@ -398,6 +322,83 @@ void fail_assert(uint8_t* src, uint32_t line);
 
 #endif // of DISABLE_NOT_TESTABLE_CODE
 
+/// \brief Check if all bits specified by f are set in x.
+/// \param x - value to be tested.
+/// \param f - bitmask where 1 indicates bit that should be tested for 1, bits with 0 are ignored.
+#define IS_SET(x,f)     (((x) & (f))==(f))
+
+/// \brief Check if bits specified by f are actually cleared in x.
+/// \param x - value to be tested.
+/// \param f - bitmask where 1 indicates bit that should be tested for 0, bits with 0 are ignored.
+#define IS_CLEARED(x,f) (((x) & (f))==0)
+
+/// \brief Clears bits specified by f in x.
+/// \param x - value to be modified.
+/// \param f - bitmask where 1 indicates bit that should be cleared, bits with 0 are ignored.
+/// \note This macro will check statically that variables being passed are the same in type size.
+///       If static assert doesn't allow compilation, make sure types have the same size or use explicit type casting.
+#define CLEAR_FLAGS(x,f) { _Static_assert(sizeof(x) == sizeof(f), "Types size are not the same"); } \
+                         ((x) = (x) & (~(f)))
+
+/// \brief Sets bits specified by f in x.
+/// \param x - value to be modified.
+/// \param f - bitmask where 1 indicates bit that should be set, bits with 0 are ignored.
+/// \note This macro will check statically that variables being passed are the same in type size.
+///       If static assert doesn't allow compilation, make sure types have the same size or use explicit type casting.
+#define SET_FLAGS(x,f)  { _Static_assert(sizeof(x) == sizeof(f), "Types size are not the same") ; } \
+                        ((x) = (x) | (f))
+
+/// \brief Sets bits specified by value in x using mask.
+/// \param x - value to be modified.
+/// \param mask - bitmask where 1 indicates bit of interest that will be modified as specified by value, bits with 0 are
+///        ignored.
+/// \param value - value that specifies new bit values.
+/// \note This macro will check statically that variables being passed are the same in type size.
+///       If static assert doesn't allow compilation, make sure types have the same size or use explicit type casting.
+#define SET_BIT_FIELD(x, mask, value) { _Static_assert(sizeof(x) == sizeof(mask), "Types size are not the same");   \
+                                        _Static_assert(sizeof(x) == sizeof(value), "Types size are not the same"); }\
+                                      (x) = (((x) & (~(mask))) | ((value)&(mask)))
+
+/// \brief Checks if flags specified by mask are set as specified
+/// \param x - value to be inspected
+/// \param mask - a mask that specify bits (flags) of interest
+/// \param flags - expected flags
+/// \return non-zero if flags specified by mask are set as described by flags
+#define CHECK_FLAGS(x, mask, flags) ( ((x) & (mask)) == ((flags) & (mask)) )
+
+/// \brief Checks if flags are not set in the register
+/// \param x - value to be inspected
+/// \param mask - a mask that specify bits (flags) of interest
+/// \param flags - expected flags combinations
+/// \return non-zero if flags specified by mask are NOT set as expected
+#define FLAGS_ARE_NOT_SET(x, mask, flags) ( ((x) & (mask)) != ((flags) & (mask)) )
+
+/// Converts bit in flag into 0 or 1 using bit offset.
+/// \param flag - value with bit of interest.
+/// \param bit_offset - offset of the bit of interest.
+#define TO_ZERO_OR_ONE(flag, bit_offset) (((flag) >> (bit_offset)) & 1)
+
+/// \brief This macro check if single bit is set in unsiged value
+/// \param x - Parameter to check
+#define IS_SINGLE_BIT(x) ( ((x)!=0) && (((x) & ((x) - 1))==0) )
+
+/// \brief This macro produce function without parameters with name specified by func_name.
+/// \param empty - do not specify it, just leave blank like: MAKE_VOID_FUNCTION_VOID_NAME(, foo)
+/// \param func_name - name of the function to be defined
+#define MAKE_VOID_FUNCTION_VOID_NAME(empty, func_name) void empty##func_name (void)
+
+/// \brief This macro produces interrupt handler.
+/// \param isr_name - name of the function to be defined
+#define MAKE_ISR(isr_name) MAKE_VOID_FUNCTION_VOID_NAME(,isr_name)
+
+/// \brief This macro produces indexed interrupt handler.
+/// \param isr_name - irq handler name to be defined.
+/// \param callee - function to be called by isr_name. This function must accept index parameter.
+/// \param index - value to be passed into callee as parameter.
+#define MAKE_ISR_WITH_INDEX(isr_name,callee, index) MAKE_ISR(isr_name)	{	\
+																callee(index);			\
+															}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -313,15 +313,6 @@ done:
     return result;
 }
 
-uint8_t adc_read_done(uint8_t device_id, uint16_t length) {
-    uint16_t index = comm_dev_context(device_id)->dev_index;
-    struct ADCDevFwInstance* dev = g_adc_devs+index;
-    volatile struct CircBuffer* circbuf = (volatile struct CircBuffer*)&(dev->circ_buffer);
-    uint8_t status = circbuf_get_ovf(circbuf) ? COMM_STATUS_OVF : COMM_STATUS_OK;
-    circbuf_stop_read(circbuf, length);
-    return status;
-}
-
 static inline uint8_t adc_reset_circ_buffer(struct ADCDevFwInstance* dev) {
     uint8_t result = COMM_STATUS_FAIL;
     uint8_t adc_started = IS_SET(dev->privdata.status, (uint16_t)ADCDEV_STATUS_STARTED);
@@ -354,9 +345,10 @@ void adc_init() {
         dev->dev_ctx.device_id = dev->dev_id;
         dev->dev_ctx.dev_index = i;
         dev->dev_ctx.on_command = adc_dev_execute;
-        dev->dev_ctx.on_read_done = adc_read_done;
         dev->dev_ctx.on_sync = adc_sync;
         dev->dev_ctx.circ_buffer = (struct CircBuffer*)( &(dev->circ_buffer) );
+        dev->dev_ctx.i2c_stream_read = 1; // Read is committed by I2C bus, overflow is reported by response header
+        dev->dev_ctx.i2c_stream_status = (volatile uint8_t*)&(pdata->status); // Status is sent with data without sync
 
         // Initialize circular buffer
         circbuf_init(dev->dev_ctx.circ_buffer, (uint8_t *)dev->buffer, dev->buffer_size);
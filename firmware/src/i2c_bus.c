@@ -20,13 +20,18 @@
  *   \author Oleh Sharuda
  */
 
+#ifdef DISABLE_NOT_TESTABLE_CODE
+#include "i2c_mock.hpp"
+#else
 #include "fw.h"
-
+#endif
 
 #include <string.h>
 #include "utools.h"
 #include "i2c_bus.h"
+#ifndef DISABLE_NOT_TESTABLE_CODE
 #include "sys_tick_counter.h"
+#endif
 
 
 #define ISR_EV_DEBUG_TRANSMIT 0
@@ -85,7 +90,8 @@ volatile uint8_t g_transmit = 0;	// shows current transfer direction
 volatile uint8_t g_comm_status = 0;
 
 /// \brief This variable stores status value returned by virtual device. It's value then being copied into g_comm_status upon
-///        next transaction initialization.
+///        next transaction initialization. It is cleared when other device is selected, and when response header is
+///        read by software, so status is reported once and for the device which returned it.
 volatile uint8_t g_returned_comm_status = 0;
 
 /// \brief This flag is used to keep current device id.
@@ -111,13 +117,18 @@ uint8_t g_device_id = 0;
 ///        status being send to the software.
 #define BUS_CMD_SYNC  3
 
+/// \def BUS_CMD_BATCH
+/// \brief Indicates batch frame (see #COMM_BATCH_FLAG) is received from the master (software). Commands of the batch
+///        are passed to tag_DeviceContext#on_command() callbacks of the corresponding virtual devices.
+#define BUS_CMD_BATCH 4
+
 /// \brief Value to enable I2C peripherals via CR1
 #define I2C_BUS_CR1_ENABLE              ((uint16_t)0x0001)
 
 
 /// \brief Indicates type of completed operation. It's value is read periodically in #main() infinite loop to perform action
-///        requested by master (software) for virtual device. It may be equal to either #BUS_CMD_NONE, #BUS_CMD_WRITE or
-///        #BUS_CMD_READ
+///        requested by master (software) for virtual device. It may be equal to either #BUS_CMD_NONE, #BUS_CMD_WRITE,
+///        #BUS_CMD_BATCH, #BUS_CMD_READ or #BUS_CMD_SYNC
 uint8_t g_cmd_type = BUS_CMD_NONE;
 
 /// \brief Number of commands (virtual device callbacks calls) issued by I2C bus
@@ -136,7 +147,10 @@ struct CommCommandHeader g_cmd_header;
 uint8_t* g_cmd_header_ptr = (uint8_t*)&g_cmd_header;
 
 /// \brief Receive buffer that is used to receive data from master (software). This is a place where master sends data.
-uint8_t g_recv_buffer[COMM_BUFFER_LENGTH];
+/// \note Buffer is aligned, so command data of the batch records (see #COMM_BATCH_ALIGN) is aligned too.
+uint8_t g_recv_buffer[COMM_BUFFER_LENGTH] __attribute__ ((aligned));
+
+_Static_assert(COMM_BUFFER_LENGTH <= COMM_LENGTH_MASK, "COMM_BUFFER_LENGTH overlaps COMM_BATCH_FLAG or COMM_CRC16_FLAG");
 
 /// \brief Total number of bytes received counter. It counts all bytes sent by master (software) to firmware except those
 ///        bytes which are exceed receive buffer (#g_recv_buffer) length defined by #COMM_BUFFER_LENGTH.
@@ -168,6 +182,60 @@ uint16_t g_tran_dev_pos __attribute__ ((aligned)) = 0;	// Number of bytes transm
 /// \brief Communication control sum accumulator. Start value is defined by #COMM_CRC_INIT_VALUE
 uint8_t g_crc = COMM_CRC_INIT_VALUE; // CRC accumulator
 
+/// \brief CRC-16 accumulator (see #COMM_CRC16_FLAG). It is updated only if #g_crc16_active is set.
+uint16_t g_crc16 = COMM_CRC16_INIT_VALUE;
+
+/// \brief Non-zero if #g_crc16 is updated by bytes of the current communication: firmware is in CRC-16 mode, or
+///        command frame carries #COMM_CRC16_FLAG. XOR mode doesn't spend time on CRC-16.
+uint8_t g_crc16_active = 0;
+
+/// \brief Value of #g_crc16 before the last transmitted byte. It is used to count preloaded byte back on stop condition.
+uint16_t g_crc16_prev = COMM_CRC16_INIT_VALUE;
+
+/// \brief Non-zero if firmware is in CRC-16 mode: the last accepted command had #COMM_CRC16_FLAG set.
+uint8_t g_crc16_mode = 0;
+
+/// \brief The first two bytes of #CommResponseHeader: control sum of the previous operation followed by
+///        #COMM_DUMMY_BYTE, or CRC-16 of the previous operation in CRC-16 mode. They are prepared on stop condition,
+///        because they must be written into I2C data register as soon as possible.
+uint8_t g_last_crc[2] = {COMM_CRC_INIT_VALUE, COMM_DUMMY_BYTE};
+
+/// \brief CRC-16 lookup table for #COMM_CRC16_POLY polynomial.
+static const uint16_t g_crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
 /// \brief Value of the last byte put into (or read from) I2C data register. It's value is used for correct control sum calculations.
 uint8_t g_last_byte = 0;
 
@@ -193,6 +261,16 @@ struct DeviceContext* g_devices[COMM_MAX_DEV_ADDR + 1];
 struct DeviceContext* g_cur_device = 0;
 /// @}
 
+/// \brief Updates CRC-16 with a byte.
+/// \param crc - CRC-16 accumulated so far.
+/// \param b - byte to be added.
+/// \return Updated CRC-16.
+__attribute__((always_inline)) static inline
+uint16_t i2c_crc16_update(uint16_t crc, uint8_t b) {
+    return (uint16_t)((crc << 8) ^ g_crc16_table[(uint8_t)((crc >> 8) ^ b)]);
+}
+
+#ifndef DISABLE_NOT_TESTABLE_CODE
 /// \brief This function initializes I2C communication peripherals
 __attribute__((always_inline)) static inline
 void i2c_bus_init_peripherals(void) {
@@ -256,6 +334,7 @@ void i2c_bus_init_peripherals(void) {
 
     I2C_BUS_PERIPH->CR1 |= I2C_BUS_CR1_ENABLE;
 }
+#endif // DISABLE_NOT_TESTABLE_CODE
 
 void i2c_bus_init(void)
 {
@@ -263,7 +342,9 @@ void i2c_bus_init(void)
     IS_ALIGNED(&g_last_usClock, sizeof(uint64_t));
 #endif
     memset((void*)g_devices, 0, sizeof(g_devices));
+#ifndef DISABLE_NOT_TESTABLE_CODE
     i2c_bus_init_peripherals();
+#endif
 #if ENABLE_SYSTICK!=0
     g_last_usClock = get_us_clock();
 #endif
@@ -292,6 +373,7 @@ void comm_register_device(struct DeviceContext* dev_ctx) {
         // This will help to avoid additional state to check, which will be faster and will decrease IRQ handlers
         // execution time. Therefore, devices without output buffers are forbidden!
         assert_param( (dev_ctx->circ_buffer != 0) || (dev_ctx->buffer != 0) );
+        assert_param( (dev_ctx->circ_buffer != 0) || (dev_ctx->i2c_stream_read == 0) );
 	} else {
         assert_param(0);
     }
@@ -302,6 +384,42 @@ struct DeviceContext* comm_dev_context(uint8_t cmd_byte) {
 	return g_devices[cmd_byte & COMM_MAX_DEV_ADDR];
 }
 
+//------------------------------------------------------------------------------------
+// i2c_dispatch_batch
+// Purpose: Passes batch frame records to ON_COMMAND callbacks of the virtual devices in order
+// Returns: Combination of the communication statuses returned by virtual devices, or COMM_STATUS_FAIL if batch is
+//          malformed. Batch is validated first, so either all the commands are executed or none.
+//------------------------------------------------------------------------------------
+static uint8_t i2c_dispatch_batch(void) {
+    uint32_t pos;
+    uint32_t size;
+    uint8_t status = COMM_STATUS_OK;
+    struct CommBatchRecord* rec;
+    struct DeviceContext* dev;
+
+    for (pos = 0; pos < g_recv_data_pos; pos += size) {
+        if (g_recv_data_pos - pos < sizeof(struct CommBatchRecord)) {
+            return COMM_STATUS_FAIL;
+        }
+
+        rec = (struct CommBatchRecord*)(g_recv_buffer + pos);
+        size = COMM_BATCH_RECORD_SIZE(rec->length);
+        dev = comm_dev_context(rec->command_byte);
+        if (size > g_recv_data_pos - pos || rec->reserved != 0 || dev == 0 || dev->on_command == 0) {
+            return COMM_STATUS_FAIL;
+        }
+    }
+
+    for (pos = 0; pos < g_recv_data_pos; pos += size) {
+        rec = (struct CommBatchRecord*)(g_recv_buffer + pos);
+        size = COMM_BATCH_RECORD_SIZE(rec->length);
+        dev = comm_dev_context(rec->command_byte);
+        status |= dev->on_command(rec->command_byte, (uint8_t*)(rec + 1), rec->length);
+    }
+
+    return status;
+}
+
 // Called to check if there were command and to call device callbacks
 void i2c_check_command(void) {
     uint8_t status;
@@ -319,6 +437,10 @@ void i2c_check_command(void) {
                 status = g_cur_device->on_command(g_cmd_header.command_byte, g_recv_buffer, g_recv_data_pos);
             break;
 
+            case BUS_CMD_BATCH:
+                status = i2c_dispatch_batch();
+            break;
+
             case BUS_CMD_SYNC:
                 status = g_cur_device->on_sync(g_cmd_header.command_byte, g_recv_total_pos);
             break;
@@ -326,7 +448,10 @@ void i2c_check_command(void) {
                 assert_param(0); // We should never be here
                 status = COMM_STATUS_FAIL;
         }
-        g_comm_status = status & (~COMM_MAX_DEV_ADDR);
+        // Status is kept for the subsequent transactions (it is restored by i2c_receive_init() and
+        // i2c_transmit_init_xxx()), otherwise failure returned by virtual device is never seen by software
+        g_returned_comm_status = status & (~COMM_MAX_DEV_ADDR);
+        g_comm_status = g_returned_comm_status;
         g_processed_cmd_count++;
     }
 }
@@ -362,6 +487,20 @@ void i2c_pool_devices(void) {
 }
 #endif
 
+/// \brief Copies live status of the device with streaming reads into circular buffer status. Status is copied before
+///        length of the data is taken, so data sampled before status change is not missed by the read.
+__attribute__((always_inline)) static inline
+void i2c_stream_status_latch(void) {
+    volatile struct CircBuffer* circ = g_cur_device->circ_buffer;
+    volatile uint8_t* src = g_cur_device->i2c_stream_status;
+
+    if (g_cur_device->i2c_stream_read && src != 0) {
+        for (int32_t i = 0; i < circ->status_size; i++) {
+            circ->status[i] = src[i];
+        }
+    }
+}
+
 /// \brief This function initializes I2C communication for transmit when I2C peripherals status has ADDR and TXE flags set
 ///        (I2C address is matched and DR address is found empty)
 /// \note Firmware must write first two bytes into data register as soon as possible (second byte is a dummy byte),
@@ -370,8 +509,12 @@ void i2c_pool_devices(void) {
 __attribute__((always_inline)) static inline
 void i2c_transmit_init_with_send(void) {
 
-    uint8_t prev_crc = g_crc;
-    g_crc = COMM_CRC_INIT_VALUE ^ COMM_DUMMY_BYTE ^ prev_crc;
+    g_crc = COMM_CRC_INIT_VALUE ^ g_last_crc[0] ^ g_last_crc[1];
+    g_crc16_active = g_crc16_mode;
+    if (g_crc16_active) {
+        g_crc16_prev = i2c_crc16_update(COMM_CRC16_INIT_VALUE, g_last_crc[0]);
+        g_crc16 = i2c_crc16_update(g_crc16_prev, g_last_crc[1]);
+    }
 
     // region I2C_TRACE #0xD2
     I2C_STATUS_TRACK(g_crc, g_last_byte, 0xD2);
@@ -385,6 +528,7 @@ void i2c_transmit_init_with_send(void) {
     g_resp_header.comm_status = g_comm_status | g_device_id;
 
     if (g_cur_device->i2c_circular_buffer) {
+        i2c_stream_status_latch();
         circbuf_start_read(g_cur_device->circ_buffer);
         g_resp_header.length = circbuf_total_len(g_cur_device->circ_buffer);
 
@@ -401,20 +545,22 @@ void i2c_transmit_init_with_send(void) {
 ///        (I2C address is matched). Note: TXE flag is not set, in this case we shouldn't write to DR yet.
 __attribute__((always_inline)) static inline
 void i2c_transmit_init_no_send(void) {
-    uint8_t prev_crc = g_crc;
     g_crc = COMM_CRC_INIT_VALUE;
+    g_crc16 = COMM_CRC16_INIT_VALUE;
+    g_crc16_active = g_crc16_mode;
 
     // Transmit
     g_tran_dev_pos = 0;
     g_transmit = 1;
     g_tran_total = 0;
 
-    g_resp_header.last_crc = prev_crc;
-    g_resp_header.dummy = COMM_DUMMY_BYTE;
+    g_resp_header.last_crc = g_last_crc[0];
+    g_resp_header.dummy = g_last_crc[1];
     g_comm_status = g_returned_comm_status;
     g_resp_header.comm_status = g_comm_status | g_device_id;
 
     if (g_cur_device->i2c_circular_buffer) {
+        i2c_stream_status_latch();
         circbuf_start_read(g_cur_device->circ_buffer);
         g_resp_header.length = circbuf_total_len(g_cur_device->circ_buffer);
 
@@ -430,6 +576,8 @@ void i2c_transmit_init_no_send(void) {
 __attribute__((always_inline)) static inline
 void i2c_receive_init(void) {
     g_crc = COMM_CRC_INIT_VALUE;
+    g_crc16 = COMM_CRC16_INIT_VALUE;
+    g_crc16_active = g_crc16_mode;
     g_tran_total = 0;
 
     // Receive (this is new command)
@@ -476,8 +624,13 @@ void i2c_receive_byte(void) {
 
 			uint8_t dev_id = (g_last_byte & COMM_MAX_DEV_ADDR);
 			g_cur_device = g_devices[dev_id];
-            g_device_id = dev_id;
             assert_param(IS_CLEARED(g_comm_status, COMM_STATUS_BUSY));
+            if (dev_id != g_device_id) {
+                // Status returned by the previous device doesn't belong to this one
+                g_returned_comm_status = 0;
+                g_comm_status = 0;
+            }
+            g_device_id = dev_id;
             I2C_STATUS_TRACK(0, dev_id, 0xC2);
 		}
 
@@ -485,11 +638,25 @@ void i2c_receive_byte(void) {
 		if (g_recv_total_pos != COMM_CRC_OFFSET + 1) {
 			g_crc = g_crc ^ g_last_byte;
 		}
+
+		// CRC-16 is calculated in CRC-16 mode and for frames which carry it. In XOR mode header is counted when it is
+		// complete and has COMM_CRC16_FLAG set.
+		if (g_crc16_active) {
+			g_crc16 = i2c_crc16_update(g_crc16, g_last_byte);
+		} else if (g_recv_total_pos == sizeof(struct CommCommandHeader) && IS_SET(g_cmd_header.length, COMM_CRC16_FLAG)) {
+			g_crc16_active = 1;
+			for (uint16_t i = 0; i < sizeof(struct CommCommandHeader); i++) {
+				g_crc16 = i2c_crc16_update(g_crc16, g_cmd_header_ptr[i]);
+			}
+		}
 	} else if (g_recv_data_pos < COMM_BUFFER_LENGTH) {
 		// receive actual command data
 		g_recv_buffer[g_recv_data_pos++] = g_last_byte;
 		g_recv_total_pos++;
 		g_crc = g_crc ^ g_last_byte;
+		if (g_crc16_active) {
+			g_crc16 = i2c_crc16_update(g_crc16, g_last_byte);
+		}
         I2C_STATUS_TRACK(g_crc, g_recv_total_pos, 0xC3);
 	} else {
 		SET_FLAGS(g_comm_status, COMM_STATUS_FAIL);
@@ -509,6 +676,10 @@ void i2c_transmit_byte(void) {
     g_tran_total++;
     g_tran_dev_pos += i2c_device_buffer_increment;
     g_crc = g_crc ^ g_last_byte;
+    if (g_crc16_active) {
+        g_crc16_prev = g_crc16;
+        g_crc16 = i2c_crc16_update(g_crc16, g_last_byte);
+    }
 
 #if ISR_EV_DEBUG_TRANSMIT
     // region I2C_TRACE #0xD4
@@ -601,12 +772,28 @@ void i2c_stop(void) {
 		}
 		g_tran_total--;
 
-		// correct CRC - just XOR one more time last byte sent
+		// correct CRC - just XOR one more time last byte sent, CRC-16 is restored
 		g_crc = g_crc ^ g_last_byte;
+		g_crc16 = g_crc16_prev;
+	}
+
+	if (g_transmit==1 && IS_CLEARED(g_resp_header.comm_status, COMM_STATUS_BUSY) &&
+	    g_tran_total >= sizeof(struct CommResponseHeader)) {
+        // Response header is read completely, status returned by device is reported
+        g_returned_comm_status = 0;
 	}
 
 	if (g_transmit==1 && IS_CLEARED(g_resp_header.comm_status, COMM_STATUS_BUSY) && g_tran_dev_pos > 0) {
-        if (	g_cur_device->on_read_done!=0 &&
+        if (g_cur_device->i2c_stream_read) {
+            // Streaming read: commit read right now, so the next read continues from here without waiting for device.
+            // Only whole blocks are committed, partially read block is sent again by the next read.
+            volatile struct CircBuffer* circ = g_cur_device->circ_buffer;
+            int32_t committed = g_tran_dev_pos;
+            if (committed > circ->status_size) {
+                committed -= (committed - circ->status_size) % circ->block_size;
+            }
+            circbuf_stop_read(circ, committed);
+        } else if (	g_cur_device->on_read_done!=0 &&
                 /* IS_CLEARED(g_comm_status, COMM_STATUS_FAIL | COMM_STATUS_CRC) && */
                 g_tran_dev_pos>0) {
             assert_param(g_cmd_count == g_processed_cmd_count);
@@ -617,17 +804,41 @@ void i2c_stop(void) {
 	} else if (g_transmit==0 &&
                 IS_CLEARED(g_comm_status, COMM_STATUS_BUSY)) {
         if (g_recv_total_pos >= sizeof(struct CommCommandHeader)) {
-            if(g_cmd_header.length!=g_recv_data_pos) {
-                SET_FLAGS(g_comm_status, COMM_STATUS_FAIL);
-                goto i2c_stop_done;
-            }
-
-            if (g_cmd_header.control_crc!=g_crc) {
-                SET_FLAGS(g_comm_status, COMM_STATUS_CRC);
-                goto i2c_stop_done;
+            if (IS_SET(g_cmd_header.length, COMM_CRC16_FLAG)) {
+                if((g_cmd_header.length & COMM_LENGTH_MASK) + COMM_CRC16_SIZE != g_recv_data_pos) {
+                    SET_FLAGS(g_comm_status, COMM_STATUS_FAIL);
+                    goto i2c_stop_done;
+                }
+
+                // CRC-16 of the frame followed by its CRC-16 is zero
+                if (g_crc16!=0) {
+                    SET_FLAGS(g_comm_status, COMM_STATUS_CRC);
+                    goto i2c_stop_done;
+                }
+
+                // Exclude CRC-16 from data, CRC-16 of the frame is reported as the control sum of this operation
+                g_recv_data_pos -= COMM_CRC16_SIZE;
+                g_crc16 = (uint16_t)((g_recv_buffer[g_recv_data_pos] << 8) | g_recv_buffer[g_recv_data_pos + 1]);
+                g_crc16_mode = 1;
+            } else {
+                if((g_cmd_header.length & COMM_LENGTH_MASK)!=g_recv_data_pos) {
+                    SET_FLAGS(g_comm_status, COMM_STATUS_FAIL);
+                    goto i2c_stop_done;
+                }
+
+                if (g_cmd_header.control_crc!=g_crc) {
+                    SET_FLAGS(g_comm_status, COMM_STATUS_CRC);
+                    goto i2c_stop_done;
+                }
+                g_crc16_mode = 0;
             }
 
-            if (g_cur_device->on_command!=0) {
+            if (IS_SET(g_cmd_header.length, COMM_BATCH_FLAG)) {
+                assert_param(g_cmd_count == g_processed_cmd_count);
+                SET_FLAGS(g_comm_status, COMM_STATUS_BUSY);
+                g_cmd_type = BUS_CMD_BATCH;
+                g_cmd_count++;
+            } else if (g_cur_device->on_command!=0) {
                 assert_param(g_cmd_count == g_processed_cmd_count);
                 SET_FLAGS(g_comm_status, COMM_STATUS_BUSY);
                 g_cmd_type = BUS_CMD_WRITE;
@@ -641,6 +852,15 @@ void i2c_stop(void) {
         }
 	}
 i2c_stop_done:
+    // Prepare control sum of this operation for the next read
+    if (g_crc16_mode) {
+        g_last_crc[0] = (uint8_t)g_crc16;
+        g_last_crc[1] = (uint8_t)(g_crc16 >> 8);
+    } else {
+        g_last_crc[0] = g_crc;
+        g_last_crc[1] = COMM_DUMMY_BYTE;
+    }
+
     // Make sure g_transmit is initialized the same way every time communication starts (when ADDR is received).
     // It will allow reliably distinguish between transmit and receive. It is related to the way how EV ISR detects
     // operation mode
@@ -681,7 +901,7 @@ MAKE_ISR(I2C_BUS_EV_ISR) {
     if (IS_SET(I2C_BUS_PERIPH->SR1, I2C_SR1_ADDR | I2C_SR1_TXE) /* && IS_SET(sr2, I2C_SR2_BUSY) */) {
 //------------------------------ ADDR TXE -------------------------------------------------
         // SPECIAL CASE: We have to write first byte of the CommResponseHeader structure here ASAP. The first byte will be CRC sum for the previous operation
-        I2C_BUS_PERIPH->DR = g_crc;
+        I2C_BUS_PERIPH->DR = g_last_crc[0];
 
 
 
@@ -693,7 +913,7 @@ MAKE_ISR(I2C_BUS_EV_ISR) {
 #endif
 
         do {
-            I2C_BUS_PERIPH->DR = COMM_DUMMY_BYTE;
+            I2C_BUS_PERIPH->DR = g_last_crc[1];
             READ_FLAGS_CLEAR_ADDR;
         } while (IS_SET(sr1, I2C_SR1_TXE));
 
@@ -702,7 +922,7 @@ MAKE_ISR(I2C_BUS_EV_ISR) {
         I2C_STATUS_TRACK(COMM_CRC_INIT_VALUE, COMM_DUMMY_BYTE, 0xD1);
 // endregion
 #endif
-        g_last_byte = COMM_DUMMY_BYTE;
+        g_last_byte = g_last_crc[1];
         i2c_transmit_init_with_send();
         i2c_init_transmit_cache();
     } else if (IS_SET(I2C_BUS_PERIPH->SR1, I2C_SR1_ADDR)) {
@@ -98,8 +98,8 @@ void timetrackerdev_init_vdev(struct TimeTrackerDevInstance* dev, uint16_t index
     devctx->device_id    = dev->dev_id;
     devctx->dev_index    = index;
     devctx->on_command   = timetrackerdev_execute;
-    devctx->on_read_done = timetrackerdev_read_done;
     devctx->on_sync      = timetrackerdev_sync;
+    devctx->i2c_stream_read = 1; // Read is committed by I2C bus, event number is updated by synchronization
 
     IS_SIZE_ALIGNED(&dev->privdata.status.first_event_ts);
     IS_SIZE_ALIGNED(&dev->privdata.status.event_number);
@@ -199,36 +199,20 @@ uint8_t timetrackerdev_execute(uint8_t cmd_byte, uint8_t* data, uint16_t length)
     return res;
 }
 
-uint8_t timetrackerdev_read_done(uint8_t device_id, uint16_t length) {
-    struct DeviceContext* devctx = comm_dev_context(device_id);
-    struct TimeTrackerDevInstance* dev = g_timetrackerdev_devs + devctx->dev_index;
-
-    volatile struct CircBuffer* circbuf = (volatile struct CircBuffer*)&(dev->circ_buffer);
-
-    circbuf_stop_read(circbuf, length);
-
-    uint16_t curlen = circbuf_len(circbuf);
-    dev->privdata.status.event_number =  curlen / sizeof(uint64_t);
-    // Either length is less than size of the status or number of bytes read from buffer consist of complete 8 byte blocks
-    assert_param( (length < sizeof(struct TimeTrackerStatus)) ||
-                 ((length - sizeof(struct TimeTrackerStatus)) % sizeof(uint64_t)) == 0);
-
-
-    GPIO_WriteBit(dev->near_full_line.port,
-                  dev->near_full_line.pin_mask,
-                  circbuf_get_wrn(circbuf));
-
-    return COMM_STATUS_OK;
-}
-
 uint8_t timetrackerdev_sync(uint8_t cmd_byte, uint16_t length) {
     UNUSED(length);
     struct DeviceContext* dev_ctx = comm_dev_context(cmd_byte);
     struct TimeTrackerDevInstance* dev = (struct TimeTrackerDevInstance*)(g_timetrackerdev_devs + dev_ctx->dev_index);
     struct TimeTrackerStatus* status = &dev->privdata.status;
     struct TimeTrackerStatus* comm_status = &dev->privdata.comm_status;
+    volatile struct CircBuffer* circbuf = (volatile struct CircBuffer*)&(dev->circ_buffer);
 
     TIMERTACKER_DISABLE_IRQ
+    /// Buffer is drained by streaming reads, so event number and near full line are refreshed here
+    status->event_number = circbuf_len(circbuf) / sizeof(uint64_t);
+    GPIO_WriteBit(dev->near_full_line.port,
+                  dev->near_full_line.pin_mask,
+                  circbuf_get_wrn(circbuf));
     /// It is safe to copy status information because device have COMM_STATUS_BUSY status at the moment. All status
     /// reads should fail because of this reason.
     memcpy(comm_status, status, sizeof(struct TimeTrackerStatus));
@@ -0,0 +1,212 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Continuous ADCDev acquisition header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include "adcdev.hpp"
+#include "ekit_drain.hpp"
+#include "tools.hpp"
+
+/// \addtogroup group_adc_dev
+/// @{
+/// \page page_adc_dev
+///
+/// \section sect_adc_dev_02 Continuous acquisition
+///
+/// Loop of ADCDev#start(), sleep and ADCDev#get() loses samples between cycles. ADCAcquisition keeps device sampling
+/// continuously and drains device circular buffer as it fills:
+/// - Drains are planned by EKitDrainScheduler (see \ref page_communication_drain), so the scheduler thread is the
+///   background thread of the acquisition. Several acquisitions (and other sources) may share the same scheduler.
+/// - Samples are converted to voltage and written directly into preallocated blocks of the lock-free single-producer
+///   single-consumer ring (tools::SPSCRing). Consumer takes blocks with ADCAcquisition#front() and
+///   ADCAcquisition#pop(), or receives them with callback set by ADCAcquisition#set_callback().
+/// - Status word returned with samples is checked after every drain. If device has stopped (circular buffer overflow,
+///   or #ADCDEV_STATUS_TOO_FAST) sampling is restarted, gap is accounted and the next block is marked with
+///   ADCBlock#gap. Samples inside of the block and between blocks without ADCBlock#gap flag are contiguous.
+/// - If ring is full, device buffer is not drained and keeps samples until consumer releases blocks, or until it
+///   overflows. Blocks in the ring are never overwritten.
+/// - Raw mode (ADCAcquisition#set_raw_callback()) passes measurements without conversion, for lossless archiving with
+///   EKitCaptureWriter (see \ref page_capture):
+/// \code
+/// acq.set_raw_callback([&cap](const ADCRawSamples& raw, uint64_t first_sample, bool gap) {
+///     cap.append(raw.data, raw.samples, gap);
+/// });
+/// \endcode
+///
+/// Example:
+/// \code
+/// auto sched = std::make_shared<EKitDrainScheduler>(0.5, 1000, 100000, 1000);
+/// ADCAcquisition acq(adc, sched, 256, 64);
+/// acq.start();
+/// sched->start();
+/// while (capturing) {
+///     const ADCBlock* b = acq.front();
+///     if (b == nullptr) { tools::sleep_ms(10); continue; }
+///     store(b->channel(0), b->samples, b->gap);
+///     acq.pop();
+/// }
+/// acq.stop();
+/// \endcode
+///
+
+/// \struct ADCBlock
+/// \brief Block of the samples converted to voltage. Values are placed channel by channel.
+struct ADCBlock {
+    uint64_t first_sample;      ///< Index of the first sample of the block since ADCAcquisition#start().
+    size_t samples;             ///< Number of the samples in the block.
+    size_t stride;              ///< Distance between channels in ADCBlock#values (maximum number of the samples).
+    bool gap;                   ///< true if samples were lost before this block.
+    std::vector<float> values;  ///< Values: sample s of the channel ch is values[ch * stride + s].
+
+    /// \brief Returns pointer to values of the channel.
+    /// \param ch - channel index.
+    const float* channel(size_t ch) const {
+        return values.data() + ch * stride;
+    }
+};
+
+/// \struct ADCAcquisitionStats
+/// \brief Statistics of the ADCAcquisition.
+struct ADCAcquisitionStats {
+    uint64_t samples;           ///< Number of the samples acquired.
+    uint64_t blocks;            ///< Number of the blocks acquired.
+    uint64_t gaps;              ///< Number of the times device was found stopped and sampling was restarted.
+    uint64_t too_fast;          ///< Number of the gaps caused by #ADCDEV_STATUS_TOO_FAST.
+    uint64_t ring_full;         ///< Number of the drains interrupted because ring was full.
+};
+
+/// \class ADCAcquisition
+/// \brief Continuous acquisition of the ADCDev samples into lock-free ring.
+class ADCAcquisition final {
+public:
+    /// \brief Type of the function receiving blocks, called by scheduler thread.
+    typedef std::function<void(const ADCBlock&)> ADCBlockCallback;
+
+    /// \brief Type of the function receiving raw measurements, called by scheduler thread. Parameters are measurements
+    ///        (valid during the call only), index of the first sample since ADCAcquisition#start() and true if samples
+    ///        were lost before them.
+    typedef std::function<void(const ADCRawSamples&, uint64_t, bool)> ADCRawCallback;
+
+private:
+    std::shared_ptr<ADCDev> adc;                    ///< Device.
+    std::shared_ptr<EKitDrainScheduler> scheduler;  ///< Scheduler which drains device.
+    const size_t block_samples;                     ///< Maximum number of the samples in block.
+    tools::SPSCRing<ADCBlock> ring;                 ///< Blocks.
+    ADCBlock callback_block;                        ///< Block passed to callback.
+    ADCBlockCallback callback;                      ///< Callback, blocks are not put into the ring if set.
+    ADCRawCallback raw_callback;                    ///< Raw callback, samples are not converted if set.
+    int source_id;                                  ///< Scheduler source id, negative if acquisition is stopped.
+    uint64_t next_sample;                           ///< Index of the next sample.
+    bool gap;                                       ///< true if samples were lost since the last block.
+
+    std::atomic<uint64_t> samples;                  ///< See ADCAcquisitionStats#samples.
+    std::atomic<uint64_t> blocks;                   ///< See ADCAcquisitionStats#blocks.
+    std::atomic<uint64_t> gaps;                     ///< See ADCAcquisitionStats#gaps.
+    std::atomic<uint64_t> too_fast;                 ///< See ADCAcquisitionStats#too_fast.
+    std::atomic<uint64_t> ring_full;                ///< See ADCAcquisitionStats#ring_full.
+
+    /// \brief Drain function called by scheduler: reads samples into blocks and checks device status.
+    /// \param ovf - set to true if device has stopped.
+    /// \return Number of the bytes read.
+    size_t drain(bool& ovf);
+
+    /// \brief Reads samples into the block.
+    /// \param block - block to be filled.
+    /// \return Number of the samples read.
+    size_t fill(ADCBlock& block);
+
+    /// \brief Reads raw samples and passes them to the raw callback.
+    /// \return Number of the samples read.
+    size_t fill_raw();
+
+    /// \brief Accounts samples read.
+    /// \param n - number of the samples.
+    void account(size_t n);
+
+public:
+    /// \brief Copy construction is forbidden
+    ADCAcquisition(const ADCAcquisition&) = delete;
+
+    /// \brief Assignment is forbidden
+    ADCAcquisition& operator=(const ADCAcquisition&) = delete;
+
+    /// \brief Constructor.
+    /// \param dev - ADCDev to acquire samples from. Device must not be used by application while acquisition is
+    ///        started.
+    /// \param sched - scheduler which drains device. Either start scheduler thread, or call EKitDrainScheduler#poll().
+    /// \param samples_per_block - maximum number of the samples in block.
+    /// \param ring_blocks - number of the blocks in the ring.
+    ADCAcquisition(std::shared_ptr<ADCDev> dev,
+                   std::shared_ptr<EKitDrainScheduler> sched,
+                   size_t samples_per_block,
+                   size_t ring_blocks);
+
+    /// \brief Destructor. Stops acquisition.
+    ~ADCAcquisition();
+
+    /// \brief Sets callback receiving blocks instead of the ring. Callback is called by scheduler thread, and must
+    ///        return quickly. Must be called while acquisition is stopped.
+    /// \param clb - callback, empty function puts blocks into the ring.
+    void set_callback(ADCBlockCallback clb);
+
+    /// \brief Sets callback receiving raw measurements instead of the converted blocks. Takes precedence over
+    ///        ADCAcquisition#set_callback(). Callback is called by scheduler thread, and must return quickly. Must be
+    ///        called while acquisition is stopped.
+    /// \param clb - callback, empty function disables raw mode.
+    void set_raw_callback(ADCRawCallback clb);
+
+    /// \brief Clears device buffer, starts continuous sampling and registers device in scheduler.
+    void start();
+
+    /// \brief Unregisters device from scheduler and stops sampling. Blocks already in the ring remain available. May be
+    ///        called by callback, no more blocks are passed after it returns.
+    void stop();
+
+    /// \brief Returns true if acquisition is started.
+    bool is_started() const {
+        return source_id >= 0;
+    }
+
+    /// \brief Returns the oldest block, nullptr if there is no block. Must be called by single consumer thread.
+    const ADCBlock* front() {
+        return ring.front();
+    }
+
+    /// \brief Releases block returned by ADCAcquisition#front(). Must be called by single consumer thread.
+    void pop() {
+        ring.pop();
+    }
+
+    /// \brief Returns number of the blocks in the ring.
+    size_t size() const {
+        return ring.size();
+    }
+
+    /// \brief Returns statistics.
+    ADCAcquisitionStats get_stats() const;
+};
+
+/// @}
@@ -0,0 +1,280 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Streaming signal processing of the ADC blocks header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include "adc_acquisition.hpp"
+
+/// \addtogroup group_adc_dev
+/// @{
+/// \page page_adc_dev
+///
+/// \section sect_adc_dev_03 Signal processing
+///
+/// DSPPipeline processes ADCBlock stream with the chain of the stages (DSPStage). Every stage receives block of the
+/// previous stage and writes its result into the block owned by pipeline. Blocks are allocated once, when stage is
+/// added, so processing does not allocate memory. Stages keep state between blocks: filter history, partial windows
+/// and trigger state. State is cleared when block with ADCBlock#gap flag arrives, because samples before it are not
+/// contiguous with the block.
+///
+/// Available stages:
+/// - DSPDecimator - averages every N samples into one sample.
+/// - DSPFIRFilter - FIR filter with arbitrary coefficients.
+/// - DSPBiquad - IIR filter second order section, DSPBiquad#lowpass() and DSPBiquad#highpass() calculate coefficients.
+/// - DSPMovingAverage - moving average or moving RMS over the window of N samples.
+/// - DSPWindowStats - minimum, maximum and mean of every N samples.
+/// - DSPTrigger - reports level crossing of the channel, passes samples unchanged.
+///
+/// Blocks are processed channel by channel, kernels summing, filtering and searching for minimum and maximum use SSE2
+/// or NEON if available. Pipeline is connected to ADCAcquisition with DSPPipeline#connect(), so blocks are processed by
+/// the scheduler thread as soon as they are drained:
+/// \code
+/// DSPPipeline dsp(adc->get_input_count(), 256);
+/// dsp.add(DSPBiquad::lowpass(sample_rate, 50.0));
+/// dsp.add(std::make_shared<DSPDecimator>(10));
+/// dsp.add(std::make_shared<DSPTrigger>(0, 1.5f, 0.1f, true, [](uint64_t s) { printf("crossed at %lu\n", s); }));
+///
+/// ADCAcquisition acq(adc, sched, 256, 64);
+/// acq.set_callback(dsp.connect([](const ADCBlock& b) { store(b.channel(0), b.samples); }));
+/// acq.start();
+/// \endcode
+///
+
+/// \class DSPStage
+/// \brief Base class for the pipeline stages.
+class DSPStage {
+public:
+    /// \brief Destructor.
+    virtual ~DSPStage();
+
+    /// \brief Prepares stage for the input blocks and allocates state. Called by DSPPipeline#add().
+    /// \param channels - number of the input channels.
+    /// \param max_samples - maximum number of the input samples in block.
+    /// \param out_channels - receives number of the output channels.
+    /// \return Maximum number of the output samples in block.
+    virtual size_t configure(size_t channels, size_t max_samples, size_t& out_channels) = 0;
+
+    /// \brief Clears state accumulated from the previous blocks.
+    virtual void reset() = 0;
+
+    /// \brief Processes the block.
+    /// \param in - input block.
+    /// \param out - output block, DSPPipeline allocates ADCBlock#values and sets ADCBlock#stride according to
+    ///        DSPStage#configure(). Stage sets ADCBlock#samples, ADCBlock#first_sample and ADCBlock#gap.
+    virtual void process(const ADCBlock& in, ADCBlock& out) = 0;
+};
+
+/// \class DSPPipeline
+/// \brief Chain of the stages processing ADCBlock stream.
+class DSPPipeline final {
+    const size_t channels;                          ///< Number of the input channels.
+    const size_t max_samples;                       ///< Maximum number of the input samples in block.
+    std::vector<std::shared_ptr<DSPStage>> stages;  ///< Stages.
+    std::vector<ADCBlock> outputs;                  ///< Output block of each stage.
+    std::vector<size_t> out_channels;               ///< Number of the output channels of each stage.
+
+public:
+    /// \brief Copy construction is forbidden
+    DSPPipeline(const DSPPipeline&) = delete;
+
+    /// \brief Assignment is forbidden
+    DSPPipeline& operator=(const DSPPipeline&) = delete;
+
+    /// \brief Constructor.
+    /// \param input_channels - number of the input channels.
+    /// \param max_input_samples - maximum number of the samples in input block.
+    DSPPipeline(size_t input_channels, size_t max_input_samples);
+
+    /// \brief Appends stage to the end of the pipeline.
+    /// \param stage - stage to be added. Stage may be added to a single pipeline.
+    void add(std::shared_ptr<DSPStage> stage);
+
+    /// \brief Processes input block with all stages.
+    /// \param in - input block with up to max_input_samples samples.
+    /// \return Output block of the last stage (input block if there are no stages). Block is valid until the next call.
+    const ADCBlock& process(const ADCBlock& in);
+
+    /// \brief Clears state of all stages.
+    void reset();
+
+    /// \brief Returns number of the output channels.
+    size_t get_output_channels() const;
+
+    /// \brief Returns callback for ADCAcquisition#set_callback() which processes blocks and passes non-empty output
+    ///        blocks to the next function. Pipeline must outlive acquisition.
+    /// \param next - function receiving output blocks.
+    ADCAcquisition::ADCBlockCallback connect(ADCAcquisition::ADCBlockCallback next);
+};
+
+/// \class DSPDecimator
+/// \brief Averages every N samples of each channel into one output sample.
+class DSPDecimator final : public DSPStage {
+    const size_t factor;            ///< Number of the samples averaged.
+    size_t count;                   ///< Number of the samples accumulated.
+    uint64_t next_sample;           ///< Index of the next output sample.
+    bool gap;                       ///< Gap to be reported with the next output sample.
+    std::vector<double> acc;        ///< Sum of the accumulated samples of each channel.
+
+public:
+    /// \brief Constructor.
+    /// \param n - number of the samples averaged into one sample.
+    explicit DSPDecimator(size_t n);
+
+    size_t configure(size_t channels, size_t max_samples, size_t& out_channels) override;
+    void reset() override;
+    void process(const ADCBlock& in, ADCBlock& out) override;
+};
+
+/// \class DSPFIRFilter
+/// \brief FIR filter: y[i] = sum(c[k] * x[i-k]).
+class DSPFIRFilter final : public DSPStage {
+    const std::vector<float> coeffs;    ///< Coefficients.
+    size_t history;                     ///< Number of the previous samples used: coeffs.size() - 1.
+    size_t stride;                      ///< Size of the work buffer of the channel.
+    std::vector<float> work;            ///< Work buffer of each channel: history followed by the input block.
+
+public:
+    /// \brief Constructor.
+    /// \param c - coefficients, c[0] is applied to the current sample.
+    explicit DSPFIRFilter(const std::vector<float>& c);
+
+    size_t configure(size_t channels, size_t max_samples, size_t& out_channels) override;
+    void reset() override;
+    void process(const ADCBlock& in, ADCBlock& out) override;
+};
+
+/// \class DSPBiquad
+/// \brief IIR filter second order section (transposed direct form II):
+///        y[i] = b0*x[i] + b1*x[i-1] + b2*x[i-2] - a1*y[i-1] - a2*y[i-2]. Higher orders are built by several stages.
+class DSPBiquad final : public DSPStage {
+    const double b0, b1, b2, a1, a2;    ///< Normalized coefficients (a0 = 1).
+    std::vector<double> state;          ///< Two state values of each channel.
+
+public:
+    /// \brief Constructor.
+    /// \param nb0, nb1, nb2 - feed forward coefficients.
+    /// \param na1, na2 - feedback coefficients, normalized to a0 = 1.
+    DSPBiquad(double nb0, double nb1, double nb2, double na1, double na2);
+
+    /// \brief Creates low pass filter (Butterworth response for default Q).
+    /// \param sample_rate - sample rate, Hz.
+    /// \param cutoff - cutoff frequency, Hz.
+    /// \param q - quality factor.
+    static std::shared_ptr<DSPBiquad> lowpass(double sample_rate, double cutoff, double q = 0.7071067811865476);
+
+    /// \brief Creates high pass filter (Butterworth response for default Q).
+    /// \param sample_rate - sample rate, Hz.
+    /// \param cutoff - cutoff frequency, Hz.
+    /// \param q - quality factor.
+    static std::shared_ptr<DSPBiquad> highpass(double sample_rate, double cutoff, double q = 0.7071067811865476);
+
+    size_t configure(size_t channels, size_t max_samples, size_t& out_channels) override;
+    void reset() override;
+    void process(const ADCBlock& in, ADCBlock& out) override;
+};
+
+/// \class DSPMovingAverage
+/// \brief Moving average or moving RMS over the last N samples. Until N samples are received window contains all
+///        received samples.
+class DSPMovingAverage final : public DSPStage {
+    const size_t window;                ///< Window length.
+    const bool rms;                     ///< true to calculate RMS instead of average.
+    size_t pos;                         ///< Position in the history of each channel.
+    size_t count;                       ///< Number of the samples in window.
+    std::vector<float> hist;            ///< Last window samples (squared for RMS) of each channel.
+    std::vector<double> sum;            ///< Sum of the window samples of each channel.
+
+public:
+    /// \brief Constructor.
+    /// \param n - window length.
+    /// \param calc_rms - true to calculate RMS, false to calculate average.
+    explicit DSPMovingAverage(size_t n, bool calc_rms = false);
+
+    size_t configure(size_t channels, size_t max_samples, size_t& out_channels) override;
+    void reset() override;
+    void process(const ADCBlock& in, ADCBlock& out) override;
+};
+
+/// \class DSPWindowStats
+/// \brief Calculates minimum, maximum and mean of every N samples. Each input channel ch gives three output channels:
+///        3*ch - minimum, 3*ch+1 - maximum, 3*ch+2 - mean.
+class DSPWindowStats final : public DSPStage {
+    const size_t window;            ///< Window length.
+    size_t count;                   ///< Number of the samples accumulated.
+    uint64_t next_sample;           ///< Index of the next output sample.
+    bool gap;                       ///< Gap to be reported with the next output sample.
+    std::vector<float> min_val;     ///< Minimum of each channel.
+    std::vector<float> max_val;     ///< Maximum of each channel.
+    std::vector<double> acc;        ///< Sum of each channel.
+
+public:
+    /// \brief Constructor.
+    /// \param n - window length.
+    explicit DSPWindowStats(size_t n);
+
+    size_t configure(size_t channels, size_t max_samples, size_t& out_channels) override;
+    void reset() override;
+    void process(const ADCBlock& in, ADCBlock& out) override;
+};
+
+/// \class DSPTrigger
+/// \brief Detects level crossing of the channel with hysteresis, passes samples unchanged. After reset trigger is armed
+///        when signal is seen on the opposite side of the level (beyond hysteresis).
+class DSPTrigger final : public DSPStage {
+public:
+    /// \brief Type of the function receiving index of the sample (ADCBlock#first_sample based) crossing the level.
+    typedef std::function<void(uint64_t sample)> DSPTriggerCallback;
+
+private:
+    const size_t channel;           ///< Channel to be checked.
+    const float level;              ///< Trigger level.
+    const float hysteresis;         ///< Distance from the level to arm trigger.
+    const bool rising;              ///< true for rising edge, false for falling edge.
+    DSPTriggerCallback callback;    ///< Callback.
+    bool armed;                     ///< true if trigger is armed.
+    uint64_t events;                ///< Number of the events.
+    size_t n_channels;              ///< Number of the channels.
+
+public:
+    /// \brief Constructor.
+    /// \param ch - channel to be checked.
+    /// \param lvl - trigger level.
+    /// \param hyst - hysteresis, trigger is armed when signal is below lvl - hyst (rising edge), or above lvl + hyst
+    ///        (falling edge).
+    /// \param rising_edge - true to detect rising edge, false to detect falling edge.
+    /// \param clb - callback, called by the thread processing blocks.
+    DSPTrigger(size_t ch, float lvl, float hyst, bool rising_edge, DSPTriggerCallback clb);
+
+    /// \brief Returns number of the events detected.
+    uint64_t get_events() const {
+        return events;
+    }
+
+    size_t configure(size_t channels, size_t max_samples, size_t& out_channels) override;
+    void reset() override;
+    void process(const ADCBlock& in, ADCBlock& out) override;
+};
+
+/// @}
@@ -23,6 +23,7 @@
 #pragma once
 
 #include <map>
+#include <cstdint>
 #include "ekit_device.hpp"
 #include "adc_common.hpp"
 
@@ -54,7 +55,11 @@
 ///    or ADC circular buffer will be overflown.
 /// 3. Wait for a data. It can be either straightforward call to std::this_thread::sleep_for() or more fascinating use of
 ///    std::async().
-/// 4. Call one of the ADCDev#get() methods.
+/// 4. Call one of the ADCDev#get() methods. ADCDev#get() with std::vector is the simplest one, if data is processed at
+///    high sample rates use ADCDev#get_raw() to access measurements without conversion, or ADCDev#get() with flat
+///    float or double buffer: values are written channel by channel, and conversion to voltage is vectorized. Neither
+///    of them allocates memory. Every ADCDev#get() and ADCDev#status() call is a single streaming read of the status
+///    and samples (see \ref sect_communication_response_02), device is synchronized only if it is busy with command.
 /// 5. If \f$V_{refint}\f$ is read by configuring "ADC_Channel_Vrefint", then it is possible to update vref voltage. This
 ///    make following conversions of sampled data to voltage more accurate by getting actual \f$V_{DDA}\f$ voltage. You
 ///    may do it with ADCDev#set_vref() method.
@@ -62,6 +67,31 @@
 ///    all requested samples was read. Optionally it is possible to reset data accumulated in circular buffer.
 ///
 
+/// \struct ADCRawSamples
+/// \brief View of the raw measurements returned by ADCDev#get_raw(). Measurements of the same sample are adjacent.
+///        Points to ADCDev internal buffer, and is valid until the next call of ADCDev#get() or ADCDev#get_raw().
+struct ADCRawSamples {
+    const uint16_t* data;   ///< Measurements: data[s * channels + ch] is a measurement of the channel ch of the sample s.
+    size_t samples;         ///< Number of the samples.
+    size_t channels;        ///< Number of the channels in sample.
+    uint16_t status;        ///< Device status read with the measurements (ADCDEV_STATUS_XXX flags).
+
+    /// \brief Returns number of the measurements.
+    size_t size() const {
+        return samples * channels;
+    }
+
+    /// \brief Returns pointer to the first measurement.
+    const uint16_t* begin() const {
+        return data;
+    }
+
+    /// \brief Returns pointer past the last measurement.
+    const uint16_t* end() const {
+        return data + size();
+    }
+};
+
 /// \class ADCDev
 /// \brief ADCDev implementation. Use this class in order to control ADCDev virtual devices.
 class ADCDev final : public EKitVirtualDevice {
@@ -124,12 +154,42 @@ class ADCDev final : public EKitVirtualDevice {
     ///        calculated with vref.
     void get(std::vector<std::vector<double>>& values);
 
+    /// \brief Read samples accumulated in circular buffer as voltage into flat buffer, channel by channel.
+    /// \param dst - buffer of get_input_count() * max_samples elements: sample s of the input ch is written into
+    ///        dst[ch * max_samples + s].
+    /// \param max_samples - maximum number of the samples to read, the rest remain in the circular buffer.
+    /// \return Number of the samples read.
+    size_t get(float* dst, size_t max_samples);
+
+    /// \brief Read samples accumulated in circular buffer as voltage into flat buffer, channel by channel.
+    /// \param dst - buffer of get_input_count() * max_samples elements: sample s of the input ch is written into
+    ///        dst[ch * max_samples + s].
+    /// \param max_samples - maximum number of the samples to read, the rest remain in the circular buffer.
+    /// \return Number of the samples read.
+    size_t get(double* dst, size_t max_samples);
+
+    /// \brief Read samples accumulated in circular buffer without conversion.
+    /// \param max_samples - maximum number of the samples to read, the rest remain in the circular buffer.
+    /// \return View of the measurements read, valid until the next read.
+    ADCRawSamples get_raw(size_t max_samples = SIZE_MAX);
+
+    /// \brief Returns device status read with the last samples by one of the ADCDev#get() or ADCDev#get_raw() calls.
+    /// \return Status flags described by ADCDEV_STATUS_XXX constants.
+    uint16_t last_status() const {
+        return *data_status;
+    }
+
     /// \brief Returns input name from input index.
     /// \param index - input index.
     /// \param channel_name - set to true to get ADC channel name (ADC_Channel_xxx) or false to get input name
     /// \return string with name
     std::string get_input_name(size_t index, bool channel_name) const;
 
+    /// \brief Returns voltage range of the input.
+    /// \param index - input index.
+    /// \return pair of voltages corresponding to zero and maximum measurement
+    std::pair<double, double> get_input_range(size_t index) const;
+
     /// \brief  Returns inputs (channels) count
     /// \return number of channels
     size_t get_input_count() const;
@@ -142,9 +202,29 @@ class ADCDev final : public EKitVirtualDevice {
     /// \return Number of bytes accumulated in circular buffer (including status).
     size_t status_priv(uint16_t* flags, EKitTimeout& to);
 
+    /// \brief Reads status followed by up to max_samples samples into data_buffer by single streaming read. Device is
+    ///        synchronized only if it is busy with the previous command.
+    /// \param max_samples - maximum number of the samples to read, zero to read status only.
+    /// \param available - receives number of bytes accumulated in circular buffer (including status).
+    /// \param to - timeout counting object.
+    /// \return Number of the samples read.
+    size_t stream_priv(size_t max_samples, size_t& available, EKitTimeout& to);
+
+    /// \brief Reads samples into data_buffer.
+    /// \param max_samples - maximum number of the samples to read.
+    /// \param to - timeout counting object.
+    /// \return Number of the samples read.
+    size_t read_samples(size_t max_samples, EKitTimeout& to);
+
+    /// \brief Implementation of the flat ADCDev#get() overloads.
+    template <typename T> size_t get_flat(T* dst, size_t max_samples);
+
     void send_command(uint8_t* ptr, size_t size, uint8_t command);
     std::vector<std::pair<double, double>> signal_ranges;
+    std::vector<double> channel_scale;      ///< Per channel voltage of the single ADC step, precalculated from signal_ranges.
+    std::vector<double> channel_offset;     ///< Per channel voltage of zero, precalculated from signal_ranges.
     std::vector<uint16_t> data_buffer;
+    std::vector<uint16_t> planar_buffer;    ///< Measurements of the single channel gathered for conversion.
     volatile uint16_t* data_status;
     volatile uint16_t* data;
 };
@@ -24,6 +24,7 @@
 #include <time.h>
 #include <memory>
 #include "ekit_bus.hpp"
+#include "ekit_spi_bus.hpp"
 #include "ekit_device.hpp"
 #include "tools.hpp"
 
@@ -132,6 +133,9 @@ class ADXL345 final : public EKitDeviceBase {
     /// \brief Free-fall acceleration on a planet Earth.
     static constexpr double grav_accel = 9.8L;
 
+    /// \brief Transaction used to drain FIFO, reused to avoid memory allocations.
+    EKitSPITransaction      fifo_trans;
+
    public:
 
     /// \brief No default constructor
@@ -171,6 +175,13 @@ class ADXL345 final : public EKitDeviceBase {
     /// \param data - pointer to the \ref ADXL345Sample structure.
     void    get_data(ADXL345Sample* data);
 
+    /// \brief Reads several ADXL345 samples from the FIFO.
+    /// \param data - pointer to the array of \ref ADXL345Sample structures.
+    /// \param count - number of samples to read, should not exceed value returned by #get_data_len().
+    /// \note If device is connected directly to SPI bus (EKitSPIBus), all samples are read by single system call and
+    ///       get the same timestamp (time when the last sample is read).
+    void    get_data(ADXL345Sample* data, size_t count);
+
     /// \brief Returns amount of data in FIFO
     /// \param fifo_triggered - true returned if trigger event occurred, otherwise false.
     /// \return Number of entries stored in FIFO.
@@ -0,0 +1,157 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus arbitration header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <vector>
+#include <chrono>
+#include "ekit_error.hpp"
+#include "ekit_bus.hpp"
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_arbiter EKitBusArbiter
+/// \brief Priority aware bus arbitration
+/// @{
+/// \page page_communication_arbiter
+/// \tableofcontents
+///
+/// \section sect_communication_arbiter_01 Bus arbitration
+///
+/// By default the thread which locks bus mutex first gets the bus. If EKitBusArbiter is set for a bus with
+/// EKitBus#set_arbiter(), addressable lock (EKitBus#lock(int addr, EKitTimeout& to), also used by BusLocker) waits for
+/// it's turn before taking bus mutex:
+/// - Device (address) with higher priority gets the bus first. Priorities are assigned with
+///   EKitBusArbiter#set_priority(), addresses without assigned priority get default priority.
+/// - Devices with the same priority get the bus in the order of the deadlines (earliest deadline first), deadline is
+///   the moment timeout passed to the lock expires. Requests with infinite timeout go after requests with deadline.
+///   Requests with equal deadlines (and requests with infinite timeout) get the bus in the order they requested it
+///   (FIFO).
+/// - If timeout passed to the lock expires while waiting, request leaves the queue and #EKIT_TIMEOUT is returned.
+/// - If admission is enabled (EKitBusArbiter#set_admission()), request with deadline which can't be met is rejected
+///   with #EKIT_TIMEOUT immediately, instead of waiting until timeout expires. Wait time is estimated by the average
+///   time bus is owned multiplied by number of the requests to be granted before it, plus the time left for the current
+///   owner. Estimation is available after the first release, until then all requests are admitted.
+///
+/// Time spent waiting is accumulated in per priority histograms (see EKitBusArbiter#get_histogram()), number of the
+/// rejected requests is returned by EKitBusArbiter#get_rejected().
+///
+
+/// \class EKitBusArbiter
+/// \brief Grants bus ownership by priority, by deadline within the same priority.
+class EKitBusArbiter final {
+public:
+    static constexpr size_t histogram_buckets = 32; ///< Number of the wait time histogram buckets.
+
+private:
+    /// \struct Waiter
+    /// \brief Describes thread waiting for the bus.
+    struct Waiter {
+        bool granted;                   ///< true if bus is granted to this waiter.
+        std::chrono::steady_clock::time_point deadline; ///< Deadline, time_point::max() if timeout is infinite.
+        std::condition_variable cond;   ///< Signalled when bus is granted to this waiter.
+    };
+
+    std::mutex arb_lock;                                ///< Guards all the data below.
+    const size_t levels;                                ///< Number of the priority levels.
+    const int default_priority;                         ///< Priority for addresses without assigned priority.
+    std::map<int, int> priorities;                      ///< Priorities by address.
+    std::vector<std::deque<Waiter*>> queues;            ///< Waiters by priority, ordered by deadline.
+    bool busy;                                          ///< true if bus is owned.
+    bool admission;                                     ///< true if requests with deadline which can't be met are
+                                                        ///  rejected.
+    std::chrono::steady_clock::time_point grant_time;   ///< Time bus was granted to the current owner.
+    double hold_avg_us;                                 ///< Average time bus is owned, microseconds (0 if unknown).
+    size_t rejected;                                    ///< Number of the requests rejected by admission.
+    std::vector<std::vector<size_t>> histograms;        ///< Wait time histograms by priority.
+
+    /// \brief Grants bus to the first waiter with highest priority. Must be called with arb_lock owned.
+    void grant_next();
+
+    /// \brief Checks if waiter may get bus before its deadline. Must be called with arb_lock owned.
+    /// \param priority - priority of the waiter.
+    /// \param ahead - number of the waiters with the same priority to be granted before it.
+    /// \param now - current time.
+    /// \param deadline - deadline of the waiter.
+    /// \return true if deadline may be met, or if it is not possible to estimate wait time yet.
+    bool admissible(int priority,
+                    size_t ahead,
+                    std::chrono::steady_clock::time_point now,
+                    std::chrono::steady_clock::time_point deadline) const;
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitBusArbiter(const EKitBusArbiter&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitBusArbiter& operator=(const EKitBusArbiter&) = delete;
+
+    /// \brief Constructor
+    /// \param priority_levels - number of the priority levels. Priorities are in range [0, priority_levels), 0 is the
+    ///        lowest priority.
+    /// \param def_priority - priority for addresses without assigned priority.
+    EKitBusArbiter(size_t priority_levels, int def_priority);
+
+    /// \brief Assigns priority to the address.
+    /// \param addr - address of the device (virtual device id for EKitFirmware).
+    /// \param priority - priority, must be less than number of the priority levels.
+    void set_priority(int addr, int priority);
+
+    /// \brief Returns priority of the address.
+    /// \param addr - address of the device.
+    /// \return Priority.
+    int get_priority(int addr);
+
+    /// \brief Enables or disables admission of the requests by deadline (disabled by default).
+    /// \param enable - true to reject requests which are not expected to get bus before timeout expires.
+    void set_admission(bool enable);
+
+    /// \brief Waits for the turn to own bus.
+    /// \param addr - address of the device.
+    /// \param to - timeout counting object, it's expiration is the deadline of the request.
+    /// \return Corresponding EKIT_ERROR error code, #EKIT_TIMEOUT if timeout is expired while waiting, or if request
+    ///         is rejected by admission.
+    EKIT_ERROR acquire(int addr, EKitTimeout& to);
+
+    /// \brief Releases bus, bus is passed to the next waiter.
+    void release();
+
+    /// \brief Returns wait time histogram for the priority.
+    /// \param priority - priority.
+    /// \return Vector with #histogram_buckets elements. Element with index 0 counts waits shorter than 2us, element
+    ///         with index i>0 counts waits in range [2^i, 2^(i+1)) microseconds.
+    std::vector<size_t> get_histogram(int priority);
+
+    /// \brief Returns number of the requests rejected by admission.
+    size_t get_rejected();
+
+    /// \brief Resets wait time histograms and number of the rejected requests.
+    void reset_histograms();
+};
+
+/// @}
+/// @}
@@ -0,0 +1,264 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Asynchronous bus request executor header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <type_traits>
+#include "ekit_error.hpp"
+#include "ekit_bus.hpp"
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_async EKitAsyncExecutor
+/// \brief Asynchronous execution of the bus requests
+/// @{
+/// \page page_communication_async
+/// \tableofcontents
+///
+/// \section sect_communication_async_01 Asynchronous bus requests
+///
+/// Virtual device calls block caller thread for the whole bus exchange. EKitAsyncExecutor allows several application
+/// threads to submit such calls to the dedicated I/O thread serving a physical bus, and to continue their own work
+/// while request is executed. Requests are executed one by one in the order of submission, so they don't contend on
+/// the bus lock.
+///
+/// Requests are placed into bounded queue. If queue is full, submitting thread is blocked until I/O thread takes one
+/// of the requests. Completion is reported either with std::future (EKitAsyncExecutor#submit()) or with callback
+/// called by I/O thread (EKitAsyncExecutor#post()). Exception thrown by completion callback doesn't stop I/O thread,
+/// it is passed to handler set by EKitAsyncExecutor#set_error_handler() and counted.
+///
+/// Example:
+/// \code
+/// EKitAsyncExecutor executor(bus, 16);
+/// std::future<void> f = executor.submit([&adc, &samples]() { adc->get(samples); });
+/// ... // do something useful
+/// f.get(); // rethrows exception thrown by ADCDev::get(), if any
+/// \endcode
+///
+
+/// \class EKitAsyncExecutor
+/// \brief Executes requests for a physical bus with dedicated I/O thread.
+class EKitAsyncExecutor final {
+    std::shared_ptr<EKitBus> bus;                   ///< Bus served by this executor.
+    std::vector<std::function<void()>> queue;       ///< Circular queue with requests.
+    size_t queue_head;                              ///< Index of the next request to be executed.
+    size_t queue_count;                             ///< Number of requests in the queue.
+    std::mutex queue_lock;                          ///< Guards queue and #stopping flag.
+    std::condition_variable not_empty;              ///< Signalled when request is added to the queue.
+    std::condition_variable not_full;               ///< Signalled when request is removed from the queue.
+    bool stopping;                                  ///< true if executor is being destroyed.
+    std::function<void(std::exception_ptr)> on_error; ///< Handler of the exceptions thrown by completion callbacks.
+    size_t errors;                                  ///< Number of the exceptions thrown by completion callbacks.
+    std::thread io_thread;                          ///< I/O thread.
+
+    /// \brief I/O thread function.
+    void thread_func();
+
+    /// \brief Adds request to the queue.
+    /// \param request - request to be added.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR enqueue(std::function<void()>&& request, EKitTimeout& to);
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitAsyncExecutor(const EKitAsyncExecutor&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitAsyncExecutor& operator=(const EKitAsyncExecutor&) = delete;
+
+    /// \brief Constructor. Starts I/O thread.
+    /// \param ebus - physical bus requests are made for. Single executor should be used per physical bus.
+    /// \param queue_length - maximum number of pending requests.
+    EKitAsyncExecutor(std::shared_ptr<EKitBus> ebus, size_t queue_length);
+
+    /// \brief Destructor. Executes pending requests and stops I/O thread.
+    ~EKitAsyncExecutor();
+
+    /// \brief Returns bus served by this executor.
+    /// \return Shared pointer to the bus.
+    std::shared_ptr<EKitBus> get_bus() const;
+
+    /// \brief Returns number of the requests waiting for execution.
+    size_t pending();
+
+    /// \brief Sets handler of the exceptions thrown by completion callbacks (see EKitAsyncExecutor#post()). Handler is
+    ///        called by I/O thread.
+    /// \param handler - handler, may be empty (exceptions are counted only).
+    void set_error_handler(std::function<void(std::exception_ptr)> handler);
+
+    /// \brief Returns number of the exceptions thrown by completion callbacks.
+    size_t get_error_count();
+
+    /// \brief Submits request with callback completion.
+    /// \param request - request to be executed by I/O thread.
+    /// \param completion - callback called by I/O thread when request is executed. Receives exception thrown by
+    ///        request, or empty std::exception_ptr on success. May be empty.
+    /// \param to - timeout counting object, used to wait for free space in the queue.
+    /// \return Corresponding EKIT_ERROR error code: #EKIT_TIMEOUT if queue stays full, #EKIT_DISCONNECTED if executor
+    ///         is being destroyed.
+    EKIT_ERROR post(std::function<void()> request,
+                    std::function<void(std::exception_ptr)> completion,
+                    EKitTimeout& to);
+
+    /// \brief Submits request with std::future completion.
+    /// \tparam F - type of the callable object.
+    /// \param request - callable object to be executed by I/O thread.
+    /// \return std::future with result of the request. Exceptions thrown by request are rethrown by std::future::get().
+    /// \throw EKitException if request may not be submitted.
+    template<class F>
+    std::future<typename std::result_of<F()>::type> submit(F request) {
+        static const char* const func_name = "EKitAsyncExecutor::submit";
+        typedef typename std::result_of<F()>::type result_type;
+
+        // std::function requires copyable object, thus packaged task is shared
+        auto task = std::make_shared<std::packaged_task<result_type()>>(std::move(request));
+        std::future<result_type> res = task->get_future();
+        EKitTimeout to(0);
+
+        EKIT_ERROR err = enqueue([task]() { (*task)(); }, to);
+        if (err != EKIT_OK) {
+            throw EKitException(func_name, err, "failed to submit request");
+        }
+
+        return res;
+    }
+};
+
+/// \section sect_communication_async_02 Bus groups
+///
+/// Setups with several MCUs usually have each MCU on its own I2C adapter. EKitBusGroup runs one EKitAsyncExecutor
+/// per adapter, so requests submitted for different adapters are executed concurrently, while requests for the same
+/// adapter are executed in the order of submission. Requests are tagged with the physical bus the device is attached
+/// to, EKitBusGroup#join() waits for all the submitted requests.
+///
+/// Example:
+/// \code
+/// EKitBusGroup group;
+/// group.add_bus(i2c0);
+/// group.add_bus(i2c1);
+/// std::future<size_t> n0 = group.submit(i2c0, [&tt0, &data0]() { tt0->read_all(data0, true); return data0.size(); });
+/// std::future<size_t> n1 = group.submit(i2c1, [&tt1, &data1]() { tt1->read_all(data1, true); return data1.size(); });
+/// group.join(to); // both adapters are read at the same time
+/// \endcode
+///
+
+/// \class EKitBusGroup
+/// \brief Executes requests for several physical buses concurrently, one I/O thread per bus.
+class EKitBusGroup final {
+    const size_t queue_length;                      ///< Queue length of the each executor.
+    std::map<const EKitBus*, std::unique_ptr<EKitAsyncExecutor>> executors; ///< Executors by physical bus.
+    std::mutex group_lock;                          ///< Guards #outstanding.
+    std::condition_variable all_done;               ///< Signalled when the last outstanding request is completed.
+    size_t outstanding;                             ///< Number of submitted requests which are not completed yet.
+    std::function<void(std::exception_ptr)> on_error; ///< Error handler of the executors.
+
+    /// \brief Returns executor serving the bus.
+    /// \param bus - physical bus.
+    /// \return Pointer to the executor, nullptr if bus is not in the group.
+    EKitAsyncExecutor* get_executor(const EKitBus* bus) const;
+
+    /// \brief Called when request is completed.
+    void request_done();
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitBusGroup(const EKitBusGroup&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitBusGroup& operator=(const EKitBusGroup&) = delete;
+
+    /// \brief Constructor.
+    /// \param queue_len - maximum number of pending requests per bus.
+    explicit EKitBusGroup(size_t queue_len = 16);
+
+    /// \brief Destructor. Executes pending requests and stops I/O threads.
+    ~EKitBusGroup();
+
+    /// \brief Adds physical bus to the group and starts I/O thread for it. Must not be called concurrently with other
+    ///        methods.
+    /// \param bus - physical bus, shouldn't be in the group already.
+    void add_bus(std::shared_ptr<EKitBus> bus);
+
+    /// \brief Sets error handler of the all executors (see EKitAsyncExecutor#set_error_handler()), including executors
+    ///        of the buses added later. Must not be called concurrently with other methods.
+    /// \param handler - handler, may be empty.
+    void set_error_handler(std::function<void(std::exception_ptr)> handler);
+
+    /// \brief Returns number of buses in the group.
+    size_t size() const;
+
+    /// \brief Returns number of the submitted requests which are not completed yet.
+    size_t pending();
+
+    /// \brief Submits request with callback completion for the bus.
+    /// \param bus - physical bus the request is made for.
+    /// \param request - request to be executed by I/O thread of the bus.
+    /// \param completion - callback called by I/O thread when request is executed (see EKitAsyncExecutor#post()).
+    /// \param to - timeout counting object, used to wait for free space in the queue.
+    /// \return Corresponding EKIT_ERROR error code: #EKIT_BAD_PARAM if bus is not in the group, or error returned by
+    ///         EKitAsyncExecutor#post().
+    EKIT_ERROR post(const std::shared_ptr<EKitBus>& bus,
+                    std::function<void()> request,
+                    std::function<void(std::exception_ptr)> completion,
+                    EKitTimeout& to);
+
+    /// \brief Submits request with std::future completion for the bus.
+    /// \tparam F - type of the callable object.
+    /// \param bus - physical bus the request is made for.
+    /// \param request - callable object to be executed by I/O thread of the bus.
+    /// \return std::future with result of the request. Exceptions thrown by request are rethrown by std::future::get().
+    /// \throw EKitException if request may not be submitted.
+    template<class F>
+    std::future<typename std::result_of<F()>::type> submit(const std::shared_ptr<EKitBus>& bus, F request) {
+        static const char* const func_name = "EKitBusGroup::submit";
+        typedef typename std::result_of<F()>::type result_type;
+
+        auto task = std::make_shared<std::packaged_task<result_type()>>(std::move(request));
+        std::future<result_type> res = task->get_future();
+        EKitTimeout to(0);
+
+        EKIT_ERROR err = post(bus, [task]() { (*task)(); }, nullptr, to);
+        if (err != EKIT_OK) {
+            throw EKitException(func_name, err, "failed to submit request");
+        }
+
+        return res;
+    }
+
+    /// \brief Waits until all the submitted requests are completed on all the buses.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code: #EKIT_TIMEOUT if some requests are not completed in time.
+    EKIT_ERROR join(EKitTimeout& to);
+};
+
+/// @}
+/// @}
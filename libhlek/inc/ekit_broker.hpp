@@ -0,0 +1,319 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus broker and remote bus header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <list>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "ekit_error.hpp"
+#include "ekit_bus.hpp"
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_broker EKitBusBroker
+/// \brief Sharing buses between processes
+/// @{
+/// \page page_communication_broker
+/// \tableofcontents
+///
+/// \section sect_communication_broker_01 Bus broker
+///
+/// EKitBus locking works within single process only, so several processes may not work with the same MCU safely.
+/// EKitBusBroker owns buses and serves them to other processes (broker daemon is in software/broker):
+/// - Clients connect to Unix socket (SOCK_SEQPACKET) and select bus by name. Each request is a single message with
+///   #EKitBrokerRequest header, each response is a single message with #EKitBrokerResponse header.
+/// - Small payloads follow the header in the same message. Large payloads (above #broker_inline_payload bytes) are
+///   passed through shared memory mapped by both client and broker: client creates memory with two areas (requests
+///   and responses) and passes it's descriptor with the first request. Only one request per connection is
+///   outstanding at a time, so each area is used as a whole by the current request.
+/// - Bus locks are granted in order of arrival across all clients (fair scheduling), a client holding the lock may
+///   not be starved by others. If client disconnects while holding the lock, lock is released by broker.
+/// - Unlock doesn't require response, so lock cycle costs a single round trip. Requests of different clients are not
+///   merged: each request is executed on behalf of the client owning the bus lock, in the order client sent them.
+/// - Shared memory must be sealed against shrinking and growing (F_SEAL_SHRINK, F_SEAL_GROW), and it's size must
+///   match requested areas, otherwise client is disconnected. So client can't make broker access unmapped memory.
+///
+/// EKitRemoteBus implements EKitBus over broker connection, so existing device classes work unchanged:
+/// \code
+/// std::shared_ptr<EKitBus> i2cbus(new EKitRemoteBus("/run/hlek/broker.sock", "i2c", BUS_I2C));
+/// i2cbus->open(to);
+/// std::shared_ptr<EKitBus> firmware(new EKitFirmware(i2cbus, firmware_addr));
+/// \endcode
+///
+
+/// \enum EKitBrokerOp
+/// \brief Broker request codes
+enum EKitBrokerOp : uint32_t {
+    BROKER_OP_HELLO         = 0,    ///< Selects bus by name (payload), shared memory descriptor is attached.
+    BROKER_OP_LOCK          = 1,    ///< EKitBus#lock(), arg is address or -1 for unaddressable lock.
+    BROKER_OP_UNLOCK        = 2,    ///< EKitBus#unlock(), no response is sent.
+    BROKER_OP_READ          = 3,    ///< EKitBus#read(), rlength is number of bytes to read.
+    BROKER_OP_WRITE         = 4,    ///< EKitBus#write(), payload is data.
+    BROKER_OP_WRITE_READ    = 5,    ///< EKitBus#write_read(), payload is data to write, rlength is number of bytes to read.
+    BROKER_OP_READ_ALL      = 6,    ///< EKitBus#read_all().
+    BROKER_OP_TRANSACTION   = 7,    ///< EKitBus#transaction(), arg is number of segments, payload is array of
+                                    ///  #EKitBrokerSegment followed by data of write segments.
+    BROKER_OP_SET_OPT       = 8,    ///< EKitBus#set_opt(), arg is option, value is option value.
+    BROKER_OP_GET_OPT       = 9,    ///< EKitBus#get_opt(), arg is option, value is returned by response.
+    BROKER_OP_SUSPEND       = 10,   ///< EKitBus#suspend().
+    BROKER_OP_RESUME        = 11    ///< EKitBus#resume().
+};
+
+/// \brief Payload is placed in shared memory instead of the message (#EKitBrokerRequest#flags and
+///        #EKitBrokerResponse#flags).
+#define BROKER_PAYLOAD_SHM 1
+
+/// \brief Maximum payload size passed in the message itself.
+constexpr size_t broker_inline_payload = 256;
+
+/// \brief Default size of the each shared memory area.
+constexpr size_t broker_default_shm_size = 65536;
+
+/// \struct EKitBrokerRequest
+/// \brief Header of the broker request.
+struct EKitBrokerRequest {
+    uint32_t op;            ///< One of the #EKitBrokerOp values.
+    uint32_t flags;         ///< Payload flags (#BROKER_PAYLOAD_SHM).
+    int32_t  arg;           ///< Request argument (address, option, number of segments or bus type).
+    int32_t  value;         ///< Option value.
+    uint32_t timeout_ms;    ///< Time left for the request, zero means infinite timeout.
+    uint32_t length;        ///< Length of the payload.
+    uint32_t rlength;       ///< Number of bytes to be read.
+};
+
+/// \struct EKitBrokerResponse
+/// \brief Header of the broker response.
+struct EKitBrokerResponse {
+    int32_t  err;           ///< EKIT_ERROR error code.
+    int32_t  value;         ///< Returned value (option value).
+    uint32_t flags;         ///< Payload flags (#BROKER_PAYLOAD_SHM).
+    uint32_t length;        ///< Length of the payload (data read).
+};
+
+/// \struct EKitBrokerSegment
+/// \brief Segment descriptor of the #BROKER_OP_TRANSACTION request.
+struct EKitBrokerSegment {
+    uint32_t length;        ///< Length of the segment.
+    uint32_t flags;         ///< Combination of #EKitBusSegmentFlags values.
+};
+
+/// \class EKitBusBroker
+/// \brief Serves buses to other processes.
+class EKitBusBroker final {
+    /// \struct BrokerBus
+    /// \brief Bus served by broker.
+    struct BrokerBus {
+        std::shared_ptr<EKitBus> bus;       ///< Bus.
+        std::mutex gate_lock;               ///< Guards the fields below.
+        std::condition_variable gate_cv;    ///< Signalled when lock is released or waiter gives up.
+        std::list<int> waiters;             ///< Descriptors of the clients waiting for lock in order of arrival.
+        int owner = -1;                     ///< Descriptor of the client owning the lock, -1 if bus is free.
+    };
+
+    const std::string socket_path;                          ///< Path of the Unix socket.
+    std::map<std::string, std::shared_ptr<BrokerBus>> buses;///< Buses by name.
+    int listen_fd;                                          ///< Listening socket.
+    std::atomic<bool> stopping;                             ///< true if broker is being stopped.
+    std::thread accept_thread;                              ///< Thread accepting connections.
+    std::mutex clients_lock;                                ///< Guards #clients, #client_threads and #finished.
+    std::set<int> clients;                                  ///< Descriptors of the connected clients.
+    std::list<std::thread> client_threads;                  ///< Threads serving clients.
+    std::vector<std::thread::id> finished;                  ///< Threads finished serving clients, not joined yet.
+
+    /// \brief Joins threads finished serving clients. Must be called with #clients_lock held.
+    void reap_threads();
+
+    /// \brief Accepts connections.
+    void accept_func();
+
+    /// \brief Serves single client until it disconnects or broker is stopped.
+    /// \param fd - client socket descriptor.
+    void client_func(int fd);
+
+    /// \brief Waits for the turn and locks the bus on behalf of client.
+    /// \param b - bus.
+    /// \param fd - client socket descriptor.
+    /// \param addr - address to be locked, -1 for unaddressable lock.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR lock_bus(BrokerBus& b, int fd, int addr, EKitTimeout& to);
+
+    /// \brief Unlocks the bus and passes the turn to the next client.
+    /// \param b - bus.
+    void unlock_bus(BrokerBus& b);
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitBusBroker(const EKitBusBroker&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitBusBroker& operator=(const EKitBusBroker&) = delete;
+
+    /// \brief Constructor.
+    /// \param path - path of the Unix socket to listen on.
+    explicit EKitBusBroker(const std::string& path);
+
+    /// \brief Destructor. Stops broker.
+    ~EKitBusBroker();
+
+    /// \brief Adds bus to be served. Must be called before EKitBusBroker#start().
+    /// \param name - name of the bus used by clients.
+    /// \param bus - opened bus.
+    void add_bus(const std::string& name, std::shared_ptr<EKitBus> bus);
+
+    /// \brief Starts listening for clients.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR start();
+
+    /// \brief Disconnects all the clients and stops listening.
+    void stop();
+};
+
+/// \class EKitRemoteBus
+/// \brief EKitBus implementation which forwards calls to the bus served by EKitBusBroker of another process.
+class EKitRemoteBus final : public EKitBus {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitBus super;
+
+    const std::string socket_path;  ///< Path of the broker Unix socket.
+    const std::string remote_name;  ///< Name of the bus served by broker.
+    const size_t shm_size;          ///< Size of the each shared memory area.
+    int sock;                       ///< Broker connection, -1 if not connected.
+    uint8_t* shm;                   ///< Shared memory: requests area followed by responses area.
+    std::vector<uint8_t> message;   ///< Message buffer, header followed by inline payload.
+    bool remote_locked;             ///< true if lock is owned on broker side.
+    bool arbitrated;                ///< true if lock was granted by arbiter, so it must be released on unlock.
+
+    /// \brief Selects location of the request payload: message itself or shared memory.
+    /// \param req - request header, length and payload flags are set by this function.
+    /// \param len - length of the payload.
+    /// \return Pointer to the memory where payload must be placed, nullptr if payload is too large.
+    uint8_t* request_payload(EKitBrokerRequest& req, size_t len);
+
+    /// \brief Sends request and receives response (unlock request is not responded).
+    /// \param req - request header, payload must be placed with EKitRemoteBus#request_payload().
+    /// \param resp - response header.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code: communication error or error returned by broker. Response payload
+    ///         is accessible with EKitRemoteBus#response_payload().
+    EKIT_ERROR call(EKitBrokerRequest& req, EKitBrokerResponse& resp, EKitTimeout& to);
+
+    /// \brief Returns payload of the last response.
+    /// \param resp - response header.
+    const uint8_t* response_payload(const EKitBrokerResponse& resp) const;
+
+    /// \brief Closes connection and unmaps shared memory.
+    void disconnect();
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitRemoteBus(const EKitRemoteBus&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitRemoteBus& operator=(const EKitRemoteBus&) = delete;
+
+    /// \brief Constructor
+    /// \param path - path of the broker Unix socket.
+    /// \param name - name of the bus served by broker.
+    /// \param bt - type of the bus served by broker.
+    /// \param shm_len - size of the each shared memory area, limits payload of a single request.
+    EKitRemoteBus(const std::string& path, const std::string& name, EKitBusType bt,
+                  size_t shm_len = broker_default_shm_size);
+
+    /// \brief Destructor (virtual)
+    ~EKitRemoteBus() override;
+
+    /// \brief Implementation of the EKitBus#open() virtual function. Connects to broker.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR open(EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#close() virtual function. Disconnects from broker.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR close() override;
+
+    /// \brief Implementation of the EKitBus#suspend() virtual function.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR suspend(EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#resume() virtual function.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR resume(EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#lock() virtual function for unaddressable buses.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR lock(EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#lock() virtual function.
+    /// \param addr - address to be locked.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR lock(int addr, EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#unlock() virtual function.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR unlock() override;
+
+    /// \brief Implementation of the EKitBus#read() virtual function.
+    /// \param ptr - pointer to the memory block.
+    /// \param len - length of the memory block.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#write() virtual function.
+    /// \param ptr - pointer to the memory block.
+    /// \param len - length of the memory block.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR write(const void* ptr, size_t len, EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#write_read() virtual function.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#read_all() virtual function.
+    /// \param buffer - Reference to a vector that will receive data from a bus.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#transaction() virtual function. Transaction is executed by broker as a
+    ///        single transaction of the served bus.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#set_opt() virtual function.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR set_opt(int opt, int value, EKitTimeout& to) override;
+
+    /// \brief Implementation of the EKitBus#get_opt() virtual function.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR get_opt(int opt, int& value, EKitTimeout& to) override;
+};
+
+/// @}
+/// @}
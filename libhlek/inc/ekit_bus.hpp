@@ -29,6 +29,7 @@
 #include <memory>
 #include "tools.hpp"
 #include "ekit_error.hpp"
+#include "ekit_metrics.hpp"
 #include <atomic>
 
 /// \addtogroup group_communication
@@ -51,6 +52,10 @@
 /// - Bus may have several addressable devices connected. This feature is implemented with EKitBus#lock() and EKitBus#unlock()
 ///   calls.
 ///
+/// Operations receive EKitTimeout which is a deadline for the whole operation, including retries. Failed or interrupted
+/// requests are retried limited number of times, #EKIT_TIMEOUT is returned if timeout expires while operation is
+/// retried, so a device that doesn't respond can't block the bus (and all the threads waiting for it) forever.
+///
 
 /// \enum EKitBusState
 /// \brief Describes bus state
@@ -69,8 +74,29 @@ enum EKitBusType : uint8_t {
     BUS_I2C_FIRMWARE = 4 ///< Communication protocol between software and firmware.
 };
 
+/// \enum EKitBusSegmentFlags
+/// \brief Flags describing a single segment of the bus transaction (see EKitBus#transaction()).
+enum EKitBusSegmentFlags : uint8_t {
+    BUS_SEGMENT_WRITE = 0,  ///< Segment writes data to a bus.
+    BUS_SEGMENT_READ  = 1,  ///< Segment reads data from a bus.
+    BUS_SEGMENT_STOP  = 2,  ///< Bus is released (STOP condition) after this segment, otherwise the next segment is
+                            ///  started with repeated start. Ignored by buses without such conditions.
+    BUS_SEGMENT_CONTINUE = 4///< Segment continues previous segment of the same direction (no START condition and
+                            ///  address are sent). Allows to scatter read data or gather written data.
+};
+
+/// \struct EKitBusSegment
+/// \brief Describes a single write or read segment of the bus transaction.
+struct EKitBusSegment {
+    void*   buffer;   ///< Data to be written or memory to read data into.
+    size_t  length;   ///< Length of the buffer. Segments with zero length are skipped.
+    uint8_t flags;    ///< Combination of #EKitBusSegmentFlags values.
+};
+
 using EKitTimeout = tools::StopWatch<std::chrono::milliseconds>;
 
+class EKitBusArbiter;
+
 /// \class EKitBus
 /// \brief Base bus abstraction
 class EKitBus {
@@ -78,6 +104,33 @@ protected:
      const EKitBusType bus_type;         ///< Bus type.
     tools::safe_mutex bus_lock;          ///< Guarding mutex.
     EKitBusState state = BUS_CLOSED;     ///< Bus state
+    std::shared_ptr<EKitBusArbiter> arbiter; ///< Optional bus arbiter (see EKitBus#set_arbiter()).
+    std::shared_ptr<EKitBusMetrics> metrics; ///< Optional metrics (see EKitBus#set_metrics()).
+    static constexpr size_t max_interrupted_retries = 64; ///< Maximum number of the system calls restarted because of
+                                                          ///  EINTR or EAGAIN by single bus request.
+    static constexpr uint32_t max_busy_delay_us = 1000;   ///< Maximum delay before system call is restarted because of
+                                                          ///  EAGAIN.
+
+    /// \brief Sleeps before system call is restarted because adapter is busy (EAGAIN). Delay is doubled by every retry
+    ///        up to #max_busy_delay_us, and doesn't exceed remaining time of the timeout.
+    /// \param retries - number of the retries made so far (starts from 1).
+    /// \param to - timeout counting object.
+    static void busy_delay(size_t retries, EKitTimeout& to);
+
+    /// \brief Waits for the turn to own the bus if arbiter is set. Must be called by addressable lock implementations
+    ///        before bus_lock is taken.
+    /// \param addr - address of the device to be locked.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR arbitrate(int addr, EKitTimeout& to);
+
+    /// \brief Passes the bus to the next waiter if arbiter is set. Must be called after bus_lock is released.
+    void release_arbiter();
+
+    /// \brief Takes bus_lock on behalf of the caller. Lock implementations pass __builtin_return_address(0) as
+    ///        site, so lock order verifier reports the code which locks the bus rather than the lock implementation.
+    /// \param site - call site to be reported (see #SAFE_MUTEX_LOCK_FROM).
+    void lock_bus(const void* site);
 
 public:
 
@@ -174,6 +227,33 @@ public:
     /// \return Corresponding EKIT_ERROR error code.
     virtual EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) = 0;
 
+    /// \brief Executes several write and read segments as a single bus transaction.
+    /// \param segments - array of the segments to be executed in order.
+    /// \param count - number of elements in segments array.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code.
+    /// \note Default implementation executes segments one by one with EKitBus#write() and EKitBus#read(). Buses which
+    ///       are able to submit several segments at once should override it.
+    virtual EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to);
+
+    /// \brief Sets bus arbiter used to order addressable locks by device priority.
+    /// \param arb - shared pointer to the arbiter, empty pointer disables arbitration.
+    /// \note Arbiter must be set before bus is used by several threads.
+    void set_arbiter(std::shared_ptr<EKitBusArbiter> arb);
+
+    /// \brief Sets metrics object which accumulates bus metrics.
+    /// \param m - shared pointer to the metrics (see EKitMetricsRegistry#add_bus()), empty pointer disables metrics.
+    /// \note Metrics must be set before bus is used by several threads.
+    void set_metrics(std::shared_ptr<EKitBusMetrics> m);
+
+    /// \brief Returns metrics object.
+    /// \return Shared pointer to the metrics, empty if metrics are not collected.
+    std::shared_ptr<EKitBusMetrics> get_metrics() const;
+
+    /// \brief Returns bus type.
+    /// \return One of the #EKitBusType values identifying actual bus implementation.
+    EKitBusType get_bus_type() const;
+
     /// \brief Returns information about implemented bus.
     /// \param busid - One of the #EKitBusType values identifying actual bus implementation.
     /// \throw Throws EKitException if incompatible bus is specified and some properties flags are not set.
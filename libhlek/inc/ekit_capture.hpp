@@ -0,0 +1,337 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Chunked capture file of the ADC samples and timestamps header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class ADCDev;
+class TimeTrackerDev;
+
+/// \defgroup group_capture Capture files
+/// \brief Binary capture files of the ADC samples and timestamps
+/// @{
+/// \page page_capture
+/// \tableofcontents
+///
+/// \section sect_capture_01 Capture file format
+///
+/// Capture file keeps stream of the fixed size records: raw ADCDev samples (one uint16_t measurement per channel) or
+/// TimeTrackerDev timestamps (uint64_t ticks). File consists of:
+/// 1. Header (EKitCaptureHeader), #EKIT_CAPTURE_HEADER_SIZE bytes. It describes device configuration, channel ranges and tick frequency, so
+///    file may be converted without device configuration library.
+/// 2. Chunks of the fixed size (EKitCaptureHeader#chunk_size). Every chunk starts with EKitCaptureChunk followed by
+///    records. Chunk N is placed at header_size + N * chunk_size, so chunk is found without reading the file.
+/// 3. Index: EKitCaptureIndexEntry of every chunk followed by EKitCaptureFooter at the end of the file. Index is
+///    written when file is closed. If it is missing (writer was killed) EKitCaptureReader rebuilds index from the chunk
+///    headers, number of the records in chunk header is updated by every append.
+///
+/// Records are not split on gap: if samples were lost before the record, the new chunk is started and marked with
+/// #EKIT_CAPTURE_CHUNK_GAP. Every chunk keeps absolute index of its first sample (EKitCaptureChunk#first_sample), so
+/// time of the sample remains correct after gap if number of the lost samples is known (see
+/// EKitCaptureWriter#append_at()). Values are in host byte order (little endian for all supported hosts).
+///
+/// EKitCaptureWriter appends records by memory copy into mapped file, file grows by several chunks at once, so there
+/// is no system call per append. EKitCaptureReader reads header and index from the end of the file and maps chunks on
+/// demand, so multi-gigabyte captures are opened without reading the data, and they don't have to fit address space
+/// of 32-bit hosts. Records are accessed by index with EKitCaptureReader#read(), or chunk by chunk with
+/// EKitCaptureReader#get_chunk(). libhlek is built with 64-bit file offsets (_FILE_OFFSET_BITS=64) for the same reason.
+///
+/// Example:
+/// \code
+/// EKitCaptureWriter cap("adc.hlekcap", EKitCaptureWriter::make_header(*adc, 1000.0));
+/// ADCRawSamples raw = adc->get_raw();
+/// cap.append_at(first_sample, raw.data, raw.samples);
+/// cap.close();
+///
+/// EKitCaptureReader rd("adc.hlekcap");
+/// rd.write_csv(stdout, 0, rd.get_records());
+/// \endcode
+///
+/// software/capture2csv utility converts capture file to CSV.
+///
+
+#define EKIT_CAPTURE_MAGIC          "HLEKCAP"       ///< EKitCaptureHeader#magic value.
+#define EKIT_CAPTURE_INDEX_MAGIC    "HLEKIDX"       ///< EKitCaptureFooter#magic value.
+#define EKIT_CAPTURE_CHUNK_MAGIC    0x4B4E4843      ///< EKitCaptureChunk#magic value ("CHNK").
+#define EKIT_CAPTURE_VERSION        2               ///< Version of the capture file format.
+#define EKIT_CAPTURE_HEADER_SIZE    4096            ///< Size of the file header, chunks are aligned by this value.
+#define EKIT_CAPTURE_MAX_CHANNELS   32              ///< Maximum number of the channels.
+#define EKIT_CAPTURE_CHUNK_GAP      0x0001          ///< Records were lost before the first record of the chunk.
+
+/// \brief Type of the records.
+enum EKitCaptureType : uint32_t {
+    EKIT_CAPTURE_ADC = 1,           ///< Raw ADCDev samples, uint16_t measurement of every channel.
+    EKIT_CAPTURE_TIMESTAMP = 2      ///< TimeTrackerDev timestamps, uint64_t ticks.
+};
+
+#pragma pack(push, 1)
+/// \struct EKitCaptureChannel
+/// \brief Describes channel of the capture: value in volts is min + raw * (max - min) / EKitCaptureHeader#adc_maxval.
+struct EKitCaptureChannel {
+    char name[32];                  ///< Input name.
+    char adc_input[16];             ///< Channel name of the device (ADC_Channel_X).
+    double min;                     ///< Value of zero measurement.
+    double max;                     ///< Value of EKitCaptureHeader#adc_maxval measurement.
+};
+
+/// \struct EKitCaptureHeader
+/// \brief Header of the capture file.
+struct EKitCaptureHeader {
+    char magic[8];                  ///< #EKIT_CAPTURE_MAGIC.
+    uint32_t version;               ///< #EKIT_CAPTURE_VERSION.
+    uint32_t header_size;           ///< Size of the header, offset of the first chunk.
+    uint32_t type;                  ///< Type of the records, one of the EKitCaptureType.
+    uint32_t chunk_size;            ///< Size of the chunk including EKitCaptureChunk, multiple of header_size.
+    uint32_t record_size;           ///< Size of the record.
+    uint32_t channels;              ///< Number of the channels in record.
+    double tick_freq;               ///< ADC: sample rate, Hz (0 if unknown). Timestamps: tick frequency, Hz.
+    int64_t start_time;             ///< Time capture was created, microseconds since epoch.
+    char dev_name[64];              ///< Device name.
+    uint32_t dev_id;                ///< Device id.
+    uint32_t dev_buffer_len;        ///< Device buffer length.
+    uint32_t timer_freq;            ///< ADC: timer clock frequency.
+    uint32_t adc_maxval;            ///< ADC: maximum measurement value.
+    uint32_t measurements_per_sample; ///< ADC: number of the measurements averaged into sample.
+    uint32_t reserved;              ///< Reserved, zero.
+    EKitCaptureChannel channel[EKIT_CAPTURE_MAX_CHANNELS]; ///< Channels.
+};
+
+/// \struct EKitCaptureChunk
+/// \brief Header of the chunk.
+struct EKitCaptureChunk {
+    uint32_t magic;                 ///< #EKIT_CAPTURE_CHUNK_MAGIC.
+    uint32_t flags;                 ///< EKIT_CAPTURE_CHUNK_XXX flags.
+    uint64_t index;                 ///< Index of the chunk.
+    uint64_t first_record;          ///< Index of the first record of the chunk.
+    uint64_t first_sample;          ///< Absolute sample index of the first record, records of the chunk are contiguous.
+    uint32_t records;               ///< Number of the records in chunk.
+    uint32_t reserved;              ///< Reserved, zero.
+};
+
+/// \struct EKitCaptureIndexEntry
+/// \brief Index entry of the chunk.
+struct EKitCaptureIndexEntry {
+    uint64_t first_record;          ///< Index of the first record of the chunk.
+    uint64_t first_sample;          ///< Absolute sample index of the first record.
+    uint32_t records;               ///< Number of the records in chunk.
+    uint32_t flags;                 ///< EKIT_CAPTURE_CHUNK_XXX flags.
+};
+
+/// \struct EKitCaptureFooter
+/// \brief The last bytes of the file, locates index.
+struct EKitCaptureFooter {
+    char magic[8];                  ///< #EKIT_CAPTURE_INDEX_MAGIC.
+    uint64_t index_offset;          ///< Offset of the index.
+    uint64_t chunks;                ///< Number of the chunks.
+    uint64_t records;               ///< Number of the records.
+};
+#pragma pack(pop)
+
+static_assert(sizeof(EKitCaptureHeader) <= EKIT_CAPTURE_HEADER_SIZE, "Capture header doesn't fit header size");
+
+/// \class EKitCaptureWriter
+/// \brief Appends records to the capture file.
+class EKitCaptureWriter final {
+    int fd;                         ///< File descriptor, negative if closed.
+    EKitCaptureHeader header;       ///< Header.
+    size_t chunk_records;           ///< Maximum number of the records in chunk.
+    size_t grow_chunks;             ///< Number of the chunks file grows by.
+    uint8_t* map;                   ///< Mapped pages, starts at page boundary before the first mapped chunk.
+    size_t map_offset;              ///< Offset of the first mapped chunk from map.
+    uint64_t map_first;             ///< Index of the first mapped chunk.
+    size_t map_chunks;              ///< Number of the mapped chunks.
+    EKitCaptureChunk* chunk;        ///< Current chunk, nullptr if there is no chunk.
+    uint64_t records;               ///< Number of the records.
+    uint64_t next_sample;           ///< Absolute sample index of the next record.
+    bool gap_pending;               ///< Gap to be reported with the next record.
+    std::vector<EKitCaptureIndexEntry> index; ///< Index of the chunks.
+
+    /// \brief Starts new chunk, maps next chunks and grows file if required.
+    /// \param gap - true if records were lost before the chunk.
+    void next_chunk(bool gap);
+
+    /// \brief Unmaps chunks.
+    void unmap();
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitCaptureWriter(const EKitCaptureWriter&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitCaptureWriter& operator=(const EKitCaptureWriter&) = delete;
+
+    /// \brief Constructor, creates (or truncates) capture file.
+    /// \param path - path to the file.
+    /// \param hdr - header, see EKitCaptureWriter#make_header(). Fields magic, version, header_size, chunk_size and
+    ///        start_time are set by constructor.
+    /// \param chunk_size - size of the chunk, rounded up to #EKIT_CAPTURE_HEADER_SIZE.
+    /// \param grow_size - number of the bytes file grows by, rounded up to chunk_size.
+    EKitCaptureWriter(const std::string& path,
+                      const EKitCaptureHeader& hdr,
+                      size_t chunk_size = 1024*1024,
+                      size_t grow_size = 64*1024*1024);
+
+    /// \brief Destructor. Closes file.
+    ~EKitCaptureWriter();
+
+    /// \brief Creates header of the ADCDev capture.
+    /// \param adc - device.
+    /// \param sample_rate - sample rate, Hz (0 if unknown).
+    /// \return Header.
+    static EKitCaptureHeader make_header(const ADCDev& adc, double sample_rate);
+
+    /// \brief Creates header of the TimeTrackerDev capture.
+    /// \param ttdev - device.
+    /// \return Header.
+    static EKitCaptureHeader make_header(const TimeTrackerDev& ttdev);
+
+    /// \brief Appends records. Sample index continues from the previous records, number of the records lost in gap
+    ///        is unknown.
+    /// \param data - records, EKitCaptureHeader#record_size bytes each (ADCRawSamples#data, or uint64_t timestamps).
+    /// \param count - number of the records.
+    /// \param gap - true if records were lost before these records.
+    void append(const void* data, size_t count, bool gap = false);
+
+    /// \brief Appends records with known absolute sample index (for example ADCBlock#first_sample). Gap is marked if
+    ///        first_sample is greater than index of the sample following previous records.
+    /// \param first_sample - absolute sample index of the first record, not less than EKitCaptureWriter#get_next_sample().
+    /// \param data - records, EKitCaptureHeader#record_size bytes each.
+    /// \param count - number of the records.
+    void append_at(uint64_t first_sample, const void* data, size_t count);
+
+    /// \brief Returns number of the records appended.
+    uint64_t get_records() const {
+        return records;
+    }
+
+    /// \brief Returns absolute sample index of the next record.
+    uint64_t get_next_sample() const {
+        return next_sample;
+    }
+
+    /// \brief Writes index and closes file. File is truncated to the last chunk used.
+    void close();
+};
+
+/// \class EKitCaptureReader
+/// \brief Reads capture file. Chunks are mapped on demand, so reader is not thread safe.
+class EKitCaptureReader final {
+    int fd;                         ///< File descriptor.
+    uint64_t file_size;             ///< Size of the file.
+    EKitCaptureHeader header;       ///< Header.
+    uint64_t records;               ///< Number of the records.
+    bool recovered;                 ///< true if index was rebuilt from the chunk headers.
+    std::vector<EKitCaptureIndexEntry> index; ///< Index.
+    mutable const uint8_t* map;     ///< Mapped pages, starts at page boundary before the mapped chunk.
+    mutable size_t map_offset;      ///< Offset of the mapped chunk from map.
+    mutable size_t mapped_chunk;    ///< Index of the mapped chunk, valid if map is not nullptr.
+
+    /// \brief Rebuilds index from the chunk headers.
+    void rebuild_index();
+
+    /// \brief Loads index written by EKitCaptureWriter#close().
+    /// \param footer - footer of the file.
+    /// \return true if index is loaded, false if it is inconsistent (index is left empty).
+    bool load_index(const EKitCaptureFooter& footer);
+
+    /// \brief Returns chunk containing the record.
+    size_t find_chunk(uint64_t record) const;
+
+    /// \brief Maps the chunk, previously mapped chunk is unmapped.
+    /// \param n - chunk index.
+    /// \return Pointer to the chunk header.
+    const EKitCaptureChunk* map_chunk(size_t n) const;
+
+    /// \brief Unmaps chunk.
+    void unmap() const;
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitCaptureReader(const EKitCaptureReader&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitCaptureReader& operator=(const EKitCaptureReader&) = delete;
+
+    /// \brief Constructor, opens capture file and loads index.
+    /// \param path - path to the file.
+    explicit EKitCaptureReader(const std::string& path);
+
+    /// \brief Destructor.
+    ~EKitCaptureReader();
+
+    /// \brief Returns header.
+    const EKitCaptureHeader& get_header() const {
+        return header;
+    }
+
+    /// \brief Returns number of the records.
+    uint64_t get_records() const {
+        return records;
+    }
+
+    /// \brief Returns number of the chunks.
+    size_t get_chunk_count() const {
+        return index.size();
+    }
+
+    /// \brief Returns true if index was missing and it was rebuilt from the chunk headers.
+    bool is_recovered() const {
+        return recovered;
+    }
+
+    /// \brief Returns records of the chunk.
+    /// \param n - chunk index.
+    /// \param first_record - receives index of the first record of the chunk.
+    /// \param count - receives number of the records.
+    /// \param gap - receives true if records were lost before the chunk.
+    /// \return Pointer to the records, valid until the next call of get_chunk(), read() or write_csv().
+    const void* get_chunk(size_t n, uint64_t& first_record, size_t& count, bool& gap) const;
+
+    /// \brief Copies records.
+    /// \param first - index of the first record.
+    /// \param count - number of the records.
+    /// \param dst - buffer for count records.
+    /// \return Number of the records copied, less than count if file ends.
+    size_t read(uint64_t first, size_t count, void* dst) const;
+
+    /// \brief Returns true if records were lost before the record.
+    /// \param record - index of the record.
+    bool is_gap(uint64_t record) const;
+
+    /// \brief Returns absolute sample index of the record.
+    /// \param record - index of the record, less than EKitCaptureReader#get_records().
+    uint64_t get_sample(uint64_t record) const;
+
+    /// \brief Writes records as CSV. ADC samples are converted to volts, time of the sample is calculated from absolute
+    ///        sample index and sample rate. Timestamps are written as ticks and seconds
+    ///        since the first timestamp of the file. The last column is 1 for the first record after gap.
+    /// \param f - output file.
+    /// \param first - index of the first record.
+    /// \param count - number of the records.
+    void write_csv(FILE* f, uint64_t first, uint64_t count) const;
+};
+
+/// @}
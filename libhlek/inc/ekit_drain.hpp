@@ -0,0 +1,203 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Drain-before-overflow acquisition scheduler header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstddef>
+#include <cstdint>
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_drain EKitDrainScheduler
+/// \brief Drain-before-overflow acquisition scheduler
+/// @{
+/// \page page_communication_drain
+/// \tableofcontents
+///
+/// \section sect_communication_drain_01 Draining several virtual devices
+///
+/// Virtual devices with circular buffers (ADCDev, TimeTrackerDev, CanDev, IRRCDev, ...) lose data if software doesn't
+/// read it before buffer is full. Polling each device with fixed period either wastes bus time with reads of almost
+/// empty buffers, or overflows buffers filled faster than expected. EKitDrainScheduler plans drains of the registered
+/// sources instead:
+/// - Source is a drain function that reads all the data available in device buffer, passes it to the application and
+///   returns number of bytes read. Drain function is called by scheduler only.
+/// - Fill rate of every source is estimated by number of bytes drained and time elapsed since the previous drain.
+/// - The next drain is planned to the moment buffer is expected to reach high-water mark (fraction of the buffer
+///   capacity). The later source is drained, the more data is read per transaction, so bus is occupied less.
+/// - Rate estimation is conservative: rate increase is taken immediately, decrease is smoothed. If drain reports
+///   overflow, rate is doubled.
+/// - Sources expected to be drained within coalescing window are drained by the same pass to decrease number of
+///   wake ups.
+/// - Drain functions and error handler are called without internal lock held, so they may call scheduler methods
+///   (for example remove their own source). EKitDrainScheduler#remove() waits until running drain of the source is
+///   completed, unless it is called by this drain.
+///
+/// Scheduler may be driven either by application with EKitDrainScheduler#poll() (time is passed by caller, which is
+/// convenient for simulated buses), or by dedicated thread started by EKitDrainScheduler#start().
+///
+/// Example:
+/// \code
+/// EKitDrainScheduler sched(0.75, 1000, 1000000, 1000);
+/// sched.add("tt", tt_config->dev_buffer_len, [&tt](bool& ovf) {
+///     std::vector<uint64_t> ts;
+///     tt.read_all(ts, false);
+///     process(ts);
+///     return ts.size() * sizeof(uint64_t);
+/// });
+/// sched.start();
+/// \endcode
+///
+
+/// \brief Drain function: reads all the data available in virtual device buffer and passes it to application.
+///        Sets ovf parameter if overflow was detected (it is false on call). Returns number of bytes read.
+typedef std::function<size_t(bool& ovf)> EKitDrainFunc;
+
+/// \brief Error handler: receives source id and exception thrown by it's drain function.
+typedef std::function<void(int id, std::exception_ptr e)> EKitDrainErrorFunc;
+
+/// \struct EKitDrainStats
+/// \brief Drain statistics for a source.
+struct EKitDrainStats {
+    size_t drains;          ///< Number of drains made.
+    size_t bytes;           ///< Total number of bytes drained.
+    size_t max_bytes;       ///< Maximum number of bytes drained at once (the highest fill level observed).
+    size_t overflows;       ///< Number of drains that reported overflow.
+    size_t errors;          ///< Number of drains that has thrown an exception.
+    uint64_t period_us;     ///< Currently planned period between drains, in microseconds.
+};
+
+/// \class EKitDrainScheduler
+/// \brief Plans drains of the virtual device buffers to keep them below high-water mark with minimal number of reads.
+class EKitDrainScheduler final {
+    /// \struct DrainSource
+    /// \brief Registered source.
+    struct DrainSource {
+        std::string name;       ///< Name of the source.
+        size_t capacity;        ///< Capacity of the device buffer in bytes.
+        EKitDrainFunc drain;    ///< Drain function.
+        double rate;            ///< Estimated fill rate in bytes per microsecond, negative if unknown.
+        bool armed;             ///< false until the first drain.
+        uint64_t last_us;       ///< Time of the last drain.
+        uint64_t next_us;       ///< Time of the next drain.
+        EKitDrainStats stats;   ///< Statistics.
+        bool busy;              ///< true while drain function is running.
+        bool removed;           ///< true if source was removed by it's own drain function, it is erased after drain.
+        std::thread::id drain_thread; ///< Thread running drain function.
+    };
+
+    const double high_water;            ///< High-water mark, fraction of the buffer capacity.
+    const uint64_t min_period_us;       ///< Minimal period between drains of the source.
+    const uint64_t max_period_us;       ///< Maximal period between drains of the source.
+    const uint64_t coalesce_us;         ///< Coalescing window.
+
+    std::mutex sched_lock;              ///< Guards sources; released while drain functions are called.
+    std::condition_variable drained;    ///< Signalled when drain function is completed.
+    std::map<int, DrainSource> sources; ///< Sources by id.
+    int next_id;                        ///< Id of the next source to be added.
+    EKitDrainErrorFunc on_error;        ///< Error handler, may be empty.
+
+    std::mutex thread_lock;             ///< Guards #stopping and #rescan.
+    std::condition_variable wake;       ///< Signalled when thread must stop or source is added.
+    bool stopping;                      ///< true if thread must stop.
+    bool rescan;                        ///< true if source is added and thread must poll again.
+    std::thread worker;                 ///< Thread started by EKitDrainScheduler#start().
+
+    /// \brief Updates statistics and fill rate of the drained source, and plans the next drain. Called with
+    ///        sched_lock held.
+    /// \param src - drained source.
+    /// \param bytes - number of the bytes drained.
+    /// \param ovf - true if drain function reported overflow.
+    /// \param now_us - current time in microseconds.
+    void plan_source(DrainSource& src, size_t bytes, bool ovf, uint64_t now_us);
+
+    /// \brief Thread function.
+    void thread_func();
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitDrainScheduler(const EKitDrainScheduler&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitDrainScheduler& operator=(const EKitDrainScheduler&) = delete;
+
+    /// \brief Constructor.
+    /// \param hwm - high-water mark, fraction of the buffer capacity (0, 1].
+    /// \param min_us - minimal period between drains of the source, in microseconds. Also used as a period of the
+    ///        first drains while fill rate is unknown.
+    /// \param max_us - maximal period between drains of the source, in microseconds.
+    /// \param window_us - coalescing window, in microseconds.
+    EKitDrainScheduler(double hwm, uint64_t min_us, uint64_t max_us, uint64_t window_us);
+
+    /// \brief Destructor. Stops thread if started.
+    ~EKitDrainScheduler();
+
+    /// \brief Returns current time of the steady clock in microseconds, used by thread started by
+    ///        EKitDrainScheduler#start().
+    static uint64_t clock_us();
+
+    /// \brief Registers source. Source is drained by the next EKitDrainScheduler#poll() call.
+    /// \param name - name of the source.
+    /// \param capacity - capacity of the device buffer in bytes.
+    /// \param drain - drain function.
+    /// \return Id of the source.
+    int add(const std::string& name, size_t capacity, EKitDrainFunc drain);
+
+    /// \brief Unregisters source. If drain function of the source is running, waits until it is completed, so drain
+    ///        function is not running once this method returns. If called by drain function of the same source, source
+    ///        is removed when drain function returns.
+    /// \param id - id of the source.
+    void remove(int id);
+
+    /// \brief Sets error handler. If handler is empty, exceptions thrown by drain functions are rethrown by
+    ///        EKitDrainScheduler#poll() (and ignored by thread).
+    void set_error_handler(EKitDrainErrorFunc handler);
+
+    /// \brief Drains sources due by the specified time (and within coalescing window).
+    /// \param now_us - current time in microseconds. Must not decrease between calls.
+    /// \return Time of the next planned drain in microseconds, UINT64_MAX if there are no sources.
+    /// \note Sources being drained by concurrent call are skipped.
+    uint64_t poll(uint64_t now_us);
+
+    /// \brief Returns statistics of the source.
+    /// \param id - id of the source.
+    /// \return Copy of the statistics.
+    EKitDrainStats get_stats(int id);
+
+    /// \brief Starts thread that calls EKitDrainScheduler#poll() with EKitDrainScheduler#clock_us() time.
+    void start();
+
+    /// \brief Stops thread started by EKitDrainScheduler#start().
+    void stop();
+};
+
+/// @}
+/// @}
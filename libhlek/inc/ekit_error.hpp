@@ -84,6 +84,7 @@ typedef int32_t EKIT_ERROR;
 #define EKIT_NOT_STARTED          31 ///< Device is not started.
 #define EKIT_NOT_STOPPED          32 ///< Device is not stopped.
 #define EKIT_REPEAT               33 ///< Device is not stopped.
+#define EKIT_DATA_LOST            34 ///< Data may be lost.
 // <\__LIBHLEK_ERROR_DEFINES__>
 
 /// \brief Translates EKIT_ERROR to string for error message formatting purposes.
@@ -22,8 +22,10 @@
 
 #pragma once
 #include <memory>
+#include <vector>
 #include "ekit_error.hpp"
 #include "ekit_bus.hpp"
+#include "ekit_poll.hpp"
 #include "i2c_proto.h"
 
 /// \addtogroup group_communication
@@ -49,6 +51,55 @@ class EKitFirmwareCallbacks {
     virtual EKIT_ERROR on_status_busy() = 0;
 };
 
+/// \class EKitFirmwareBatch
+/// \brief Collects commands of the virtual devices to be sent to firmware by single bus write (batch frame, see
+///        #COMM_BATCH_FLAG). Batch is sent by EKitFirmware#write_batch().
+/// \note Memory is not released by EKitFirmwareBatch#clear(), so batch reused in a loop doesn't allocate memory.
+class EKitFirmwareBatch final {
+    friend class EKitFirmware;
+
+    std::vector<uint8_t> frame;   ///< #CommCommandHeader followed by #CommBatchRecord records with command data.
+    size_t records = 0;           ///< Number of the records.
+    tools::ControlSum records_crc;///< Control sum of the records, calculated while records are added.
+    int last_dev = -1;            ///< Virtual device id of the last record.
+    const size_t buffer_length;   ///< Length of the firmware command buffer (COMM_BUFFER_LENGTH).
+
+public:
+    static constexpr size_t default_buffer_length = 512;    ///< Default length of the firmware command buffer.
+
+    /// \brief Constructor
+    /// \param buffer_len - length of the firmware command buffer (COMM_BUFFER_LENGTH of the firmware configuration),
+    ///        batch frame data must fit it together with optional CRC-16.
+    explicit EKitFirmwareBatch(size_t buffer_len = default_buffer_length);
+
+    /// \brief Appends command to the batch.
+    /// \param dev_id - virtual device id.
+    /// \param flags - virtual device specific command flags (the same as EKitFirmware#FIRMWARE_OPT_FLAGS value).
+    /// \param data - command data, may be nullptr if len is zero.
+    /// \param len - length of the command data.
+    /// \return Corresponding EKIT_ERROR error code. #EKIT_BAD_PARAM is returned if device id or flags are invalid,
+    ///         #EKIT_OVERFLOW if batch frame becomes too long or doesn't fit firmware command buffer.
+    EKIT_ERROR add(int dev_id, uint8_t flags, const void* data, size_t len);
+
+    /// \brief Removes all the commands from the batch.
+    void clear();
+
+    /// \brief Returns number of the commands in the batch.
+    size_t size() const {
+        return records;
+    }
+
+    /// \brief Returns true if batch has no commands.
+    bool empty() const {
+        return records == 0;
+    }
+
+    /// \brief Returns length of the batch frame data (excluding #CommCommandHeader).
+    size_t data_length() const {
+        return frame.size() - sizeof(CommCommandHeader);
+    }
+};
+
 /// \class EKitFirmware
 /// \brief Software to firmware communication protocol implementation.
 class EKitFirmware final : public EKitBus,
@@ -62,10 +113,32 @@ class EKitFirmware final : public EKitBus,
 	uint8_t flags = 0;            ///< Virtual device specific command flags.
 	int firmware_addr;            ///< Firmware address on a bus
 
+    /// \enum EKitCRC16Mode
+    /// \brief State of the CRC-16 framing (see #COMM_CRC16_FLAG).
+    enum EKitCRC16Mode {
+        CRC16_OFF = 0,          ///< Commands are protected by control sum.
+        CRC16_NEGOTIATE = 1,    ///< CRC-16 is requested, the next command negotiates it with firmware.
+        CRC16_ON = 2            ///< Firmware has acknowledged CRC-16, commands and reads are protected by CRC-16.
+    };
+    EKitCRC16Mode crc16_mode = CRC16_OFF; ///< State of the CRC-16 framing.
+    static constexpr size_t crc16_negotiate_attempts = 3; ///< Number of not acknowledged CRC-16 frames before
+                                                          ///  EKitFirmware falls back to control sum.
+
     /// \brief Container to store virtual devices connected to the firmware bus
     ///        Keys are virtual device ids, values EKitFirmwareCallbacks interface implementations.
     std::map<int, EKitFirmwareCallbacks*> registered_devices;
     tools::safe_mutex data_lock;
+    static constexpr uint32_t default_poll_min_us = 20;     ///< Default EKitBackoffPoll minimal delay.
+    static constexpr uint32_t default_poll_max_us = 1000;   ///< Default EKitBackoffPoll maximum delay.
+    std::shared_ptr<EKitPollStrategy> poll_strategy;       ///< Strategy used to wait for busy virtual devices.
+    uint32_t completion_hint_us = 0;                        ///< Expected duration of the current command (0 - unknown).
+    static constexpr size_t default_max_retries = 16;       ///< Default EKitFirmware#max_retries value.
+    size_t max_retries = default_max_retries;               ///< Maximum number of the retries made by single operation,
+                                                            ///  zero means operation is limited by timeout only.
+
+    static constexpr size_t scratch_initial_size = 64; ///< Initial size of the EKitFirmware#scratch buffer.
+    std::vector<uint8_t> scratch; ///< Scratch buffer used to prepare commands. Grows on demand and never shrinks, so
+                                  ///  steady state communication doesn't allocate memory.
 
 	/// \brief Helper function that processes communication status by converting it to #EKIT_ERROR and calling corresponding
 	///        EKitFirmwareCallbacks callbacks from converts virtual device communication.
@@ -73,13 +146,99 @@ class EKitFirmware final : public EKitBus,
     /// \return Corresponding #EKIT_ERROR error code.
     EKIT_ERROR process_comm_status(uint8_t cs);
 
+    /// \brief Helper function that decides if failed bus request may be repeated, and waits before the next attempt.
+    /// \param err - error returned by the failed request.
+    /// \param retries - number of the retries made by operation so far, incremented if request may be repeated.
+    /// \param to - timeout counting object.
+    /// \return #EKIT_OK if request may be repeated, #EKIT_TIMEOUT if timeout is expired, err if
+    ///         EKitFirmware#max_retries retries are made.
+    EKIT_ERROR retry(EKIT_ERROR err, size_t& retries, EKitTimeout& to);
+
+    /// \brief Helper function that accounts retries made by completed operation in metrics.
+    /// \param retries - number of the retries made by operation.
+    /// \param err - error code returned by operation.
+    void account_retries(size_t retries, EKIT_ERROR err) {
+        if (metrics) metrics->add_operation_retries(vdev_addr, retries, err);
+    }
+
+    /// \brief Helper function that reads response header from firmware until success.
+    /// \param hdr - reference to command response header to be read.
+    /// \param retries - number of the retries made by operation, read failures are added.
+    /// \param to - timeout counting object.
+    /// \return Corresponding #EKIT_ERROR error code.
+    EKIT_ERROR read_status(CommResponseHeader& hdr, size_t& retries, EKitTimeout& to);
+
+    /// \brief Helper function that processes response header just read from firmware.
+    /// \param hdr - reference to command response header read from firmware.
+    /// \param wait_device - wait until virtual device will not reset #COMM_STATUS_BUSY.
+    /// \param to - timeout counting object.
+    /// \return Corresponding #EKIT_ERROR error code.
+    EKIT_ERROR check_status(CommResponseHeader& hdr, bool wait_device, EKitTimeout& to);
+
+    /// \brief Helper function that checks if response header acknowledges buffer, i.e. control sum of the previous
+    ///        operation reported by firmware is control sum of the buffer.
+    /// \param buf - buffer written (either command or single byte with virtual device id).
+    /// \param len - length of the buffer.
+    /// \param hdr - response header read after the buffer was written.
+    /// \return true if buffer was received by firmware, otherwise false.
+    bool acknowledged(const uint8_t* buf, size_t len, const CommResponseHeader& hdr) const;
+
+    /// \brief Helper function that writes buffer to firmware and reads response header by single bus transaction. If
+    ///        transaction fails, response header is read again; buffer is written again only if it may be not
+    ///        received by firmware.
+    /// \param buf - buffer to be written (either command or single byte with virtual device id).
+    /// \param len - length of the buffer.
+    /// \param hdr - reference to command response header to be read.
+    /// \param to - timeout counting object.
+    /// \return Corresponding #EKIT_ERROR error code. Response header is not processed.
+    EKIT_ERROR write_read_status(const uint8_t* buf, size_t len, CommResponseHeader& hdr, EKitTimeout& to);
+
+    /// \brief Helper function that sends command frame and reads response header. If frame has #COMM_CRC16_FLAG set,
+    ///        CRC-16 is appended to the frame, and CRC-16 framing is negotiated if required.
+    /// \param frame - command frame with control sum set, must have #COMM_CRC16_SIZE spare bytes after the end.
+    /// \param len - length of the command frame.
+    /// \param hdr - reference to command response header to be read.
+    /// \param to - timeout counting object.
+    /// \return Corresponding #EKIT_ERROR error code. Response header is not processed.
+    EKIT_ERROR send_command(uint8_t* frame, size_t len, CommResponseHeader& hdr, EKitTimeout& to);
+
+    /// \brief Helper function that returns CRC-16 of the previous operation from the response header.
+    static uint16_t last_crc16(const CommResponseHeader& hdr);
+
+    /// \brief Helper function that returns flags to be set in CommCommandHeader#length of the command frames.
+    uint16_t frame_flags() const {
+        return crc16_mode != CRC16_OFF ? COMM_CRC16_FLAG : 0;
+    }
+
+    /// \brief Helper function that locks the bus and virtual device without communication with firmware.
+    /// \param vdev - virtual device id.
+    /// \param site - call site to be reported by lock order verifier (see EKitBus#lock_bus()).
+    /// \param to - timeout counting object.
+    /// \return Corresponding #EKIT_ERROR error code.
+    EKIT_ERROR lock_vdev(int vdev, const void* site, EKitTimeout& to);
+
+    /// \brief Helper function that reads response header, data and response header with control sum of the data by
+    ///        single bus transaction.
+    /// \param ptr - pointer to the memory block.
+    /// \param len - length of the memory block.
+    /// \param hdr - reference to command response header read before data.
+    /// \param stream - true if device has streaming reads enabled: failed transaction is not retried because firmware
+    ///        may have already committed the data (see EKitFirmware#read_stream()).
+    /// \param to - timeout counting object.
+    /// \return Corresponding #EKIT_ERROR error code.
+    EKIT_ERROR read_checked(void* ptr, size_t len, CommResponseHeader& hdr, bool stream, EKitTimeout& to);
 
 
 public:
 
     /// \enum EKitFirmwareOptions
     enum EKitFirmwareOptions {
-        FIRMWARE_OPT_FLAGS = 100      ///< Indicates that device specific command option flags are set
+        FIRMWARE_OPT_FLAGS = 100,     ///< Indicates that device specific command option flags are set
+        FIRMWARE_OPT_CRC16 = 101,     ///< Non-zero value requests CRC-16 framing, it is negotiated by the next command
+                                      ///  (see \ref sect_communication_details_02). EKitFirmware#get_opt() returns 1
+                                      ///  if firmware has acknowledged CRC-16 framing.
+        FIRMWARE_OPT_MAX_RETRIES = 102///< Maximum number of the retries of the failed bus requests made by single
+                                      ///  operation (16 by default). Zero means retries are limited by timeout only.
     };
 
     /// \brief Copy construction is forbidden
@@ -113,6 +272,25 @@ public:
     /// \return Corresponding EKIT_ERROR error code.
     EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override;
 
+    /// \brief Reads up to max_len bytes from the circular buffer of the virtual device with streaming reads enabled
+    ///        (see \ref sect_communication_response_02) by single bus transaction. Unlike EKitFirmware#read(), it is
+    ///        allowed to request more data than device has, and device doesn't become busy with read completion, so
+    ///        this function may be called back to back without synchronization with virtual device.
+    /// \param ptr - pointer to the memory block. Data starts with circular buffer status (if any).
+    /// \param max_len - length of the memory block. Should be status size plus multiple of the circular buffer block
+    ///        size, otherwise partially read block will be lost.
+    /// \param len - number of the valid bytes read into memory block.
+    /// \param to - timeout counting object.
+    /// \param available - optional, receives number of the bytes device had when read started (CommResponseHeader#length)
+    ///        if #EKIT_OK or #EKIT_OVERFLOW is returned.
+    /// \return Corresponding EKIT_ERROR error code. len is valid if #EKIT_OK or #EKIT_OVERFLOW is returned.
+    ///         #EKIT_CRC_ERROR is returned if data is corrupted, in this case data is lost because it was already
+    ///         removed from device buffer. #EKIT_DATA_LOST is returned if bus transaction has failed: it is not
+    ///         retried, because firmware commits read on the stop condition after data, and the next read would return
+    ///         the next chunk. Failed chunk may or may not be removed from device buffer, caller must treat it as a gap.
+    ///         Nothing is removed from device buffer if device is busy.
+    EKIT_ERROR read_stream(void* ptr, size_t max_len, size_t& len, EKitTimeout& to, size_t* available = nullptr);
+
     /// \brief Does write and read by single operation, the first write with subsequent read.
     /// \param wbuf - memory to write.
     /// \param wlen - length of the write buffer.
@@ -158,7 +336,8 @@ public:
 	EKIT_ERROR unlock() override;
 
     /// \brief Implementation of the EKitBus#read_all() virtual function.
-    /// \param buffer - Reference to a vector that will receive data from a bus.
+    /// \param buffer - Reference to a vector that will receive data from a bus. Vector is reallocated only if its capacity
+    ///        is less than amount of data, so vector reused by caller keeps read allocation free.
     /// \return Corresponding EKIT_ERROR error code.
 	EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override;
 
@@ -190,8 +369,32 @@ public:
     /// \param hdr - Resulting command header returned by device
     /// \param yield - relinquish thread execution time in favour of other threads (may be useful in some situations)
     /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code. #EKIT_TIMEOUT is returned if timeout is expired while device is busy.
+    /// \note Delays between status reads are defined by the poll strategy (see EKitFirmware#set_poll_strategy()).
     EKIT_ERROR wait_vdev(CommResponseHeader& hdr, bool yield, EKitTimeout& to);
 
+    /// \brief Sets strategy to be used to wait for busy virtual devices.
+    /// \param strategy - shared pointer to the strategy. May be changed at any time.
+    void set_poll_strategy(std::shared_ptr<EKitPollStrategy> strategy);
+
+    /// \brief Returns strategy used to wait for busy virtual devices.
+    /// \return Shared pointer to the strategy.
+    std::shared_ptr<EKitPollStrategy> get_poll_strategy();
+
+    /// \brief Passes expected duration of the next command of the locked virtual device to the poll strategy.
+    /// \param us - expected duration in microseconds.
+    /// \note Hint is discarded when device is unlocked.
+    void set_completion_hint(uint32_t us);
+
+    /// \brief Sends all the commands collected by batch with a single bus write and waits until they are executed.
+    /// \param batch - batch to be sent. Batch is not cleared.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code. #EKIT_FAIL is returned if firmware rejected the batch or any
+    ///         virtual device failed its command, #EKIT_CRC_ERROR if batch frame was corrupted.
+    /// \note Bus must not be locked by the caller. Virtual device status callbacks are not called, because status of
+    ///       the batch is a combination of the statuses of several virtual devices.
+    EKIT_ERROR write_batch(EKitFirmwareBatch& batch, EKitTimeout& to);
+
     /// \brief Registers virtual device
     EKIT_ERROR register_vdev(int dev_id, EKitFirmwareCallbacks* vdev);
 
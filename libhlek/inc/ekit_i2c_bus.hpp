@@ -49,6 +49,12 @@ class EKitI2CBus final : public EKitBus {
 	std::string bus_name;         ///< Name of the bus.
 	int i2c_descriptor;           ///< I2C bus descriptor.
 	int address;                  ///< Address of the I2C slave device.
+	bool stop_supported;          ///< true if adapter may generate STOP condition between messages of the single
+	                              ///  I2C_RDWR request (I2C_FUNC_PROTOCOL_MANGLING), otherwise false.
+	bool nostart_supported;       ///< true if adapter may continue message without START condition and address
+	                              ///  (I2C_FUNC_NOSTART), otherwise false.
+	std::vector<uint8_t> bounce_buffer; ///< Buffer to merge #BUS_SEGMENT_CONTINUE segments if adapter doesn't support
+	                                    ///  I2C_FUNC_NOSTART. Grows on demand and never shrinks.
 
 	/// \brief  Helper function for opening i2c bus descriptor.
     /// \return Corresponding EKIT_ERROR error code.
@@ -58,6 +64,14 @@ class EKitI2CBus final : public EKitBus {
     /// \return Corresponding EKIT_ERROR error code.
 	EKIT_ERROR i2c_read_write(uint8_t addr, bool readop, void* buffer, size_t len, EKitTimeout& to);
 
+	/// \brief Submits several I2C messages with single I2C_RDWR request.
+	/// \param addr - i2c address.
+	/// \param segments - array of the segments to be submitted.
+	/// \param count - number of segments, must not exceed I2C_RDWR_IOCTL_MAX_MSGS.
+	/// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code, #EKIT_TIMEOUT if timeout expires while adapter is busy.
+	EKIT_ERROR i2c_transfer(uint8_t addr, EKitBusSegment* segments, size_t count, EKitTimeout& to);
+
 
 public:
     /// \brief Check if address is suitable for a bus.
@@ -123,6 +137,22 @@ public:
     /// \return Corresponding EKIT_ERROR error code.
     EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to)  override;
 
+    /// \brief Implementation of the EKitBus#transaction() virtual function.
+    /// \param segments - array of the segments to be executed in order.
+    /// \param count - number of elements in segments array.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code.
+    /// \note Segments are submitted with as few I2C_RDWR requests as possible. If adapter is not capable to generate STOP
+    ///       condition inside of the single request, request is split after every segment with #BUS_SEGMENT_STOP flag.
+    ///       Raspberry Pi (bcm2835) adapter is not capable of it, so firmware command and response header read
+    ///       (EKitFirmware) take two I2C_RDWR requests there, the same as separate write() and read().
+    ///       Segments with #BUS_SEGMENT_CONTINUE flag are sent with I2C_M_NOSTART flag, or, if adapter doesn't support it,
+    ///       merged with previous segment through internal bounce buffer. Raspberry Pi (bcm2835) adapter doesn't
+    ///       support I2C_M_NOSTART either, so there EKitFirmware reads (response header continued by data) are not copy
+    ///       free: data is read into bounce buffer and copied into the segment buffers after request (data to be
+    ///       written is copied into it before request). Bounce buffer is not reallocated once it has grown.
+    EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) override;
+
     /// \brief Implementation of the EKitBus#lock() virtual function.
     /// \param addr - Address of the device connected to the bus to work with. Ignored for buses that may not address
     ///        several devices.
@@ -0,0 +1,287 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus metrics header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ekit_error.hpp"
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_metrics EKitMetricsRegistry
+/// \brief Bus and virtual device metrics
+/// @{
+/// \page page_communication_metrics
+/// \tableofcontents
+///
+/// \section sect_communication_metrics_01 Metrics
+///
+/// Buses collect metrics if EKitBusMetrics object is assigned with EKitBus#set_metrics(). Metrics are kept by device
+/// address: I2C address for EKitI2CBus, virtual device id for EKitFirmware, 0 for buses without addresses. Following
+/// metrics are collected:
+/// - bytes written and read;
+/// - transactions (bus requests) and failed transactions;
+/// - retries caused by #EKIT_WRITE_FAILED and #EKIT_READ_FAILED errors, and log2 histogram of the retries made by
+///   single operation (only operations which needed retries are accounted);
+/// - operations abandoned with #EKIT_TIMEOUT because timeout expired while request was retried or device was busy;
+/// - busy polls (status reads while virtual device is busy);
+/// - lock wait time and transaction duration: totals and log2 histograms in microseconds.
+///
+/// All counters are updated with relaxed atomic operations, no locks are taken and no memory is allocated, so
+/// metrics may stay enabled in production.
+///
+/// EKitMetricsRegistry creates EKitBusMetrics objects, makes consistent snapshots of all the registered metrics and
+/// optionally dumps them periodically from the dedicated thread:
+/// \code
+/// EKitMetricsRegistry registry;
+/// i2c_bus->set_metrics(registry.add_bus("i2c-1"));
+/// firmware->set_metrics(registry.add_bus("firmware"));
+/// registry.start_dump([](const std::vector<EKitMetricsSnapshot>& s) {
+///     fputs(EKitMetricsRegistry::format(s).c_str(), stderr); }, 10000);
+/// \endcode
+///
+
+/// \struct EKitMetricsSnapshot
+/// \brief Copy of the metrics for single device address of the bus.
+struct EKitMetricsSnapshot {
+    std::string bus;                        ///< Name of the bus.
+    int         addr;                       ///< Device address.
+    uint64_t    bytes_out;                  ///< Bytes written.
+    uint64_t    bytes_in;                   ///< Bytes read.
+    uint64_t    transactions;               ///< Number of the transactions.
+    uint64_t    errors;                     ///< Number of the failed transactions.
+    uint64_t    write_retries;              ///< Retries caused by #EKIT_WRITE_FAILED.
+    uint64_t    read_retries;               ///< Retries caused by #EKIT_READ_FAILED.
+    uint64_t    busy_polls;                 ///< Status reads while device is busy.
+    uint64_t    timeouts;                   ///< Operations abandoned with #EKIT_TIMEOUT.
+    uint64_t    locks;                      ///< Number of the locks.
+    uint64_t    lock_wait_us;               ///< Total lock wait time in microseconds.
+    uint64_t    transaction_us;             ///< Total transaction duration in microseconds.
+    std::vector<uint64_t> lock_wait_hist;   ///< Lock wait time histogram (see EKitBusMetrics#bucket()).
+    std::vector<uint64_t> transaction_hist; ///< Transaction duration histogram (see EKitBusMetrics#bucket()).
+    std::vector<uint64_t> retry_hist;       ///< Retries per operation histogram (see EKitBusMetrics#bucket()).
+};
+
+/// \class EKitBusMetrics
+/// \brief Lock-free metrics of a single bus.
+class EKitBusMetrics final {
+public:
+    static constexpr size_t max_addresses = 128;     ///< Number of the device addresses, address is masked with it.
+    static constexpr size_t histogram_buckets = 32;  ///< Number of the histogram buckets.
+
+private:
+    /// \struct AddrMetrics
+    /// \brief Counters of the single device address.
+    struct AddrMetrics {
+        std::atomic<uint64_t> bytes_out;
+        std::atomic<uint64_t> bytes_in;
+        std::atomic<uint64_t> transactions;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> write_retries;
+        std::atomic<uint64_t> read_retries;
+        std::atomic<uint64_t> busy_polls;
+        std::atomic<uint64_t> timeouts;
+        std::atomic<uint64_t> locks;
+        std::atomic<uint64_t> lock_wait_us;
+        std::atomic<uint64_t> transaction_us;
+        std::atomic<uint64_t> lock_wait_hist[histogram_buckets];
+        std::atomic<uint64_t> transaction_hist[histogram_buckets];
+        std::atomic<uint64_t> retry_hist[histogram_buckets];
+    };
+
+    const std::string name;                 ///< Name of the bus.
+    AddrMetrics addresses[max_addresses];   ///< Metrics by device address.
+
+    /// \brief Returns metrics of the address.
+    AddrMetrics& at(int addr) {
+        return addresses[static_cast<size_t>(addr) & (max_addresses - 1)];
+    }
+
+    /// \brief Increments counter, relaxed memory order is used.
+    static void inc(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitBusMetrics(const EKitBusMetrics&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitBusMetrics& operator=(const EKitBusMetrics&) = delete;
+
+    /// \brief Constructor.
+    /// \param bus_name - name of the bus used in snapshots.
+    explicit EKitBusMetrics(const std::string& bus_name);
+
+    /// \brief Returns name of the bus.
+    const std::string& get_name() const {
+        return name;
+    }
+
+    /// \brief Returns histogram bucket for the value.
+    /// \param us - value in microseconds.
+    /// \return Bucket index: 0 for values less than 2us, i>0 for values in range [2^i, 2^(i+1)).
+    static size_t bucket(uint64_t us) {
+        size_t res = 0;
+        while (us > 1 && res < histogram_buckets - 1) {
+            us >>= 1;
+            res++;
+        }
+        return res;
+    }
+
+    /// \brief Returns microseconds elapsed since time point.
+    /// \param start - time point.
+    static uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// \brief Accounts transaction (bus request).
+    /// \param addr - device address.
+    /// \param out - bytes written.
+    /// \param in - bytes read.
+    /// \param err - error code returned by transaction. Data is not accounted for failed transactions.
+    /// \param us - duration of the transaction in microseconds.
+    void add_transaction(int addr, size_t out, size_t in, EKIT_ERROR err, uint64_t us) {
+        AddrMetrics& m = at(addr);
+        inc(m.transactions, 1);
+        if (err == EKIT_OK) {
+            inc(m.bytes_out, out);
+            inc(m.bytes_in, in);
+        } else {
+            inc(m.errors, 1);
+        }
+        inc(m.transaction_us, us);
+        inc(m.transaction_hist[bucket(us)], 1);
+    }
+
+    /// \brief Accounts lock.
+    /// \param addr - device address.
+    /// \param us - time spent waiting for lock in microseconds.
+    void add_lock(int addr, uint64_t us) {
+        AddrMetrics& m = at(addr);
+        inc(m.locks, 1);
+        inc(m.lock_wait_us, us);
+        inc(m.lock_wait_hist[bucket(us)], 1);
+    }
+
+    /// \brief Accounts retry.
+    /// \param addr - device address.
+    /// \param err - error caused retry: #EKIT_WRITE_FAILED or #EKIT_READ_FAILED.
+    void add_retry(int addr, EKIT_ERROR err) {
+        AddrMetrics& m = at(addr);
+        inc(err == EKIT_WRITE_FAILED ? m.write_retries : m.read_retries, 1);
+    }
+
+    /// \brief Accounts operation completed after retries.
+    /// \param addr - device address.
+    /// \param retries - number of the retries made by operation, nothing is accounted if zero.
+    /// \param err - error code returned by operation.
+    void add_operation_retries(int addr, size_t retries, EKIT_ERROR err) {
+        AddrMetrics& m = at(addr);
+        if (retries > 0) {
+            inc(m.retry_hist[bucket(retries)], 1);
+        }
+        if (err == EKIT_TIMEOUT) {
+            inc(m.timeouts, 1);
+        }
+    }
+
+    /// \brief Accounts busy polls.
+    /// \param addr - device address.
+    /// \param polls - number of status reads while device was busy.
+    void add_busy_polls(int addr, size_t polls) {
+        inc(at(addr).busy_polls, polls);
+    }
+
+    /// \brief Appends snapshots of the used addresses.
+    /// \param snap - vector to append snapshots to.
+    void snapshot(std::vector<EKitMetricsSnapshot>& snap);
+
+    /// \brief Resets all the counters.
+    void reset();
+};
+
+/// \class EKitMetricsRegistry
+/// \brief Keeps metrics of the buses, makes snapshots and periodic dumps.
+class EKitMetricsRegistry final {
+    std::mutex reg_lock;                                    ///< Guards buses.
+    std::vector<std::shared_ptr<EKitBusMetrics>> buses;     ///< Registered metrics.
+
+    std::mutex dump_lock;                                   ///< Guards dump_stop.
+    std::condition_variable dump_cond;                      ///< Signalled to stop dump thread.
+    bool dump_stop;                                         ///< true if dump thread must stop.
+    std::thread dump_thread;                                ///< Periodic dump thread.
+
+public:
+    /// \brief Type of the function receiving periodic dumps.
+    typedef std::function<void(const std::vector<EKitMetricsSnapshot>&)> EKitMetricsSink;
+
+    /// \brief Copy construction is forbidden
+    EKitMetricsRegistry(const EKitMetricsRegistry&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitMetricsRegistry& operator=(const EKitMetricsRegistry&) = delete;
+
+    /// \brief Constructor.
+    EKitMetricsRegistry();
+
+    /// \brief Destructor. Stops periodic dump.
+    ~EKitMetricsRegistry();
+
+    /// \brief Creates metrics for a bus.
+    /// \param name - name of the bus used in snapshots.
+    /// \return Shared pointer to metrics to be passed to EKitBus#set_metrics().
+    std::shared_ptr<EKitBusMetrics> add_bus(const std::string& name);
+
+    /// \brief Makes snapshot of all the registered metrics.
+    /// \param snap - vector to receive snapshots, one element per bus and used device address.
+    void snapshot(std::vector<EKitMetricsSnapshot>& snap);
+
+    /// \brief Resets all the registered metrics.
+    void reset();
+
+    /// \brief Starts periodic dump.
+    /// \param sink - function receiving snapshots, called by dump thread.
+    /// \param interval_ms - dump interval in milliseconds.
+    void start_dump(EKitMetricsSink sink, uint32_t interval_ms);
+
+    /// \brief Stops periodic dump, does nothing if dump is not started.
+    void stop_dump();
+
+    /// \brief Formats snapshots as text, one line per bus and device address.
+    /// \param snap - snapshots.
+    /// \return Text representation.
+    static std::string format(const std::vector<EKitMetricsSnapshot>& snap);
+};
+
+/// @}
+/// @}
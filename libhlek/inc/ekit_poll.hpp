@@ -0,0 +1,182 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Poll strategies for busy virtual devices header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include "i2c_proto.h"
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_poll EKitPollStrategy
+/// \brief Poll strategies for busy virtual devices
+/// @{
+/// \page page_communication_poll
+/// \tableofcontents
+///
+/// \section sect_communication_poll_01 Waiting for virtual devices
+///
+/// When virtual device is busy with command execution (#COMM_STATUS_BUSY is set), EKitFirmware polls it's status until
+/// command is completed. The way how EKitFirmware waits between status reads is defined by EKitPollStrategy
+/// implementation set with EKitFirmware#set_poll_strategy():
+/// - EKitSpinPoll - reads status as fast as possible. The lowest latency, but bus is saturated with status reads.
+/// - EKitYieldPoll - relinquishes thread execution time between status reads.
+/// - EKitBackoffPoll - sleeps between status reads, every next delay is twice longer than previous one, but not longer
+///   than specified limit. This is the default strategy.
+/// - EKitPredictedPoll - sleeps for the expected command duration before the first status read, then continues as
+///   EKitBackoffPoll. Expected duration is either hint passed by virtual device with
+///   EKitFirmware#set_completion_hint(), or average duration of the previous commands of the same virtual device.
+///
+/// Every strategy collects per virtual device statistics (EKitPollStats) on number of the status reads required by commands.
+/// Remaining time of the operation timeout is passed to the strategy, no delay exceeds it.
+///
+
+/// \struct EKitPollStats
+/// \brief Poll statistics for a virtual device.
+struct EKitPollStats {
+    size_t commands;      ///< Number of waits for command completion.
+    size_t polls;         ///< Total number of status reads made while waiting.
+    size_t max_polls;     ///< Maximum number of status reads required by a single command.
+    size_t total_us;      ///< Total time spent waiting, in microseconds.
+    size_t max_us;        ///< Maximum time spent waiting for a single command, in microseconds.
+};
+
+/// \class EKitPollStrategy
+/// \brief Base class for poll strategies.
+/// \note Methods EKitPollStrategy#begin(), EKitPollStrategy#wait() and EKitPollStrategy#end() are called by
+///       EKitFirmware with bus locked.
+class EKitPollStrategy {
+    std::mutex stats_lock;                          ///< Guards #stats.
+    EKitPollStats stats[COMM_MAX_DEV_ADDR + 1];     ///< Statistics by virtual device id.
+
+protected:
+    /// \brief Sleeps, delay is limited by remaining time of the timeout.
+    /// \param us - delay in microseconds.
+    /// \param remaining_ms - remaining time of the timeout in milliseconds (EKitTimeout#remaining()), zero if there is
+    ///        no timeout.
+    static void sleep_us(uint32_t us, int remaining_ms);
+
+public:
+    /// \brief Constructor
+    EKitPollStrategy();
+
+    /// \brief Destructor (virtual)
+    virtual ~EKitPollStrategy();
+
+    /// \brief Called before the first status read.
+    /// \param dev_id - virtual device id.
+    /// \param hint_us - expected command duration in microseconds passed by virtual device, zero if unknown.
+    /// \param remaining_ms - remaining time of the timeout in milliseconds, zero if there is no timeout.
+    virtual void begin(int dev_id, uint32_t hint_us, int remaining_ms);
+
+    /// \brief Called after each status read that reported busy device, and before failed request is repeated.
+    ///        Implementation must wait before next status read, but not longer than remaining_ms.
+    /// \param dev_id - virtual device id.
+    /// \param attempt - number of status reads made so far (starts from 1).
+    /// \param yield - caller requests to relinquish thread execution time.
+    /// \param remaining_ms - remaining time of the timeout in milliseconds, zero if there is no timeout.
+    virtual void wait(int dev_id, size_t attempt, bool yield, int remaining_ms) = 0;
+
+    /// \brief Called when command is completed.
+    /// \param dev_id - virtual device id.
+    /// \param polls - number of the status reads made.
+    /// \param elapsed_us - time elapsed since EKitPollStrategy#begin(), in microseconds.
+    virtual void end(int dev_id, size_t polls, size_t elapsed_us);
+
+    /// \brief Returns statistics for the virtual device.
+    /// \param dev_id - virtual device id.
+    /// \return Copy of the statistics.
+    EKitPollStats get_stats(int dev_id);
+
+    /// \brief Resets statistics for all virtual devices.
+    void reset_stats();
+};
+
+/// \class EKitSpinPoll
+/// \brief Reads status without delays (yields if caller requests it).
+class EKitSpinPoll : public EKitPollStrategy {
+public:
+    /// \brief Implementation of the EKitPollStrategy#wait() virtual function.
+    void wait(int dev_id, size_t attempt, bool yield, int remaining_ms) override;
+};
+
+/// \class EKitYieldPoll
+/// \brief Relinquishes thread execution time between status reads.
+class EKitYieldPoll : public EKitPollStrategy {
+public:
+    /// \brief Implementation of the EKitPollStrategy#wait() virtual function.
+    void wait(int dev_id, size_t attempt, bool yield, int remaining_ms) override;
+};
+
+/// \class EKitBackoffPoll
+/// \brief Sleeps between status reads with exponentially growing delay.
+class EKitBackoffPoll : public EKitPollStrategy {
+    const uint32_t min_delay_us;    ///< Delay after the first status read, in microseconds.
+    const uint32_t max_delay_us;    ///< Maximum delay, in microseconds.
+
+public:
+    /// \brief Constructor
+    /// \param min_us - delay after the first status read, in microseconds.
+    /// \param max_us - maximum delay, in microseconds.
+    EKitBackoffPoll(uint32_t min_us, uint32_t max_us);
+
+    /// \brief Returns delay to be made after specified number of the status reads.
+    /// \param attempt - number of status reads made so far (starts from 1).
+    /// \return Delay in microseconds.
+    uint32_t delay_us(size_t attempt) const;
+
+    /// \brief Implementation of the EKitPollStrategy#wait() virtual function.
+    void wait(int dev_id, size_t attempt, bool yield, int remaining_ms) override;
+};
+
+/// \class EKitPredictedPoll
+/// \brief Sleeps for expected command duration (limited by maximum delay) before the first status read, then behaves
+///        as EKitBackoffPoll.
+class EKitPredictedPoll : public EKitBackoffPoll {
+    typedef EKitBackoffPoll super;  ///< Defines parent class
+
+    std::mutex predict_lock;                        ///< Guards #average_us.
+    uint32_t average_us[COMM_MAX_DEV_ADDR + 1];     ///< Moving average of the command duration by virtual device id.
+
+public:
+    /// \brief Constructor
+    /// \param min_us - delay after the first unsuccessful status read, in microseconds.
+    /// \param max_us - maximum delay, in microseconds.
+    EKitPredictedPoll(uint32_t min_us, uint32_t max_us);
+
+    /// \brief Returns expected command duration for the virtual device.
+    /// \param dev_id - virtual device id.
+    /// \return Expected duration in microseconds, zero if unknown.
+    uint32_t predicted_us(int dev_id);
+
+    /// \brief Implementation of the EKitPollStrategy#begin() virtual function.
+    void begin(int dev_id, uint32_t hint_us, int remaining_ms) override;
+
+    /// \brief Implementation of the EKitPollStrategy#end() virtual function.
+    void end(int dev_id, size_t polls, size_t elapsed_us) override;
+};
+
+/// @}
+/// @}
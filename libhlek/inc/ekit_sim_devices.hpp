@@ -0,0 +1,238 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Virtual device models for EKitSimFirmwareBus header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "ekit_sim_firmware.hpp"
+#include "adc_common.hpp"
+#include "timetrackerdev_common.hpp"
+#include "can_common.hpp"
+#include "spidac_common.hpp"
+#include "step_motor_common.hpp"
+
+/// \addtogroup group_communication_sim
+/// @{
+
+/// \class EKitSimADCDev
+/// \brief ADCDev model. Samples are produced by generator with period configured by #ADCDEV_CONFIGURE command, or
+///        with default sample rate if timer is not configured. Like firmware, sampling is stopped on overflow.
+class EKitSimADCDev final : public EKitSimDevice {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitSimDevice super;
+
+public:
+    /// \brief Generator of the measurements: returns value for the channel and sample index.
+    typedef std::function<uint16_t(size_t channel, uint64_t sample)> EKitSimADCGenerator;
+
+private:
+    const ADCConfig* config;            ///< ADCDev configuration.
+    const double default_rate;          ///< Sample rate used if timer is not configured.
+    EKitSimADCGenerator generator;      ///< Measurements generator.
+    uint16_t status;                    ///< Status flags (ADCDEV_STATUS_XXX).
+    uint16_t prescaller;                ///< Configured timer prescaller.
+    uint16_t period;                    ///< Configured timer period.
+    uint16_t samples_left;              ///< Number of samples left to be sampled.
+    uint64_t sample_index;              ///< Index of the next sample.
+    double next_sample_us;              ///< Simulated time of the next sample.
+
+    /// \brief Returns sampling period in microseconds.
+    double sample_period_us() const;
+
+    /// \brief Stops sampling.
+    void stop();
+
+public:
+    /// \brief Constructor.
+    /// \param cfg - ADCDev configuration.
+    /// \param sample_rate - sample rate in Hz used if timer is not configured.
+    EKitSimADCDev(const ADCConfig* cfg, double sample_rate);
+
+    /// \brief Destructor.
+    ~EKitSimADCDev() override;
+
+    /// \brief Sets measurements generator. Default generator produces saw tooth signal.
+    void set_generator(EKitSimADCGenerator gen);
+
+    void advance(uint64_t now) override;
+    uint8_t on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) override;
+    uint8_t on_sync(uint8_t cmd_byte, size_t length) override;
+};
+
+/// \class EKitSimTimeTrackerDev
+/// \brief TimeTrackerDev model. Events are generated with configured rate while device is started, timestamps are in
+///        ticks of TimeTrackerDevConfig#tick_freq.
+class EKitSimTimeTrackerDev final : public EKitSimDevice {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitSimDevice super;
+
+    const TimeTrackerDevConfig* config; ///< TimeTrackerDev configuration.
+    const double event_period_us;       ///< Period between events.
+    TimeTrackerStatus status;           ///< Current status.
+    double next_event_us;               ///< Simulated time of the next event.
+
+public:
+    /// \brief Constructor.
+    /// \param cfg - TimeTrackerDev configuration.
+    /// \param event_rate - event rate in Hz.
+    EKitSimTimeTrackerDev(const TimeTrackerDevConfig* cfg, double event_rate);
+
+    /// \brief Destructor.
+    ~EKitSimTimeTrackerDev() override;
+
+    void advance(uint64_t now) override;
+    uint8_t on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) override;
+    uint8_t on_sync(uint8_t cmd_byte, size_t length) override;
+};
+
+/// \class EKitSimCanDev
+/// \brief CanDev model. Messages are received with configured rate while device is started, sent messages are
+///        collected. Like firmware, device is stopped with #CAN_ERROR_OVERFLOW on overflow.
+class EKitSimCanDev final : public EKitSimDevice {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitSimDevice super;
+
+public:
+    /// \brief Generator of the received messages: fills message with the index.
+    typedef std::function<void(uint64_t index, CanRecvMessage& msg)> EKitSimCanGenerator;
+
+private:
+    const CANConfig* config;            ///< CanDev configuration.
+    const double message_period_us;     ///< Period between received messages.
+    EKitSimCanGenerator generator;      ///< Received messages generator.
+    CanStatus status;                   ///< Current status.
+    uint64_t message_index;             ///< Index of the next received message.
+    double next_message_us;             ///< Simulated time of the next received message.
+    std::vector<std::vector<uint8_t>> sent; ///< Sent messages (#CanSendCommand with data).
+
+public:
+    /// \brief Constructor.
+    /// \param cfg - CanDev configuration.
+    /// \param message_rate - rate of the received messages in Hz.
+    EKitSimCanDev(const CANConfig* cfg, double message_rate);
+
+    /// \brief Destructor.
+    ~EKitSimCanDev() override;
+
+    /// \brief Sets received messages generator. Default generator produces standard data frames with 8 data bytes.
+    void set_generator(EKitSimCanGenerator gen);
+
+    /// \brief Returns sent messages. Must not be called while bus is in use.
+    const std::vector<std::vector<uint8_t>>& get_sent() const {
+        return sent;
+    }
+
+    void advance(uint64_t now) override;
+    uint8_t on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) override;
+    uint8_t on_sync(uint8_t cmd_byte, size_t length) override;
+    uint8_t on_read_done(size_t length) override;
+};
+
+/// \class EKitSimSPIDACDev
+/// \brief SPIDACDev model. Uploaded samples are played with the configured timer period: channels are advanced by
+///        phase increments, sampling stops after the first period if started with #START_PERIOD.
+class EKitSimSPIDACDev final : public EKitSimDevice {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitSimDevice super;
+
+    const SPIDACConfig* config;         ///< SPIDACDev configuration.
+    const size_t sample_size;           ///< Size of the single channel sample in bytes.
+    std::vector<uint8_t> status_buffer; ///< #SPIDACStatus followed by channels sampling information.
+    SPIDACStatus* status;               ///< Points to status_buffer.
+    std::vector<uint8_t> samples;       ///< Uploaded samples.
+    std::vector<uint8_t> default_sample;///< Default samples.
+    std::vector<size_t> positions;      ///< Current sample of each channel.
+    bool continuous;                    ///< false if sampling stops after the first period.
+    uint64_t samples_sent;              ///< Number of samples sent to DACs.
+    double next_sample_us;              ///< Simulated time of the next sample.
+
+    /// \brief Returns sampling period in microseconds.
+    double sample_period_us() const;
+
+public:
+    /// \brief Constructor.
+    /// \param cfg - SPIDACDev configuration.
+    explicit EKitSimSPIDACDev(const SPIDACConfig* cfg);
+
+    /// \brief Destructor.
+    ~EKitSimSPIDACDev() override;
+
+    /// \brief Returns number of the samples sent to DACs. Must not be called while bus is in use.
+    uint64_t get_samples_sent() const {
+        return samples_sent;
+    }
+
+    void advance(uint64_t now) override;
+    uint8_t on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) override;
+};
+
+/// \class EKitSimStepMotorDev
+/// \brief StepMotorDev model. Motor commands are executed in simulated time: moves change position by microstep
+///        delta every step wait period, waits delay the next command. Device becomes idle when all the motor
+///        command buffers are executed.
+class EKitSimStepMotorDev final : public EKitSimDevice {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitSimDevice super;
+
+    /// \struct SimMotor
+    /// \brief State of the single motor.
+    struct SimMotor {
+        std::vector<uint8_t> commands;  ///< Motor command buffer.
+        size_t cmd_pos;                 ///< Offset of the next command.
+        uint64_t step_wait;             ///< Microseconds between steps.
+        uint64_t steps_left;            ///< Steps left of the current move.
+        double next_us;                 ///< Simulated time of the next step or command.
+    };
+
+    const StepMotorConfig* config;      ///< StepMotorDev configuration.
+    std::vector<SimMotor> motors;       ///< Motors.
+    std::vector<uint8_t> status_buffer; ///< #StepMotorDevStatus followed by motor statuses.
+    StepMotorDevStatus* status;         ///< Points to status_buffer.
+
+    /// \brief Resets motor to the default configuration.
+    void reset_motor(size_t mindex);
+
+    /// \brief Executes motor commands and steps up to the current simulated time.
+    void run_motor(size_t mindex);
+
+    /// \brief Makes steps of the current move up to the current simulated time.
+    void step_motor(size_t mindex);
+
+public:
+    /// \brief Constructor.
+    /// \param cfg - StepMotorDev configuration.
+    explicit EKitSimStepMotorDev(const StepMotorConfig* cfg);
+
+    /// \brief Destructor.
+    ~EKitSimStepMotorDev() override;
+
+    void advance(uint64_t now) override;
+    uint8_t on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) override;
+};
+
+/// @}
@@ -0,0 +1,337 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Simulated firmware bus header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ekit_error.hpp"
+#include "ekit_bus.hpp"
+#include "i2c_proto.h"
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_sim EKitSimFirmwareBus
+/// \brief In-process simulation of the firmware
+/// @{
+/// \page page_communication_sim
+/// \tableofcontents
+///
+/// \section sect_communication_sim_01 Simulated firmware bus
+///
+/// EKitSimFirmwareBus is a bus which behaves like I2C bus with the firmware connected: it implements firmware side of
+/// the communication protocol (see i2c_bus.c) in-process, so EKitFirmware and virtual device classes may be used
+/// without hardware:
+/// - written messages are parsed as #CommCommandHeader followed by data. Length mismatch and buffer overrun set
+///   #COMM_STATUS_FAIL, control sum mismatch sets #COMM_STATUS_CRC, messages shorter than #CommCommandHeader are
+///   synchronization requests. Frames with #COMM_CRC16_FLAG are checked by CRC-16 and switch simulation to CRC-16
+///   mode, like firmware does (see \ref sect_communication_details_02).
+/// - read messages start with #CommResponseHeader followed by data of the virtual device buffer; #COMM_BAD_BYTE is
+///   sent beyond available data, #COMM_STATUS_OVF is set if circular buffer is overflown.
+/// - accepted command, synchronization request and completed read set #COMM_STATUS_BUSY until virtual device model
+///   processes it; other commands are ignored while device is busy.
+///
+/// Virtual devices are simulated by models derived from EKitSimDevice, which are added by
+/// EKitSimFirmwareBus#add_device(). Models for ADCDev, TimeTrackerDev, CanDev, SPIDACDev and StepMotorDev are
+/// declared in ekit_sim_devices.hpp.
+///
+/// \code
+/// std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(I2C_FIRMWARE_ADDRESS, 512, false));
+/// sim->add_device(std::make_shared<EKitSimADCDev>(&adc_config_0, 1000.0));
+/// std::shared_ptr<EKitBus> firmware(new EKitFirmware(sim, I2C_FIRMWARE_ADDRESS));
+/// ADCDev adc(firmware, &adc_config_0);
+/// \endcode
+///
+/// \section sect_communication_sim_02 Simulated time
+///
+/// Models are driven by simulated time in microseconds which is updated before every bus message. In real time mode
+/// simulated time is a time elapsed since bus construction. Otherwise simulated time is advanced by duration of the
+/// bus messages (see EKitSimFirmwareBus#set_bus_speed()) and by explicit EKitSimFirmwareBus#advance_time() calls,
+/// which makes simulation deterministic. EKitSimFirmwareBus#set_command_latency() sets time virtual device stays
+/// busy after command is accepted.
+///
+
+/// \class EKitSimCircBuffer
+/// \brief Circular buffer used by virtual device models, mirrors firmware circular buffer (see circbuffer.h) in block
+///        mode: data is written by blocks, status bytes are read before data.
+class EKitSimCircBuffer final {
+    std::vector<uint8_t> buffer;    ///< Data storage.
+    std::vector<uint8_t> status;    ///< Status bytes, sent before data.
+    const size_t block_size;        ///< Size of the block.
+    size_t get_pos;                 ///< Offset of the first unread byte.
+    size_t data_len;                ///< Number of the unread bytes.
+    bool ovf;                       ///< Overflow flag.
+
+public:
+    /// \brief Constructor.
+    /// \param length - length of the buffer, it is truncated to be multiple of the block size.
+    /// \param bs - block size.
+    /// \param status_size - number of the status bytes.
+    EKitSimCircBuffer(size_t length, size_t bs, size_t status_size);
+
+    /// \brief Returns pointer to the status bytes.
+    uint8_t* get_status() {
+        return status.data();
+    }
+
+    /// \brief Returns size of the block.
+    size_t get_block_size() const {
+        return block_size;
+    }
+
+    /// \brief Returns number of the status bytes.
+    size_t get_status_size() const {
+        return status.size();
+    }
+
+    /// \brief Returns number of the unread data bytes.
+    size_t len() const {
+        return data_len;
+    }
+
+    /// \brief Returns number of the bytes available for read, including status bytes.
+    size_t total_len() const {
+        return data_len + status.size();
+    }
+
+    /// \brief Returns true if buffer has been overflown.
+    bool get_ovf() const {
+        return ovf;
+    }
+
+    /// \brief Clears overflow flag.
+    void clear_ovf() {
+        ovf = false;
+    }
+
+    /// \brief Drops all the data and clears overflow flag.
+    void reset();
+
+    /// \brief Reserves block for writing.
+    /// \return Pointer to the block, nullptr if buffer is full (overflow flag is set in this case).
+    uint8_t* reserve_block();
+
+    /// \brief Commits block reserved with EKitSimCircBuffer#reserve_block().
+    void commit_block();
+
+    /// \brief Copies bytes available for read: status bytes followed by data.
+    /// \param dst - destination buffer.
+    /// \param offset - offset of the first byte to copy.
+    /// \param length - number of the bytes to copy, offset + length must not exceed EKitSimCircBuffer#total_len().
+    void copy(uint8_t* dst, size_t offset, size_t length) const;
+
+    /// \brief Completes read: drops data read.
+    /// \param num_bytes - number of the bytes read, including status bytes.
+    void stop_read(size_t num_bytes);
+};
+
+/// \class EKitSimDevice
+/// \brief Base class for virtual device models. Like DeviceContext of the firmware, it exposes either circular buffer
+///        or linear buffer to be read by software, and callbacks for commands, synchronization requests and
+///        completed reads. All the methods are called by EKitSimFirmwareBus with its internal lock owned.
+class EKitSimDevice {
+    friend class EKitSimFirmwareBus;
+
+protected:
+    const uint8_t dev_id;                           ///< Virtual device id.
+    uint64_t now_us;                                ///< Simulated time of the last EKitSimDevice#advance() call.
+    std::unique_ptr<EKitSimCircBuffer> circ_buffer; ///< Circular buffer, nullptr if linear buffer is used.
+    const uint8_t* buffer;                          ///< Linear buffer, used if circ_buffer is nullptr.
+    size_t bytes_available;                         ///< Number of the bytes available in linear buffer.
+    bool stream_read;                               ///< true if streaming reads of the circular buffer are enabled,
+                                                    ///  mirrors tag_DeviceContext#i2c_stream_read.
+    const void* stream_status;                      ///< Optional source of the circular buffer status for streaming
+                                                    ///  reads, mirrors tag_DeviceContext#i2c_stream_status.
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitSimDevice(const EKitSimDevice&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitSimDevice& operator=(const EKitSimDevice&) = delete;
+
+    /// \brief Constructor.
+    /// \param id - virtual device id.
+    explicit EKitSimDevice(uint8_t id);
+
+    /// \brief Destructor (virtual)
+    virtual ~EKitSimDevice();
+
+    /// \brief Returns virtual device id.
+    uint8_t get_dev_id() const {
+        return dev_id;
+    }
+
+    /// \brief Advances simulated time, models generate data here. Overrides must call this method.
+    /// \param now - simulated time in microseconds, never decreases.
+    virtual void advance(uint64_t now);
+
+    /// \brief Called when command is received, mirrors tag_DeviceContext#on_command().
+    /// \param cmd_byte - command byte.
+    /// \param data - command data.
+    /// \param length - length of the command data.
+    /// \return Communication status: #COMM_STATUS_OK or combination of #COMM_STATUS_FAIL, #COMM_STATUS_OVF.
+    virtual uint8_t on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) = 0;
+
+    /// \brief Called when synchronization request is received, mirrors tag_DeviceContext#on_sync().
+    /// \param cmd_byte - command byte.
+    /// \param length - number of the bytes received.
+    /// \return Communication status.
+    virtual uint8_t on_sync(uint8_t cmd_byte, size_t length);
+
+    /// \brief Called when data is read by software, mirrors tag_DeviceContext#on_read_done(). Not called if streaming
+    ///        reads are enabled.
+    /// \param length - number of the bytes read (including status bytes of the circular buffer).
+    /// \return Communication status.
+    virtual uint8_t on_read_done(size_t length);
+};
+
+/// \class EKitSimFirmwareBus
+/// \brief I2C bus simulation with the firmware connected.
+class EKitSimFirmwareBus final : public EKitBus {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitBus super;
+
+    /// \enum SimCommand
+    /// \brief Type of the command waiting for processing, mirrors firmware command types.
+    enum SimCommand {
+        SIM_CMD_NONE = 0,
+        SIM_CMD_WRITE = 1,
+        SIM_CMD_READ = 2,
+        SIM_CMD_SYNC = 3,
+        SIM_CMD_BATCH = 4
+    };
+
+public:
+    static constexpr size_t default_comm_buffer_length = 512;   ///< Default length of the command buffer.
+    static constexpr uint32_t default_bus_speed = 100000;       ///< Default bus speed in Hz.
+
+private:
+    const int firmware_addr;                    ///< Address of the firmware.
+    const size_t comm_buffer_length;            ///< Length of the command buffer (COMM_BUFFER_LENGTH).
+    const bool realtime;                        ///< true if simulated time follows wall clock.
+    int address = -1;                           ///< Locked address.
+
+    std::mutex sim_lock;                        ///< Guards simulation state below.
+    std::shared_ptr<EKitSimDevice> devices[COMM_MAX_DEV_ADDR + 1]; ///< Virtual device models by id.
+    std::chrono::steady_clock::time_point start_time; ///< Time of the construction.
+    uint64_t sim_time_us = 0;                   ///< Simulated time, used if realtime is false.
+    uint64_t command_latency_us = 0;            ///< Time device stays busy after command is accepted.
+    uint32_t bus_speed = default_bus_speed;     ///< Bus speed used to calculate duration of the messages.
+
+    uint8_t comm_status = COMM_STATUS_OK;       ///< Communication status flags.
+    uint8_t device_id = 0;                      ///< Current virtual device id.
+    uint8_t crc = COMM_CRC_INIT_VALUE;          ///< Control sum of the last operation.
+    uint16_t crc16 = COMM_CRC16_INIT_VALUE;     ///< CRC-16 of the last operation.
+    bool crc16_mode = false;                    ///< true if the last accepted command had #COMM_CRC16_FLAG set.
+    bool crc16_support = true;                  ///< false to simulate firmware without CRC-16 support.
+    SimCommand cmd_type = SIM_CMD_NONE;         ///< Command waiting for processing.
+    uint64_t cmd_due_us = 0;                    ///< Simulated time when command is processed.
+    uint8_t cmd_byte = 0;                       ///< Command byte of the command waiting for processing.
+    size_t cmd_length = 0;                      ///< Data length (or number of read bytes) of the command.
+    std::vector<uint8_t> recv_buffer;           ///< Command data.
+    std::vector<uint8_t> message;               ///< Used to gather written segments.
+
+    /// \brief Returns current simulated time. Must be called with sim_lock owned.
+    uint64_t now();
+
+    /// \brief Advances models and processes command if it is due. Must be called with sim_lock owned.
+    void process(uint64_t t);
+
+    /// \brief Passes batch frame records to the models in order, mirrors i2c_dispatch_batch() of the firmware.
+    ///        Must be called with sim_lock owned.
+    /// \return Combination of the statuses returned by models, or #COMM_STATUS_FAIL if batch is malformed.
+    uint8_t dispatch_batch();
+
+    /// \brief Handles single written message. Must be called with sim_lock owned.
+    /// \param data - message data.
+    /// \param length - length of the message.
+    void receive(const uint8_t* data, size_t length);
+
+    /// \brief Handles single read message. Must be called with sim_lock owned.
+    /// \param segments - segments of the message.
+    /// \param count - number of the segments.
+    void transmit(EKitBusSegment* segments, size_t count);
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitSimFirmwareBus(const EKitSimFirmwareBus&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitSimFirmwareBus& operator=(const EKitSimFirmwareBus&) = delete;
+
+    /// \brief Constructor.
+    /// \param addr - address of the simulated firmware, messages to other addresses fail.
+    /// \param comm_buffer_len - length of the firmware command buffer.
+    /// \param rt - true if simulated time follows wall clock, false if it is advanced by bus messages and
+    ///        EKitSimFirmwareBus#advance_time() calls only.
+    EKitSimFirmwareBus(int addr, size_t comm_buffer_len = default_comm_buffer_length, bool rt = true);
+
+    /// \brief Destructor.
+    ~EKitSimFirmwareBus() override;
+
+    /// \brief Adds virtual device model.
+    /// \param dev - model, replaces model with the same virtual device id.
+    void add_device(std::shared_ptr<EKitSimDevice> dev);
+
+    /// \brief Advances simulated time. Has no effect in real time mode.
+    /// \param us - number of microseconds.
+    void advance_time(uint64_t us);
+
+    /// \brief Returns current simulated time in microseconds.
+    uint64_t get_time();
+
+    /// \brief Sets time virtual device stays busy after command, synchronization request or read is accepted.
+    /// \param us - latency in microseconds.
+    void set_command_latency(uint64_t us);
+
+    /// \brief Sets bus speed used to advance simulated time by duration of the messages (9 bit times per byte).
+    /// \param hz - bus speed in Hz, 0 if messages take no time.
+    void set_bus_speed(uint32_t hz);
+
+    /// \brief Enables or disables CRC-16 support. Without CRC-16 support #COMM_CRC16_FLAG is treated as a part of the
+    ///        length, like firmware built before CRC-16 framing does.
+    /// \param enable - true to support CRC-16 framing (default).
+    void set_crc16_support(bool enable);
+
+    // EKitBus interface implementation
+    EKIT_ERROR open(EKitTimeout& to) override;
+    EKIT_ERROR close() override;
+    EKIT_ERROR lock(EKitTimeout& to) override;
+    EKIT_ERROR lock(int addr, EKitTimeout& to) override;
+    EKIT_ERROR unlock() override;
+    EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override;
+    EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override;
+    EKIT_ERROR write(const void* ptr, size_t len, EKitTimeout& to) override;
+    EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) override;
+
+    /// \brief Executes segments, every message (segment and following continued segments) is handled by firmware
+    ///        as if it is terminated by STOP condition.
+    EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) override;
+};
+
+/// @}
+/// @}
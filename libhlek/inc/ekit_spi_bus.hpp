@@ -21,6 +21,7 @@
  */
 
 #pragma once
+#include <linux/spi/spidev.h>
 #include "ekit_bus.hpp"
 #include "ekit_error.hpp"
 
@@ -37,6 +38,60 @@
 ///
 /// EKitSPIBus implements EKitBus with SPI support.
 ///
+/// \section sect_communication_spi_impl_02 Batched transfers
+///
+/// Every EKitSPIBus#write_read() call is a separate system call. Sequences like command with subsequent data, or
+/// draining of the sensor FIFO, may be described with EKitSPITransaction and submitted to the kernel with a single
+/// EKitSPIBus#execute() call (SPI_IOC_MESSAGE(N) ioctl). Every segment of the transaction has it's own transmit and
+/// receive buffers (data is received directly into caller memory), chip select behaviour, delay and clock frequency.
+///
+/// Example:
+/// \code
+/// EKitSPITransaction trans;
+/// trans.add(cmd, nullptr, sizeof(cmd))                  // send command, ignore MISO
+///      .add(nullptr, data, sizeof(data), true, 5);     // read data, deselect device and wait 5us
+/// BusLocker blocker(spi_bus, to);
+/// EKIT_ERROR err = spi_bus->execute(trans, to);
+/// \endcode
+///
+/// EKitSPIBus#transaction() is implemented with the same single ioctl: write segments transmit data and ignore MISO,
+/// read segments transmit zeros, #BUS_SEGMENT_STOP deselects the device before the next segment.
+///
+
+/// \class EKitSPITransaction
+/// \brief Describes sequence of SPI transfers to be executed by single EKitSPIBus#execute() call.
+class EKitSPITransaction final {
+    friend class EKitSPIBus;
+
+    std::vector<struct spi_ioc_transfer> transfers; ///< Transfers in the kernel format.
+
+public:
+    /// \brief Maximum number of the transfers in the single transaction (limited by ioctl request size).
+    static constexpr size_t max_transfers = ((1 << _IOC_SIZEBITS) - 1) / sizeof(struct spi_ioc_transfer);
+
+    /// \brief Adds transfer (segment) to the transaction.
+    /// \param tx - data to be transmitted, nullptr to transmit zeros.
+    /// \param rx - memory to receive data into, nullptr to ignore received data. May be the same as tx.
+    /// \param len - length of the transfer in bytes.
+    /// \param cs_change - true to deselect device after this transfer (for the last transfer of the transaction: true
+    ///        to keep device selected after transaction).
+    /// \param delay_us - delay after transfer in microseconds (before chip select is changed, if it is).
+    /// \param speed_hz - clock frequency for this transfer, 0 to use bus frequency (EKitSPIBus#SPI_OPT_CLOCK_FREQUENCY).
+    /// \return Reference to this object to chain calls.
+    /// \note Buffers must stay valid until transaction is executed.
+    EKitSPITransaction& add(const void* tx,
+                            void* rx,
+                            size_t len,
+                            bool cs_change = false,
+                            uint16_t delay_us = 0,
+                            uint32_t speed_hz = 0);
+
+    /// \brief Removes all transfers. Reserved memory is kept, so transaction object may be reused without allocations.
+    void clear();
+
+    /// \brief Returns number of the transfers in the transaction.
+    size_t size() const;
+};
 
 /// \class EKitSPIBus
 /// \brief Direct (w/o firmware) SPI bus implementation
@@ -72,6 +127,9 @@ class EKitSPIBus final : public EKitBus {
     /// Specifies when CS must change (deselect device) after SPI transaction.
     bool cs_change = false;
 
+    /// Transaction used by EKitSPIBus#transaction(), reused to avoid memory allocations.
+    EKitSPITransaction segment_trans;
+
     /// \brief  Helper function for opening spi bus descriptor.
     /// \return Corresponding EKIT_ERROR error code.
     EKIT_ERROR open_internal(EKitTimeout& to);
@@ -79,6 +137,14 @@ class EKitSPIBus final : public EKitBus {
     /// \brief Performs SPI read/write operation
     /// \return Corresponding EKIT_ERROR error code.
     EKIT_ERROR spi_read_write(void* buffer, size_t len, EKitTimeout& to);
+
+    /// \brief Submits transfers to the kernel by single SPI_IOC_MESSAGE(N) ioctl.
+    /// \param xfr - pointer to array of transfers.
+    /// \param count - number of the transfers, must not exceed EKitSPITransaction#max_transfers.
+    /// \param to - timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code, #EKIT_TIMEOUT if timeout expires while request is restarted.
+    EKIT_ERROR spi_message(struct spi_ioc_transfer* xfr, size_t count, EKitTimeout& to);
+
     EKIT_ERROR spi_update_mode(EKitTimeout& to);
     EKIT_ERROR spi_update_frequency(EKitTimeout& to);
     EKIT_ERROR spi_update_word_size(EKitTimeout& to);
@@ -188,6 +254,23 @@ class EKitSPIBus final : public EKitBus {
                          size_t rlen,
                          EKitTimeout& to) override;
 
+    /// \brief Implementation of the EKitBus#transaction() virtual function.
+    /// \param segments - array of the segments to be executed in order.
+    /// \param count - number of elements in segments array.
+    /// \param to - reference to timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code.
+    /// \note All segments are submitted by single ioctl. Device is deselected after segments with #BUS_SEGMENT_STOP
+    ///       flag and at the end of transaction.
+    EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) override;
+
+    /// \brief Executes SPI transaction by single system call.
+    /// \param trans - transaction to be executed.
+    /// \param to - reference to timeout counting object.
+    /// \return Corresponding EKIT_ERROR error code, #EKIT_OVERFLOW if transaction has more than
+    ///         EKitSPITransaction#max_transfers transfers.
+    /// \note Bus must be locked. Data received by transaction is not available via EKitSPIBus#read().
+    EKIT_ERROR execute(EKitSPITransaction& trans, EKitTimeout& to);
+
     /// \brief Implementation of the EKitBus#set_opt() virtual function.
     /// \param opt - bus specific option. Must be one of the #EKitSPIOptions
     /// values. \param value - bus specific option value. \return Corresponding
@@ -0,0 +1,318 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus trace recorder and replay bus header
+ *   \author Oleh Sharuda
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "ekit_error.hpp"
+#include "ekit_bus.hpp"
+
+/// \addtogroup group_communication
+/// @{
+
+/// \defgroup group_communication_trace EKitTraceBus and EKitReplayBus
+/// \brief Recording of the bus traffic and it's deterministic replay
+/// @{
+/// \page page_communication_trace
+/// \tableofcontents
+///
+/// \section sect_communication_trace_01 Recording bus traffic
+///
+/// EKitTraceBus wraps any bus and passes all the calls to it, recording every call (lock, unlock, open, close,
+/// suspend, resume, set_opt, get_opt, write, read, read_all, write_read, transaction) into binary trace file. Every
+/// record contains monotonic time since the trace start, duration of the call, arguments, data written or read and
+/// returned error code.
+///
+/// Virtual devices require EKitFirmware bus, so in order to record their traffic wrap the bus which is passed to
+/// EKitFirmware:
+/// \code
+/// std::shared_ptr<EKitBus> i2c(new EKitI2CBus("/dev/i2c-1"));
+/// std::shared_ptr<EKitBus> trace(new EKitTraceBus(i2c, "session.ektrace"));
+/// std::shared_ptr<EKitBus> firmware(new EKitFirmware(trace, 0x5A));
+/// \endcode
+///
+/// \section sect_communication_trace_02 Replaying bus traffic
+///
+/// EKitReplayBus loads trace file and serves recorded responses in the same order: read operations return recorded
+/// data, every operation returns recorded error code. Replay is done at full speed by default, optionally recorded
+/// call durations may be reproduced. If sequence of calls differs from the recorded one, #EKIT_PROTOCOL is returned;
+/// if trace is over, #EKIT_NO_DATA is returned. Differences in written data don't break replay, they are counted
+/// (see EKitReplayBus#get_mismatches()).
+///
+/// Replay is deterministic if the same sequence of the bus calls is made. Several threads working with the same bus
+/// are ordered by bus lock, but order of threads may differ from the recorded one.
+///
+/// \section sect_communication_trace_03 Trace file format
+///
+/// Trace file starts with #EKitTraceHeader and followed by records. Each record is #EKitTraceRecord followed by
+/// EKitTraceRecord#length bytes of data. All values are in host byte order.
+///
+/// | Operation                  | arg                  | value          | data                                       |
+/// |----------------------------|----------------------|----------------|--------------------------------------------|
+/// | #TRACE_OP_LOCK             | -                    | -              | -                                          |
+/// | #TRACE_OP_LOCK_ADDR        | address              | -              | -                                          |
+/// | #TRACE_OP_UNLOCK           | -                    | -              | -                                          |
+/// | #TRACE_OP_OPEN, #TRACE_OP_CLOSE, #TRACE_OP_SUSPEND, #TRACE_OP_RESUME | - | -        | -                                          |
+/// | #TRACE_OP_SET_OPT, #TRACE_OP_GET_OPT | option     | option value   | -                                          |
+/// | #TRACE_OP_WRITE            | -                    | -              | written data                               |
+/// | #TRACE_OP_READ, #TRACE_OP_READ_ALL | -            | -              | read data                                  |
+/// | #TRACE_OP_WRITE_READ       | length of write data | -              | written data followed by read data         |
+/// | #TRACE_OP_TRANSACTION      | number of segments   | -              | for each segment: flags (1 byte), length (4 bytes), segment data |
+///
+
+/// \enum EKitTraceOp
+/// \brief Bus operations recorded in trace.
+enum EKitTraceOp : uint8_t {
+    TRACE_OP_LOCK        = 1,   ///< EKitBus#lock(EKitTimeout&)
+    TRACE_OP_LOCK_ADDR   = 2,   ///< EKitBus#lock(int, EKitTimeout&)
+    TRACE_OP_UNLOCK      = 3,   ///< EKitBus#unlock()
+    TRACE_OP_OPEN        = 4,   ///< EKitBus#open()
+    TRACE_OP_CLOSE       = 5,   ///< EKitBus#close()
+    TRACE_OP_SUSPEND     = 6,   ///< EKitBus#suspend()
+    TRACE_OP_RESUME      = 7,   ///< EKitBus#resume()
+    TRACE_OP_SET_OPT     = 8,   ///< EKitBus#set_opt()
+    TRACE_OP_GET_OPT     = 9,   ///< EKitBus#get_opt()
+    TRACE_OP_WRITE       = 10,  ///< EKitBus#write()
+    TRACE_OP_READ        = 11,  ///< EKitBus#read()
+    TRACE_OP_READ_ALL    = 12,  ///< EKitBus#read_all()
+    TRACE_OP_WRITE_READ  = 13,  ///< EKitBus#write_read()
+    TRACE_OP_TRANSACTION = 14,  ///< EKitBus#transaction()
+    TRACE_OP_MAX         = TRACE_OP_TRANSACTION
+};
+
+#pragma pack(push, 1)
+/// \struct EKitTraceHeader
+/// \brief Trace file header.
+struct EKitTraceHeader {
+    char     magic[4];      ///< Must be "EKTR".
+    uint16_t version;       ///< Trace file format version.
+    uint8_t  bus_type;      ///< Type of the recorded bus, one of the #EKitBusType values.
+    uint8_t  reserved;      ///< Reserved, zero.
+};
+
+/// \struct EKitTraceRecord
+/// \brief Trace record header.
+struct EKitTraceRecord {
+    uint64_t timestamp_ns;  ///< Start of the call in nanoseconds since trace start (monotonic clock).
+    uint64_t duration_ns;   ///< Duration of the call in nanoseconds.
+    uint8_t  op;            ///< Operation, one of the #EKitTraceOp values.
+    int32_t  result;        ///< Returned EKIT_ERROR code.
+    int32_t  arg;           ///< Operation specific argument.
+    int32_t  value;         ///< Operation specific value.
+    uint32_t length;        ///< Length of the data following this header.
+};
+#pragma pack(pop)
+
+/// \class EKitTraceBus
+/// \brief Bus decorator which records all the calls to the wrapped bus into trace file.
+class EKitTraceBus final : public EKitBus {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitBus super;
+
+public:
+    static constexpr const char* trace_magic = "EKTR";  ///< Trace file magic.
+    static constexpr uint16_t trace_version = 2;        ///< Trace file format version.
+
+private:
+    static constexpr size_t flush_threshold = 65536;    ///< Buffered data is written to file when exceeds this size.
+
+    std::shared_ptr<EKitBus> bus;                       ///< Wrapped bus.
+    int trace_descriptor;                               ///< Trace file descriptor.
+    std::mutex trace_lock;                              ///< Guards trace buffer and file.
+    std::vector<uint8_t> trace_buffer;                  ///< Records not written to file yet.
+    std::vector<uint8_t> segment_data;                  ///< Used to prepare data of #TRACE_OP_TRANSACTION records.
+    EKIT_ERROR trace_error;                             ///< First error occurred during writing trace file.
+    std::chrono::steady_clock::time_point trace_start;  ///< Time of the trace start.
+
+    /// \brief Appends record to the trace. Must be called with trace_lock owned.
+    /// \param op - operation, one of the #EKitTraceOp values.
+    /// \param start - time when call has been started.
+    /// \param result - returned error code.
+    /// \param arg - operation specific argument.
+    /// \param value - operation specific value.
+    /// \param data1 - first part of the record data.
+    /// \param len1 - length of the first part of the record data.
+    /// \param data2 - second part of the record data.
+    /// \param len2 - length of the second part of the record data.
+    void append_record(uint8_t op,
+                       std::chrono::steady_clock::time_point start,
+                       EKIT_ERROR result,
+                       int32_t arg = 0,
+                       int32_t value = 0,
+                       const void* data1 = nullptr,
+                       size_t len1 = 0,
+                       const void* data2 = nullptr,
+                       size_t len2 = 0);
+
+    /// \brief Writes buffered records to file. Must be called with trace_lock owned.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR flush_internal();
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitTraceBus(const EKitTraceBus&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitTraceBus& operator=(const EKitTraceBus&) = delete;
+
+    /// \brief Constructor.
+    /// \param ebus - bus to be wrapped.
+    /// \param file_name - name of the trace file, existing file is overwritten.
+    /// \throw EKitException if trace file may not be created.
+    EKitTraceBus(std::shared_ptr<EKitBus> ebus, const std::string& file_name);
+
+    /// \brief Destructor. Writes buffered records and closes trace file.
+    ~EKitTraceBus() override;
+
+    /// \brief Writes buffered records to the trace file.
+    /// \return Corresponding EKIT_ERROR error code, the first error occurred during writing trace file, if any.
+    EKIT_ERROR flush();
+
+    /// \brief Returns wrapped bus.
+    /// \return Shared pointer to the wrapped bus.
+    std::shared_ptr<EKitBus> get_bus() const;
+
+    // EKitBus interface implementation: calls are passed to the wrapped bus and recorded.
+    EKIT_ERROR open(EKitTimeout& to) override;
+    EKIT_ERROR close() override;
+    EKIT_ERROR lock(EKitTimeout& to) override;
+    EKIT_ERROR lock(int addr, EKitTimeout& to) override;
+    EKIT_ERROR unlock() override;
+    EKIT_ERROR suspend(EKitTimeout& to) override;
+    EKIT_ERROR resume(EKitTimeout& to) override;
+    EKIT_ERROR set_opt(int opt, int value, EKitTimeout& to) override;
+    EKIT_ERROR get_opt(int opt, int& value, EKitTimeout& to) override;
+    EKIT_ERROR write(const void* ptr, size_t len, EKitTimeout& to) override;
+    EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override;
+    EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override;
+    EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) override;
+    EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) override;
+};
+
+/// \class EKitReplayBus
+/// \brief Bus which serves responses recorded by EKitTraceBus.
+class EKitReplayBus final : public EKitBus {
+    /// \typedef super
+    /// \brief Defines parent class
+    typedef EKitBus super;
+
+    std::vector<uint8_t> trace;         ///< Content of the trace file.
+    std::vector<size_t> records;        ///< Offsets of the records in trace.
+    size_t cursor;                      ///< Index of the next record to be replayed.
+    size_t mismatches;                  ///< Number of differences in written data.
+    bool realtime;                      ///< true if recorded durations are reproduced.
+    std::mutex replay_lock;             ///< Guards replay state.
+
+    /// \brief Loads trace file.
+    /// \param file_name - name of the trace file.
+    /// \return Content of the trace file.
+    /// \throw EKitException if file may not be read.
+    static std::vector<uint8_t> load_trace(const std::string& file_name);
+
+    /// \brief Validates trace header.
+    /// \param data - content of the trace file.
+    /// \return Type of the recorded bus.
+    /// \throw EKitException if trace header is not valid.
+    static EKitBusType trace_bus_type(const std::vector<uint8_t>& data);
+
+    /// \brief Constructor, used by public one.
+    /// \param data - content of the trace file.
+    /// \param rt - true to reproduce recorded durations.
+    EKitReplayBus(std::vector<uint8_t>&& data, bool rt);
+
+    /// \brief Takes the next record, must be called with replay_lock owned.
+    /// \param op - expected operation, one of the #EKitTraceOp values.
+    /// \param rec - pointer to the record header in trace.
+    /// \param data - pointer to the record data in trace.
+    /// \return #EKIT_OK if record is taken, #EKIT_NO_DATA if trace is over, #EKIT_PROTOCOL if next record describes
+    ///         another operation.
+    EKIT_ERROR next_record(uint8_t op, const EKitTraceRecord*& rec, const uint8_t*& data);
+
+    /// \brief Compares written data with recorded one, must be called with replay_lock owned.
+    /// \param expected - recorded data.
+    /// \param actual - written data.
+    /// \param len - length of data.
+    void compare(const void* expected, const void* actual, size_t len);
+
+    /// \brief Replays operations without data.
+    /// \param op - operation, one of the #EKitTraceOp values.
+    /// \param arg - expected argument of the operation.
+    /// \return Recorded error code, or #EKIT_NO_DATA/#EKIT_PROTOCOL (see next_record()).
+    EKIT_ERROR replay_simple(uint8_t op, int32_t arg = 0);
+
+    /// \brief Takes bus lock, waits no longer than timeout.
+    /// \param site - call site to be reported by lock order verifier (see EKitBus#lock_bus()).
+    /// \param to - timeout counting object.
+    /// \return #EKIT_OK if bus lock is taken, otherwise #EKIT_TIMEOUT.
+    EKIT_ERROR take_bus_lock(const void* site, EKitTimeout& to);
+
+public:
+    /// \brief Copy construction is forbidden
+    EKitReplayBus(const EKitReplayBus&) = delete;
+
+    /// \brief Assignment is forbidden
+    EKitReplayBus& operator=(const EKitReplayBus&) = delete;
+
+    /// \brief Constructor.
+    /// \param file_name - name of the trace file written by EKitTraceBus.
+    /// \param rt - true to reproduce recorded call durations, false to replay at full speed.
+    /// \throw EKitException if trace file may not be read or is not valid.
+    explicit EKitReplayBus(const std::string& file_name, bool rt = false);
+
+    /// \brief Destructor (virtual)
+    ~EKitReplayBus() override;
+
+    /// \brief Returns number of the records which are not replayed yet.
+    size_t remaining();
+
+    /// \brief Returns number of written data blocks (or option values) which differ from recorded.
+    size_t get_mismatches();
+
+    /// \brief Returns total recorded duration of the operation.
+    /// \param op - operation, one of the #EKitTraceOp values.
+    /// \return Sum of the durations of all the recorded calls of the operation in nanoseconds.
+    uint64_t get_recorded_time(uint8_t op);
+
+    // EKitBus interface implementation: calls are replayed from the trace.
+    EKIT_ERROR open(EKitTimeout& to) override;
+    EKIT_ERROR close() override;
+    EKIT_ERROR lock(EKitTimeout& to) override;
+    EKIT_ERROR lock(int addr, EKitTimeout& to) override;
+    EKIT_ERROR unlock() override;
+    EKIT_ERROR suspend(EKitTimeout& to) override;
+    EKIT_ERROR resume(EKitTimeout& to) override;
+    EKIT_ERROR set_opt(int opt, int value, EKitTimeout& to) override;
+    EKIT_ERROR get_opt(int opt, int& value, EKitTimeout& to) override;
+    EKIT_ERROR write(const void* ptr, size_t len, EKitTimeout& to) override;
+    EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override;
+    EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override;
+    EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) override;
+    EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) override;
+};
+
+/// @}
+/// @}
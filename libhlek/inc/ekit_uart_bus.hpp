@@ -21,6 +21,9 @@
  */
 
 #pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "ekit_bus.hpp"
 #include "ekit_error.hpp"
 
@@ -37,6 +40,12 @@
 ///
 /// EKitUARTBus implements EKitBus with UART support.
 ///
+/// Serial port is opened in non-blocking raw mode, port parameters are set with EKitUARTBus#set_opt() (see
+/// #EKitUARTBus::EKitUARTOptions). Once bus is opened, internal reader thread waits for incoming data with epoll() and
+/// stores it into internal circular buffer, so EKitUARTBus#read() and EKitUARTBus#read_all() take data from this
+/// buffer without system calls. If buffer is full, the oldest data is discarded and the next read reports
+/// #EKIT_OVERFLOW.
+///
 
 /// \class EKitUARTBus
 /// \brief Direct (w/o firmware) UART bus implementation
@@ -47,13 +56,71 @@ class EKitUARTBus final : public EKitBus {
 
     std::string bus_name;  ///< Name of the bus.
     int uart_descriptor;   ///< UART bus descriptor.
+    int epoll_descriptor;  ///< epoll descriptor used by reader thread.
+    int stop_descriptor;   ///< eventfd descriptor used to stop reader thread.
+
+    int baud_rate;         ///< Baud rate.
+    int data_bits;         ///< Number of data bits.
+    int parity;            ///< Parity, one of the #EKitUARTParity values.
+    int stop_bits;         ///< Number of stop bits.
+    int flow_control;      ///< Flow control, one of the #EKitUARTFlowControl values.
+
+    std::thread reader_thread;              ///< Reader thread.
+    std::mutex rx_lock;                     ///< Guards receive buffer and reader state.
+    std::condition_variable rx_cond;        ///< Signalled when data is received or reader thread stops.
+    std::vector<uint8_t> rx_buffer;         ///< Receive circular buffer.
+    size_t rx_head;                         ///< Index of the oldest byte in receive buffer.
+    size_t rx_count;                        ///< Number of bytes in receive buffer.
+    bool rx_overflow;                       ///< true if data was discarded since last read.
+    EKIT_ERROR rx_error;                    ///< Error which stopped reader thread, EKIT_OK if running.
 
     /// \brief  Helper function for opening uart bus descriptor.
     /// \return Corresponding EKIT_ERROR error code.
     EKIT_ERROR open_internal(EKitTimeout& to);
 
+    /// \brief  Helper function for closing uart bus descriptor, stops reader thread.
+    void close_internal();
+
+    /// \brief  Applies port parameters to opened descriptor.
+    /// \return Corresponding EKIT_ERROR error code.
+    EKIT_ERROR apply_termios();
+
+    /// \brief Reader thread function.
+    void reader_func();
+
+    /// \brief Takes data from receive buffer. Must be called with rx_lock owned.
+    /// \param ptr - memory to copy data to.
+    /// \param len - number of bytes to take, must not exceed number of bytes in the buffer.
+    void rx_take(uint8_t* ptr, size_t len);
+
    public:
-    enum EKitUARTOptions : uint8_t { UART_TO_BE_IMPLEMENTED___ = 0xff };
+    /// \enum EKitUARTOptions
+    /// \brief Options for EKitUARTBus#set_opt() and EKitUARTBus#get_opt().
+    enum EKitUARTOptions : uint8_t {
+        UART_OPT_BAUD_RATE    = 0,  ///< Baud rate, one of the standard rates (9600, 115200, ...). Default is 115200.
+        UART_OPT_DATA_BITS    = 1,  ///< Number of data bits: 5, 6, 7 or 8. Default is 8.
+        UART_OPT_PARITY       = 2,  ///< Parity, one of the #EKitUARTParity values. Default is #UART_PARITY_NONE.
+        UART_OPT_STOP_BITS    = 3,  ///< Number of stop bits: 1 or 2. Default is 1.
+        UART_OPT_FLOW_CONTROL = 4   ///< Flow control, one of the #EKitUARTFlowControl values. Default is #UART_FLOW_NONE.
+    };
+
+    /// \enum EKitUARTParity
+    /// \brief Parity values for #UART_OPT_PARITY option.
+    enum EKitUARTParity : uint8_t {
+        UART_PARITY_NONE = 0,       ///< No parity.
+        UART_PARITY_ODD  = 1,       ///< Odd parity.
+        UART_PARITY_EVEN = 2        ///< Even parity.
+    };
+
+    /// \enum EKitUARTFlowControl
+    /// \brief Flow control values for #UART_OPT_FLOW_CONTROL option.
+    enum EKitUARTFlowControl : uint8_t {
+        UART_FLOW_NONE    = 0,      ///< No flow control.
+        UART_FLOW_RTSCTS  = 1,      ///< Hardware (RTS/CTS) flow control.
+        UART_FLOW_XONXOFF = 2       ///< Software (XON/XOFF) flow control.
+    };
+
+    static constexpr size_t default_rx_buffer_size = 4096; ///< Default size of the receive buffer.
 
     /// \brief Copy construction is forbidden
     EKitUARTBus(const EKitBus&) = delete;
@@ -63,7 +130,8 @@ class EKitUARTBus final : public EKitBus {
 
     /// \brief Constructor
     /// \param file_name - device file name.
-    explicit EKitUARTBus(const std::string& file_name);
+    /// \param rx_size - size of the receive buffer.
+    explicit EKitUARTBus(const std::string& file_name, size_t rx_size = default_rx_buffer_size);
 
     /// \brief Destructor (virtual)
     /// \note Important note: Destructor may need to lock bus to terminate communication;
@@ -90,18 +158,21 @@ class EKitUARTBus final : public EKitBus {
     /// \brief Implementation of the EKitBus#read() virtual function.
     /// \param ptr - pointer to the memory block.
     /// \param len - length of the memory block.
-    /// \return Corresponding EKIT_ERROR error code.
+    /// \return Corresponding EKIT_ERROR error code. Waits until len bytes are received, #EKIT_TIMEOUT is returned
+    ///         if timeout expires before.
     EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override;
 
     /// \brief Implementation of the EKitBus#read_all() virtual function.
     /// \param buffer - Reference to a vector that will receive data from a bus.
     /// \return Corresponding EKIT_ERROR error code.
+    /// \note Doesn't wait for data, buffer is empty if nothing is received.
     EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override;
 
     /// \brief Implementation of the EKitBus#write() virtual function.
     /// \param ptr - pointer to the memory block.
     /// \param len - length of the memory block.
-    /// \return Corresponding EKIT_ERROR error code.
+    /// \return Corresponding EKIT_ERROR error code. #EKIT_TIMEOUT is returned if timeout expires before all the data
+    ///         is passed to the driver.
     EKIT_ERROR write(const void* ptr, size_t len, EKitTimeout& to) override;
 
     /// \brief Does write and read by single operation, the first write with
@@ -122,15 +193,16 @@ class EKitUARTBus final : public EKitBus {
                          EKitTimeout& to) override;
 
     /// \brief Implementation of the EKitBus#set_opt() virtual function.
-    /// \param opt - bus specific option. Must be one of the #EKitUARTOptions
-    /// values. \param value - bus specific option value. \return Corresponding
-    /// EKIT_ERROR error code.
+    /// \param opt - bus specific option. Must be one of the #EKitUARTOptions values.
+    /// \param value - bus specific option value.
+    /// \return Corresponding EKIT_ERROR error code.
+    /// \note Options may be set before bus is opened, they are applied when port is opened.
     EKIT_ERROR set_opt(int opt, int value, EKitTimeout& to) override;
 
     /// \brief Implementation of the EKitBus#get_opt() virtual function.
-    /// \param opt - bus specific option. Must be one of the #EKitUARTOptions
-    /// values. \param value - reference to bus specific option value. \return
-    /// Corresponding EKIT_ERROR error code.
+    /// \param opt - bus specific option. Must be one of the #EKitUARTOptions values.
+    /// \param value - reference to bus specific option value.
+    /// \return Corresponding EKIT_ERROR error code.
     EKIT_ERROR get_opt(int opt, int& value, EKitTimeout& to) override;
 };
 
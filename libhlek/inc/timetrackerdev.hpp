@@ -23,6 +23,7 @@
 #pragma once
 
 #include <map>
+#include <functional>
 #include "ekit_device.hpp"
 #include "timetrackerdev_common.hpp"
 
@@ -117,6 +118,19 @@ private:
     /// \param to - timeout counting object
     /// \param ovf - output parameter. If true, overflow has occurred, otherwise false.
     void get_priv(size_t count, EKitTimeout& to, bool& ovf);
+
+    /// \brief Read status and as many timestamps as possible from device into internal buffer by single streaming read
+    ///        (see EKitFirmware#read_stream()). Read timestamps are removed from device buffer.
+    /// \param to - timeout counting object
+    /// \param ovf - output parameter. If true, overflow has occurred, otherwise false.
+    /// \return number of timestamps read.
+    size_t stream_priv(EKitTimeout& to, bool& ovf);
+
+    /// \brief Reads all data from the device by streaming reads.
+    /// \param cb - callback called for each chunk of timestamps read, parameters are: start point (first timestamp
+    ///        since reset if relative, otherwise 0) and number of timestamps in internal data buffer.
+    /// \param relative - if true, start point is the first timestamp since reset.
+    void read_all_priv(const std::function<void(uint64_t start_point, size_t n)>& cb, bool relative);
 };
 
 /// @}
@@ -29,6 +29,8 @@
 #include <functional>
 #include <vector>
 #include <set>
+#include <atomic>
+#include <unordered_map>
 #include <cstdarg>
 #include <regex>
 #include <thread>
@@ -69,50 +71,93 @@ namespace tools {
 
 #ifndef NDEBUG
 
+	/// \struct MutexEntry
+	/// \brief Mutex entry structure for @ref GlobalMutexVerifier and @ref TLSMutexVerifier classes.
+	struct MutexEntry{
+		uint32_t id;        ///< Identifier of the mutex (see GlobalMutexVerifier#new_mutex())
+		const void* site;   ///< Call site: code address the mutex is locked from
+	};
+
     /// \class GlobalMutexVerifier
-    /// \brief This class is used to track possible deadlock conditions. It's not implemented, just dummy methods are added.
-    ///        Must be implemented in future because it is very useful thing.
+    /// \brief This class is used to track possible deadlock conditions.
+    /// \details Lock order graph is maintained: edge A->B is added when mutex B is locked by the thread which already
+    ///          owns mutex A. If new edge closes a cycle, two threads may deadlock; this is reported regardless
+    ///          whether deadlock actually happened or not. The graph is searched only when a new edge appears, locks
+    ///          in already known order cost single hash lookup, locks with no other mutex owned are not tracked
+    ///          globally at all. Mutexes are identified by call sites (return addresses), backtrace is captured only
+    ///          when violation is reported.
 	class GlobalMutexVerifier final {
-	public:		
+	public:
+	    /// \typedef ViolationHandler
+	    /// \brief Function to be called with violation report.
+		typedef std::function<void(const std::string&)> ViolationHandler;
+
+	private:
+	    /// \struct Edge
+	    /// \brief Lock order graph edge, keeps call sites where order was seen first time.
+		struct Edge {
+			const void* from_site;  ///< Call site of the mutex owned
+			const void* to_site;    ///< Call site of the mutex being locked
+		};
+
+		std::mutex graph_lock;                                              ///< Guards all the members below
+		std::unordered_map<uint64_t, Edge> edges;                           ///< Edges by (from << 32 | to) key
+		std::unordered_map<uint32_t, std::vector<uint32_t>> successors;     ///< Adjacency lists: from -> to
+		std::unordered_map<uint32_t, std::vector<uint32_t>> predecessors;   ///< Adjacency lists: to -> from
+		std::atomic<uint32_t> next_id;                                      ///< Next mutex identifier
+		size_t violations;                                                  ///< Number of the violations reported
+		ViolationHandler handler;                                           ///< Violation handler
+
+		/// \brief Makes edge key
+		static uint64_t edge_key(uint32_t from, uint32_t to) {
+			return (static_cast<uint64_t>(from) << 32) | to;
+		}
+
+		/// \brief Looks for a path in lock order graph (graph_lock must be owned).
+		/// \param from - first mutex of the path
+		/// \param to - last mutex of the path
+		/// \param path - receives the path if found (from ... to)
+		/// \return true if path is found, otherwise false.
+		bool find_path(uint32_t from, uint32_t to, std::vector<uint32_t>& path);
+
+		/// \brief Passes report to the violation handler (graph_lock must not be owned).
+		/// \param report - violation description
+		void report_violation(const std::string& report);
+
+	public:
 		GlobalMutexVerifier();
-		~GlobalMutexVerifier();		
+		~GlobalMutexVerifier();
+
+		/// \brief Returns global verifier instance.
+		static GlobalMutexVerifier& instance();
 
 		/// \brief Call to register and track new mutex.
-		/// \param nh - native object handle for the mutex to be tracked
-		/// \param where - backtrace of the code created this mutex
-		void new_mutex(std::mutex::native_handle_type nh, const std::string& where);
+		/// \return Identifier assigned to the mutex.
+		uint32_t new_mutex();
 
         /// \brief Call to deregister and to stop tracking mutex.
-        /// \param nh - native object handle for the mutex to be tracked
-        /// \param where - backtrace of the code created this mutex
-		void delete_mutex(std::mutex::native_handle_type nh, const std::string& where);
-
-        /// \brief Track mutex ownership.
-        /// \param nh - native object handle for the mutex to be tracked
-        /// \param where - backtrace of the code created this mutex
-		void lock_mutex(std::mutex::native_handle_type nh, const std::string& where);
-
-        /// \brief Track mutex release of the ownership.
-        /// \param nh - native object handle for the mutex to be tracked
-        /// \param where - backtrace of the code created this mutex
-		void unlock_mutex(std::mutex::native_handle_type nh, const std::string& where);		
-	};
+        /// \param id - identifier of the mutex
+		void delete_mutex(uint32_t id);
 
+        /// \brief Verifies lock order, must be called before mutex is actually locked.
+        /// \param me - mutex being locked
+        /// \param owned - mutexes currently owned by the thread (see TLSMutexVerifier#get_owned())
+		void lock_mutex(const MutexEntry& me, const std::vector<MutexEntry>& owned);
 
-	/// \struct MutexEntry
-	/// \brief Mutex entry structure for @ref GlobalMutexVerifier and @ref TLSMutexVerifier classes.
-	struct MutexEntry{
-		std::string back_trace;             ///< Stack backtrace
-		std::mutex::native_handle_type nh;  ///< Native object handle for the mutex to be tracked
-	};
+		/// \brief Returns number of the violations reported.
+		size_t get_violations();
 
+		/// \brief Sets violation handler. Default handler prints report to stderr.
+		/// \param h - new handler
+		/// \return Previous handler.
+		ViolationHandler set_violation_handler(ViolationHandler h);
+	};
 
 	/// \class TLSMutexVerifier
 	/// \brief This class is used to check if some mutex is actually owned by the thread or no.
 	/// \note This class must have thread local storage specification.
 	class TLSMutexVerifier final {
-		std::stack<MutexEntry> lock_trace;                          ///< storage for the stack back trace.
-		std::set<std::mutex::native_handle_type> locked_mutexes;    ///< Set of the native object handles currently owned.
+		std::vector<MutexEntry> owned;  ///< Mutexes currently owned, in lock order.
 
 	public:
 	    /// \brief Constructor
@@ -122,26 +167,23 @@ namespace tools {
 		~TLSMutexVerifier();
 
 		/// \brief Register mutex ownership
-        /// \param nh - native object handle for the mutex to be tracked
-        /// \param where - backtrace of the code created this mutex
-		void lock_mutex(std::mutex::native_handle_type nh, const std::string& where);
+        /// \param me - mutex entry
+		void lock_mutex(const MutexEntry& me);
 
         /// \brief Register mutex release of the ownership
-        /// \param nh - native object handle for the mutex to be tracked
-        /// \param where - backtrace of the code created this mutex
-		void unlock_mutex(std::mutex::native_handle_type nh, const std::string& where);
+        /// \param id - identifier of the mutex
+		void unlock_mutex(uint32_t id);
 
 		/// \brief Checks if the mutex is actually locked
-        /// \param nh - native object handle for the mutex to be tracked
+        /// \param id - identifier of the mutex
 		/// \return true if mutex is owned, otherwise false.
-		bool is_locked(std::mutex::native_handle_type nh);
-	};
-
-	/// \brief Thread local variable to track which mutexes are currently owned by the thread
-	static thread_local TLSMutexVerifier tls_mtx_verif;
+		bool is_locked(uint32_t id) const;
 
-	/// \brief Global variable to track deadlock conditions
-	// extern GlobalMutexVerifier g_mtx_verif;
+		/// \brief Returns mutexes currently owned by the thread, in lock order
+		const std::vector<MutexEntry>& get_owned() const {
+			return owned;
+		}
+	};
 
 	/// \class safe_mutex
 	/// \brief This class is used as wrapper on std::mutex. For debug builds it tracks and verifies mutexes. For release
@@ -152,7 +194,7 @@ namespace tools {
         /// \brief Defines parent class
 		typedef std::mutex super;
 
-		std::mutex::native_handle_type hndl; ///< Native handle that represent std::mutex
+		uint32_t id; ///< Identifier assigned by GlobalMutexVerifier
 
 	public:
 	    /// \brief Constructor
@@ -164,6 +206,20 @@ namespace tools {
 		/// \brief Takes ownership on the mutex
 		void lock();
 
+		/// \brief Takes ownership on the mutex on behalf of the caller (see #SAFE_MUTEX_LOCK_FROM).
+		/// \param site - call site to be reported (see MutexEntry#site).
+		void lock(const void* site);
+
+		/// \brief Takes ownership on the mutex if it is not owned by other thread.
+		/// \return true if ownership is taken, otherwise false.
+		/// \note Lock order is not verified, because try_lock() never waits and can't cause deadlock.
+		bool try_lock();
+
+		/// \brief Takes ownership on the mutex if it is not owned by other thread, on behalf of the caller.
+		/// \param site - call site to be reported (see MutexEntry#site).
+		/// \return true if ownership is taken, otherwise false.
+		bool try_lock(const void* site);
+
 		/// \brief Release ownership on the mutex
 		void unlock();
 
@@ -192,6 +248,16 @@ namespace tools {
 	/// \brief Checks if the mutex is owned.
 	#define CHECK_SAFE_MUTEX_LOCKED(m) {m.check_locked();}
 
+	/// \def SAFE_MUTEX_LOCK_FROM
+	/// \brief Locks the mutex on behalf of the caller. Functions which lock mutex for their callers (like
+	///        EKitBus#lock()) pass __builtin_return_address(0) as site, so the real call site is reported instead of
+	///        the wrapper.
+	#define SAFE_MUTEX_LOCK_FROM(m, site) {(m).lock(site);}
+
+	/// \def SAFE_MUTEX_TRY_LOCK_FROM
+	/// \brief Tries to lock the mutex on behalf of the caller (see #SAFE_MUTEX_LOCK_FROM), true if lock is taken.
+	#define SAFE_MUTEX_TRY_LOCK_FROM(m, site) ((m).try_lock(site))
+
     /// \def LOCK
     /// \brief Locks std::mutex (must be non-recursive mutex)
     #define LOCK(x) tools::safe_mutex_locker  safe_locker_##x(&(x));
@@ -205,6 +271,14 @@ namespace tools {
 	/// \brief Does nothing in release builds
 	#define CHECK_SAFE_MUTEX_LOCKED(m) {}
 
+	/// \def SAFE_MUTEX_LOCK_FROM
+	/// \brief Locks the mutex, call site is ignored in release builds
+	#define SAFE_MUTEX_LOCK_FROM(m, site) {(m).lock();}
+
+	/// \def SAFE_MUTEX_TRY_LOCK_FROM
+	/// \brief Tries to lock the mutex, call site is ignored in release builds
+	#define SAFE_MUTEX_TRY_LOCK_FROM(m, site) ((m).try_lock())
+
     /// \def LOCK
     /// \brief Locks std::mutex (must be non-recursive mutex)
     ///  #define LOCK(x)  			std::unique_lock<std::mutex> _unique_lock(x);
@@ -270,6 +344,16 @@ namespace tools {
 			return false;
 		}
 
+		/// \brief Returns time left until time out is expired.
+		/// \return Number of DURATION_UNITs left (at least one), zero if time out is infinite.
+		int remaining() {
+			if (timeout>0) {
+				size_t elapsed = measure();
+				return (elapsed < static_cast<size_t>(timeout)) ? timeout - static_cast<int>(elapsed) : 1;
+			}
+			return 0;
+		}
+
 		/// \brief Pauses StopWatch
 		void pause() {
 	        if (!paused) {
@@ -332,9 +416,184 @@ namespace tools {
 	/// \param length - length of the buffer
 	/// \param exclude_byte - offset of the byte to be excluded from calculation
 	/// \return 8-bit unsigned value representing control sum.
-	/// \note It is possible to optimize this function by XORing excluded byte twice, thus "if" statement will be moved out of the
-    ///       for loop. Implement this optimization in the case, if performance requirements will be more significant.
-    uint8_t calc_contol_sum(uint8_t* buffer, size_t length, size_t exclude_byte);
+	/// \note Excluded byte is XORed twice, so buffer is processed by xor_reduce() without per byte checks.
+    uint8_t calc_contol_sum(const uint8_t* buffer, size_t length, size_t exclude_byte);
+
+    /// \brief XORs all the bytes of the buffer. Buffer is processed by 64-bit words, four independent accumulators allow
+    ///        compiler to vectorize the loop.
+    /// \param buffer - buffer to be calculated
+    /// \param length - length of the buffer
+    /// \return XOR of all the bytes, zero for empty buffer.
+    uint8_t xor_reduce(const void* buffer, size_t length);
+
+    /// \brief Copies buffer and XORs all the copied bytes in the same pass.
+    /// \param dst - destination buffer, must not overlap with source buffer
+    /// \param src - source buffer
+    /// \param length - number of bytes to copy
+    /// \return XOR of all the copied bytes, zero for empty buffer.
+    uint8_t copy_xor_reduce(void* dst, const void* src, size_t length);
+
+    /// \class ControlSum
+    /// \brief Incremental control sum, gives the same value as calc_contol_sum() for the same bytes. Allows to calculate
+    ///        control sum while frame is assembled, instead of a separate pass over assembled frame.
+    class ControlSum {
+        uint8_t sum;    ///< Current value.
+    public:
+        /// \brief Constructor, sets initial value to COMM_CRC_INIT_VALUE.
+        ControlSum();
+
+        /// \brief Sets initial value to COMM_CRC_INIT_VALUE.
+        void reset();
+
+        /// \brief Adds bytes to the control sum.
+        /// \param buffer - buffer to be added
+        /// \param length - length of the buffer
+        void update(const void* buffer, size_t length) {
+            sum ^= xor_reduce(buffer, length);
+        }
+
+        /// \brief Copies buffer and adds copied bytes to the control sum.
+        /// \param dst - destination buffer
+        /// \param src - source buffer
+        /// \param length - number of bytes to copy
+        void copy(void* dst, const void* src, size_t length) {
+            sum ^= copy_xor_reduce(dst, src, length);
+        }
+
+        /// \brief Returns control sum of the bytes added so far.
+        uint8_t value() const {
+            return sum;
+        }
+    };
+
+    /// \brief Updates CRC-16 (COMM_CRC16_POLY polynomial, no reflection) with the buffer. Buffer is processed by
+    ///        slicing-by-8: eight bytes are folded in by eight independent table lookups.
+    /// \param crc - CRC-16 calculated so far, COMM_CRC16_INIT_VALUE for the first buffer.
+    /// \param buffer - buffer to be calculated
+    /// \param length - length of the buffer
+    /// \return Updated CRC-16.
+    uint16_t crc16_update(uint16_t crc, const void* buffer, size_t length);
+
+    /// \class CRC16
+    /// \brief Incremental CRC-16 used by CRC-16 framing (see COMM_CRC16_FLAG).
+    class CRC16 {
+        uint16_t crc;   ///< Current value.
+    public:
+        /// \brief Constructor, sets initial value to COMM_CRC16_INIT_VALUE.
+        CRC16();
+
+        /// \brief Sets initial value to COMM_CRC16_INIT_VALUE.
+        void reset();
+
+        /// \brief Adds bytes to CRC-16.
+        /// \param buffer - buffer to be added
+        /// \param length - length of the buffer
+        void update(const void* buffer, size_t length) {
+            crc = crc16_update(crc, buffer, length);
+        }
+
+        /// \brief Returns CRC-16 of the bytes added so far.
+        uint16_t value() const {
+            return crc;
+        }
+    };
+
+    /// \brief Converts unsigned 16-bit values to float: dst[i] = src[i] * scale + offset. Uses SSE2 or NEON if
+    ///        available, eight values per iteration.
+    /// \param src - values to be converted.
+    /// \param count - number of the values.
+    /// \param scale - scale factor.
+    /// \param offset - offset added after scaling.
+    /// \param dst - buffer to receive count converted values, may be unaligned.
+    void scale_u16(const uint16_t* src, size_t count, float scale, float offset, float* dst);
+
+    /// \brief Converts unsigned 16-bit values to double: dst[i] = src[i] * scale + offset. Uses SSE2 or AArch64 NEON
+    ///        if available, eight values per iteration.
+    /// \param src - values to be converted.
+    /// \param count - number of the values.
+    /// \param scale - scale factor.
+    /// \param offset - offset added after scaling.
+    /// \param dst - buffer to receive count converted values, may be unaligned.
+    void scale_u16(const uint16_t* src, size_t count, double scale, double offset, double* dst);
+
+    /// \class SPSCRing
+    /// \brief Lock-free ring of preallocated slots for single producer thread and single consumer thread. Producer
+    ///        fills the slot returned by SPSCRing#back() and publishes it with SPSCRing#push(), consumer reads the slot
+    ///        returned by SPSCRing#front() and releases it with SPSCRing#pop(). Slots are reused in place, so nothing is
+    ///        copied or allocated after construction.
+    /// \tparam T - type of the slot.
+    template <class T>
+    class SPSCRing {
+        static constexpr size_t cache_line = 64;    ///< Indexes are kept in separate cache lines.
+
+        std::vector<T> slots;                       ///< Slots, one of them is always free to distinguish full ring.
+        std::atomic<size_t> head;                   ///< Index of the next slot to be read, written by consumer.
+        char head_pad[cache_line - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> tail;                   ///< Index of the next slot to be written, written by producer.
+        char tail_pad[cache_line - sizeof(std::atomic<size_t>)];
+
+        /// \brief Returns index of the slot following specified one.
+        size_t next(size_t i) const {
+            return (i + 1 == slots.size()) ? 0 : i + 1;
+        }
+
+    public:
+        /// \brief Copy construction is forbidden
+        SPSCRing(const SPSCRing&) = delete;
+
+        /// \brief Assignment is forbidden
+        SPSCRing& operator=(const SPSCRing&) = delete;
+
+        /// \brief Constructor.
+        /// \param capacity - maximum number of the slots published and not released yet.
+        /// \param proto - initial value of the slots (for example, with preallocated memory).
+        SPSCRing(size_t capacity, const T& proto) :
+            slots(capacity + 1, proto),
+            head(0),
+            tail(0) {
+            assert(capacity > 0);
+        }
+
+        /// \brief Returns maximum number of the slots published and not released yet.
+        size_t capacity() const {
+            return slots.size() - 1;
+        }
+
+        /// \brief Returns number of the published slots not released yet. Exact if called by producer or consumer.
+        size_t size() const {
+            size_t h = head.load(std::memory_order_acquire);
+            size_t t = tail.load(std::memory_order_acquire);
+            return (t >= h) ? t - h : t + slots.size() - h;
+        }
+
+        /// \brief Returns slot to be filled by producer, or nullptr if ring is full. Must be called by producer only.
+        T* back() {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (next(t) == head.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            return &slots[t];
+        }
+
+        /// \brief Publishes slot returned by SPSCRing#back(). Must be called by producer only.
+        void push() {
+            tail.store(next(tail.load(std::memory_order_relaxed)), std::memory_order_release);
+        }
+
+        /// \brief Returns the oldest published slot, or nullptr if ring is empty. Must be called by consumer only.
+        T* front() {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            return &slots[h];
+        }
+
+        /// \brief Releases slot returned by SPSCRing#front(). Must be called by consumer only.
+        void pop() {
+            head.store(next(head.load(std::memory_order_relaxed)), std::memory_order_release);
+        }
+    };
 
 	/// \brief Simple wrapper on std::this_thread::sleep_for
 	/// \param ms
@@ -342,6 +601,12 @@ namespace tools {
         std::this_thread::sleep_for(std::chrono::milliseconds(ms));
     }
 
+	/// \brief Simple wrapper on std::this_thread::sleep_for
+	/// \param us - number of microseconds to sleep
+    inline void sleep_us(size_t us) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
     /// \brief Calculates timer parameters for STM32F103x timers.
     /// \param freq - Timer clock frequency (typical value - 36000000)
     /// \param delay_s - timer period in seconds
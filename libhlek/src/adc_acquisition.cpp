@@ -0,0 +1,202 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Continuous ADCDev acquisition implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <cassert>
+#include "adc_acquisition.hpp"
+
+//------------------------------------------------------------------------------------
+// ADCAcquisition::ADCAcquisition
+// Purpose: ADCAcquisition class constructor, preallocates blocks of the ring
+// std::shared_ptr<ADCDev> dev: device to acquire samples from
+// std::shared_ptr<EKitDrainScheduler> sched: scheduler which drains device
+// size_t samples_per_block: maximum number of the samples in block
+// size_t ring_blocks: number of the blocks in the ring
+//------------------------------------------------------------------------------------
+ADCAcquisition::ADCAcquisition(std::shared_ptr<ADCDev> dev,
+                               std::shared_ptr<EKitDrainScheduler> sched,
+                               size_t samples_per_block,
+                               size_t ring_blocks) :
+    adc(dev),
+    scheduler(sched),
+    block_samples(samples_per_block),
+    ring(ring_blocks, ADCBlock{0, 0, samples_per_block, false,
+                               std::vector<float>(samples_per_block * dev->get_input_count())}),
+    callback_block(ADCBlock{0, 0, samples_per_block, false,
+                            std::vector<float>(samples_per_block * dev->get_input_count())}),
+    source_id(-1),
+    next_sample(0),
+    gap(false),
+    samples(0),
+    blocks(0),
+    gaps(0),
+    too_fast(0),
+    ring_full(0) {
+    assert(samples_per_block > 0);
+}
+
+ADCAcquisition::~ADCAcquisition() {
+    stop();
+}
+
+void ADCAcquisition::set_callback(ADCBlockCallback clb) {
+    assert(!is_started());
+    callback = std::move(clb);
+}
+
+void ADCAcquisition::set_raw_callback(ADCRawCallback clb) {
+    assert(!is_started());
+    raw_callback = std::move(clb);
+}
+
+//------------------------------------------------------------------------------------
+// ADCAcquisition::start
+// Purpose: Clears device buffer, starts continuous sampling and registers drain function in scheduler
+//------------------------------------------------------------------------------------
+void ADCAcquisition::start() {
+    if (is_started()) {
+        return;
+    }
+
+    next_sample = 0;
+    gap = false;
+
+    adc->stop();
+    adc->reset();
+    adc->start(0);
+
+    source_id = scheduler->add(adc->get_dev_name(),
+                               adc->config->dev_buffer_len,
+                               [this](bool& ovf) { return drain(ovf); });
+}
+
+void ADCAcquisition::stop() {
+    if (!is_started()) {
+        return;
+    }
+
+    // Scheduler waits for running drain function, unless stop() is called by callback of this acquisition. In this
+    // case drain() returns as soon as callback returns.
+    scheduler->remove(source_id);
+    source_id = -1;
+    adc->stop();
+}
+
+//------------------------------------------------------------------------------------
+// ADCAcquisition::fill
+// Purpose: Reads samples into the block, converted by ADCDev directly into block memory
+// ADCBlock& block: block to be filled
+// Returns: number of the samples read
+//------------------------------------------------------------------------------------
+size_t ADCAcquisition::fill(ADCBlock& block) {
+    block.samples = adc->get(block.values.data(), block_samples);
+    if (block.samples == 0) {
+        return 0;
+    }
+
+    block.first_sample = next_sample;
+    block.gap = gap;
+    account(block.samples);
+    return block.samples;
+}
+
+//------------------------------------------------------------------------------------
+// ADCAcquisition::fill_raw
+// Purpose: Reads raw samples and passes them to the raw callback, measurements remain in ADCDev buffer
+// Returns: number of the samples read
+//------------------------------------------------------------------------------------
+size_t ADCAcquisition::fill_raw() {
+    ADCRawSamples raw = adc->get_raw(block_samples);
+    if (raw.samples == 0) {
+        return 0;
+    }
+
+    raw_callback(raw, next_sample, gap);
+    account(raw.samples);
+    return raw.samples;
+}
+
+void ADCAcquisition::account(size_t n) {
+    next_sample += n;
+    gap = false;
+    samples.fetch_add(n, std::memory_order_relaxed);
+    blocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------------
+// ADCAcquisition::drain
+// Purpose: Drains device buffer into blocks, restarts sampling if device has stopped
+// bool& ovf: set to true if device has stopped
+// Returns: number of the bytes read
+//------------------------------------------------------------------------------------
+size_t ADCAcquisition::drain(bool& ovf) {
+    size_t n;
+    size_t total = 0;
+    bool drained = false;
+    uint16_t status;
+    const size_t buffer_samples = adc->config->dev_buffer_len / (adc->get_input_count() * sizeof(uint16_t));
+
+    // Read until device has less than a block. Drain is limited by device buffer size, otherwise it never ends if bus
+    // is not faster than the device.
+    do {
+        if (raw_callback) {
+            n = fill_raw();
+        } else if (callback) {
+            n = fill(callback_block);
+            if (n > 0) callback(callback_block);
+        } else {
+            ADCBlock* block = ring.back();
+            if (block == nullptr) {
+                // Samples remain in device buffer until consumer releases blocks
+                ring_full.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+
+            n = fill(*block);
+            if (n > 0) ring.push();
+        }
+        drained = (n < block_samples);
+        total += n;
+    } while (!drained && total < buffer_samples && is_started());
+
+    // Status word is read with the samples. Device stops itself on overflow or if it can't keep the sample rate. It is
+    // checked when device buffer is empty, so gap is reported after the last sample taken before device has stopped.
+    status = adc->last_status();
+    if (drained && is_started() && (status & ADCDEV_STATUS_STARTED) == 0) {
+        ovf = true;
+        gap = true;
+        gaps.fetch_add(1, std::memory_order_relaxed);
+        if ((status & ADCDEV_STATUS_TOO_FAST) != 0) {
+            too_fast.fetch_add(1, std::memory_order_relaxed);
+        }
+        adc->start(0);
+    }
+
+    return total * adc->get_input_count() * sizeof(uint16_t);
+}
+
+ADCAcquisitionStats ADCAcquisition::get_stats() const {
+    return ADCAcquisitionStats{samples.load(std::memory_order_relaxed),
+                               blocks.load(std::memory_order_relaxed),
+                               gaps.load(std::memory_order_relaxed),
+                               too_fast.load(std::memory_order_relaxed),
+                               ring_full.load(std::memory_order_relaxed)};
+}
@@ -0,0 +1,600 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Streaming signal processing of the ADC blocks implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "adc_dsp.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+//------------------------------------------------------------------------------------
+// dsp_sum
+// Purpose: Calculates sum of the values
+// const float* x: values
+// size_t n: number of the values
+// Returns: sum
+//------------------------------------------------------------------------------------
+static float dsp_sum(const float* x, size_t n) {
+    size_t i = 0;
+    float res = 0.0f;
+
+#if defined(__SSE2__)
+    float part[4];
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_loadu_ps(x + i));
+    }
+    _mm_storeu_ps(part, acc);
+    res = (part[0] + part[1]) + (part[2] + part[3]);
+#elif defined(__ARM_NEON)
+    float part[4];
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        acc = vaddq_f32(acc, vld1q_f32(x + i));
+    }
+    vst1q_f32(part, acc);
+    res = (part[0] + part[1]) + (part[2] + part[3]);
+#endif
+
+    for (; i < n; i++) {
+        res += x[i];
+    }
+
+    return res;
+}
+
+//------------------------------------------------------------------------------------
+// dsp_min_max_sum
+// Purpose: Calculates minimum, maximum and sum of the values
+// const float* x: values
+// size_t n: number of the values, must be positive
+// float& mn, float& mx: receive minimum and maximum
+// float& sum: receives sum
+//------------------------------------------------------------------------------------
+static void dsp_min_max_sum(const float* x, size_t n, float& mn, float& mx, float& sum) {
+    size_t i = 0;
+    sum = 0.0f;
+    mn = x[0];
+    mx = x[0];
+
+#if defined(__SSE2__)
+    if (n >= 4) {
+        float pmin[4], pmax[4], psum[4];
+        __m128 vmin = _mm_loadu_ps(x);
+        __m128 vmax = vmin;
+        __m128 vsum = vmin;
+        for (i = 4; i + 4 <= n; i += 4) {
+            __m128 v = _mm_loadu_ps(x + i);
+            vmin = _mm_min_ps(vmin, v);
+            vmax = _mm_max_ps(vmax, v);
+            vsum = _mm_add_ps(vsum, v);
+        }
+        _mm_storeu_ps(pmin, vmin);
+        _mm_storeu_ps(pmax, vmax);
+        _mm_storeu_ps(psum, vsum);
+        mn = std::min(std::min(pmin[0], pmin[1]), std::min(pmin[2], pmin[3]));
+        mx = std::max(std::max(pmax[0], pmax[1]), std::max(pmax[2], pmax[3]));
+        sum = (psum[0] + psum[1]) + (psum[2] + psum[3]);
+    }
+#elif defined(__ARM_NEON)
+    if (n >= 4) {
+        float pmin[4], pmax[4], psum[4];
+        float32x4_t vmin = vld1q_f32(x);
+        float32x4_t vmax = vmin;
+        float32x4_t vsum = vmin;
+        for (i = 4; i + 4 <= n; i += 4) {
+            float32x4_t v = vld1q_f32(x + i);
+            vmin = vminq_f32(vmin, v);
+            vmax = vmaxq_f32(vmax, v);
+            vsum = vaddq_f32(vsum, v);
+        }
+        vst1q_f32(pmin, vmin);
+        vst1q_f32(pmax, vmax);
+        vst1q_f32(psum, vsum);
+        mn = std::min(std::min(pmin[0], pmin[1]), std::min(pmin[2], pmin[3]));
+        mx = std::max(std::max(pmax[0], pmax[1]), std::max(pmax[2], pmax[3]));
+        sum = (psum[0] + psum[1]) + (psum[2] + psum[3]);
+    }
+#endif
+
+    for (; i < n; i++) {
+        mn = std::min(mn, x[i]);
+        mx = std::max(mx, x[i]);
+        sum += x[i];
+    }
+}
+
+//------------------------------------------------------------------------------------
+// dsp_axpy
+// Purpose: Adds scaled values: y[i] += a * x[i]
+// float a: scale factor
+// const float* x: values to be scaled
+// float* y: values to be updated
+// size_t n: number of the values
+//------------------------------------------------------------------------------------
+static void dsp_axpy(float a, const float* x, float* y, size_t n) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 va = _mm_set1_ps(a);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t va = vdupq_n_f32(a);
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(y + i, vmlaq_f32(vld1q_f32(y + i), va, vld1q_f32(x + i)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+DSPStage::~DSPStage() {
+}
+
+//------------------------------------------------------------------------------------
+// DSPPipeline::DSPPipeline
+// Purpose: DSPPipeline class constructor
+// size_t input_channels: number of the input channels
+// size_t max_input_samples: maximum number of the samples in input block
+//------------------------------------------------------------------------------------
+DSPPipeline::DSPPipeline(size_t input_channels, size_t max_input_samples) :
+    channels(input_channels),
+    max_samples(max_input_samples) {
+    assert(input_channels > 0 && max_input_samples > 0);
+}
+
+//------------------------------------------------------------------------------------
+// DSPPipeline::add
+// Purpose: Configures stage for the output of the last stage and allocates its output block
+// std::shared_ptr<DSPStage> stage: stage to be added
+//------------------------------------------------------------------------------------
+void DSPPipeline::add(std::shared_ptr<DSPStage> stage) {
+    size_t in_channels = outputs.empty() ? channels : out_channels.back();
+    size_t in_samples = outputs.empty() ? max_samples : outputs.back().stride;
+    size_t n_channels = 0;
+    size_t n_samples = stage->configure(in_channels, in_samples, n_channels);
+    assert(n_channels > 0 && n_samples > 0);
+
+    stages.push_back(stage);
+    out_channels.push_back(n_channels);
+    outputs.push_back(ADCBlock{0, 0, n_samples, false, std::vector<float>(n_channels * n_samples)});
+}
+
+//------------------------------------------------------------------------------------
+// DSPPipeline::process
+// Purpose: Processes block with all stages
+// const ADCBlock& in: input block
+// Returns: output block of the last stage
+// Note: Samples before block with gap are not contiguous with it, so state of all stages is cleared.
+//------------------------------------------------------------------------------------
+const ADCBlock& DSPPipeline::process(const ADCBlock& in) {
+    const ADCBlock* block = &in;
+    assert(in.samples <= max_samples && in.samples <= in.stride);
+    assert(in.values.size() >= channels * in.stride);
+
+    if (in.gap) {
+        reset();
+    }
+
+    for (size_t i = 0; i < stages.size(); i++) {
+        stages[i]->process(*block, outputs[i]);
+        block = &outputs[i];
+    }
+
+    return *block;
+}
+
+void DSPPipeline::reset() {
+    for (auto& s : stages) {
+        s->reset();
+    }
+}
+
+size_t DSPPipeline::get_output_channels() const {
+    return out_channels.empty() ? channels : out_channels.back();
+}
+
+ADCAcquisition::ADCBlockCallback DSPPipeline::connect(ADCAcquisition::ADCBlockCallback next) {
+    return [this, next](const ADCBlock& in) {
+        const ADCBlock& out = process(in);
+        if (out.samples > 0) {
+            next(out);
+        }
+    };
+}
+
+//------------------------------------------------------------------------------------
+// DSPDecimator
+//------------------------------------------------------------------------------------
+DSPDecimator::DSPDecimator(size_t n) :
+    factor(n),
+    count(0),
+    next_sample(0),
+    gap(false) {
+    assert(n > 0);
+}
+
+size_t DSPDecimator::configure(size_t channels, size_t max_samples, size_t& out_channels) {
+    acc.assign(channels, 0.0);
+    out_channels = channels;
+    return max_samples / factor + 1;
+}
+
+void DSPDecimator::reset() {
+    std::fill(acc.begin(), acc.end(), 0.0);
+    count = 0;
+    gap = true;
+}
+
+//------------------------------------------------------------------------------------
+// DSPDecimator::process
+// Purpose: Sums runs of the samples up to the end of the current group, and emits average of the complete groups
+//------------------------------------------------------------------------------------
+void DSPDecimator::process(const ADCBlock& in, ADCBlock& out) {
+    size_t pos = 0;
+    size_t channels = acc.size();
+
+    out.first_sample = next_sample;
+    out.samples = 0;
+    out.gap = gap;
+
+    while (pos < in.samples) {
+        size_t run = std::min(factor - count, in.samples - pos);
+        for (size_t ch = 0; ch < channels; ch++) {
+            acc[ch] += dsp_sum(in.channel(ch) + pos, run);
+        }
+        count += run;
+        pos += run;
+
+        if (count == factor) {
+            for (size_t ch = 0; ch < channels; ch++) {
+                out.values[ch * out.stride + out.samples] = static_cast<float>(acc[ch] / factor);
+                acc[ch] = 0.0;
+            }
+            out.samples++;
+            count = 0;
+        }
+    }
+
+    next_sample += out.samples;
+    if (out.samples > 0) {
+        gap = false;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// DSPFIRFilter
+//------------------------------------------------------------------------------------
+DSPFIRFilter::DSPFIRFilter(const std::vector<float>& c) :
+    coeffs(c),
+    history(c.empty() ? 0 : c.size() - 1),
+    stride(0) {
+    assert(!c.empty());
+}
+
+size_t DSPFIRFilter::configure(size_t channels, size_t max_samples, size_t& out_channels) {
+    stride = history + max_samples;
+    work.assign(channels * stride, 0.0f);
+    out_channels = channels;
+    return max_samples;
+}
+
+void DSPFIRFilter::reset() {
+    std::fill(work.begin(), work.end(), 0.0f);
+}
+
+//------------------------------------------------------------------------------------
+// DSPFIRFilter::process
+// Purpose: Filters each channel
+// Note: Input is appended to the history in work buffer, so output is calculated as sum of the shifted input vectors
+//       scaled by coefficients without checks for the block boundary.
+//------------------------------------------------------------------------------------
+void DSPFIRFilter::process(const ADCBlock& in, ADCBlock& out) {
+    size_t channels = work.size() / stride;
+    size_t n = in.samples;
+
+    out.first_sample = in.first_sample;
+    out.samples = n;
+    out.gap = in.gap;
+
+    for (size_t ch = 0; ch < channels; ch++) {
+        float* w = work.data() + ch * stride;
+        float* y = out.values.data() + ch * out.stride;
+
+        memcpy(w + history, in.channel(ch), n * sizeof(float));
+        std::fill(y, y + n, 0.0f);
+        for (size_t k = 0; k < coeffs.size(); k++) {
+            dsp_axpy(coeffs[k], w + history - k, y, n);
+        }
+
+        // Keep last samples for the next block
+        memmove(w, w + n, history * sizeof(float));
+    }
+}
+
+//------------------------------------------------------------------------------------
+// DSPBiquad
+//------------------------------------------------------------------------------------
+DSPBiquad::DSPBiquad(double nb0, double nb1, double nb2, double na1, double na2) :
+    b0(nb0), b1(nb1), b2(nb2), a1(na1), a2(na2) {
+}
+
+//------------------------------------------------------------------------------------
+// DSPBiquad::lowpass
+// Purpose: Creates low pass filter
+// Note: Coefficients are calculated by bilinear transform, see "Cookbook formulae for audio EQ biquad filter
+//       coefficients" by Robert Bristow-Johnson.
+//------------------------------------------------------------------------------------
+std::shared_ptr<DSPBiquad> DSPBiquad::lowpass(double sample_rate, double cutoff, double q) {
+    assert(cutoff > 0.0 && cutoff < sample_rate / 2.0 && q > 0.0);
+    double w0 = 2.0 * M_PI * cutoff / sample_rate;
+    double alpha = sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+    double c = cos(w0);
+    return std::make_shared<DSPBiquad>((1.0 - c) / 2.0 / a0, (1.0 - c) / a0, (1.0 - c) / 2.0 / a0,
+                                       -2.0 * c / a0, (1.0 - alpha) / a0);
+}
+
+std::shared_ptr<DSPBiquad> DSPBiquad::highpass(double sample_rate, double cutoff, double q) {
+    assert(cutoff > 0.0 && cutoff < sample_rate / 2.0 && q > 0.0);
+    double w0 = 2.0 * M_PI * cutoff / sample_rate;
+    double alpha = sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+    double c = cos(w0);
+    return std::make_shared<DSPBiquad>((1.0 + c) / 2.0 / a0, -(1.0 + c) / a0, (1.0 + c) / 2.0 / a0,
+                                       -2.0 * c / a0, (1.0 - alpha) / a0);
+}
+
+size_t DSPBiquad::configure(size_t channels, size_t max_samples, size_t& out_channels) {
+    state.assign(channels * 2, 0.0);
+    out_channels = channels;
+    return max_samples;
+}
+
+void DSPBiquad::reset() {
+    std::fill(state.begin(), state.end(), 0.0);
+}
+
+//------------------------------------------------------------------------------------
+// DSPBiquad::process
+// Purpose: Filters each channel
+// Note: Each output depends on the previous one, so samples are processed sequentially. State is kept in double to
+//       avoid accumulation of the rounding errors at low cutoff frequencies.
+//------------------------------------------------------------------------------------
+void DSPBiquad::process(const ADCBlock& in, ADCBlock& out) {
+    size_t channels = state.size() / 2;
+
+    out.first_sample = in.first_sample;
+    out.samples = in.samples;
+    out.gap = in.gap;
+
+    for (size_t ch = 0; ch < channels; ch++) {
+        const float* x = in.channel(ch);
+        float* y = out.values.data() + ch * out.stride;
+        double s1 = state[ch * 2];
+        double s2 = state[ch * 2 + 1];
+
+        for (size_t i = 0; i < in.samples; i++) {
+            double v = x[i];
+            double r = b0 * v + s1;
+            s1 = b1 * v - a1 * r + s2;
+            s2 = b2 * v - a2 * r;
+            y[i] = static_cast<float>(r);
+        }
+
+        state[ch * 2] = s1;
+        state[ch * 2 + 1] = s2;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// DSPMovingAverage
+//------------------------------------------------------------------------------------
+DSPMovingAverage::DSPMovingAverage(size_t n, bool calc_rms) :
+    window(n),
+    rms(calc_rms),
+    pos(0),
+    count(0) {
+    assert(n > 0);
+}
+
+size_t DSPMovingAverage::configure(size_t channels, size_t max_samples, size_t& out_channels) {
+    hist.assign(channels * window, 0.0f);
+    sum.assign(channels, 0.0);
+    out_channels = channels;
+    return max_samples;
+}
+
+void DSPMovingAverage::reset() {
+    std::fill(hist.begin(), hist.end(), 0.0f);
+    std::fill(sum.begin(), sum.end(), 0.0);
+    pos = 0;
+    count = 0;
+}
+
+//------------------------------------------------------------------------------------
+// DSPMovingAverage::process
+// Purpose: Updates running sum of each channel with the new sample and the sample leaving window
+//------------------------------------------------------------------------------------
+void DSPMovingAverage::process(const ADCBlock& in, ADCBlock& out) {
+    size_t channels = sum.size();
+    size_t p = pos;
+    size_t c = count;
+
+    out.first_sample = in.first_sample;
+    out.samples = in.samples;
+    out.gap = in.gap;
+
+    for (size_t ch = 0; ch < channels; ch++) {
+        const float* x = in.channel(ch);
+        float* y = out.values.data() + ch * out.stride;
+        float* h = hist.data() + ch * window;
+        double s = sum[ch];
+        p = pos;
+        c = count;
+
+        for (size_t i = 0; i < in.samples; i++) {
+            float v = rms ? x[i] * x[i] : x[i];
+            s += static_cast<double>(v) - h[p];
+            h[p] = v;
+            p = (p + 1 == window) ? 0 : p + 1;
+            c = std::min(c + 1, window);
+
+            double mean = s / c;
+            y[i] = static_cast<float>(rms ? sqrt(std::max(mean, 0.0)) : mean);
+        }
+
+        sum[ch] = s;
+    }
+
+    pos = p;
+    count = c;
+}
+
+//------------------------------------------------------------------------------------
+// DSPWindowStats
+//------------------------------------------------------------------------------------
+DSPWindowStats::DSPWindowStats(size_t n) :
+    window(n),
+    count(0),
+    next_sample(0),
+    gap(false) {
+    assert(n > 0);
+}
+
+size_t DSPWindowStats::configure(size_t channels, size_t max_samples, size_t& out_channels) {
+    min_val.assign(channels, 0.0f);
+    max_val.assign(channels, 0.0f);
+    acc.assign(channels, 0.0);
+    out_channels = channels * 3;
+    return max_samples / window + 1;
+}
+
+void DSPWindowStats::reset() {
+    std::fill(acc.begin(), acc.end(), 0.0);
+    count = 0;
+    gap = true;
+}
+
+//------------------------------------------------------------------------------------
+// DSPWindowStats::process
+// Purpose: Accumulates runs of the samples up to the end of the current window, and emits statistics of the complete
+//          windows
+//------------------------------------------------------------------------------------
+void DSPWindowStats::process(const ADCBlock& in, ADCBlock& out) {
+    size_t pos = 0;
+    size_t channels = acc.size();
+
+    out.first_sample = next_sample;
+    out.samples = 0;
+    out.gap = gap;
+
+    while (pos < in.samples) {
+        size_t run = std::min(window - count, in.samples - pos);
+        for (size_t ch = 0; ch < channels; ch++) {
+            float mn, mx, s;
+            dsp_min_max_sum(in.channel(ch) + pos, run, mn, mx, s);
+            min_val[ch] = (count == 0) ? mn : std::min(min_val[ch], mn);
+            max_val[ch] = (count == 0) ? mx : std::max(max_val[ch], mx);
+            acc[ch] += s;
+        }
+        count += run;
+        pos += run;
+
+        if (count == window) {
+            for (size_t ch = 0; ch < channels; ch++) {
+                out.values[(ch * 3) * out.stride + out.samples] = min_val[ch];
+                out.values[(ch * 3 + 1) * out.stride + out.samples] = max_val[ch];
+                out.values[(ch * 3 + 2) * out.stride + out.samples] = static_cast<float>(acc[ch] / window);
+                acc[ch] = 0.0;
+            }
+            out.samples++;
+            count = 0;
+        }
+    }
+
+    next_sample += out.samples;
+    if (out.samples > 0) {
+        gap = false;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// DSPTrigger
+//------------------------------------------------------------------------------------
+DSPTrigger::DSPTrigger(size_t ch, float lvl, float hyst, bool rising_edge, DSPTriggerCallback clb) :
+    channel(ch),
+    level(lvl),
+    hysteresis(hyst),
+    rising(rising_edge),
+    callback(std::move(clb)),
+    armed(false),
+    events(0),
+    n_channels(0) {
+    assert(hyst >= 0.0f);
+}
+
+size_t DSPTrigger::configure(size_t channels, size_t max_samples, size_t& out_channels) {
+    assert(channel < channels);
+    n_channels = channels;
+    out_channels = channels;
+    return max_samples;
+}
+
+void DSPTrigger::reset() {
+    armed = false;
+}
+
+void DSPTrigger::process(const ADCBlock& in, ADCBlock& out) {
+    const float* x = in.channel(channel);
+    const float arm_level = rising ? level - hysteresis : level + hysteresis;
+
+    for (size_t ch = 0; ch < n_channels; ch++) {
+        memcpy(out.values.data() + ch * out.stride, in.channel(ch), in.samples * sizeof(float));
+    }
+    out.first_sample = in.first_sample;
+    out.samples = in.samples;
+    out.gap = in.gap;
+
+    for (size_t i = 0; i < in.samples; i++) {
+        bool crossed = rising ? (x[i] >= level) : (x[i] <= level);
+        if (armed && crossed) {
+            armed = false;
+            events++;
+            if (callback) {
+                callback(in.first_sample + i);
+            }
+        } else if (!armed && (rising ? (x[i] < arm_level) : (x[i] > arm_level))) {
+            armed = true;
+        }
+    }
+}
@@ -39,7 +39,14 @@ ADCDev::ADCDev(std::shared_ptr<EKitBus>& ebus, const ADCConfig* cfg)
         sr->second = 3.3L;
     }
 
+    // Conversion to voltage is v_min + v * (v_max - v_min) / adc_maxval
+    for (auto sr = signal_ranges.begin(); sr!=signal_ranges.end(); ++sr) {
+        channel_scale.push_back((sr->second - sr->first) / (double)config->adc_maxval);
+        channel_offset.push_back(sr->first);
+    }
+
     data_buffer.resize(cfg->dev_buffer_len + sizeof(uint16_t));
+    planar_buffer.resize(cfg->dev_buffer_len / sizeof(uint16_t));
     data_status = static_cast<volatile uint16_t*>(data_buffer.data());
     data = data_status + 1;
 }
@@ -58,6 +65,16 @@ std::string ADCDev::get_input_name(size_t index, bool channel_name) const {
                         : config->inputs[index].in_name;
 }
 
+std::pair<double, double> ADCDev::get_input_range(size_t index) const {
+    static const char* const func_name = "ADCDev::get_input_range";
+    if (index >= config->input_count) {
+        throw EKitException(
+            func_name, EKIT_BAD_PARAM, "ADC input index is out of range");
+    }
+
+    return signal_ranges[index];
+}
+
 size_t ADCDev::get_input_count() const {
     return config->input_count;
 }
@@ -140,22 +157,57 @@ void ADCDev::send_command(uint8_t* ptr, size_t size, uint8_t command) {
     }
 }
 
+size_t ADCDev::read_samples(size_t max_samples, EKitTimeout& to) {
+    size_t sample_size = config->input_count * sizeof(uint16_t);
+    size_t available;
+
+    // Read as much as buffer may hold, device sends what it has. Samples which are not read remain in circular buffer.
+    return stream_priv(std::min(max_samples, config->dev_buffer_len / sample_size), available, to);
+}
+
+//------------------------------------------------------------------------------------
+// ADCDev::stream_priv
+// Purpose: Reads response header, status and samples by single bus transaction
+// size_t max_samples: maximum number of the samples to read
+// size_t& available: receives number of bytes in device circular buffer (including status)
+// Returns: number of the samples read
+// Note: Firmware takes status before length of the data, so samples taken before device has stopped are either read
+//       or remain in device buffer. Bytes beyond data available are discarded.
+//------------------------------------------------------------------------------------
+size_t ADCDev::stream_priv(size_t max_samples, size_t& available, EKitTimeout& to) {
+    static const char* const func_name = "ADCDev::stream_priv";
+    size_t sample_size = config->input_count * sizeof(uint16_t);
+    size_t max_len = sizeof(uint16_t) + max_samples * sample_size;
+    size_t len = 0;
+    CommResponseHeader hdr;
+
+    auto fw = std::dynamic_pointer_cast<EKitFirmware>(bus);
+    EKIT_ERROR err = fw->read_stream((uint8_t*)data_status, max_len, len, to, &available);
+    if (err == EKIT_REPEAT) {
+        // Device is busy with the previous command, nothing was read
+        err = fw->sync_vdev(hdr, false, to);
+        if (err == EKIT_OK) {
+            err = fw->read_stream((uint8_t*)data_status, max_len, len, to, &available);
+        }
+    }
+
+    if (err != EKIT_OK) {
+        throw EKitException(func_name, err, "read_stream() failed");
+    }
+
+    if (len < sizeof(uint16_t) || ((available - sizeof(uint16_t)) % sample_size) != 0) {
+        throw EKitException(func_name, EKIT_UNALIGNED, "Device buffer is unaligned.");
+    }
+
+    return (len - sizeof(uint16_t)) / sample_size;
+}
+
 void ADCDev::get(std::vector<std::vector<double>>& dst) {
     static const char* const func_name = "ADCDev::get(1)";
     EKitTimeout        to(get_timeout());
     BusLocker          blocker(bus, get_addr(), to);
 
-    // get amount of data
-    size_t data_size = status_priv(nullptr, to);
-    assert(data_size>=sizeof(uint16_t));
-
-    // read data (into data_buffer)
-    EKIT_ERROR err = bus->read((uint8_t*)data_status, data_size, to);
-    if (err != EKIT_OK) {
-        throw EKitException(func_name, err, "read() failed");
-    }
-    data_size = (data_size - sizeof(uint16_t)) / sizeof(uint16_t); // <- Number of measurements (all channels)
-    size_t sample_count = data_size / config->input_count; // <- Number of samples
+    size_t sample_count = read_samples(SIZE_MAX, to);
 
     // convert into doubles
     dst.resize(sample_count);
@@ -163,14 +215,66 @@ void ADCDev::get(std::vector<std::vector<double>>& dst) {
         dst[s].resize(config->input_count);
         for (size_t ch = 0; ch < config->input_count; ch++) {
             uint16_t v = data[ch + s * config->input_count];
-            double v_min = signal_ranges[ch].first;
-            double v_max = signal_ranges[ch].second;
-            double x = v_min + ((double)v / (double)config->adc_maxval) * (v_max - v_min);
-            dst[s][ch] = x;
+            dst[s][ch] = channel_offset[ch] + v * channel_scale[ch];
         }
     }
 }
 
+//------------------------------------------------------------------------------------
+// ADCDev::get_flat
+// Purpose: Reads samples and converts them into flat buffer, channel by channel
+// T* dst: buffer of input_count * max_samples elements
+// size_t max_samples: maximum number of the samples to read
+// Returns: number of the samples read
+// Note: Measurements of the channel are gathered into planar_buffer, so conversion works on contiguous values and is
+//       vectorized by tools::scale_u16().
+//------------------------------------------------------------------------------------
+template <typename T> size_t ADCDev::get_flat(T* dst, size_t max_samples) {
+    EKitTimeout        to(get_timeout());
+    BusLocker          blocker(bus, get_addr(), to);
+    const size_t       channels = config->input_count;
+    const uint16_t*    raw = const_cast<const uint16_t*>(data);
+
+    size_t sample_count = read_samples(max_samples, to);
+
+    for (size_t ch = 0; ch < channels; ch++) {
+        const uint16_t* src = raw;
+        if (channels > 1) {
+            src = planar_buffer.data();
+            for (size_t s = 0; s < sample_count; s++) {
+                planar_buffer[s] = raw[s * channels + ch];
+            }
+        }
+        tools::scale_u16(src,
+                         sample_count,
+                         static_cast<T>(channel_scale[ch]),
+                         static_cast<T>(channel_offset[ch]),
+                         dst + ch * max_samples);
+    }
+
+    return sample_count;
+}
+
+size_t ADCDev::get(float* dst, size_t max_samples) {
+    return get_flat(dst, max_samples);
+}
+
+size_t ADCDev::get(double* dst, size_t max_samples) {
+    return get_flat(dst, max_samples);
+}
+
+ADCRawSamples ADCDev::get_raw(size_t max_samples) {
+    EKitTimeout        to(get_timeout());
+    BusLocker          blocker(bus, get_addr(), to);
+    ADCRawSamples      res;
+
+    res.samples = read_samples(max_samples, to);
+    res.channels = config->input_count;
+    res.data = const_cast<const uint16_t*>(data);
+    res.status = *data_status;
+    return res;
+}
+
 size_t ADCDev::status(uint16_t& flags) {
     static const char* const func_name = "ADCDev::status";
 
@@ -181,33 +285,15 @@ size_t ADCDev::status(uint16_t& flags) {
 }
 
 size_t ADCDev::status_priv(uint16_t* flags, EKitTimeout& to) {
-    static const char* const func_name = "ADCDev::status_priv";
-    EKIT_ERROR err = EKIT_FAIL;
-    CommResponseHeader hdr;
+    size_t available;
 
-    auto fw = std::dynamic_pointer_cast<EKitFirmware>(bus);
-    fw->sync_vdev(hdr, false, to);
+    // Status only: nothing is removed from device buffer
+    stream_priv(0, available, to);
 
-    /*
-    do {
-        err = fw->get_status(hdr, false, to);
-    } while ( (err!=EKIT_OK) && (hdr.comm_status & COMM_STATUS_BUSY) );
-    assert((hdr.comm_status & COMM_STATUS_BUSY)==0);
-*/
-
-    if (((hdr.length - sizeof(uint16_t)) % (config->input_count * sizeof(uint16_t)))!=0) {
-        throw EKitException(func_name, EKIT_UNALIGNED, "Device buffer is unaligned.");
-    }
-
-    if (flags == nullptr) goto done;
-
-    err = bus->read((uint8_t*)data_status, sizeof(uint16_t), to);
-    if (err != EKIT_OK) {
-        throw EKitException(func_name, err, "read() failed");
+    if (flags != nullptr) {
+        *flags = *data_status;
     }
-    *flags = *data_status;
 
-done:
-    return hdr.length;
+    return available;
 }
 
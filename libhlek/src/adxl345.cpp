@@ -130,6 +130,65 @@ void ADXL345::get_data(ADXL345Sample* data) {
     std::this_thread::sleep_for(std::chrono::microseconds(10));
 }
 
+void ADXL345::get_data(ADXL345Sample* data, size_t count) {
+    static const char* const func_name = "ADXL345::get_data";
+    constexpr size_t         data_len  = sizeof(ADXL345Data) + 1;
+    struct timespec          ts;
+    int                      err;
+    EKIT_ERROR               res = EKIT_OK;
+
+    EKitTimeout              to(get_timeout());
+    BusLocker                blocker(bus, to);
+
+    EKitSPIBus* spi_bus = dynamic_cast<EKitSPIBus*>(bus.get());
+    fifo_trans.clear();
+
+    for (size_t i = 0; i < count; i++) {
+        // See get_data(ADXL345Sample*) regarding buffer
+        uint8_t* buffer = reinterpret_cast<uint8_t*>(&(data[i].data)) - 1;
+        buffer[0]       = READ_REG_FLAG | MULTYBYTE_FLAG | ADXL345Registers::DATAX0;
+
+        if (spi_bus != nullptr) {
+            // Device must be deselected between FIFO entries, delay of 5us is required by ADXL345 datasheet.
+            fifo_trans.add(buffer, buffer, data_len, i + 1 < count, 5);
+        } else {
+            res = bus->write_read(buffer, data_len, buffer, data_len, to);
+            if (res != EKIT_OK) break;
+
+            err = clock_gettime(CLOCK_MONOTONIC_RAW, &(data[i].timestamp));
+            if (err < 0) {
+                res = ERRNO_TO_EKIT_ERROR(errno);
+                throw EKitException(func_name, res, "Failed to obtain timestamp.");
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+    }
+
+    if (spi_bus != nullptr) {
+        res = spi_bus->execute(fifo_trans, to);
+    }
+
+    if (res != EKIT_OK) {
+        throw EKitException(func_name, res, "SPI transaction failed.");
+    }
+
+    if (spi_bus != nullptr) {
+        err = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        if (err < 0) {
+            res = ERRNO_TO_EKIT_ERROR(errno);
+            throw EKitException(func_name, res, "Failed to obtain timestamp.");
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            data[i].timestamp = ts;
+        }
+
+        // Delay of 5us is required by ADXL345 datasheet.
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+    }
+}
+
 EKIT_ERROR ADXL345::get_fifo_ctl_priv(size_t&      fifolen,
                                       uint8_t&     mode,
                                       bool&        trigger,
@@ -0,0 +1,200 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus arbitration implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <cassert>
+#include <algorithm>
+#include "ekit_arbiter.hpp"
+
+//------------------------------------------------------------------------------------
+// EKitBusArbiter::EKitBusArbiter
+// Purpose: EKitBusArbiter class constructor
+// size_t priority_levels: number of the priority levels
+// int def_priority: priority for addresses without assigned priority
+//------------------------------------------------------------------------------------
+EKitBusArbiter::EKitBusArbiter(size_t priority_levels, int def_priority) :
+    levels(priority_levels),
+    default_priority(def_priority),
+    queues(priority_levels),
+    busy(false),
+    admission(false),
+    hold_avg_us(0.0),
+    rejected(0),
+    histograms(priority_levels, std::vector<size_t>(histogram_buckets, 0)) {
+    assert(priority_levels > 0);
+    assert(def_priority >= 0 && (size_t)def_priority < priority_levels);
+}
+
+void EKitBusArbiter::set_priority(int addr, int priority) {
+    assert(priority >= 0 && (size_t)priority < levels);
+    std::lock_guard<std::mutex> lock(arb_lock);
+    priorities[addr] = priority;
+}
+
+void EKitBusArbiter::set_admission(bool enable) {
+    std::lock_guard<std::mutex> lock(arb_lock);
+    admission = enable;
+}
+
+int EKitBusArbiter::get_priority(int addr) {
+    std::lock_guard<std::mutex> lock(arb_lock);
+    auto p = priorities.find(addr);
+    return (p == priorities.end()) ? default_priority : p->second;
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusArbiter::grant_next
+// Purpose: Passes bus to the first waiter with highest priority. Must be called with arb_lock owned
+//------------------------------------------------------------------------------------
+void EKitBusArbiter::grant_next() {
+    assert(!busy);
+
+    for (size_t i = levels; i > 0; i--) {
+        std::deque<Waiter*>& q = queues[i-1];
+        if (!q.empty()) {
+            // Only the granted waiter is woken up
+            Waiter* w = q.front();
+            q.pop_front();
+            w->granted = true;
+            busy = true;
+            grant_time = std::chrono::steady_clock::now();
+            w->cond.notify_one();
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusArbiter::admissible
+// Purpose: Estimates wait time of the waiter and compares it with the deadline. Must be called with arb_lock owned
+// int priority: priority of the waiter
+// size_t ahead: number of the waiters with the same priority to be granted before it
+// Returns: true if deadline may be met, or if wait time can't be estimated yet
+// Note: Waiters with higher priority are granted first, waiters with lower priority are not. Every waiter is expected
+//       to own bus for average time, current owner for the rest of average time.
+//------------------------------------------------------------------------------------
+bool EKitBusArbiter::admissible(int priority,
+                                size_t ahead,
+                                std::chrono::steady_clock::time_point now,
+                                std::chrono::steady_clock::time_point deadline) const {
+    if (hold_avg_us <= 0.0) {
+        return true;
+    }
+
+    for (size_t p = static_cast<size_t>(priority) + 1; p < levels; p++) {
+        ahead += queues[p].size();
+    }
+
+    double owned_us = std::chrono::duration_cast<std::chrono::microseconds>(now - grant_time).count();
+    double wait_us = std::max(0.0, hold_avg_us - owned_us) + static_cast<double>(ahead) * hold_avg_us;
+    return now + std::chrono::microseconds(static_cast<int64_t>(wait_us)) <= deadline;
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusArbiter::acquire
+// Purpose: Waits for the turn to own bus
+// int addr: address of the device
+// Returns: corresponding EKIT_ERROR code
+// Note: Waiter is inserted into the queue of its priority after waiters with the same or earlier deadline, so queue
+//       stays ordered by deadline and it is FIFO for equal deadlines.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitBusArbiter::acquire(int addr, EKitTimeout& to) {
+    int priority = get_priority(addr);
+    Waiter w;
+    auto start = std::chrono::steady_clock::now();
+    int left = to.remaining();
+    std::unique_lock<std::mutex> lock(arb_lock);
+
+    w.granted = false;
+    w.deadline = (left == 0) ? std::chrono::steady_clock::time_point::max() : start + std::chrono::milliseconds(left);
+    if (!busy) {
+        // Bus is free, nobody may wait for free bus
+        busy = true;
+        grant_time = start;
+        w.granted = true;
+    } else {
+        auto granted = [&w]() { return w.granted; };
+        std::deque<Waiter*>& q = queues[priority];
+        auto pos = std::upper_bound(q.begin(), q.end(), &w, [](const Waiter* a, const Waiter* b) {
+            return a->deadline < b->deadline;
+        });
+
+        if (admission && left != 0 && !admissible(priority, pos - q.begin(), start, w.deadline)) {
+            rejected++;
+            return EKIT_TIMEOUT;
+        }
+
+        q.insert(pos, &w);
+        if (left == 0) {
+            w.cond.wait(lock, granted);
+        } else if (!w.cond.wait_until(lock, w.deadline, granted)) {
+            // Not granted, waiter is still in the queue
+            q.erase(std::find(q.begin(), q.end(), &w));
+            return EKIT_TIMEOUT;
+        }
+    }
+
+    size_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    size_t bucket = 0;
+    while (us > 1 && bucket < histogram_buckets - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    histograms[priority][bucket]++;
+
+    return EKIT_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusArbiter::release
+// Purpose: Releases bus, bus is passed to the next waiter
+//------------------------------------------------------------------------------------
+void EKitBusArbiter::release() {
+    std::lock_guard<std::mutex> lock(arb_lock);
+    assert(busy);
+
+    // Average time bus is owned is used by admission, recent ownership has weight 1/8
+    double hold_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                           grant_time).count();
+    hold_avg_us = (hold_avg_us <= 0.0) ? std::max(hold_us, 1.0) : hold_avg_us + (hold_us - hold_avg_us) / 8.0;
+
+    busy = false;
+    grant_next();
+}
+
+std::vector<size_t> EKitBusArbiter::get_histogram(int priority) {
+    assert(priority >= 0 && (size_t)priority < levels);
+    std::lock_guard<std::mutex> lock(arb_lock);
+    return histograms[priority];
+}
+
+size_t EKitBusArbiter::get_rejected() {
+    std::lock_guard<std::mutex> lock(arb_lock);
+    return rejected;
+}
+
+void EKitBusArbiter::reset_histograms() {
+    std::lock_guard<std::mutex> lock(arb_lock);
+    rejected = 0;
+    for (auto& h : histograms) {
+        std::fill(h.begin(), h.end(), 0);
+    }
+}
@@ -0,0 +1,295 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Asynchronous bus request executor implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <cassert>
+#include "ekit_async.hpp"
+
+//------------------------------------------------------------------------------------
+// EKitAsyncExecutor::EKitAsyncExecutor
+// Purpose: EKitAsyncExecutor class constructor. Starts I/O thread
+// std::shared_ptr<EKitBus> ebus: bus served by executor
+// size_t queue_length: maximum number of pending requests
+//------------------------------------------------------------------------------------
+EKitAsyncExecutor::EKitAsyncExecutor(std::shared_ptr<EKitBus> ebus, size_t queue_length) :
+    bus(std::move(ebus)),
+    queue(queue_length),
+    queue_head(0),
+    queue_count(0),
+    stopping(false),
+    errors(0) {
+    assert(queue_length > 0);
+    io_thread = std::thread(&EKitAsyncExecutor::thread_func, this);
+}
+
+//------------------------------------------------------------------------------------
+// EKitAsyncExecutor::~EKitAsyncExecutor
+// Purpose: EKitAsyncExecutor class destructor. Executes pending requests and stops I/O thread
+//------------------------------------------------------------------------------------
+EKitAsyncExecutor::~EKitAsyncExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(queue_lock);
+        stopping = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+    io_thread.join();
+}
+
+std::shared_ptr<EKitBus> EKitAsyncExecutor::get_bus() const {
+    return bus;
+}
+
+size_t EKitAsyncExecutor::pending() {
+    std::lock_guard<std::mutex> lock(queue_lock);
+    return queue_count;
+}
+
+void EKitAsyncExecutor::set_error_handler(std::function<void(std::exception_ptr)> handler) {
+    std::lock_guard<std::mutex> lock(queue_lock);
+    on_error = std::move(handler);
+}
+
+size_t EKitAsyncExecutor::get_error_count() {
+    std::lock_guard<std::mutex> lock(queue_lock);
+    return errors;
+}
+
+//------------------------------------------------------------------------------------
+// EKitAsyncExecutor::thread_func
+// Purpose: I/O thread function. Executes requests until executor is stopped and queue is empty
+//------------------------------------------------------------------------------------
+void EKitAsyncExecutor::thread_func() {
+    std::function<void()> request;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_lock);
+            not_empty.wait(lock, [this]() { return queue_count > 0 || stopping; });
+
+            if (queue_count == 0) {
+                break; // stopping and nothing to do
+            }
+
+            request = std::move(queue[queue_head]);
+            queue[queue_head] = nullptr;
+            queue_head = (queue_head + 1) % queue.size();
+            queue_count--;
+        }
+        not_full.notify_one();
+
+        // Requests report errors by themselves (see post() and submit()), exception may be thrown by completion
+        // callback only. It must not stop I/O thread, it is passed to error handler.
+        try {
+            request();
+        } catch (...) {
+            std::function<void(std::exception_ptr)> handler;
+            {
+                std::lock_guard<std::mutex> lock(queue_lock);
+                errors++;
+                handler = on_error;
+            }
+
+            if (handler) {
+                try {
+                    handler(std::current_exception());
+                } catch (...) {
+                    // Nowhere to report
+                }
+            }
+        }
+        request = nullptr;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitAsyncExecutor::enqueue
+// Purpose: Adds request to the queue, waits if queue is full until I/O thread takes request or timeout expires
+// std::function<void()>&& request: request to be added
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitAsyncExecutor::enqueue(std::function<void()>&& request, EKitTimeout& to) {
+    {
+        std::unique_lock<std::mutex> lock(queue_lock);
+        auto ready = [this]() { return queue_count < queue.size() || stopping; };
+        int left = to.remaining();
+
+        if (left == 0) {
+            not_full.wait(lock, ready);
+        } else if (to.expired() ||
+                   !not_full.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(left), ready)) {
+            return EKIT_TIMEOUT;
+        }
+
+        if (stopping) {
+            return EKIT_DISCONNECTED;
+        }
+
+        queue[(queue_head + queue_count) % queue.size()] = std::move(request);
+        queue_count++;
+    }
+    not_empty.notify_one();
+
+    return EKIT_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitAsyncExecutor::post
+// Purpose: Submits request with callback completion
+// std::function<void()> request: request to be executed
+// std::function<void(std::exception_ptr)> completion: completion callback, may be empty
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitAsyncExecutor::post(std::function<void()> request,
+                                   std::function<void(std::exception_ptr)> completion,
+                                   EKitTimeout& to) {
+    assert(request);
+    return enqueue([request, completion]() {
+        std::exception_ptr ex;
+        try {
+            request();
+        } catch (...) {
+            ex = std::current_exception();
+        }
+
+        if (completion) {
+            completion(ex);
+        }
+    }, to);
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusGroup::EKitBusGroup
+// Purpose: EKitBusGroup class constructor
+// size_t queue_len: maximum number of pending requests per bus
+//------------------------------------------------------------------------------------
+EKitBusGroup::EKitBusGroup(size_t queue_len) :
+    queue_length(queue_len),
+    outstanding(0) {
+    assert(queue_len > 0);
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusGroup::~EKitBusGroup
+// Purpose: EKitBusGroup class destructor. Executors are destroyed before the rest of the members, so pending requests
+//          may still report completion.
+//------------------------------------------------------------------------------------
+EKitBusGroup::~EKitBusGroup() {
+    executors.clear();
+}
+
+void EKitBusGroup::add_bus(std::shared_ptr<EKitBus> bus) {
+    assert(bus && executors.count(bus.get()) == 0);
+    const EKitBus* key = bus.get();
+    executors[key].reset(new EKitAsyncExecutor(std::move(bus), queue_length));
+    executors[key]->set_error_handler(on_error);
+}
+
+void EKitBusGroup::set_error_handler(std::function<void(std::exception_ptr)> handler) {
+    on_error = std::move(handler);
+    for (auto& e : executors) {
+        e.second->set_error_handler(on_error);
+    }
+}
+
+size_t EKitBusGroup::size() const {
+    return executors.size();
+}
+
+size_t EKitBusGroup::pending() {
+    std::lock_guard<std::mutex> lock(group_lock);
+    return outstanding;
+}
+
+EKitAsyncExecutor* EKitBusGroup::get_executor(const EKitBus* bus) const {
+    auto it = executors.find(bus);
+    return (it == executors.end()) ? nullptr : it->second.get();
+}
+
+void EKitBusGroup::request_done() {
+    std::lock_guard<std::mutex> lock(group_lock);
+    assert(outstanding > 0);
+    outstanding--;
+    if (outstanding == 0) {
+        all_done.notify_all();
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusGroup::post
+// Purpose: Submits request to the executor of the bus. Request is counted as outstanding until completion callback
+//          returns.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitBusGroup::post(const std::shared_ptr<EKitBus>& bus,
+                              std::function<void()> request,
+                              std::function<void(std::exception_ptr)> completion,
+                              EKitTimeout& to) {
+    EKitAsyncExecutor* executor = get_executor(bus.get());
+    if (executor == nullptr) {
+        return EKIT_BAD_PARAM;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(group_lock);
+        outstanding++;
+    }
+
+    EKIT_ERROR err = executor->post(std::move(request), [this, completion](std::exception_ptr ex) {
+        // Request is completed even if completion callback throws, exception is passed to executor error handler
+        try {
+            if (completion) {
+                completion(ex);
+            }
+        } catch (...) {
+            request_done();
+            throw;
+        }
+        request_done();
+    }, to);
+
+    if (err != EKIT_OK) {
+        request_done();
+    }
+
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusGroup::join
+// Purpose: Waits until all the requests submitted to all the buses are completed
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitBusGroup::join(EKitTimeout& to) {
+    std::unique_lock<std::mutex> lock(group_lock);
+    while (outstanding > 0) {
+        int left = to.remaining();
+        if (left == 0) {
+            all_done.wait(lock);
+        } else if (to.expired()) {
+            return EKIT_TIMEOUT;
+        } else {
+            all_done.wait_for(lock, std::chrono::milliseconds(left));
+        }
+    }
+
+    return EKIT_OK;
+}
@@ -0,0 +1,1072 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus broker and remote bus implementation
+ *   \author Oleh Sharuda
+ */
+
+#include "ekit_broker.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "tools.hpp"
+
+/// \brief Maximum size of the broker message.
+static constexpr size_t broker_message_size = sizeof(EKitBrokerRequest) + broker_inline_payload;
+
+//------------------------------------------------------------------------------------
+// broker_send
+// Purpose: Sends single message, optionally with file descriptor attached.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+static EKIT_ERROR broker_send(int sock, const void* buffer, size_t len, int fd) {
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    iov.iov_base = const_cast<void*>(buffer);
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t res = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (res < 0) {
+        return ERRNO_TO_EKIT_ERROR(errno);
+    }
+
+    return (static_cast<size_t>(res) == len) ? EKIT_OK : EKIT_WRITE_FAILED;
+}
+
+//------------------------------------------------------------------------------------
+// broker_recv
+// Purpose: Receives single message. If fd is not nullptr, it receives attached file descriptor (-1 if there is no
+//          descriptor attached).
+// Returns: corresponding EKIT_ERROR code, EKIT_DISCONNECTED if peer has closed connection.
+//------------------------------------------------------------------------------------
+static EKIT_ERROR broker_recv(int sock, void* buffer, size_t max_len, size_t& len, int* fd) {
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    iov.iov_base = buffer;
+    iov.iov_len = max_len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t res;
+    do {
+        res = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (res < 0 && errno == EINTR);
+
+    if (res < 0) {
+        return ERRNO_TO_EKIT_ERROR(errno);
+    }
+
+    if (res == 0) {
+        return EKIT_DISCONNECTED;
+    }
+
+    if (fd != nullptr) {
+        *fd = -1;
+    }
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int rfd;
+            memcpy(&rfd, CMSG_DATA(cmsg), sizeof(int));
+            if (fd != nullptr) {
+                *fd = rfd;
+            } else {
+                ::close(rfd);
+            }
+        }
+    }
+
+    len = static_cast<size_t>(res);
+    return ((msg.msg_flags & MSG_TRUNC) != 0) ? EKIT_PROTOCOL : EKIT_OK;
+}
+
+//------------------------------------------------------------------------------------
+// broker_address
+// Purpose: Fills Unix socket address.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+static EKIT_ERROR broker_address(const std::string& path, struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.length() >= sizeof(addr.sun_path)) {
+        return EKIT_BAD_PARAM;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.length());
+    return EKIT_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusBroker::EKitBusBroker
+// Purpose: EKitBusBroker class constructor
+//------------------------------------------------------------------------------------
+EKitBusBroker::EKitBusBroker(const std::string& path) :
+    socket_path(path),
+    listen_fd(-1),
+    stopping(false) {
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusBroker::~EKitBusBroker
+// Purpose: EKitBusBroker class destructor
+//------------------------------------------------------------------------------------
+EKitBusBroker::~EKitBusBroker() {
+    stop();
+}
+
+void EKitBusBroker::add_bus(const std::string& name, std::shared_ptr<EKitBus> bus) {
+    assert(listen_fd < 0);
+    std::shared_ptr<BrokerBus> b(new BrokerBus);
+    b->bus = std::move(bus);
+    buses[name] = b;
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusBroker::start
+// Purpose: Creates listening socket and starts accepting connections
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitBusBroker::start() {
+    EKIT_ERROR err;
+    struct sockaddr_un addr;
+
+    if (listen_fd >= 0) {
+        return EKIT_ALREADY_CONNECTED;
+    }
+
+    err = broker_address(socket_path, addr);
+    if (err != EKIT_OK) {
+        goto done;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        err = ERRNO_TO_EKIT_ERROR(errno);
+        goto done;
+    }
+
+    // Socket left by previous instance is removed, make_pid_file() is expected to protect from the second instance.
+    unlink(socket_path.c_str());
+
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listen_fd, SOMAXCONN) < 0) {
+        err = ERRNO_TO_EKIT_ERROR(errno);
+        ::close(listen_fd);
+        listen_fd = -1;
+        goto done;
+    }
+
+    stopping = false;
+    accept_thread = std::thread(&EKitBusBroker::accept_func, this);
+
+done:
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusBroker::stop
+// Purpose: Stops accepting connections, disconnects clients and waits for all the threads
+//------------------------------------------------------------------------------------
+void EKitBusBroker::stop() {
+    if (listen_fd < 0) {
+        return;
+    }
+
+    stopping = true;
+    shutdown(listen_fd, SHUT_RDWR);
+    accept_thread.join();
+    ::close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path.c_str());
+
+    std::list<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(clients_lock);
+        for (int fd : clients) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        threads.swap(client_threads);
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void EKitBusBroker::accept_func() {
+    while (!stopping) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(clients_lock);
+        if (stopping) {
+            ::close(fd);
+            break;
+        }
+        reap_threads();
+        clients.insert(fd);
+        client_threads.emplace_back(&EKitBusBroker::client_func, this, fd);
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusBroker::reap_threads
+// Purpose: Joins threads which finished serving clients, so threads of the closed connections don't accumulate
+// Note: Thread adds itself to finished list as the last action, so join doesn't wait.
+//------------------------------------------------------------------------------------
+void EKitBusBroker::reap_threads() {
+    for (auto id : finished) {
+        auto t = std::find_if(client_threads.begin(),
+                              client_threads.end(),
+                              [id](const std::thread& th) { return th.get_id() == id; });
+        if (t != client_threads.end()) {
+            t->join();
+            client_threads.erase(t);
+        }
+    }
+    finished.clear();
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusBroker::lock_bus
+// Purpose: Waits until all the clients requested lock earlier release the bus, then locks bus
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitBusBroker::lock_bus(BrokerBus& b, int fd, int addr, EKitTimeout& to) {
+    EKIT_ERROR err = EKIT_OK;
+    {
+        std::unique_lock<std::mutex> lock(b.gate_lock);
+        b.waiters.push_back(fd);
+        auto my_turn = [&b, fd]() { return b.owner < 0 && b.waiters.front() == fd; };
+
+        for (;;) {
+            if (my_turn()) break;
+
+            int left = to.remaining();
+            if (left == 0) {
+                b.gate_cv.wait(lock);
+            } else if (b.gate_cv.wait_for(lock, std::chrono::milliseconds(left)) == std::cv_status::timeout &&
+                       to.expired() && !my_turn()) {
+                err = EKIT_TIMEOUT;
+                break;
+            }
+        }
+
+        b.waiters.remove(fd);
+        if (err != EKIT_OK) {
+            // The next waiter may be the first now
+            b.gate_cv.notify_all();
+            goto done;
+        }
+        b.owner = fd;
+    }
+
+    // Just the owner of the gate gets here, so bus lock is not contended by other clients
+    err = (addr < 0) ? b.bus->lock(to) : b.bus->lock(addr, to);
+    if (err != EKIT_OK) {
+        std::lock_guard<std::mutex> lock(b.gate_lock);
+        b.owner = -1;
+        b.gate_cv.notify_all();
+    }
+
+done:
+    return err;
+}
+
+void EKitBusBroker::unlock_bus(BrokerBus& b) {
+    b.bus->unlock();
+    std::lock_guard<std::mutex> lock(b.gate_lock);
+    b.owner = -1;
+    b.gate_cv.notify_all();
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusBroker::client_func
+// Purpose: Executes client requests. Requests other than lock and unlock are expected to be sent while bus is locked
+//          by the client, the same way as EKitBus functions are expected to be called.
+//------------------------------------------------------------------------------------
+void EKitBusBroker::client_func(int fd) {
+    std::vector<uint8_t> in(broker_message_size);
+    std::vector<uint8_t> out(sizeof(EKitBrokerResponse) + broker_inline_payload);
+    std::vector<uint8_t> read_all_buffer;
+    std::vector<EKitBusSegment> segs;
+    std::shared_ptr<BrokerBus> b;
+    uint8_t* shm = nullptr;
+    size_t shm_size = 0;
+    bool locked = false;
+
+    for (;;) {
+        EKIT_ERROR err;
+        size_t len;
+        int shm_fd = -1;
+
+        err = broker_recv(fd, in.data(), in.size(), len, (shm == nullptr) ? &shm_fd : nullptr);
+        if (err != EKIT_OK || len < sizeof(EKitBrokerRequest)) {
+            if (shm_fd >= 0) ::close(shm_fd);
+            break;
+        }
+
+        EKitBrokerRequest req;
+        memcpy(&req, in.data(), sizeof(req));
+        EKitBrokerResponse resp;
+        memset(&resp, 0, sizeof(resp));
+        EKitTimeout to(static_cast<int>(req.timeout_ms));
+
+        // Request payload
+        const uint8_t* payload;
+        if ((req.flags & BROKER_PAYLOAD_SHM) != 0) {
+            payload = shm;
+            if (shm == nullptr || req.length > shm_size) break;
+        } else {
+            payload = in.data() + sizeof(req);
+            if (req.length != len - sizeof(req)) break;
+        }
+
+        // Response payload: short responses are sent inline, longer are placed into the responses area
+        auto response = [&](size_t rlen) -> uint8_t* {
+            resp.length = static_cast<uint32_t>(rlen);
+            if (rlen <= broker_inline_payload) {
+                resp.flags = 0;
+                return out.data() + sizeof(resp);
+            }
+            resp.flags = BROKER_PAYLOAD_SHM;
+            return (rlen <= shm_size) ? shm + shm_size : nullptr;
+        };
+
+        if (req.op == BROKER_OP_HELLO) {
+            if (b || shm_fd < 0) {
+                if (shm_fd >= 0) ::close(shm_fd);
+                break;
+            }
+
+            // Memory is accepted only if client can't resize it, otherwise broker may access pages beyond the end of
+            // the file and get SIGBUS.
+            struct stat st;
+            int seals = fcntl(shm_fd, F_GET_SEALS);
+            const int required_seals = F_SEAL_SHRINK | F_SEAL_GROW;
+            if (req.value <= 0 || fstat(shm_fd, &st) != 0 ||
+                st.st_size != 2 * static_cast<off_t>(req.value) ||
+                seals < 0 || (seals & required_seals) != required_seals) {
+                ::close(shm_fd);
+                break;
+            }
+
+            shm_size = static_cast<uint32_t>(req.value);
+            void* p = mmap(nullptr, 2 * shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+            ::close(shm_fd);
+            if (p == MAP_FAILED) {
+                shm_size = 0;
+                break;
+            }
+            shm = static_cast<uint8_t*>(p);
+
+            auto it = buses.find(std::string(reinterpret_cast<const char*>(payload), req.length));
+            if (it == buses.end()) {
+                resp.err = EKIT_NOT_OPENED;
+            } else if (it->second->bus->get_bus_type() != static_cast<EKitBusType>(req.arg)) {
+                resp.err = EKIT_WRONG_DEVICE;
+            } else {
+                b = it->second;
+            }
+        } else if (!b) {
+            break;
+        } else if (req.op == BROKER_OP_LOCK) {
+            resp.err = locked ? EKIT_LOCKED : lock_bus(*b, fd, req.arg, to);
+            locked = locked || resp.err == EKIT_OK;
+        } else if (req.op == BROKER_OP_UNLOCK) {
+            if (locked) {
+                unlock_bus(*b);
+                locked = false;
+            }
+            continue; // No response for unlock
+        } else if (!locked) {
+            resp.err = EKIT_UNLOCKED;
+        } else {
+            EKitBus* bus = b->bus.get();
+            switch (req.op) {
+                case BROKER_OP_READ: {
+                    uint8_t* data = response(req.rlength);
+                    resp.err = (data == nullptr) ? EKIT_BAD_PARAM : bus->read(data, req.rlength, to);
+                }
+                break;
+
+                case BROKER_OP_WRITE:
+                    resp.err = bus->write(payload, req.length, to);
+                break;
+
+                case BROKER_OP_WRITE_READ: {
+                    uint8_t* data = response(req.rlength);
+                    resp.err = (data == nullptr) ? EKIT_BAD_PARAM :
+                                bus->write_read(payload, req.length, data, req.rlength, to);
+                }
+                break;
+
+                case BROKER_OP_READ_ALL: {
+                    resp.err = bus->read_all(read_all_buffer, to);
+                    if (resp.err == EKIT_OK) {
+                        uint8_t* data = response(read_all_buffer.size());
+                        if (data == nullptr) {
+                            resp.err = EKIT_OVERFLOW;
+                        } else {
+                            memcpy(data, read_all_buffer.data(), read_all_buffer.size());
+                        }
+                    }
+                }
+                break;
+
+                case BROKER_OP_TRANSACTION: {
+                    // Segment table is followed by data of the write segments, read segments data is returned in
+                    // the same order.
+                    // Lengths are supplied by client: count is bounded before multiplication, and every segment
+                    // length is checked against the space left before it is added, so sums can't wrap.
+                    size_t count = static_cast<size_t>(req.arg);
+                    size_t wpos;
+                    size_t rlen = 0;
+                    size_t max_rlen = std::max(broker_inline_payload, shm_size);
+                    uint8_t* data;
+                    if (req.arg < 0 || count > req.length / sizeof(EKitBrokerSegment)) {
+                        resp.err = EKIT_BAD_PARAM;
+                        break;
+                    }
+
+                    wpos = count * sizeof(EKitBrokerSegment);
+                    segs.resize(count);
+                    for (size_t i = 0; i < count && resp.err == EKIT_OK; i++) {
+                        EKitBrokerSegment s;
+                        memcpy(&s, payload + i * sizeof(s), sizeof(s));
+                        segs[i].length = s.length;
+                        segs[i].flags = static_cast<uint8_t>(s.flags);
+                        if ((s.flags & BUS_SEGMENT_READ) != 0) {
+                            if (s.length > max_rlen - rlen) {
+                                resp.err = EKIT_BAD_PARAM;
+                            } else {
+                                rlen += s.length;
+                            }
+                        } else {
+                            if (s.length > req.length - wpos) {
+                                resp.err = EKIT_BAD_PARAM;
+                            } else {
+                                wpos += s.length;
+                            }
+                        }
+                    }
+                    if (resp.err != EKIT_OK) {
+                        break;
+                    }
+
+                    data = response(rlen);
+                    if (wpos != req.length || data == nullptr) {
+                        resp.err = EKIT_BAD_PARAM;
+                        break;
+                    }
+
+                    wpos = count * sizeof(EKitBrokerSegment);
+                    for (auto& s : segs) {
+                        if ((s.flags & BUS_SEGMENT_READ) != 0) {
+                            s.buffer = data;
+                            data += s.length;
+                        } else {
+                            s.buffer = const_cast<uint8_t*>(payload + wpos);
+                            wpos += s.length;
+                        }
+                    }
+
+                    resp.err = bus->transaction(segs.data(), count, to);
+                }
+                break;
+
+                case BROKER_OP_SET_OPT:
+                    resp.err = bus->set_opt(req.arg, req.value, to);
+                break;
+
+                case BROKER_OP_GET_OPT: {
+                    int value = 0;
+                    resp.err = bus->get_opt(req.arg, value, to);
+                    resp.value = value;
+                }
+                break;
+
+                case BROKER_OP_SUSPEND:
+                    resp.err = bus->suspend(to);
+                break;
+
+                case BROKER_OP_RESUME:
+                    resp.err = bus->resume(to);
+                break;
+
+                default:
+                    resp.err = EKIT_NOT_SUPPORTED;
+            }
+        }
+
+        // Data is returned even if request failed: bus may return partial data with some errors (EKIT_OVERFLOW)
+        if ((resp.flags & BROKER_PAYLOAD_SHM) != 0 && resp.length > shm_size) {
+            resp.length = 0;
+            resp.flags = 0;
+        }
+        memcpy(out.data(), &resp, sizeof(resp));
+        len = sizeof(resp) + (((resp.flags & BROKER_PAYLOAD_SHM) == 0) ? resp.length : 0);
+        if (broker_send(fd, out.data(), len, -1) != EKIT_OK) {
+            break;
+        }
+    }
+
+    // Lock owned by disconnected client is released
+    if (locked) {
+        unlock_bus(*b);
+    }
+
+    if (shm != nullptr) {
+        munmap(shm, 2 * shm_size);
+    }
+
+    std::lock_guard<std::mutex> lock(clients_lock);
+    clients.erase(fd);
+    ::close(fd);
+    finished.push_back(std::this_thread::get_id());
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::EKitRemoteBus
+// Purpose: EKitRemoteBus class constructor
+//------------------------------------------------------------------------------------
+EKitRemoteBus::EKitRemoteBus(const std::string& path, const std::string& name, EKitBusType bt, size_t shm_len) :
+    super(bt),
+    socket_path(path),
+    remote_name(name),
+    shm_size(std::max(shm_len, broker_inline_payload)),
+    sock(-1),
+    shm(nullptr),
+    message(broker_message_size),
+    remote_locked(false),
+    arbitrated(false) {
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::~EKitRemoteBus
+// Purpose: EKitRemoteBus class destructor
+//------------------------------------------------------------------------------------
+EKitRemoteBus::~EKitRemoteBus() {
+    EKitTimeout to(0);
+    super::lock(to);
+    close();
+    super::unlock();
+}
+
+void EKitRemoteBus::disconnect() {
+    if (sock >= 0) {
+        ::close(sock);
+        sock = -1;
+    }
+
+    if (shm != nullptr) {
+        munmap(shm, 2 * shm_size);
+        shm = nullptr;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::request_payload
+// Purpose: Selects location of the request payload and sets payload flags of the request
+// Returns: Pointer where payload must be placed, nullptr if payload doesn't fit shared memory
+//------------------------------------------------------------------------------------
+uint8_t* EKitRemoteBus::request_payload(EKitBrokerRequest& req, size_t len) {
+    req.length = static_cast<uint32_t>(len);
+    if (len <= broker_inline_payload) {
+        req.flags = 0;
+        return message.data() + sizeof(req);
+    }
+
+    req.flags = BROKER_PAYLOAD_SHM;
+    return (len <= shm_size) ? shm : nullptr;
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::call
+// Purpose: Sends request (payload must be placed with request_payload()) and receives response
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitRemoteBus::call(EKitBrokerRequest& req, EKitBrokerResponse& resp, EKitTimeout& to) {
+    EKIT_ERROR err;
+    size_t len;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    memset(&resp, 0, sizeof(resp));
+
+    if (sock < 0) {
+        err = EKIT_NOT_OPENED;
+        goto done;
+    }
+
+    if (to.expired()) {
+        err = EKIT_TIMEOUT;
+        goto done;
+    }
+
+    req.timeout_ms = static_cast<uint32_t>(to.remaining());
+    memcpy(message.data(), &req, sizeof(req));
+    len = sizeof(req) + (((req.flags & BROKER_PAYLOAD_SHM) == 0) ? req.length : 0);
+    err = broker_send(sock, message.data(), len, -1);
+    if (err != EKIT_OK || req.op == BROKER_OP_UNLOCK) {
+        goto done;
+    }
+
+    err = broker_recv(sock, message.data(), message.size(), len, nullptr);
+    if (err != EKIT_OK) {
+        goto done;
+    }
+
+    if (len < sizeof(resp)) {
+        err = EKIT_PROTOCOL;
+        goto done;
+    }
+
+    memcpy(&resp, message.data(), sizeof(resp));
+    if ((resp.flags & BROKER_PAYLOAD_SHM) != 0 ? resp.length > shm_size : resp.length != len - sizeof(resp)) {
+        err = EKIT_PROTOCOL;
+        goto done;
+    }
+
+    err = resp.err;
+
+done:
+    return err;
+}
+
+const uint8_t* EKitRemoteBus::response_payload(const EKitBrokerResponse& resp) const {
+    return ((resp.flags & BROKER_PAYLOAD_SHM) != 0) ? shm + shm_size : message.data() + sizeof(resp);
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::open
+// Purpose: Connects to broker, creates shared memory and selects bus
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitRemoteBus::open(EKitTimeout& to) {
+    EKIT_ERROR err;
+    struct sockaddr_un addr;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    uint8_t* payload;
+    size_t len;
+    int shm_fd = -1;
+    void* p;
+    super::lock(to);
+
+    if (state != BUS_CLOSED) {
+        err = EKIT_ALREADY_CONNECTED;
+        goto done;
+    }
+
+    err = broker_address(socket_path, addr);
+    if (err != EKIT_OK || remote_name.length() > broker_inline_payload) {
+        err = EKIT_BAD_PARAM;
+        goto done;
+    }
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        err = ERRNO_TO_EKIT_ERROR(errno);
+        goto done;
+    }
+
+    if (connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        err = EKIT_CANT_CONNECT;
+        goto done;
+    }
+
+    // Requests area followed by responses area
+    shm_fd = memfd_create("hlek_broker", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (shm_fd < 0 || ftruncate(shm_fd, static_cast<off_t>(2 * shm_size)) < 0 ||
+        fcntl(shm_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        err = ERRNO_TO_EKIT_ERROR(errno);
+        goto done;
+    }
+
+    p = mmap(nullptr, 2 * shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (p == MAP_FAILED) {
+        err = ERRNO_TO_EKIT_ERROR(errno);
+        goto done;
+    }
+    shm = static_cast<uint8_t*>(p);
+
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_HELLO;
+    req.arg = get_bus_type();
+    req.value = static_cast<int32_t>(shm_size);
+    req.timeout_ms = static_cast<uint32_t>(to.remaining());
+    payload = request_payload(req, remote_name.length());
+    memcpy(payload, remote_name.c_str(), remote_name.length());
+    memcpy(message.data(), &req, sizeof(req));
+    len = sizeof(req) + req.length;
+    err = broker_send(sock, message.data(), len, shm_fd);
+    if (err != EKIT_OK) {
+        goto done;
+    }
+
+    err = broker_recv(sock, message.data(), message.size(), len, nullptr);
+    if (err != EKIT_OK) {
+        goto done;
+    }
+
+    if (len < sizeof(resp)) {
+        err = EKIT_PROTOCOL;
+        goto done;
+    }
+
+    memcpy(&resp, message.data(), sizeof(resp));
+    err = resp.err;
+
+done:
+    if (shm_fd >= 0) {
+        ::close(shm_fd);
+    }
+
+    if (err == EKIT_OK) {
+        state = BUS_OPENED;
+    } else {
+        disconnect();
+    }
+
+    super::unlock();
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::close
+// Purpose: Disconnects from broker. Lock owned on broker side is released by broker.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitRemoteBus::close() {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    if (state == BUS_CLOSED) return EKIT_DISCONNECTED;
+
+    disconnect();
+    state = BUS_CLOSED;
+
+    return EKIT_OK;
+}
+
+EKIT_ERROR EKitRemoteBus::suspend(EKitTimeout& to) {
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_SUSPEND;
+    return call(req, resp, to);
+}
+
+EKIT_ERROR EKitRemoteBus::resume(EKitTimeout& to) {
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_RESUME;
+    return call(req, resp, to);
+}
+
+EKIT_ERROR EKitRemoteBus::lock(EKitTimeout& to) {
+    EKIT_ERROR res;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    lock_bus(__builtin_return_address(0));
+
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_LOCK;
+    req.arg = -1;
+    res = call(req, resp, to);
+    if (res != EKIT_OK) {
+        super::unlock();
+    } else {
+        remote_locked = true;
+    }
+
+    return res;
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::lock
+// Purpose: Locks bus in this process, then on broker side. Broker grants lock to processes in order of requests.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitRemoteBus::lock(int addr, EKitTimeout& to) {
+    EKIT_ERROR res;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    auto start = std::chrono::steady_clock::now();
+
+    res = arbitrate(addr, to);
+    if (res != EKIT_OK) {
+        goto done;
+    }
+
+    lock_bus(__builtin_return_address(0));
+
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_LOCK;
+    req.arg = addr;
+    res = call(req, resp, to);
+    if (res != EKIT_OK) {
+        super::unlock();
+        release_arbiter();
+        goto done;
+    }
+
+    remote_locked = true;
+    arbitrated = true;
+
+    if (metrics) {
+        metrics->add_lock(addr, EKitBusMetrics::elapsed_us(start));
+    }
+done:
+    return res;
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::unlock
+// Purpose: Unlocks bus. Broker doesn't respond to unlock, so it doesn't wait for round trip.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitRemoteBus::unlock() {
+    EKIT_ERROR err = EKIT_OK;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    EKitTimeout to(0);
+
+    if (!remote_locked) {
+        assert(false);
+        return EKIT_UNLOCKED;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_UNLOCK;
+    call(req, resp, to);
+    remote_locked = false;
+
+    super::unlock();
+
+    // Unaddressable lock doesn't use arbiter
+    if (arbitrated) {
+        arbitrated = false;
+        release_arbiter();
+    }
+    return err;
+}
+
+EKIT_ERROR EKitRemoteBus::read(void* ptr, size_t len, EKitTimeout& to) {
+    EKIT_ERROR err;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+
+    if (len > shm_size) {
+        return EKIT_BAD_PARAM;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_READ;
+    req.rlength = static_cast<uint32_t>(len);
+    err = call(req, resp, to);
+    if (err == EKIT_OK && resp.length != len) {
+        err = EKIT_PROTOCOL;
+    }
+
+    if (resp.length == len) {
+        memcpy(ptr, response_payload(resp), len);
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitRemoteBus::write(const void* ptr, size_t len, EKitTimeout& to) {
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_WRITE;
+    uint8_t* payload = request_payload(req, len);
+    if (payload == nullptr) {
+        return EKIT_BAD_PARAM;
+    }
+
+    memcpy(payload, ptr, len);
+    return call(req, resp, to);
+}
+
+EKIT_ERROR EKitRemoteBus::write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) {
+    EKIT_ERROR err;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_WRITE_READ;
+    req.rlength = static_cast<uint32_t>(rlen);
+    uint8_t* payload = request_payload(req, wlen);
+    if (payload == nullptr || rlen > shm_size) {
+        return EKIT_BAD_PARAM;
+    }
+
+    memcpy(payload, wbuf, wlen);
+    err = call(req, resp, to);
+    if (err == EKIT_OK && resp.length != rlen) {
+        err = EKIT_PROTOCOL;
+    }
+
+    if (resp.length == rlen) {
+        memcpy(rbuf, response_payload(resp), rlen);
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitRemoteBus::read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) {
+    EKIT_ERROR err;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_READ_ALL;
+    err = call(req, resp, to);
+    if (err == EKIT_OK) {
+        const uint8_t* data = response_payload(resp);
+        buffer.assign(data, data + resp.length);
+    }
+
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitRemoteBus::transaction
+// Purpose: Sends all the segments with a single request, so transaction is executed by broker as a whole
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitRemoteBus::transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) {
+    EKIT_ERROR err;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    uint8_t* payload;
+    const uint8_t* data;
+    size_t wlen = count * sizeof(EKitBrokerSegment);
+    size_t rlen = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if ((segments[i].flags & BUS_SEGMENT_READ) != 0) {
+            rlen += segments[i].length;
+        } else {
+            wlen += segments[i].length;
+        }
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_TRANSACTION;
+    req.arg = static_cast<int32_t>(count);
+    payload = request_payload(req, wlen);
+    if (payload == nullptr || rlen > shm_size) {
+        err = EKIT_BAD_PARAM;
+        goto done;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        EKitBrokerSegment s;
+        s.length = static_cast<uint32_t>(segments[i].length);
+        s.flags = segments[i].flags;
+        memcpy(payload, &s, sizeof(s));
+        payload += sizeof(s);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if ((segments[i].flags & BUS_SEGMENT_READ) == 0) {
+            memcpy(payload, segments[i].buffer, segments[i].length);
+            payload += segments[i].length;
+        }
+    }
+
+    err = call(req, resp, to);
+    if (resp.length != rlen) {
+        if (err == EKIT_OK) err = EKIT_PROTOCOL;
+        goto done;
+    }
+
+    // Read data is copied even on error, like bus would fill buffers with data read before error occurred
+    data = response_payload(resp);
+    for (size_t i = 0; i < count; i++) {
+        if ((segments[i].flags & BUS_SEGMENT_READ) != 0) {
+            memcpy(segments[i].buffer, data, segments[i].length);
+            data += segments[i].length;
+        }
+    }
+
+done:
+    return err;
+}
+
+EKIT_ERROR EKitRemoteBus::set_opt(int opt, int value, EKitTimeout& to) {
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_SET_OPT;
+    req.arg = opt;
+    req.value = value;
+    return call(req, resp, to);
+}
+
+EKIT_ERROR EKitRemoteBus::get_opt(int opt, int& value, EKitTimeout& to) {
+    EKIT_ERROR err;
+    EKitBrokerRequest req;
+    EKitBrokerResponse resp;
+    memset(&req, 0, sizeof(req));
+    req.op = BROKER_OP_GET_OPT;
+    req.arg = opt;
+    err = call(req, resp, to);
+    if (err == EKIT_OK) {
+        value = resp.value;
+    }
+
+    return err;
+}
@@ -20,7 +20,12 @@
  *   \author Oleh Sharuda
  */
 
+#include <algorithm>
 #include "ekit_bus.hpp"
+#include "ekit_arbiter.hpp"
+
+constexpr size_t EKitBus::max_interrupted_retries;
+constexpr uint32_t EKitBus::max_busy_delay_us;
 
 EKitBus::EKitBus(const EKitBusType bt) :
     bus_type(bt){
@@ -30,7 +35,7 @@ EKitBus::~EKitBus() {
 }
 
 EKIT_ERROR EKitBus::lock(EKitTimeout& to) {
-	bus_lock.lock();
+	lock_bus(__builtin_return_address(0));
 	return EKIT_OK;
 }
 
@@ -104,6 +109,68 @@ EKIT_ERROR EKitBus::get_opt(int opt, int& value, EKitTimeout& to) {
 	return EKIT_NOT_SUPPORTED;
 }
 
+EKIT_ERROR EKitBus::transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) {
+    EKIT_ERROR err = EKIT_OK;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    for (size_t i = 0; i < count && err == EKIT_OK; i++) {
+        EKitBusSegment& seg = segments[i];
+        if (seg.length == 0) continue;
+
+        if ((seg.flags & BUS_SEGMENT_READ) != 0) {
+            err = read(seg.buffer, seg.length, to);
+        } else {
+            err = write(seg.buffer, seg.length, to);
+        }
+    }
+
+    return err;
+}
+
+void EKitBus::set_arbiter(std::shared_ptr<EKitBusArbiter> arb) {
+    arbiter = std::move(arb);
+}
+
+void EKitBus::set_metrics(std::shared_ptr<EKitBusMetrics> m) {
+    metrics = std::move(m);
+}
+
+std::shared_ptr<EKitBusMetrics> EKitBus::get_metrics() const {
+    return metrics;
+}
+
+EKIT_ERROR EKitBus::arbitrate(int addr, EKitTimeout& to) {
+    return arbiter ? arbiter->acquire(addr, to) : EKIT_OK;
+}
+
+void EKitBus::release_arbiter() {
+    if (arbiter) {
+        arbiter->release();
+    }
+}
+
+void EKitBus::lock_bus(const void* site) {
+    SAFE_MUTEX_LOCK_FROM(bus_lock, site);
+}
+
+void EKitBus::busy_delay(size_t retries, EKitTimeout& to) {
+    uint64_t us = max_busy_delay_us;
+    int remaining_ms = to.remaining();
+
+    if (retries < 16) {
+        us = std::min<uint64_t>(1ULL << retries, max_busy_delay_us);
+    }
+    if (remaining_ms > 0) {
+        us = std::min<uint64_t>(us, static_cast<uint64_t>(remaining_ms) * 1000);
+    }
+
+    tools::sleep_us(us);
+}
+
+EKitBusType EKitBus::get_bus_type() const {
+    return bus_type;
+}
+
 void EKitBus::check_bus(const EKitBusType busid) const {
     static const char* const func_name = "EKitBus::check_bus";
     if (busid != bus_type) {
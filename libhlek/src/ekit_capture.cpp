@@ -0,0 +1,672 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Chunked capture file of the ADC samples and timestamps implementation
+ *   \author Oleh Sharuda
+ */
+
+#include "ekit_capture.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+
+#include "ekit_error.hpp"
+#include "adcdev.hpp"
+#include "timetrackerdev.hpp"
+
+static_assert(sizeof(off_t) >= sizeof(uint64_t), "Capture files require 64-bit file offsets (_FILE_OFFSET_BITS=64)");
+
+//------------------------------------------------------------------------------------
+// capture_copy_name
+// Purpose: Copies string into fixed size field, string is truncated and terminated by zero
+//------------------------------------------------------------------------------------
+static void capture_copy_name(char* dst, size_t size, const std::string& src) {
+    size_t n = std::min(size - 1, src.length());
+    memcpy(dst, src.c_str(), n);
+    memset(dst + n, 0, size - n);
+}
+
+//------------------------------------------------------------------------------------
+// capture_write_all
+// Purpose: Writes buffer at the offset of the file
+// Returns: true if buffer is written, otherwise false
+//------------------------------------------------------------------------------------
+static bool capture_write_all(int fd, const void* buf, size_t len, off_t offset) {
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// capture_read_all
+// Purpose: Reads buffer from the offset of the file
+// Returns: true if buffer is read, otherwise false (including end of the file)
+//------------------------------------------------------------------------------------
+static bool capture_read_all(int fd, void* buf, size_t len, off_t offset) {
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureWriter::EKitCaptureWriter
+// Purpose: Creates capture file and writes header. Chunks are mapped by the first append.
+// const std::string& path: path to the file
+// const EKitCaptureHeader& hdr: header
+// size_t chunk_size: size of the chunk
+// size_t grow_size: number of the bytes file grows by
+//------------------------------------------------------------------------------------
+EKitCaptureWriter::EKitCaptureWriter(const std::string& path,
+                                     const EKitCaptureHeader& hdr,
+                                     size_t chunk_size,
+                                     size_t grow_size) :
+    fd(-1),
+    header(hdr),
+    chunk_records(0),
+    grow_chunks(0),
+    map(nullptr),
+    map_offset(0),
+    map_first(0),
+    map_chunks(0),
+    chunk(nullptr),
+    records(0),
+    next_sample(0),
+    gap_pending(false) {
+    static const char* const func_name = "EKitCaptureWriter::EKitCaptureWriter";
+    std::vector<uint8_t> page(EKIT_CAPTURE_HEADER_SIZE, 0);
+
+    chunk_size = std::max<size_t>(chunk_size, 1);
+    chunk_size = (chunk_size + EKIT_CAPTURE_HEADER_SIZE - 1) / EKIT_CAPTURE_HEADER_SIZE * EKIT_CAPTURE_HEADER_SIZE;
+    if (hdr.record_size == 0 || hdr.channels > EKIT_CAPTURE_MAX_CHANNELS ||
+        chunk_size > UINT32_MAX || hdr.record_size > chunk_size - sizeof(EKitCaptureChunk)) {
+        throw EKitException(func_name, EKIT_BAD_PARAM, "Wrong record or chunk size, or too many channels");
+    }
+
+    memcpy(header.magic, EKIT_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = EKIT_CAPTURE_VERSION;
+    header.header_size = EKIT_CAPTURE_HEADER_SIZE;
+    header.chunk_size = static_cast<uint32_t>(chunk_size);
+    header.start_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count();
+
+    chunk_records = (chunk_size - sizeof(EKitCaptureChunk)) / header.record_size;
+    grow_chunks = std::max<size_t>((grow_size + chunk_size - 1) / chunk_size, 1);
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw EKitException(func_name, EKIT_OPEN_FAILED, "Failed to create " + path);
+    }
+
+    memcpy(page.data(), &header, sizeof(header));
+    if (!capture_write_all(fd, page.data(), page.size(), 0)) {
+        ::close(fd);
+        fd = -1;
+        throw EKitException(func_name, EKIT_WRITE_FAILED, "Failed to write header of " + path);
+    }
+}
+
+EKitCaptureWriter::~EKitCaptureWriter() {
+    try {
+        close();
+    } catch (EKitException&) {
+        // File remains without index, it is rebuilt by reader
+    }
+}
+
+EKitCaptureHeader EKitCaptureWriter::make_header(const ADCDev& adc, double sample_rate) {
+    static const char* const func_name = "EKitCaptureWriter::make_header";
+    EKitCaptureHeader hdr;
+    size_t channels = adc.get_input_count();
+
+    if (channels > EKIT_CAPTURE_MAX_CHANNELS) {
+        throw EKitException(func_name, EKIT_OUT_OF_RANGE, "Too many channels");
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = EKIT_CAPTURE_ADC;
+    hdr.record_size = static_cast<uint32_t>(channels * sizeof(uint16_t));
+    hdr.channels = static_cast<uint32_t>(channels);
+    hdr.tick_freq = sample_rate;
+    capture_copy_name(hdr.dev_name, sizeof(hdr.dev_name), adc.get_dev_name());
+    hdr.dev_id = adc.config->dev_id;
+    hdr.dev_buffer_len = adc.config->dev_buffer_len;
+    hdr.timer_freq = adc.config->timer_freq;
+    hdr.adc_maxval = adc.config->adc_maxval;
+    hdr.measurements_per_sample = adc.config->measurements_per_sample;
+
+    for (size_t ch = 0; ch < channels; ch++) {
+        std::pair<double, double> range = adc.get_input_range(ch);
+        capture_copy_name(hdr.channel[ch].name, sizeof(hdr.channel[ch].name), adc.get_input_name(ch, false));
+        capture_copy_name(hdr.channel[ch].adc_input, sizeof(hdr.channel[ch].adc_input), adc.get_input_name(ch, true));
+        hdr.channel[ch].min = range.first;
+        hdr.channel[ch].max = range.second;
+    }
+
+    return hdr;
+}
+
+EKitCaptureHeader EKitCaptureWriter::make_header(const TimeTrackerDev& ttdev) {
+    EKitCaptureHeader hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = EKIT_CAPTURE_TIMESTAMP;
+    hdr.record_size = sizeof(uint64_t);
+    hdr.channels = 1;
+    hdr.tick_freq = static_cast<double>(ttdev.config->tick_freq);
+    capture_copy_name(hdr.dev_name, sizeof(hdr.dev_name), ttdev.get_dev_name());
+    hdr.dev_id = ttdev.config->dev_id;
+    hdr.dev_buffer_len = static_cast<uint32_t>(ttdev.config->dev_buffer_len);
+    capture_copy_name(hdr.channel[0].name, sizeof(hdr.channel[0].name), "Timestamp");
+
+    return hdr;
+}
+
+void EKitCaptureWriter::unmap() {
+    if (map != nullptr) {
+        munmap(map, map_offset + map_chunks * header.chunk_size);
+        map = nullptr;
+        chunk = nullptr;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureWriter::next_chunk
+// Purpose: Starts new chunk. If it is beyond mapped chunks, file is extended by grow_chunks chunks and they are mapped.
+// bool gap: true if records were lost before the chunk
+// Note: Chunks are aligned by EKIT_CAPTURE_HEADER_SIZE, which is less than page size of some systems (16K, 64K), so
+//       mapping starts at page boundary before the chunk. Only grow_chunks chunks are mapped at a time, offsets are
+//       64-bit (see _FILE_OFFSET_BITS in libhlek CMakeLists.txt), so capture may exceed address space of 32-bit hosts.
+//------------------------------------------------------------------------------------
+void EKitCaptureWriter::next_chunk(bool gap) {
+    static const char* const func_name = "EKitCaptureWriter::next_chunk";
+    static const off_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t n = index.size();
+    size_t cs = header.chunk_size;
+
+    if (map == nullptr || n >= map_first + map_chunks) {
+        unmap();
+
+        // File is sparse, blocks are allocated when pages are written
+        if (ftruncate(fd, static_cast<off_t>(header.header_size + (n + grow_chunks) * cs)) != 0) {
+            throw EKitException(func_name, EKIT_WRITE_FAILED, "Failed to extend capture file");
+        }
+
+        off_t offset = static_cast<off_t>(header.header_size + n * cs);
+        off_t page_offset = offset / page_size * page_size;
+        size_t len = (offset - page_offset) + grow_chunks * cs;
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, page_offset);
+        if (p == MAP_FAILED) {
+            throw EKitException(func_name, EKIT_WRITE_FAILED, "Failed to map capture file");
+        }
+
+        madvise(p, len, MADV_SEQUENTIAL);
+        map = static_cast<uint8_t*>(p);
+        map_offset = offset - page_offset;
+        map_first = n;
+        map_chunks = grow_chunks;
+    }
+
+    chunk = reinterpret_cast<EKitCaptureChunk*>(map + map_offset + (n - map_first) * cs);
+    chunk->flags = gap ? EKIT_CAPTURE_CHUNK_GAP : 0;
+    chunk->index = n;
+    chunk->first_record = records;
+    chunk->first_sample = next_sample;
+    chunk->records = 0;
+    chunk->reserved = 0;
+    chunk->magic = EKIT_CAPTURE_CHUNK_MAGIC;
+
+    index.push_back(EKitCaptureIndexEntry{records, next_sample, 0, chunk->flags});
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureWriter::append
+// Purpose: Copies records into mapped chunks
+// const void* data: records
+// size_t count: number of the records
+// bool gap: true if records were lost before these records
+// Note: Number of the records in chunk header is updated after records are copied, so reader recovering file without
+//       index never sees incomplete records.
+//------------------------------------------------------------------------------------
+void EKitCaptureWriter::append(const void* data, size_t count, bool gap) {
+    static const char* const func_name = "EKitCaptureWriter::append";
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    size_t rs = header.record_size;
+
+    if (fd < 0) {
+        throw EKitException(func_name, EKIT_NOT_OPENED, "Capture file is closed");
+    }
+
+    gap = gap || gap_pending;
+    if (count == 0) {
+        gap_pending = gap;
+        return;
+    }
+    gap_pending = false;
+
+    if (chunk == nullptr || (gap && chunk->records > 0)) {
+        next_chunk(gap);
+    } else if (gap) {
+        chunk->flags |= EKIT_CAPTURE_CHUNK_GAP;
+        chunk->first_sample = next_sample;
+        index.back().flags = chunk->flags;
+        index.back().first_sample = next_sample;
+    }
+
+    while (count > 0) {
+        if (chunk->records == chunk_records) {
+            next_chunk(false);
+        }
+
+        size_t n = std::min(count, chunk_records - chunk->records);
+        memcpy(reinterpret_cast<uint8_t*>(chunk + 1) + chunk->records * rs, src, n * rs);
+        chunk->records += static_cast<uint32_t>(n);
+        index.back().records = chunk->records;
+        records += n;
+        next_sample += n;
+        src += n * rs;
+        count -= n;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureWriter::append_at
+// Purpose: Appends records with absolute sample index, samples skipped since the previous records are marked as gap
+// uint64_t first_sample: absolute sample index of the first record
+// const void* data: records
+// size_t count: number of the records
+//------------------------------------------------------------------------------------
+void EKitCaptureWriter::append_at(uint64_t first_sample, const void* data, size_t count) {
+    static const char* const func_name = "EKitCaptureWriter::append_at";
+    bool gap;
+
+    if (first_sample < next_sample) {
+        throw EKitException(func_name, EKIT_BAD_PARAM, "Sample index is less than index of the previous samples");
+    }
+
+    gap = (first_sample > next_sample) && records > 0;
+    next_sample = first_sample;
+    append(data, count, gap);
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureWriter::close
+// Purpose: Truncates file to the last chunk used, and writes index and footer after it
+//------------------------------------------------------------------------------------
+void EKitCaptureWriter::close() {
+    static const char* const func_name = "EKitCaptureWriter::close";
+    EKitCaptureFooter footer;
+    bool ok;
+
+    if (fd < 0) {
+        return;
+    }
+
+    unmap();
+
+    memcpy(footer.magic, EKIT_CAPTURE_INDEX_MAGIC, sizeof(footer.magic));
+    footer.index_offset = header.header_size + index.size() * header.chunk_size;
+    footer.chunks = index.size();
+    footer.records = records;
+
+    ok = ftruncate(fd, footer.index_offset) == 0 &&
+         capture_write_all(fd, index.data(), index.size() * sizeof(EKitCaptureIndexEntry), footer.index_offset) &&
+         capture_write_all(fd,
+                           &footer,
+                           sizeof(footer),
+                           footer.index_offset + index.size() * sizeof(EKitCaptureIndexEntry));
+
+    ::close(fd);
+    fd = -1;
+
+    if (!ok) {
+        throw EKitException(func_name, EKIT_WRITE_FAILED, "Failed to write capture index");
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureReader::EKitCaptureReader
+// Purpose: Reads header of the capture file and loads index from the end of the file, or rebuilds it if it is missing
+// const std::string& path: path to the file
+// Note: Chunks are not mapped here, see EKitCaptureReader::map_chunk().
+//------------------------------------------------------------------------------------
+EKitCaptureReader::EKitCaptureReader(const std::string& path) :
+    fd(-1),
+    file_size(0),
+    records(0),
+    recovered(false),
+    map(nullptr),
+    map_offset(0),
+    mapped_chunk(0) {
+    static const char* const func_name = "EKitCaptureReader::EKitCaptureReader";
+    struct stat st;
+    EKitCaptureFooter footer;
+
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw EKitException(func_name, EKIT_OPEN_FAILED, "Failed to open " + path);
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < EKIT_CAPTURE_HEADER_SIZE ||
+        !capture_read_all(fd, &header, sizeof(header), 0)) {
+        goto bad_file;
+    }
+    file_size = static_cast<uint64_t>(st.st_size);
+
+    if (memcmp(header.magic, EKIT_CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != EKIT_CAPTURE_VERSION ||
+        header.header_size < sizeof(EKitCaptureHeader) ||
+        header.header_size > file_size ||
+        header.chunk_size <= sizeof(EKitCaptureChunk) ||
+        header.record_size == 0 ||
+        header.record_size > header.chunk_size - sizeof(EKitCaptureChunk) ||
+        header.channels > EKIT_CAPTURE_MAX_CHANNELS) {
+        goto bad_file;
+    }
+
+    if (file_size < header.header_size + sizeof(EKitCaptureFooter) ||
+        !capture_read_all(fd, &footer, sizeof(footer), file_size - sizeof(EKitCaptureFooter)) ||
+        memcmp(footer.magic, EKIT_CAPTURE_INDEX_MAGIC, sizeof(footer.magic)) != 0 ||
+        footer.chunks > (file_size - header.header_size) / header.chunk_size ||
+        footer.index_offset != header.header_size + footer.chunks * header.chunk_size ||
+        footer.index_offset + footer.chunks * sizeof(EKitCaptureIndexEntry) + sizeof(EKitCaptureFooter) != file_size ||
+        !load_index(footer)) {
+        rebuild_index();
+    }
+
+    return;
+
+bad_file:
+    ::close(fd);
+    throw EKitException(func_name, EKIT_BAD_PARAM, path + " is not a capture file");
+}
+
+EKitCaptureReader::~EKitCaptureReader() {
+    unmap();
+    ::close(fd);
+}
+
+void EKitCaptureReader::unmap() const {
+    if (map != nullptr) {
+        munmap(const_cast<uint8_t*>(map), map_offset + header.chunk_size);
+        map = nullptr;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureReader::map_chunk
+// Purpose: Maps the chunk, chunk which is already mapped is reused
+// size_t n: chunk index
+// Returns: pointer to the chunk header
+// Note: Only one chunk is mapped at a time, so capture file doesn't have to fit address space. Like
+//       EKitCaptureWriter::next_chunk() mapping starts at page boundary before the chunk.
+//------------------------------------------------------------------------------------
+const EKitCaptureChunk* EKitCaptureReader::map_chunk(size_t n) const {
+    static const char* const func_name = "EKitCaptureReader::map_chunk";
+    static const off_t page_size = sysconf(_SC_PAGESIZE);
+
+    if (map == nullptr || mapped_chunk != n) {
+        unmap();
+
+        off_t offset = static_cast<off_t>(header.header_size + static_cast<uint64_t>(n) * header.chunk_size);
+        off_t page_offset = offset / page_size * page_size;
+        size_t len = (offset - page_offset) + header.chunk_size;
+        void* p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, page_offset);
+        if (p == MAP_FAILED) {
+            throw EKitException(func_name, EKIT_READ_FAILED, "Failed to map capture file chunk");
+        }
+
+        madvise(p, len, MADV_SEQUENTIAL);
+        map = static_cast<const uint8_t*>(p);
+        map_offset = offset - page_offset;
+        mapped_chunk = n;
+    }
+
+    return reinterpret_cast<const EKitCaptureChunk*>(map + map_offset);
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureReader::rebuild_index
+// Purpose: Rebuilds index from the chunk headers of the file written by killed writer
+// Note: Chunks are scanned until the first chunk which is not written, or doesn't continue previous chunks. Chunk
+//       headers are read without mapping chunks.
+//------------------------------------------------------------------------------------
+void EKitCaptureReader::rebuild_index() {
+    size_t chunk_records = (header.chunk_size - sizeof(EKitCaptureChunk)) / header.record_size;
+    uint64_t chunks = (file_size - header.header_size) / header.chunk_size;
+
+    recovered = true;
+    for (uint64_t i = 0; i < chunks; i++) {
+        EKitCaptureChunk c;
+        if (!capture_read_all(fd, &c, sizeof(c), header.header_size + i * header.chunk_size) ||
+            c.magic != EKIT_CAPTURE_CHUNK_MAGIC || c.index != i || c.first_record != records ||
+            c.records == 0 || c.records > chunk_records ||
+            (i > 0 && c.first_sample < index.back().first_sample + index.back().records)) {
+            break;
+        }
+
+        index.push_back(EKitCaptureIndexEntry{c.first_record, c.first_sample, c.records, c.flags});
+        records += c.records;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureReader::load_index
+// Purpose: Loads index from the end of the file. Entries are checked as chunk headers are checked by rebuild_index(),
+//          so damaged index never makes reader access records beyond chunk.
+// const EKitCaptureFooter& footer: footer of the file
+// Returns: true if index is loaded, false if it is inconsistent
+//------------------------------------------------------------------------------------
+bool EKitCaptureReader::load_index(const EKitCaptureFooter& footer) {
+    size_t chunk_records = (header.chunk_size - sizeof(EKitCaptureChunk)) / header.record_size;
+    std::vector<EKitCaptureIndexEntry> entries(static_cast<size_t>(footer.chunks));
+    uint64_t total = 0;
+
+    if (!capture_read_all(fd, entries.data(), entries.size() * sizeof(EKitCaptureIndexEntry), footer.index_offset)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].first_record != total || entries[i].records == 0 || entries[i].records > chunk_records ||
+            (i > 0 && entries[i].first_sample < entries[i - 1].first_sample + entries[i - 1].records)) {
+            return false;
+        }
+        total += entries[i].records;
+    }
+
+    if (total != footer.records) {
+        return false;
+    }
+
+    index.swap(entries);
+    records = total;
+    return true;
+}
+
+size_t EKitCaptureReader::find_chunk(uint64_t record) const {
+    auto it = std::upper_bound(index.begin(),
+                               index.end(),
+                               record,
+                               [](uint64_t r, const EKitCaptureIndexEntry& e) { return r < e.first_record; });
+    return (it - index.begin()) - 1;
+}
+
+const void* EKitCaptureReader::get_chunk(size_t n, uint64_t& first_record, size_t& count, bool& gap) const {
+    static const char* const func_name = "EKitCaptureReader::get_chunk";
+    if (n >= index.size()) {
+        throw EKitException(func_name, EKIT_OUT_OF_RANGE, "Chunk index is out of range");
+    }
+
+    first_record = index[n].first_record;
+    count = index[n].records;
+    gap = (index[n].flags & EKIT_CAPTURE_CHUNK_GAP) != 0;
+    return map_chunk(n) + 1;
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureReader::read
+// Purpose: Copies records, chunk containing the first record is found by binary search in index
+// uint64_t first: index of the first record
+// size_t count: number of the records
+// void* dst: buffer for the records
+// Returns: number of the records copied
+//------------------------------------------------------------------------------------
+size_t EKitCaptureReader::read(uint64_t first, size_t count, void* dst) const {
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    size_t rs = header.record_size;
+    size_t done = 0;
+
+    if (first >= records) {
+        return 0;
+    }
+    count = static_cast<size_t>(std::min<uint64_t>(count, records - first));
+
+    for (size_t c = find_chunk(first); done < count; c++) {
+        uint64_t chunk_first;
+        size_t chunk_count;
+        bool gap;
+        const uint8_t* src = static_cast<const uint8_t*>(get_chunk(c, chunk_first, chunk_count, gap));
+        size_t offset = static_cast<size_t>(first + done - chunk_first);
+        size_t n = std::min(count - done, chunk_count - offset);
+
+        memcpy(out + done * rs, src + offset * rs, n * rs);
+        done += n;
+    }
+
+    return done;
+}
+
+bool EKitCaptureReader::is_gap(uint64_t record) const {
+    if (record >= records) {
+        return false;
+    }
+
+    const EKitCaptureIndexEntry& e = index[find_chunk(record)];
+    return e.first_record == record && (e.flags & EKIT_CAPTURE_CHUNK_GAP) != 0;
+}
+
+uint64_t EKitCaptureReader::get_sample(uint64_t record) const {
+    static const char* const func_name = "EKitCaptureReader::get_sample";
+    if (record >= records) {
+        throw EKitException(func_name, EKIT_OUT_OF_RANGE, "Record index is out of range");
+    }
+
+    const EKitCaptureIndexEntry& e = index[find_chunk(record)];
+    return e.first_sample + (record - e.first_record);
+}
+
+//------------------------------------------------------------------------------------
+// EKitCaptureReader::write_csv
+// Purpose: Writes records as CSV: "Sample,[Time,]<inputs>,Gap" for ADC samples, "N,Ticks,Seconds,Gap" for timestamps
+// FILE* f: output file
+// uint64_t first: index of the first record
+// uint64_t count: number of the records
+//------------------------------------------------------------------------------------
+void EKitCaptureReader::write_csv(FILE* f, uint64_t first, uint64_t count) const {
+    static const char* const func_name = "EKitCaptureReader::write_csv";
+    const bool adc = (header.type == EKIT_CAPTURE_ADC);
+    const bool has_time = header.tick_freq > 0.0;
+    std::vector<double> scale;
+    uint64_t first_ts = 0;
+
+    if (adc) {
+        if (header.record_size != header.channels * sizeof(uint16_t) || header.adc_maxval == 0) {
+            throw EKitException(func_name, EKIT_NOT_SUPPORTED, "Wrong ADC capture header");
+        }
+
+        fputs(has_time ? "Sample,Time" : "Sample", f);
+        for (size_t ch = 0; ch < header.channels; ch++) {
+            const EKitCaptureChannel& c = header.channel[ch];
+            scale.push_back((c.max - c.min) / static_cast<double>(header.adc_maxval));
+            fprintf(f, ",\"%.*s\"", static_cast<int>(sizeof(c.name)), c.name);
+        }
+        fputs(",Gap\n", f);
+    } else if (header.type == EKIT_CAPTURE_TIMESTAMP && header.record_size == sizeof(uint64_t)) {
+        read(0, 1, &first_ts);
+        fputs(has_time ? "N,Ticks,Seconds,Gap\n" : "N,Ticks,Gap\n", f);
+    } else {
+        throw EKitException(func_name, EKIT_NOT_SUPPORTED, "Unsupported capture type");
+    }
+
+    if (first >= records) {
+        return;
+    }
+    count = std::min(count, records - first);
+
+    for (size_t c = find_chunk(first); count > 0; c++) {
+        uint64_t chunk_first;
+        size_t chunk_count;
+        bool gap;
+        const uint8_t* src = static_cast<const uint8_t*>(get_chunk(c, chunk_first, chunk_count, gap));
+        size_t offset = static_cast<size_t>(first - chunk_first);
+        size_t n = static_cast<size_t>(std::min<uint64_t>(count, chunk_count - offset));
+
+        for (size_t i = offset; i < offset + n; i++) {
+            uint64_t r = chunk_first + i;
+            int g = (gap && i == 0) ? 1 : 0;
+
+            if (adc) {
+                const uint16_t* v = reinterpret_cast<const uint16_t*>(src + i * header.record_size);
+                fprintf(f, "%" PRIu64, r);
+                if (has_time) fprintf(f, ",%.9f", static_cast<double>(index[c].first_sample + i) / header.tick_freq);
+                for (size_t ch = 0; ch < header.channels; ch++) {
+                    fprintf(f, ",%.6f", header.channel[ch].min + v[ch] * scale[ch]);
+                }
+                fprintf(f, ",%d\n", g);
+            } else {
+                uint64_t ts;
+                memcpy(&ts, src + i * sizeof(uint64_t), sizeof(ts));
+                fprintf(f, "%" PRIu64 ",%" PRIu64, r, ts);
+                if (has_time) fprintf(f, ",%.9f", static_cast<double>(ts - first_ts) / header.tick_freq);
+                fprintf(f, ",%d\n", g);
+            }
+        }
+
+        first += n;
+        count -= n;
+    }
+}
@@ -0,0 +1,299 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Drain-before-overflow acquisition scheduler implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <cassert>
+#include <chrono>
+#include <algorithm>
+#include "ekit_drain.hpp"
+
+//------------------------------------------------------------------------------------
+// EKitDrainScheduler::EKitDrainScheduler
+// Purpose: EKitDrainScheduler class constructor
+// double hwm: high-water mark, fraction of the buffer capacity
+// uint64_t min_us: minimal period between drains of the source
+// uint64_t max_us: maximal period between drains of the source
+// uint64_t window_us: coalescing window
+//------------------------------------------------------------------------------------
+EKitDrainScheduler::EKitDrainScheduler(double hwm, uint64_t min_us, uint64_t max_us, uint64_t window_us) :
+    high_water(hwm),
+    min_period_us(min_us),
+    max_period_us(max_us),
+    coalesce_us(window_us),
+    next_id(0),
+    stopping(false),
+    rescan(false) {
+    assert(hwm > 0.0 && hwm <= 1.0);
+    assert(min_us > 0 && min_us <= max_us);
+}
+
+EKitDrainScheduler::~EKitDrainScheduler() {
+    stop();
+}
+
+uint64_t EKitDrainScheduler::clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int EKitDrainScheduler::add(const std::string& name, size_t capacity, EKitDrainFunc drain) {
+    int id;
+    assert(capacity > 0);
+
+    {
+        std::lock_guard<std::mutex> lock(sched_lock);
+        id = next_id++;
+        DrainSource& src = sources[id];
+        src.name = name;
+        src.capacity = capacity;
+        src.drain = std::move(drain);
+        src.rate = -1.0;
+        src.armed = false;
+        src.last_us = 0;
+        src.next_us = 0;
+        src.stats = EKitDrainStats{0, 0, 0, 0, 0, min_period_us};
+        src.busy = false;
+        src.removed = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(thread_lock);
+        rescan = true;
+    }
+    wake.notify_all();
+    return id;
+}
+
+//------------------------------------------------------------------------------------
+// EKitDrainScheduler::remove
+// Purpose: Unregisters source, waits until running drain of the source is completed
+// int id: id of the source
+// Note: Drain function removing it's own source can't be waited for, source is erased by poll() when it returns.
+//------------------------------------------------------------------------------------
+void EKitDrainScheduler::remove(int id) {
+    std::unique_lock<std::mutex> lock(sched_lock);
+    auto it = sources.find(id);
+
+    if (it == sources.end()) {
+        return;
+    }
+
+    if (it->second.busy && it->second.drain_thread == std::this_thread::get_id()) {
+        it->second.removed = true;
+        return;
+    }
+
+    // Only remove() erases sources, so iterator remains valid while waiting
+    drained.wait(lock, [&it]() { return !it->second.busy; });
+    sources.erase(it);
+}
+
+void EKitDrainScheduler::set_error_handler(EKitDrainErrorFunc handler) {
+    std::lock_guard<std::mutex> lock(sched_lock);
+    on_error = std::move(handler);
+}
+
+EKitDrainStats EKitDrainScheduler::get_stats(int id) {
+    std::lock_guard<std::mutex> lock(sched_lock);
+    return sources.at(id).stats;
+}
+
+//------------------------------------------------------------------------------------
+// EKitDrainScheduler::poll
+// Purpose: Drains sources due by the specified time and within coalescing window
+// uint64_t now_us: current time in microseconds
+// Returns: time of the next planned drain, UINT64_MAX if there are no sources
+// Note: Due sources are collected with sched_lock held, drain functions and error handler are called without it.
+//       Source is marked busy while it's drain function is running, so remove() waits for it.
+//------------------------------------------------------------------------------------
+uint64_t EKitDrainScheduler::poll(uint64_t now_us) {
+    std::unique_lock<std::mutex> lock(sched_lock);
+    uint64_t next = UINT64_MAX;
+    std::exception_ptr error;
+    std::vector<int> due;
+
+    for (auto& s : sources) {
+        if (!s.second.armed || s.second.next_us <= now_us + coalesce_us) {
+            due.push_back(s.first);
+        }
+    }
+
+    for (int id : due) {
+        auto it = sources.find(id);
+        if (it == sources.end() || it->second.busy) {
+            continue; // Removed by previous drain function, or drained by concurrent poll()
+        }
+
+        DrainSource& src = it->second;
+        EKitDrainErrorFunc handler;
+        std::exception_ptr e;
+        bool ovf = false;
+        size_t bytes = 0;
+
+        src.busy = true;
+        src.drain_thread = std::this_thread::get_id();
+        lock.unlock();
+
+        try {
+            bytes = src.drain(ovf);
+        } catch (...) {
+            e = std::current_exception();
+        }
+
+        lock.lock();
+        src.busy = false;
+        if (src.removed) {
+            sources.erase(it);
+            e = nullptr;
+        } else if (e) {
+            // Source is retried after minimal period
+            src.stats.errors++;
+            src.next_us = now_us + min_period_us;
+            handler = on_error;
+        } else {
+            plan_source(src, bytes, ovf, now_us);
+        }
+        drained.notify_all();
+
+        if (handler) {
+            lock.unlock();
+            handler(id, e);
+            lock.lock();
+        } else if (e && !error) {
+            error = e;
+        }
+    }
+
+    for (auto& s : sources) {
+        next = std::min(next, s.second.next_us);
+    }
+    lock.unlock();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    return next;
+}
+
+//------------------------------------------------------------------------------------
+// EKitDrainScheduler::plan_source
+// Purpose: Updates fill rate estimation and plans the next drain
+// DrainSource& src: drained source
+// size_t bytes: number of the bytes drained
+// bool ovf: true if drain function reported overflow
+// uint64_t now_us: current time in microseconds
+//------------------------------------------------------------------------------------
+void EKitDrainScheduler::plan_source(DrainSource& src, size_t bytes, bool ovf, uint64_t now_us) {
+    double plan_rate;
+    uint64_t period;
+
+    src.stats.drains++;
+    src.stats.bytes += bytes;
+    src.stats.max_bytes = std::max(src.stats.max_bytes, bytes);
+    if (ovf) {
+        src.stats.overflows++;
+    }
+
+    if (!src.armed) {
+        // Data accumulated before the first drain tells nothing about rate
+        src.armed = true;
+        period = min_period_us;
+    } else {
+        // Rate increase is taken immediately, decrease is smoothed
+        double elapsed = static_cast<double>(std::max<uint64_t>(now_us - src.last_us, 1));
+        double inst_rate = static_cast<double>(bytes) / elapsed;
+        src.rate = (src.rate < 0.0) ? inst_rate : (src.rate + inst_rate) / 2.0;
+        plan_rate = std::max(src.rate, inst_rate);
+
+        if (ovf) {
+            // Data is lost, so actual rate is higher than estimated
+            plan_rate = std::max(plan_rate, static_cast<double>(src.capacity) / elapsed) * 2.0;
+            src.rate = plan_rate;
+        }
+
+        if (plan_rate > 0.0) {
+            double p = high_water * static_cast<double>(src.capacity) / plan_rate;
+            period = (p >= static_cast<double>(max_period_us)) ? max_period_us : static_cast<uint64_t>(p);
+        } else {
+            period = max_period_us;
+        }
+
+        period = std::min(std::max(period, min_period_us), max_period_us);
+    }
+
+    src.stats.period_us = period;
+    src.last_us = now_us;
+    src.next_us = now_us + period;
+}
+
+//------------------------------------------------------------------------------------
+// EKitDrainScheduler::start
+// Purpose: Starts thread that drains sources in time
+//------------------------------------------------------------------------------------
+void EKitDrainScheduler::start() {
+    std::lock_guard<std::mutex> lock(thread_lock);
+    assert(!worker.joinable());
+    stopping = false;
+    worker = std::thread(&EKitDrainScheduler::thread_func, this);
+}
+
+void EKitDrainScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(thread_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void EKitDrainScheduler::thread_func() {
+    uint64_t next;
+
+    while (true) {
+        try {
+            next = poll(clock_us());
+        } catch (...) {
+            // No error handler, source is retried after minimal period
+            next = clock_us() + min_period_us;
+        }
+
+        std::unique_lock<std::mutex> lock(thread_lock);
+        auto woken = [this]() { return stopping || rescan; };
+
+        if (next == UINT64_MAX) {
+            wake.wait(lock, woken);
+        } else {
+            uint64_t now = clock_us();
+            if (next > now) {
+                wake.wait_for(lock, std::chrono::microseconds(next - now), woken);
+            }
+        }
+
+        if (stopping) {
+            break;
+        }
+        rescan = false;
+    }
+}
@@ -20,12 +20,18 @@
  *   \author Oleh Sharuda
  */
 
+#include <algorithm>
 #include <cstring>
 #include <cassert>
 #include "ekit_firmware.hpp"
 #include "i2c_proto.h"
 #include "tools.hpp"
 
+constexpr uint32_t EKitFirmware::default_poll_min_us;
+constexpr uint32_t EKitFirmware::default_poll_max_us;
+constexpr size_t EKitFirmware::crc16_negotiate_attempts;
+constexpr size_t EKitFirmware::default_max_retries;
+
 //------------------------------------------------------------------------------------
 // EKitFirmware::EKitFirmware
 // std::shared_ptr<EKitBus*>& ebus : shared pointer for EKitBus implementation
@@ -34,7 +40,9 @@
 EKitFirmware::EKitFirmware(std::shared_ptr<EKitBus>& ebus, int addr) :
     super(EKitBusType::BUS_I2C_FIRMWARE),
     bus(ebus),
-    firmware_addr(addr) {
+    firmware_addr(addr),
+    poll_strategy(std::make_shared<EKitBackoffPoll>(default_poll_min_us, default_poll_max_us)),
+    scratch(scratch_initial_size) {
     ebus->check_bus(EKitBusType::BUS_I2C);
 }
 
@@ -102,47 +110,71 @@ EKIT_ERROR EKitFirmware::lock(EKitTimeout& to) {
 // Returns: corresponding EKIT_ERROR code
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitFirmware::lock(int vdev, EKitTimeout& to){
-	std::vector<uint8_t> buf;
-    const size_t buf_len = 1;
+	uint8_t cmd;
 	CommResponseHeader hdr;
     EKIT_ERROR err;
 
-	// Attempt to lock bus first
-	err = bus->lock(firmware_addr, to);
-	if (err != EKIT_OK) {
-		goto done;
-	} 
-
-	// Attempt to lock self
-	err = super::lock(to);
-	if (err != EKIT_OK) {
-		bus->unlock();
-		goto done;
-	} 	
-
-	assert(check_address(vdev));
-	vdev_addr = vdev;
+    err = lock_vdev(vdev, __builtin_return_address(0), to);
+    if (err != EKIT_OK) {
+        goto done;
+    }
 
 	// Prepare command byte to send
-	buf.resize(buf_len);
-	buf[0]=vdev;
+	cmd = vdev;
 
     // <TODO> Make sure we actually need to communicate with firmware here. If not, remove write to bus
-	do {
-		err = bus->write(buf.data(), buf_len, to);
-	} while (err == EKIT_WRITE_FAILED);
+	err = write_read_status(&cmd, sizeof(cmd), hdr, to);
 
     if (err == EKIT_OK) {
-		get_status(hdr, true, to);
+		check_status(hdr, true, to);
     } else {
         EKitBus::unlock();
         bus->unlock();
+        release_arbiter();
     }
 
 done:
 	return err;
 }
 
+//------------------------------------------------------------------------------------
+// EKitFirmware::lock_vdev
+// Purpose: Locks the bus and virtual device without communication with firmware
+// int vdev : device id to acquire
+// const void* site: call site to be reported by lock order verifier (see EKitBus::lock_bus())
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::lock_vdev(int vdev, const void* site, EKitTimeout& to) {
+    EKIT_ERROR err;
+    auto start = std::chrono::steady_clock::now();
+
+	// Wait for the turn if virtual devices are arbitrated
+	err = arbitrate(vdev, to);
+	if (err != EKIT_OK) {
+		goto done;
+	}
+
+	// Attempt to lock bus first
+	err = bus->lock(firmware_addr, to);
+	if (err != EKIT_OK) {
+		release_arbiter();
+		goto done;
+	} 
+
+	// Lock self
+	lock_bus(site);
+
+	assert(check_address(vdev));
+	vdev_addr = vdev;
+
+	if (metrics) {
+	    metrics->add_lock(vdev, EKitBusMetrics::elapsed_us(start));
+	}
+
+done:
+	return err;
+}
+
 
 //------------------------------------------------------------------------------------
 // EKitFirmware::unlock
@@ -152,8 +184,10 @@ done:
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitFirmware::unlock(){
 	vdev_addr = -1;
+	completion_hint_us = 0;
 	EKitBus::unlock();
 	bus->unlock();
+	release_arbiter();
 
 	return EKIT_OK;
 }
@@ -167,29 +201,219 @@ EKIT_ERROR EKitFirmware::unlock(){
 //------------------------------------------------------------------------------------
 /// \brief Returns status of the device
 EKIT_ERROR EKitFirmware::get_status(CommResponseHeader& hdr, bool wait_device, EKitTimeout& to){
-	uint8_t last_op_crc;
+	EKIT_ERROR err;
+	size_t retries = 0;
+
+	CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+	err = read_status(hdr, retries, to);
+	account_retries(retries, err);
+	if (err != EKIT_OK) {
+		return err;
+	}
+
+    return check_status(hdr, wait_device, to);
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmware::retry
+// Purpose: Decides if failed bus request may be repeated, waits with poll strategy before the next attempt
+// EKIT_ERROR err: error returned by the failed request
+// size_t& retries: number of the retries made by operation so far, incremented if request may be repeated
+// Returns: EKIT_OK if request may be repeated, EKIT_TIMEOUT if timeout is expired, otherwise err
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::retry(EKIT_ERROR err, size_t& retries, EKitTimeout& to) {
+    if (to.expired()) {
+        return EKIT_TIMEOUT;
+    }
+
+    if (max_retries != 0 && retries >= max_retries) {
+        return err;
+    }
+
+    retries++;
+    if (metrics) metrics->add_retry(vdev_addr, err);
+    std::atomic_load(&poll_strategy)->wait(vdev_addr, retries, false, to.remaining());
+    return EKIT_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmware::read_status
+// Purpose: Reads response header until success, retries are limited by timeout and max_retries
+// CommResponseHeader& hdr: response header read from firmware
+// size_t& retries: number of the retries made by operation
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::read_status(CommResponseHeader& hdr, size_t& retries, EKitTimeout& to) {
 	EKIT_ERROR err;
 
 	CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
 	do {
-		// Read header until success
 		err = bus->read(&hdr, sizeof(hdr), to);
-		if (err == EKIT_OK) break;
-		tools::sleep_ms(1);
-	} while (true);
+	} while (err == EKIT_READ_FAILED && (err = retry(err, retries, to)) == EKIT_OK);
+
+	return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmware::check_status
+// Purpose: Processes response header just read from firmware
+// CommResponseHeader& hdr: response header read from firmware
+// bool wait_device: true if read until COMM_STATUS_BUSY is cleared, otherwise false
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::check_status(CommResponseHeader& hdr, bool wait_device, EKitTimeout& to) {
+	uint8_t last_op_crc;
+	EKIT_ERROR err;
+
+	CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
 	last_op_crc = hdr.last_crc;
-    assert(hdr.dummy == COMM_DUMMY_BYTE);
+    assert(crc16_mode != CRC16_OFF || hdr.dummy == COMM_DUMMY_BYTE);
 
 	if (wait_device && (hdr.comm_status & COMM_STATUS_BUSY) != 0) {
-        wait_vdev(hdr, false, to);
+        err = wait_vdev(hdr, false, to);
+	} else {
+	    err = EKIT_OK;
+	}
+
+	if (err == EKIT_OK) {
+	    err = process_comm_status(hdr.comm_status);
 	}
-	err = process_comm_status(hdr.comm_status);
 
 	hdr.last_crc = last_op_crc;
-	
-    return err;	
+
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmware::write_read_status
+// Purpose: Writes buffer to firmware and reads response header by single bus transaction
+// const uint8_t* buf: buffer to be written
+// size_t len: length of the buffer
+// CommResponseHeader& hdr: response header read from firmware
+// Returns: corresponding EKIT_ERROR code
+// Note: Response header is read after STOP condition, so firmware handles written buffer as usual. Transaction is
+//       submitted by single request only if adapter generates STOP itself (I2C_FUNC_PROTOCOL_MANGLING); otherwise
+//       (e.g. bcm2835 of Raspberry Pi) bus splits it at STOP into write and read requests, so there is no saving of
+//       system calls, only a single call to the bus.
+//       EKIT_READ_FAILED means the buffer is written already, so just response header is read again. EKIT_WRITE_FAILED
+//       doesn't tell which of the segments failed, therefore response header is read and the buffer is written again
+//       only if firmware doesn't acknowledge it by control sum of the previous operation. Commands are not executed
+//       twice, unless the failed read segment was partially transmitted (control sum of this read is reported then)
+//       or control sum of the previous operation matches accidentally (1/256 without CRC-16).
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::write_read_status(const uint8_t* buf, size_t len, CommResponseHeader& hdr, EKitTimeout& to) {
+    EKIT_ERROR err;
+    size_t retries = 0;
+    bool rewrite;
+    EKitBusSegment segments[2] = {
+        {const_cast<uint8_t*>(buf), len, BUS_SEGMENT_WRITE | BUS_SEGMENT_STOP},
+        {&hdr, sizeof(hdr), BUS_SEGMENT_READ | BUS_SEGMENT_STOP}};
+
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    err = bus->transaction(segments, 2, to);
+    if (err != EKIT_WRITE_FAILED && err != EKIT_READ_FAILED) {
+        return err;
+    }
+
+    rewrite = (err == EKIT_WRITE_FAILED);
+    err = retry(err, retries, to);
+    if (err == EKIT_OK) {
+        err = read_status(hdr, retries, to);
+    }
+
+    while (err == EKIT_OK && rewrite && !acknowledged(buf, len, hdr)) {
+        err = bus->write(buf, len, to);
+        rewrite = (err == EKIT_WRITE_FAILED);
+        if (rewrite) {
+            err = retry(err, retries, to);
+        }
+
+        if (err == EKIT_OK) {
+            err = read_status(hdr, retries, to);
+        }
+    }
+
+    account_retries(retries, err);
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmware::acknowledged
+// Purpose: Checks if control sum of the previous operation reported by firmware is control sum of the buffer
+// const uint8_t* buf: buffer written
+// size_t len: length of the buffer
+// const CommResponseHeader& hdr: response header read after the buffer was written
+// Returns: true if buffer was received by firmware, otherwise false
+//------------------------------------------------------------------------------------
+bool EKitFirmware::acknowledged(const uint8_t* buf, size_t len, const CommResponseHeader& hdr) const {
+    const CommCommandHeader* phdr = reinterpret_cast<const CommCommandHeader*>(buf);
+
+    if (len >= sizeof(CommCommandHeader) + COMM_CRC16_SIZE && (phdr->length & COMM_CRC16_FLAG) != 0) {
+        // CRC-16 frame is acknowledged by its CRC-16 which follows the frame
+        return last_crc16(hdr) == static_cast<uint16_t>((buf[len - 2] << 8) | buf[len - 1]);
+    } else if (crc16_mode == CRC16_ON) {
+        return last_crc16(hdr) == tools::crc16_update(COMM_CRC16_INIT_VALUE, buf, len);
+    } else {
+        return hdr.last_crc == tools::calc_contol_sum(buf, len, COMM_CRC_OFFSET);
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmware::send_command
+// Purpose: Sends command frame and reads response header, appends CRC-16 and negotiates CRC-16 framing if required
+// uint8_t* frame: command frame with COMM_CRC16_SIZE spare bytes after the end
+// size_t len: length of the command frame
+// CommResponseHeader& hdr: response header read from firmware
+// Returns: corresponding EKIT_ERROR code
+// Note: Firmware acknowledges CRC-16 frame by CRC-16 of the frame in the response header. Firmware without CRC-16
+//       support rejects such frames, so if frame is not acknowledged after crc16_negotiate_attempts attempts it is
+//       sent again with control sum only. Not acknowledged frame is not executed, so it is safe to send it again.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::send_command(uint8_t* frame, size_t len, CommResponseHeader& hdr, EKitTimeout& to) {
+    CommCommandHeader* phdr = (CommCommandHeader*)frame;
+    uint16_t crc;
+    EKIT_ERROR err;
+    size_t attempt = 0;
+
+    if ((phdr->length & COMM_CRC16_FLAG) == 0) {
+        return write_read_status(frame, len, hdr, to);
+    }
+
+    // CRC-16 follows the frame, most significant byte first
+    crc = tools::crc16_update(COMM_CRC16_INIT_VALUE, frame, len);
+    frame[len] = static_cast<uint8_t>(crc >> 8);
+    frame[len + 1] = static_cast<uint8_t>(crc);
+
+    do {
+        err = write_read_status(frame, len + COMM_CRC16_SIZE, hdr, to);
+        if (err != EKIT_OK || crc16_mode != CRC16_NEGOTIATE) {
+            goto done;
+        }
+
+        if (last_crc16(hdr) == crc) {
+            crc16_mode = CRC16_ON;
+            goto done;
+        }
+
+        if (metrics) metrics->add_retry(vdev_addr, EKIT_CRC_ERROR);
+    } while (++attempt < crc16_negotiate_attempts);
+
+    // Fall back to control sum, length field is changed so control sum must be recalculated
+    crc16_mode = CRC16_OFF;
+    phdr->length &= ~COMM_CRC16_FLAG;
+    phdr->control_crc = tools::calc_contol_sum(frame, len, COMM_CRC_OFFSET);
+    err = write_read_status(frame, len, hdr, to);
+
+done:
+    return err;
+}
+
+uint16_t EKitFirmware::last_crc16(const CommResponseHeader& hdr) {
+    return static_cast<uint16_t>(hdr.last_crc | (hdr.dummy << 8));
 }
 
 EKIT_ERROR EKitFirmware::set_opt(int opt, int value, EKitTimeout& to) {
@@ -199,6 +423,19 @@ EKIT_ERROR EKitFirmware::set_opt(int opt, int value, EKitTimeout& to) {
 		assert((value & COMM_MAX_DEV_ADDR) == 0);
 		flags = value;
 		return EKIT_OK;
+	} else if (opt == FIRMWARE_OPT_CRC16) {
+		if (value == 0) {
+			crc16_mode = CRC16_OFF;
+		} else if (crc16_mode == CRC16_OFF) {
+			crc16_mode = CRC16_NEGOTIATE;
+		}
+		return EKIT_OK;
+	} else if (opt == FIRMWARE_OPT_MAX_RETRIES) {
+		if (value < 0) {
+			return EKIT_BAD_PARAM;
+		}
+		max_retries = static_cast<size_t>(value);
+		return EKIT_OK;
 	}  else {
 		return EKIT_NOT_SUPPORTED;
 	}
@@ -209,6 +446,12 @@ EKIT_ERROR EKitFirmware::get_opt(int opt, int& value, EKitTimeout& to) {
 	if (opt == FIRMWARE_OPT_FLAGS) {
 		value = flags;
 		return EKIT_OK;
+	} else if (opt == FIRMWARE_OPT_CRC16) {
+		value = (crc16_mode == CRC16_ON) ? 1 : 0;
+		return EKIT_OK;
+	} else if (opt == FIRMWARE_OPT_MAX_RETRIES) {
+		value = static_cast<int>(max_retries);
+		return EKIT_OK;
 	}  else {
 		return EKIT_NOT_SUPPORTED;
 	}
@@ -222,39 +465,100 @@ EKIT_ERROR EKitFirmware::get_opt(int opt, int& value, EKitTimeout& to) {
 // Returns: corresponding EKIT_ERROR code
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitFirmware::write(const void* ptr, size_t len, EKitTimeout& to){
-    std::vector<uint8_t> buf;
     CommResponseHeader rhdr;
-    size_t buf_len = len + sizeof(CommCommandHeader);
-    buf.resize(buf_len);
-    uint8_t* pbuf = buf.data();
+    size_t buf_len = len + sizeof(CommCommandHeader) + COMM_CRC16_SIZE; // CRC-16 may follow the frame
+    uint8_t* pbuf;
     EKIT_ERROR err;
+    tools::ControlSum crc;
+    auto start = std::chrono::steady_clock::now();
 
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
+    if (scratch.size() < buf_len) {
+        scratch.resize(buf_len);
+    }
+    pbuf = scratch.data();
+
     // Prepare buffer
     CommCommandHeader* phdr = (CommCommandHeader*)pbuf;
     assert(vdev_addr>=0 && vdev_addr <= COMM_MAX_DEV_ADDR);
     phdr->command_byte = vdev_addr | flags;
-    phdr->length = len;
-    if (len > 0) {
-        memcpy(pbuf + sizeof(CommCommandHeader), ptr, len);
-    }
-    phdr->control_crc = tools::calc_contol_sum(pbuf, buf_len, sizeof(CommCommandHeader) - 1);
-
-    do {
-            err = bus->write(pbuf, buf_len, to);
-    } while (err == EKIT_WRITE_FAILED);
+    phdr->length = len | frame_flags();
+    crc.update(pbuf, COMM_CRC_OFFSET);
+    crc.copy(pbuf + sizeof(CommCommandHeader), ptr, len);  // control sum is calculated while data is copied
+    phdr->control_crc = crc.value();
 
+    err = send_command(pbuf, len + sizeof(CommCommandHeader), rhdr, to);
 
     if (err == EKIT_OK) {
         // wait device since command may take a while
         // Note, don't bother with CRC here because it's firmware responsibility to check it
-        err = get_status(rhdr, true, to);
+        err = check_status(rhdr, true, to);
+    }
+
+    if (metrics) {
+        metrics->add_transaction(vdev_addr, len, 0, err, EKitBusMetrics::elapsed_us(start));
     }
 
     return err;
 }
 
+//------------------------------------------------------------------------------------
+// EKitFirmware::write_batch
+// Purpose: Sends commands collected by batch with a single bus write
+// EKitFirmwareBatch& batch: batch to send
+// Returns: corresponding EKIT_ERROR code
+// Note: Batch frame selects virtual device of the last record, so response header refers to this device.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::write_batch(EKitFirmwareBatch& batch, EKitTimeout& to) {
+    CommResponseHeader rhdr;
+    EKIT_ERROR err;
+    int vdev = batch.last_dev;
+    size_t frame_len = batch.frame.size();
+    tools::ControlSum crc = batch.records_crc;
+    auto start = std::chrono::steady_clock::now();
+
+    if (batch.empty()) {
+        return EKIT_OK;
+    }
+
+    err = lock_vdev(vdev, __builtin_return_address(0), to);
+    if (err != EKIT_OK) {
+        return err;
+    }
+
+    // Prepare header, records are already in place
+    CommCommandHeader* phdr = (CommCommandHeader*)batch.frame.data();
+    phdr->command_byte = vdev;
+    phdr->length = batch.data_length() | COMM_BATCH_FLAG | frame_flags();
+    crc.update(phdr, COMM_CRC_OFFSET);
+    phdr->control_crc = crc.value();
+
+    batch.frame.resize(frame_len + COMM_CRC16_SIZE); // CRC-16 may follow the frame
+    err = send_command(batch.frame.data(), frame_len, rhdr, to);
+    batch.frame.resize(frame_len);
+    if (err == EKIT_OK && (rhdr.comm_status & COMM_STATUS_BUSY) != 0) {
+        err = wait_vdev(rhdr, false, to);
+    }
+
+    if (err == EKIT_OK) {
+        if ((rhdr.comm_status & COMM_MAX_DEV_ADDR) != vdev) {
+            err = EKIT_WRONG_DEVICE;
+        } else if ((rhdr.comm_status & COMM_STATUS_FAIL) != 0) {
+            err = EKIT_FAIL;
+        } else if ((rhdr.comm_status & COMM_STATUS_CRC) != 0) {
+            err = EKIT_CRC_ERROR;
+        }
+    }
+
+    if (metrics) {
+        metrics->add_transaction(vdev, batch.data_length(), 0, err, EKitBusMetrics::elapsed_us(start));
+    }
+
+    unlock();
+    return err;
+}
+
 //------------------------------------------------------------------------------------
 // EKitFirmware::read
 // Purpose: Read from the device fixed amount of bytes
@@ -270,48 +574,124 @@ EKIT_ERROR EKitFirmware::write(const void* ptr, size_t len, EKitTimeout& to){
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitFirmware::read(void* ptr, size_t len, EKitTimeout& to){
 	EKIT_ERROR err;
-	std::vector<uint8_t> buf;
-	size_t buf_len = len+sizeof(CommResponseHeader);
-	uint8_t actual_crc;
+	CommResponseHeader hdr;
+	auto start = std::chrono::steady_clock::now();
 
 	CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
-	// prepare buffer
-	buf.resize(buf_len);
-	uint8_t* pbuf = buf.data();
-	uint8_t* pdata = pbuf+sizeof(CommResponseHeader);
-	CommResponseHeader* phdr = (CommResponseHeader*)pbuf;
-	CommResponseHeader rhdr;
+	err = read_checked(ptr, len, hdr, false, to);
 
-	do {
-		// Read header until success
-		err = bus->read(pbuf, buf_len, to);
-	} while (err == EKIT_READ_FAILED);
+    // It is possible to request more data the available in device buffer.
+    // This check is made to make this situation visible, because it is a logical error:
+    // software must be sure device has required amount of data before read it.
+    assert(err != EKIT_OK || len <= hdr.length);
 
-    if (err != EKIT_OK) {
-        goto done;
+    if (metrics) {
+        metrics->add_transaction(vdev_addr, 0, len, err, EKitBusMetrics::elapsed_us(start));
     }
+    return err;
+}
 
+//------------------------------------------------------------------------------------
+// EKitFirmware::read_stream
+// Purpose: Read from the device circular buffer up to max_len bytes, device must have streaming reads enabled
+// void* ptr: buffer to receive data
+// size_t max_len: length of the buffer
+// size_t& len: number of valid bytes in the buffer
+// size_t* available: optional, receives number of bytes device had when read started
+// Returns: corresponding EKIT_ERROR code
+// Notes: Firmware commits read on STOP condition, so the next call continues where this one has stopped. Bytes beyond
+//        device data are filled with COMM_BAD_BYTE, they are covered by control sum as well.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::read_stream(void* ptr, size_t max_len, size_t& len, EKitTimeout& to, size_t* available) {
+	EKIT_ERROR err;
+	CommResponseHeader hdr;
+	auto start = std::chrono::steady_clock::now();
 
-    // It is possible to request more data the available in device buffer.
-    // This check is made to make this situation visible, because it is a logical error:
-    // software must be sure device has required amount of data before read it.
-    assert(len <= phdr->length);
+	CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
-    // Copy data back
-    memcpy(ptr, pdata, len);
+	len = 0;
+	err = read_checked(ptr, max_len, hdr, true, to);
+	if (err == EKIT_OK || err == EKIT_OVERFLOW) {
+	    len = std::min(max_len, static_cast<size_t>(hdr.length));
+	    if (available != nullptr) {
+	        *available = hdr.length;
+	    }
+	}
+
+    if (metrics) {
+        metrics->add_transaction(vdev_addr, 0, len, err, EKitBusMetrics::elapsed_us(start));
+    }
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmware::read_checked
+// Purpose: Reads response header, data and response header with control sum of the data by single bus transaction
+// void* ptr: buffer to receive data
+// size_t len: length of the buffer
+// CommResponseHeader& hdr: response header read before data
+// bool stream: true if device has streaming reads enabled
+// Returns: corresponding EKIT_ERROR code
+// Note: Stream device commits read on the stop condition after data, before trailing response header is read. Retry of
+//       the whole transaction would read the next chunk, and rereading response header alone doesn't help because
+//       it reports control sum of the failed read. Therefore failed transaction of the stream device is reported as
+//       EKIT_DATA_LOST instead of retry.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmware::read_checked(void* ptr, size_t len, CommResponseHeader& hdr, bool stream, EKitTimeout& to) {
+	EKIT_ERROR err;
+	tools::ControlSum actual_crc;
+	CommResponseHeader rhdr;
+	size_t retries = 0;
+
+	// Response header and data are read by single message, data lands directly into caller buffer if bus supports
+	// continued segments natively (on Raspberry Pi it is copied by EKitI2CBus, see EKitI2CBus#transaction())
+	EKitBusSegment segments[3] = {
+	    {&hdr, sizeof(hdr), BUS_SEGMENT_READ},
+	    {ptr, len, BUS_SEGMENT_READ | BUS_SEGMENT_CONTINUE | BUS_SEGMENT_STOP},
+	    {&rhdr, sizeof(rhdr), BUS_SEGMENT_READ | BUS_SEGMENT_STOP}};
+
+	CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+	// Read data and response header with control sum of the data by single bus transaction
+	if (stream) {
+		err = bus->transaction(segments, 3, to);
+		if (err == EKIT_READ_FAILED) {
+		    err = EKIT_DATA_LOST;
+		}
+	} else {
+		do {
+			err = bus->transaction(segments, 3, to);
+		} while (err == EKIT_READ_FAILED && (err = retry(err, retries, to)) == EKIT_OK);
+		account_retries(retries, err);
+	}
 
-    err = process_comm_status(phdr->comm_status);
     if (err != EKIT_OK) {
         goto done;
     }
 
-    // Check CRC
-    err = get_status(rhdr, false, to);
-	actual_crc = tools::calc_contol_sum(pbuf, buf_len, -1);
-	if (actual_crc!=rhdr.last_crc) {
-    	err = EKIT_CRC_ERROR;
-	} 
+    // Check CRC even if status is not ok: overflow doesn't invalidate data.
+    // Note, device is likely to be busy with read completion at this moment, it is not an error.
+    assert(crc16_mode != CRC16_OFF || rhdr.dummy == COMM_DUMMY_BYTE);
+    err = process_comm_status(hdr.comm_status);
+    if (err == EKIT_OK) {
+        err = process_comm_status(rhdr.comm_status & (~COMM_STATUS_BUSY));
+    }
+
+	if (crc16_mode == CRC16_ON) {
+	    tools::CRC16 actual_crc16;
+	    actual_crc16.update(&hdr, sizeof(hdr));
+	    actual_crc16.update(ptr, len);
+	    if (actual_crc16.value()!=last_crc16(rhdr)) {
+	        err = EKIT_CRC_ERROR;
+	    }
+	} else {
+	    actual_crc.update(&hdr, sizeof(hdr));
+	    actual_crc.update(ptr, len);
+	    if (actual_crc.value()!=rhdr.last_crc) {
+	        err = EKIT_CRC_ERROR;
+	    }
+	}
 
 done:
     return err;	
@@ -327,11 +707,14 @@ done:
 //           there is no place to pass CRC
 //        2) It it possible that device will have unread data after this call, because device may write new data between reading status
 //           and actual read from the device
+//        3) Buffer is grown only if it is shorter than device data and shrunk after read, so buffer reused by caller is
+//           not reallocated or zero filled in steady state. Buffer is left unchanged if device status can't be read.
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitFirmware::read_all(std::vector<uint8_t>& buffer, EKitTimeout& to){
 	EKIT_ERROR err;
 	CommResponseHeader hdr;
-    size_t data_len;
+    size_t data_len = 0;
+    auto start = std::chrono::steady_clock::now();
 
 	CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
@@ -340,15 +723,26 @@ EKIT_ERROR EKitFirmware::read_all(std::vector<uint8_t>& buffer, EKitTimeout& to)
         goto done;
     }
 
-    data_len = hdr.length+sizeof(CommResponseHeader);
-    buffer.resize(data_len);
-    err = bus->read(buffer.data(), data_len, to);
+    // Header is read separately, so data lands directly into the buffer (copied by EKitI2CBus if adapter doesn't
+    // support I2C_M_NOSTART)
+    data_len = hdr.length;
+    if (buffer.size() < data_len) {
+        buffer.resize(data_len);
+    }
+    {
+        EKitBusSegment segments[2] = {
+            {&hdr, sizeof(hdr), BUS_SEGMENT_READ},
+            {buffer.data(), data_len, BUS_SEGMENT_READ | BUS_SEGMENT_CONTINUE | BUS_SEGMENT_STOP}};
+        err = bus->transaction(segments, 2, to);
+    }
 
-    // Move data to remove CommResponseHeader header
-    memmove(buffer.data(), buffer.data() + sizeof(CommResponseHeader), hdr.length);
-    buffer.resize(hdr.length);
+    // Shrinking doesn't release memory
+    buffer.resize(data_len);
 
 done:
+    if (metrics) {
+        metrics->add_transaction(vdev_addr, 0, data_len, err, EKitBusMetrics::elapsed_us(start));
+    }
     return err;	
 }
 
@@ -389,22 +783,62 @@ EKIT_ERROR EKitFirmware::unregister_vdev(int dev_id, EKitFirmwareCallbacks* vdev
 EKIT_ERROR EKitFirmware::wait_vdev(CommResponseHeader& hdr, bool yield, EKitTimeout& to) {
     EKIT_ERROR err;
     bool do_again;
+    size_t polls = 1; // Caller has already read status once
+    size_t retries = 0;
+    std::shared_ptr<EKitPollStrategy> strategy = std::atomic_load(&poll_strategy);
+    auto start = std::chrono::steady_clock::now();
 
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
+    strategy->begin(vdev_addr, completion_hint_us, to.remaining());
+    completion_hint_us = 0;
+
     do {
         err = bus->read(&hdr, sizeof(hdr), to);
-        do_again = (err != EKIT_OK) || ((hdr.comm_status & COMM_STATUS_BUSY) != 0);
-        assert(hdr.dummy == COMM_DUMMY_BYTE);
-
-        if (yield && do_again) {
-            sched_yield();
+        polls++;
+        do_again = (err == EKIT_READ_FAILED) || (err == EKIT_OK && (hdr.comm_status & COMM_STATUS_BUSY) != 0);
+        assert(err != EKIT_OK || crc16_mode != CRC16_OFF || hdr.dummy == COMM_DUMMY_BYTE);
+
+        if (err == EKIT_READ_FAILED) {
+            // Failed reads are limited by max_retries as well, busy device is limited by timeout only
+            err = retry(err, retries, to);
+            if (err != EKIT_OK) break;
+        } else if (do_again) {
+            if (to.expired()) {
+                err = EKIT_TIMEOUT;
+                break;
+            }
+            strategy->wait(vdev_addr, polls, yield, to.remaining());
         }
     } while (do_again);
 
+    account_retries(retries, err);
+
+    if (metrics) {
+        metrics->add_busy_polls(vdev_addr, polls - 1);
+    }
+
+    strategy->end(vdev_addr,
+                  polls,
+                  std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
     return err;
 }
 
+void EKitFirmware::set_poll_strategy(std::shared_ptr<EKitPollStrategy> strategy) {
+    assert(strategy);
+    std::atomic_store(&poll_strategy, strategy);
+}
+
+std::shared_ptr<EKitPollStrategy> EKitFirmware::get_poll_strategy() {
+    return std::atomic_load(&poll_strategy);
+}
+
+void EKitFirmware::set_completion_hint(uint32_t us) {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    completion_hint_us = us;
+}
+
 EKIT_ERROR EKitFirmware::sync_vdev(CommResponseHeader& hdr, bool yield, EKitTimeout& to) {
     uint8_t dev_id = vdev_addr;
     assert(dev_id >= 0 && dev_id <= COMM_MAX_DEV_ADDR);
@@ -413,11 +847,12 @@ EKIT_ERROR EKitFirmware::sync_vdev(CommResponseHeader& hdr, bool yield, EKitTime
 
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
-    do {
-        err = bus->write(&dev_id, buf_len, to);
-    } while (err == EKIT_WRITE_FAILED);
+    err = write_read_status(&dev_id, buf_len, hdr, to);
+    if (err == EKIT_OK && (hdr.comm_status & COMM_STATUS_BUSY) != 0) {
+        err = wait_vdev(hdr, yield, to);
+    }
 
-    err = wait_vdev(hdr, yield, to);
+    assert(crc16_mode != CRC16_OFF || hdr.dummy == COMM_DUMMY_BYTE);
     return err;
 }
 
@@ -445,3 +880,60 @@ EKIT_ERROR EKitFirmware::on_status_busy() {
     EKIT_ERROR err = dev_callbacks->on_status_busy();
     return err;
 }
+
+//------------------------------------------------------------------------------------
+// EKitFirmwareBatch::EKitFirmwareBatch
+// Purpose: EKitFirmwareBatch class constructor
+// size_t buffer_len: length of the firmware command buffer
+//------------------------------------------------------------------------------------
+constexpr size_t EKitFirmwareBatch::default_buffer_length;
+
+EKitFirmwareBatch::EKitFirmwareBatch(size_t buffer_len) :
+    frame(sizeof(CommCommandHeader)),
+    buffer_length(buffer_len) {
+}
+
+//------------------------------------------------------------------------------------
+// EKitFirmwareBatch::add
+// Purpose: Appends command record to the batch frame
+// int dev_id: virtual device id
+// uint8_t flags: virtual device specific command flags
+// const void* data: command data
+// size_t len: length of the command data
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitFirmwareBatch::add(int dev_id, uint8_t flags, const void* data, size_t len) {
+    size_t pos = frame.size();
+    size_t rec_size = COMM_BATCH_RECORD_SIZE(len);
+    CommBatchRecord rec;
+
+    if (!EKitFirmware::check_address(dev_id) || (flags & COMM_MAX_DEV_ADDR) != 0 || len > COMM_LENGTH_MASK) {
+        return EKIT_BAD_PARAM;
+    }
+
+    // Firmware receives data into command buffer, CRC-16 is received into the same buffer
+    if (data_length() + rec_size > COMM_LENGTH_MASK ||
+        data_length() + rec_size + COMM_CRC16_SIZE > buffer_length) {
+        return EKIT_OVERFLOW;
+    }
+
+    rec.command_byte = dev_id | flags;
+    rec.reserved = 0;
+    rec.length = len;
+
+    // Padding is zeroed by resize() and doesn't change control sum
+    frame.resize(pos + rec_size);
+    records_crc.copy(frame.data() + pos, &rec, sizeof(rec));
+    records_crc.copy(frame.data() + pos + sizeof(rec), data, len);
+
+    records++;
+    last_dev = dev_id;
+    return EKIT_OK;
+}
+
+void EKitFirmwareBatch::clear() {
+    frame.resize(sizeof(CommCommandHeader));
+    records_crc.reset();
+    records = 0;
+    last_dev = -1;
+}
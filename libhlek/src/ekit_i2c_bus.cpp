@@ -28,6 +28,7 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <cstring>
 #include <mutex>
 
 #include "tools.hpp"
@@ -42,6 +43,8 @@ EKitI2CBus::EKitI2CBus(const std::string& file_name)
     i2c_descriptor = 0;
     state = BUS_CLOSED;
     address = -1;
+    stop_supported = false;
+    nostart_supported = false;
 }
 
 //------------------------------------------------------------------------------------
@@ -70,12 +73,15 @@ EKIT_ERROR EKitI2CBus::open_internal(EKitTimeout& to) {
         return ERRNO_TO_EKIT_ERROR(errno);
     }
 
-    // Uncomment if doubt that operational system driver support everything we
-    // need. unsigned long data = 0; int res = ioctl(i2c_descriptor, I2C_FUNCS,
-    // &data); bool i2csupp = (data & I2C_FUNC_I2C)!=0; bool repstart = (data &
-    // I2C_FUNC_NOSTART)!=0; bool mangling = (data &
-    // I2C_FUNC_PROTOCOL_MANGLING)!=0; bool tenbit = (data &
-    // I2C_FUNC_10BIT_ADDR)!=0;
+    // Check if adapter is capable to generate STOP condition between messages of the single I2C_RDWR request and
+    // to continue message without START condition. If not, transaction() will split requests on segments which
+    // require STOP condition and merge continued segments with bounce buffer.
+    unsigned long funcs = 0;
+    if (ioctl(i2c_descriptor, I2C_FUNCS, &funcs) < 0) {
+        funcs = 0;
+    }
+    stop_supported = (funcs & I2C_FUNC_PROTOCOL_MANGLING) != 0;
+    nostart_supported = (funcs & I2C_FUNC_NOSTART) != 0;
 
     return EKIT_OK;
 }
@@ -135,6 +141,7 @@ EKIT_ERROR EKitI2CBus::lock(EKitTimeout& to) {
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitI2CBus::lock(int addr, EKitTimeout& to) {
     EKIT_ERROR res = EKIT_OK;
+    auto start = std::chrono::steady_clock::now();
 
     if (!check_address(addr)) {
         res = EKIT_BAD_PARAM;
@@ -142,16 +149,26 @@ EKIT_ERROR EKitI2CBus::lock(int addr, EKitTimeout& to) {
         goto done;
     }
 
-    super::lock(to);
+    res = arbitrate(addr, to);
+    if (res != EKIT_OK) {
+        goto done;
+    }
+
+    lock_bus(__builtin_return_address(0));
 
     if (address >= 0) {
         res = EKIT_LOCKED;
         assert(false);
         super::unlock();
+        release_arbiter();
         goto done;
     }
 
     address = addr;
+
+    if (metrics) {
+        metrics->add_lock(addr, EKitBusMetrics::elapsed_us(start));
+    }
 done:
     return res;
 }
@@ -170,6 +187,7 @@ EKIT_ERROR EKitI2CBus::unlock() {
     }
     address = -1;
     super::unlock();
+    release_arbiter();
     return err;
 }
 
@@ -187,45 +205,171 @@ EKIT_ERROR EKitI2CBus::i2c_read_write(uint8_t addr,
                                       void* buffer,
                                       size_t len,
                                       EKitTimeout& to) {
-    struct i2c_msg msgs[1];
+    EKitBusSegment segment;
+    segment.buffer = buffer;
+    segment.length = len;
+    segment.flags = readop ? BUS_SEGMENT_READ : BUS_SEGMENT_STOP;
+
+    return i2c_transfer(addr, &segment, 1, to);
+}
+
+//------------------------------------------------------------------------------------
+// EKitI2CBus::i2c_transfer
+// Purpose: Submits several I2C messages by single I2C_RDWR request. Private, for internal use only
+// uint8_t addr: i2c address
+// EKitBusSegment* segments: segments to be submitted. Segments with zero length are skipped
+// size_t count : number of segments, may not exceed I2C_RDWR_IOCTL_MAX_MSGS
+// Returns: corresponding EKIT_ERROR code
+// Note: It is not possible to figure out which of the messages failed, therefore EKIT_WRITE_FAILED is returned if
+//       request has at least one write message (data may be not delivered), otherwise EKIT_READ_FAILED is returned.
+//       If adapter doesn't support I2C_FUNC_NOSTART, continued segments are merged into single message through
+//       bounce_buffer. Request is restarted on EINTR and EAGAIN at most max_interrupted_retries times, EKIT_TIMEOUT is
+//       returned if timeout expires while adapter remains busy. Busy adapter (EAGAIN) is given growing delay before
+//       restart.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitI2CBus::i2c_transfer(uint8_t addr,
+                                    EKitBusSegment* segments,
+                                    size_t count,
+                                    EKitTimeout& to) {
+    struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+    size_t msg_first[I2C_RDWR_IOCTL_MAX_MSGS];   // index of the first segment of the message
+    size_t msg_last[I2C_RDWR_IOCTL_MAX_MSGS];    // index of the last segment of the message
     struct i2c_rdwr_ioctl_data msgset[1];
+    size_t nmsgs = 0;
+    size_t bounce_len = 0;
+    size_t bytes_out = 0;
+    size_t bytes_in = 0;
+    bool has_write = false;
+    size_t retries = 0;
     EKIT_ERROR err;
+    auto start = std::chrono::steady_clock::now();
 
     // This assert should fail if there is an attempt to use read/write without
     // locking bus first
     assert(check_address(addr));
+    assert(count <= I2C_RDWR_IOCTL_MAX_MSGS);
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
-    msgs[0].addr = addr;
-    msgs[0].flags = readop ? I2C_M_RD : I2C_M_STOP;
-    msgs[0].len = len;
-    msgs[0].buf = (uint8_t*)buffer;
+    for (size_t i = 0; i < count; i++) {
+        const EKitBusSegment& seg = segments[i];
+        bool readop = (seg.flags & BUS_SEGMENT_READ) != 0;
+        bool cont = (seg.flags & BUS_SEGMENT_CONTINUE) != 0 && nmsgs > 0;
+        uint16_t stop = (seg.flags & BUS_SEGMENT_STOP) ? I2C_M_STOP : 0;
+
+        if (seg.length == 0) {
+            // Nothing to send, but STOP condition must be preserved
+            if (nmsgs > 0) msgs[nmsgs-1].flags |= stop;
+            continue;
+        }
+
+        (readop ? bytes_in : bytes_out) += seg.length;
+
+        if (cont && readop != ((msgs[nmsgs-1].flags & I2C_M_RD) != 0)) {
+            return EKIT_BAD_PARAM;      // Message may be continued with the same direction only
+        }
+
+        if (cont && !nostart_supported) {
+            // Merge with previous message, buffer will be assigned later
+            struct i2c_msg& m = msgs[nmsgs-1];
+            if (m.len + seg.length > UINT16_MAX) return EKIT_BAD_PARAM;
+            if (msg_first[nmsgs-1] == msg_last[nmsgs-1]) {
+                bounce_len += m.len;
+            }
+            bounce_len += seg.length;
+            m.len += seg.length;
+            m.flags = (m.flags & ~I2C_M_STOP) | stop;
+            msg_last[nmsgs-1] = i;
+            continue;
+        }
+
+        if (seg.length > UINT16_MAX) return EKIT_BAD_PARAM;
+
+        msgs[nmsgs].addr = addr;
+        msgs[nmsgs].flags = (readop ? I2C_M_RD : 0) | (cont ? I2C_M_NOSTART : 0) | stop;
+        msgs[nmsgs].len = seg.length;
+        msgs[nmsgs].buf = (uint8_t*)seg.buffer;
+        msg_first[nmsgs] = i;
+        msg_last[nmsgs] = i;
+        has_write = has_write || !readop;
+        nmsgs++;
+    }
+
+    // Assign bounce buffer to merged messages, gather data to be written
+    if (bounce_len > 0) {
+        if (bounce_buffer.size() < bounce_len) {
+            bounce_buffer.resize(bounce_len);
+        }
+
+        uint8_t* p = bounce_buffer.data();
+        for (size_t m = 0; m < nmsgs; m++) {
+            if (msg_first[m] == msg_last[m]) continue;
+
+            msgs[m].buf = p;
+            for (size_t i = msg_first[m]; i <= msg_last[m]; i++) {
+                if ((msgs[m].flags & I2C_M_RD) == 0) {
+                    memcpy(p, segments[i].buffer, segments[i].length);
+                }
+                p += segments[i].length;
+            }
+        }
+    }
 
     msgset[0].msgs = msgs;
-    msgset[0].nmsgs = 1;
+    msgset[0].nmsgs = nmsgs;
 
     if (state == BUS_CLOSED) {
         err = EKIT_NOT_OPENED;
     } else if (state == BUS_PAUSED) {
         err = EKIT_SUSPENDED;
-    } else if (len == 0) {
+    } else if (nmsgs == 0) {
         err = EKIT_OK;  // Nothing to send, just success
     } else {
         int res;
         int ern;
+        bool again;
+        err = has_write ? EKIT_WRITE_FAILED : EKIT_READ_FAILED;
         do {
             res = ioctl(i2c_descriptor, I2C_RDWR, &msgset);
             ern = errno;
-        } while (res < 0 &&
-                 (ern == EINTR || ern == EAGAIN || ern == EWOULDBLOCK));
-        if (res == 1) {
-            // must send 1 message
+            again = res < 0 && (ern == EINTR || ern == EAGAIN || ern == EWOULDBLOCK);
+            if (again) {
+                // Adapter is busy (arbitration lost, slave holds the clock, etc.) or call is interrupted
+                if (to.expired()) {
+                    err = EKIT_TIMEOUT;
+                    break;
+                }
+                if (retries == max_interrupted_retries) {
+                    break;
+                }
+                retries++;
+                if (metrics) metrics->add_retry(addr, err);
+                if (ern != EINTR) busy_delay(retries, to);
+            }
+        } while (again);
+        if (res == nmsgs) {
+            // must send all messages
             err = EKIT_OK;
-        } else {
-            err = readop ? EKIT_READ_FAILED : EKIT_WRITE_FAILED;
         }
     }
 
+    // Scatter data read into merged messages
+    if (err == EKIT_OK && bounce_len > 0) {
+        for (size_t m = 0; m < nmsgs; m++) {
+            if (msg_first[m] == msg_last[m] || (msgs[m].flags & I2C_M_RD) == 0) continue;
+
+            const uint8_t* p = msgs[m].buf;
+            for (size_t i = msg_first[m]; i <= msg_last[m]; i++) {
+                memcpy(segments[i].buffer, p, segments[i].length);
+                p += segments[i].length;
+            }
+        }
+    }
+
+    if (metrics && nmsgs > 0) {
+        metrics->add_transaction(addr, bytes_out, bytes_in, err, EKitBusMetrics::elapsed_us(start));
+        metrics->add_operation_retries(addr, retries, err);
+    }
+
     return err;
 }
 
@@ -271,9 +415,51 @@ EKIT_ERROR EKitI2CBus::write_read(const uint8_t* wbuf,
                                  uint8_t* rbuf,
                                  size_t rlen,
                                  EKitTimeout& to) {
-    static const char* const func_name = "EKitI2CBus::write_read";
-    assert(false);  // MUST BE IMPLEMENTED
-    return EKIT_NOT_SUPPORTED;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    // Read is started with repeated start condition
+    EKitBusSegment segments[2] = {
+        {const_cast<uint8_t*>(wbuf), wlen, BUS_SEGMENT_WRITE},
+        {rbuf, rlen, BUS_SEGMENT_READ | BUS_SEGMENT_STOP}};
+
+    return transaction(segments, 2, to);
+}
+
+//------------------------------------------------------------------------------------
+// EKitI2CBus::transaction
+// Purpose: Executes several write and read segments as a single bus transaction
+// EKitBusSegment* segments: segments to be executed
+// size_t count: number of segments
+// Returns: corresponding EKIT_ERROR code
+// Note: Segments are grouped into as few I2C_RDWR requests as possible. Request is split if I2C_RDWR_IOCTL_MAX_MSGS
+//       is reached or when segment requires STOP condition which adapter is not able to generate itself.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitI2CBus::transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) {
+    EKIT_ERROR err = EKIT_OK;
+    size_t first = 0;
+
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    for (size_t i = 0; i < count && err == EKIT_OK; i++) {
+        size_t n = i + 1 - first;
+        bool last = (i + 1 == count);
+        bool split = last ||
+                     (n == I2C_RDWR_IOCTL_MAX_MSGS) ||
+                     (!stop_supported && (segments[i].flags & BUS_SEGMENT_STOP) != 0);
+
+        if (split) {
+            if (!last && (segments[i+1].flags & BUS_SEGMENT_CONTINUE) != 0) {
+                // Continued segment may not be submitted with another request
+                err = EKIT_BAD_PARAM;
+                break;
+            }
+
+            err = i2c_transfer(address, segments + first, n, to);
+            first = i + 1;
+        }
+    }
+
+    return err;
 }
 
 //------------------------------------------------------------------------------------
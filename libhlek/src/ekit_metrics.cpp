@@ -0,0 +1,175 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus metrics implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <cassert>
+#include <cinttypes>
+#include <cstdio>
+#include "ekit_metrics.hpp"
+
+EKitBusMetrics::EKitBusMetrics(const std::string& bus_name) :
+    name(bus_name) {
+    reset();
+}
+
+//------------------------------------------------------------------------------------
+// EKitBusMetrics::snapshot
+// Purpose: Appends snapshots of the addresses which have been used
+// std::vector<EKitMetricsSnapshot>& snap: vector to append snapshots to
+//------------------------------------------------------------------------------------
+void EKitBusMetrics::snapshot(std::vector<EKitMetricsSnapshot>& snap) {
+    for (size_t addr = 0; addr < max_addresses; addr++) {
+        AddrMetrics& m = addresses[addr];
+        uint64_t transactions = m.transactions.load(std::memory_order_relaxed);
+        uint64_t locks = m.locks.load(std::memory_order_relaxed);
+        if (transactions == 0 && locks == 0) continue;
+
+        EKitMetricsSnapshot s;
+        s.bus = name;
+        s.addr = static_cast<int>(addr);
+        s.bytes_out = m.bytes_out.load(std::memory_order_relaxed);
+        s.bytes_in = m.bytes_in.load(std::memory_order_relaxed);
+        s.transactions = transactions;
+        s.errors = m.errors.load(std::memory_order_relaxed);
+        s.write_retries = m.write_retries.load(std::memory_order_relaxed);
+        s.read_retries = m.read_retries.load(std::memory_order_relaxed);
+        s.busy_polls = m.busy_polls.load(std::memory_order_relaxed);
+        s.timeouts = m.timeouts.load(std::memory_order_relaxed);
+        s.locks = locks;
+        s.lock_wait_us = m.lock_wait_us.load(std::memory_order_relaxed);
+        s.transaction_us = m.transaction_us.load(std::memory_order_relaxed);
+        s.lock_wait_hist.resize(histogram_buckets);
+        s.transaction_hist.resize(histogram_buckets);
+        s.retry_hist.resize(histogram_buckets);
+        for (size_t i = 0; i < histogram_buckets; i++) {
+            s.lock_wait_hist[i] = m.lock_wait_hist[i].load(std::memory_order_relaxed);
+            s.transaction_hist[i] = m.transaction_hist[i].load(std::memory_order_relaxed);
+            s.retry_hist[i] = m.retry_hist[i].load(std::memory_order_relaxed);
+        }
+
+        snap.push_back(std::move(s));
+    }
+}
+
+void EKitBusMetrics::reset() {
+    for (AddrMetrics& m : addresses) {
+        m.bytes_out.store(0, std::memory_order_relaxed);
+        m.bytes_in.store(0, std::memory_order_relaxed);
+        m.transactions.store(0, std::memory_order_relaxed);
+        m.errors.store(0, std::memory_order_relaxed);
+        m.write_retries.store(0, std::memory_order_relaxed);
+        m.read_retries.store(0, std::memory_order_relaxed);
+        m.busy_polls.store(0, std::memory_order_relaxed);
+        m.timeouts.store(0, std::memory_order_relaxed);
+        m.locks.store(0, std::memory_order_relaxed);
+        m.lock_wait_us.store(0, std::memory_order_relaxed);
+        m.transaction_us.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < histogram_buckets; i++) {
+            m.lock_wait_hist[i].store(0, std::memory_order_relaxed);
+            m.transaction_hist[i].store(0, std::memory_order_relaxed);
+            m.retry_hist[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+EKitMetricsRegistry::EKitMetricsRegistry() :
+    dump_stop(false) {
+}
+
+EKitMetricsRegistry::~EKitMetricsRegistry() {
+    stop_dump();
+}
+
+std::shared_ptr<EKitBusMetrics> EKitMetricsRegistry::add_bus(const std::string& name) {
+    std::shared_ptr<EKitBusMetrics> res(new EKitBusMetrics(name));
+    std::lock_guard<std::mutex> lock(reg_lock);
+    buses.push_back(res);
+    return res;
+}
+
+void EKitMetricsRegistry::snapshot(std::vector<EKitMetricsSnapshot>& snap) {
+    std::lock_guard<std::mutex> lock(reg_lock);
+    snap.clear();
+    for (auto& b : buses) {
+        b->snapshot(snap);
+    }
+}
+
+void EKitMetricsRegistry::reset() {
+    std::lock_guard<std::mutex> lock(reg_lock);
+    for (auto& b : buses) {
+        b->reset();
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitMetricsRegistry::start_dump
+// Purpose: Starts thread which passes snapshots to the sink periodically
+// EKitMetricsSink sink: function receiving snapshots
+// uint32_t interval_ms: dump interval
+//------------------------------------------------------------------------------------
+void EKitMetricsRegistry::start_dump(EKitMetricsSink sink, uint32_t interval_ms) {
+    assert(sink);
+    stop_dump();
+
+    dump_stop = false;
+    dump_thread = std::thread([this, sink, interval_ms]() {
+        std::vector<EKitMetricsSnapshot> snap;
+        std::unique_lock<std::mutex> lock(dump_lock);
+
+        while (!dump_cond.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]() { return dump_stop; })) {
+            lock.unlock();
+            snapshot(snap);
+            sink(snap);
+            lock.lock();
+        }
+    });
+}
+
+void EKitMetricsRegistry::stop_dump() {
+    if (!dump_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(dump_lock);
+        dump_stop = true;
+    }
+    dump_cond.notify_all();
+    dump_thread.join();
+}
+
+std::string EKitMetricsRegistry::format(const std::vector<EKitMetricsSnapshot>& snap) {
+    std::string res;
+    char line[512];
+
+    for (const EKitMetricsSnapshot& s : snap) {
+        snprintf(line, sizeof(line),
+                 "%s[%d]: out=%" PRIu64 " in=%" PRIu64 " trans=%" PRIu64 " err=%" PRIu64 " wretry=%" PRIu64
+                 " rretry=%" PRIu64 " busy=%" PRIu64 " timeouts=%" PRIu64 " locks=%" PRIu64 " lock_wait_us=%" PRIu64
+                 " trans_us=%" PRIu64 "\n",
+                 s.bus.c_str(), s.addr, s.bytes_out, s.bytes_in, s.transactions, s.errors, s.write_retries,
+                 s.read_retries, s.busy_polls, s.timeouts, s.locks, s.lock_wait_us, s.transaction_us);
+        res += line;
+    }
+
+    return res;
+}
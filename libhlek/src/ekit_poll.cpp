@@ -0,0 +1,151 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Poll strategies for busy virtual devices implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+#include <sched.h>
+#include "ekit_poll.hpp"
+#include "tools.hpp"
+
+//------------------------------------------------------------------------------------
+// EKitPollStrategy
+//------------------------------------------------------------------------------------
+EKitPollStrategy::EKitPollStrategy() {
+    memset(stats, 0, sizeof(stats));
+}
+
+EKitPollStrategy::~EKitPollStrategy() {
+}
+
+void EKitPollStrategy::begin(int dev_id, uint32_t hint_us, int remaining_ms) {
+}
+
+void EKitPollStrategy::sleep_us(uint32_t us, int remaining_ms) {
+    if (remaining_ms > 0 && us > static_cast<uint64_t>(remaining_ms) * 1000) {
+        us = static_cast<uint32_t>(remaining_ms) * 1000;
+    }
+    tools::sleep_us(us);
+}
+
+void EKitPollStrategy::end(int dev_id, size_t polls, size_t elapsed_us) {
+    assert(dev_id >= 0 && dev_id <= COMM_MAX_DEV_ADDR);
+    std::lock_guard<std::mutex> lock(stats_lock);
+    EKitPollStats& s = stats[dev_id];
+
+    s.commands++;
+    s.polls += polls;
+    s.total_us += elapsed_us;
+    if (polls > s.max_polls) s.max_polls = polls;
+    if (elapsed_us > s.max_us) s.max_us = elapsed_us;
+}
+
+EKitPollStats EKitPollStrategy::get_stats(int dev_id) {
+    assert(dev_id >= 0 && dev_id <= COMM_MAX_DEV_ADDR);
+    std::lock_guard<std::mutex> lock(stats_lock);
+    return stats[dev_id];
+}
+
+void EKitPollStrategy::reset_stats() {
+    std::lock_guard<std::mutex> lock(stats_lock);
+    memset(stats, 0, sizeof(stats));
+}
+
+//------------------------------------------------------------------------------------
+// EKitSpinPoll
+//------------------------------------------------------------------------------------
+void EKitSpinPoll::wait(int dev_id, size_t attempt, bool yield, int remaining_ms) {
+    if (yield) {
+        sched_yield();
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitYieldPoll
+//------------------------------------------------------------------------------------
+void EKitYieldPoll::wait(int dev_id, size_t attempt, bool yield, int remaining_ms) {
+    sched_yield();
+}
+
+//------------------------------------------------------------------------------------
+// EKitBackoffPoll
+//------------------------------------------------------------------------------------
+EKitBackoffPoll::EKitBackoffPoll(uint32_t min_us, uint32_t max_us) :
+    min_delay_us(min_us),
+    max_delay_us(max_us) {
+    assert(min_us > 0 && min_us <= max_us);
+}
+
+uint32_t EKitBackoffPoll::delay_us(size_t attempt) const {
+    uint64_t res = min_delay_us;
+
+    for (size_t i = 1; i < attempt && res < max_delay_us; i++) {
+        res <<= 1;
+    }
+
+    return (res > max_delay_us) ? max_delay_us : (uint32_t)res;
+}
+
+void EKitBackoffPoll::wait(int dev_id, size_t attempt, bool yield, int remaining_ms) {
+    sleep_us(delay_us(attempt), remaining_ms);
+}
+
+//------------------------------------------------------------------------------------
+// EKitPredictedPoll
+//------------------------------------------------------------------------------------
+EKitPredictedPoll::EKitPredictedPoll(uint32_t min_us, uint32_t max_us) :
+    super(min_us, max_us) {
+    memset(average_us, 0, sizeof(average_us));
+}
+
+uint32_t EKitPredictedPoll::predicted_us(int dev_id) {
+    assert(dev_id >= 0 && dev_id <= COMM_MAX_DEV_ADDR);
+    std::lock_guard<std::mutex> lock(predict_lock);
+
+    // Elapsed time includes initial sleep, so wait a bit less than average to let prediction decrease.
+    return average_us[dev_id] - average_us[dev_id] / 4;
+}
+
+void EKitPredictedPoll::begin(int dev_id, uint32_t hint_us, int remaining_ms) {
+    uint32_t us = (hint_us != 0) ? hint_us : predicted_us(dev_id);
+
+    // Longer commands are polled with maximum delay
+    us = std::min(us, delay_us(SIZE_MAX));
+    if (us != 0) {
+        sleep_us(us, remaining_ms);
+    }
+}
+
+void EKitPredictedPoll::end(int dev_id, size_t polls, size_t elapsed_us) {
+    super::end(dev_id, polls, elapsed_us);
+
+    std::lock_guard<std::mutex> lock(predict_lock);
+    uint32_t& avg = average_us[dev_id];
+    uint32_t elapsed = (elapsed_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed_us;
+
+    // Moving average with 1/8 weight of the new value
+    if (avg == 0) {
+        avg = elapsed;
+    } else {
+        avg = (uint32_t)(((uint64_t)avg * 7 + elapsed) / 8);
+    }
+}
@@ -0,0 +1,610 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Virtual device models for EKitSimFirmwareBus implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "ekit_sim_devices.hpp"
+
+static const StepMotorMicrostepTables sim_microstep_tables = STEP_MOTOR_MICROSTEP_TABLE;
+
+//------------------------------------------------------------------------------------
+// EKitSimADCDev
+//------------------------------------------------------------------------------------
+EKitSimADCDev::EKitSimADCDev(const ADCConfig* cfg, double sample_rate) :
+    super(cfg->dev_id),
+    config(cfg),
+    default_rate(sample_rate),
+    status(0),
+    prescaller(0),
+    period(0),
+    samples_left(0),
+    sample_index(0),
+    next_sample_us(0) {
+    assert(sample_rate > 0);
+    circ_buffer.reset(new EKitSimCircBuffer(cfg->dev_buffer_len,
+                                            cfg->input_count * sizeof(uint16_t),
+                                            sizeof(uint16_t)));
+    stream_read = true;
+    stream_status = &status;
+    set_generator(nullptr);
+}
+
+EKitSimADCDev::~EKitSimADCDev() {
+}
+
+void EKitSimADCDev::set_generator(EKitSimADCGenerator gen) {
+    if (gen) {
+        generator = std::move(gen);
+    } else {
+        uint32_t range = config->adc_maxval + 1;
+        generator = [range](size_t channel, uint64_t sample) {
+            return static_cast<uint16_t>((sample * 16 + channel * 256) % range);
+        };
+    }
+}
+
+double EKitSimADCDev::sample_period_us() const {
+    if (prescaller == 0 && period == 0) {
+        return 1.0e6 / default_rate;
+    }
+
+    return 1.0e6 * (prescaller + 1.0) * (period + 1.0) / config->timer_freq;
+}
+
+void EKitSimADCDev::stop() {
+    status &= ~(ADCDEV_STATUS_STARTED | ADCDEV_STATUS_SAMPLING);
+    samples_left = 0;
+}
+
+void EKitSimADCDev::advance(uint64_t now) {
+    double sp = sample_period_us();
+
+    while ((status & ADCDEV_STATUS_STARTED) != 0 && next_sample_us <= now) {
+        uint16_t* block = reinterpret_cast<uint16_t*>(circ_buffer->reserve_block());
+        if (block == nullptr) {
+            stop();
+            break;
+        }
+
+        for (size_t ch = 0; ch < config->input_count; ch++) {
+            block[ch] = generator(ch, sample_index);
+        }
+        circ_buffer->commit_block();
+        sample_index++;
+        next_sample_us += sp;
+
+        if ((status & ADCDEV_STATUS_UNSTOPPABLE) == 0 && --samples_left == 0) {
+            stop();
+        }
+    }
+
+    super::advance(now);
+}
+
+uint8_t EKitSimADCDev::on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) {
+    bool started = (status & ADCDEV_STATUS_STARTED) != 0;
+
+    switch (cmd_byte & COMM_CMDBYTE_SPECIFIC_MASK) {
+        case ADCDEV_START: {
+            if (length != sizeof(ADCDevCommand) || started) break;
+            const ADCDevCommand* cmd = reinterpret_cast<const ADCDevCommand*>(data);
+            if (cmd->sample_count == 0) {
+                status |= ADCDEV_STATUS_UNSTOPPABLE;
+            } else {
+                status &= ~ADCDEV_STATUS_UNSTOPPABLE;
+            }
+            samples_left = cmd->sample_count;
+            status |= ADCDEV_STATUS_STARTED;
+
+            // Timer is started and fired immediately
+            next_sample_us = now_us;
+            return COMM_STATUS_OK;
+        }
+
+        case ADCDEV_STOP:
+            stop();
+            return COMM_STATUS_OK;
+
+        case ADCDEV_RESET:
+            if (started) break;
+            circ_buffer->reset();
+            return COMM_STATUS_OK;
+
+        case ADCDEV_CONFIGURE: {
+            if (length < sizeof(ADCDevConfig) || length > sizeof(ADCDevConfig) + config->input_count || started) break;
+            const ADCDevConfig* cfg = reinterpret_cast<const ADCDevConfig*>(data);
+            if (cfg->measurements_per_sample < 1 || cfg->measurements_per_sample > config->measurements_per_sample) break;
+            prescaller = cfg->timer_prescaller;
+            period = cfg->timer_period;
+            return COMM_STATUS_OK;
+        }
+    }
+
+    return COMM_STATUS_FAIL;
+}
+
+uint8_t EKitSimADCDev::on_sync(uint8_t cmd_byte, size_t length) {
+    memcpy(circ_buffer->get_status(), &status, sizeof(status));
+    return COMM_STATUS_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimTimeTrackerDev
+//------------------------------------------------------------------------------------
+EKitSimTimeTrackerDev::EKitSimTimeTrackerDev(const TimeTrackerDevConfig* cfg, double event_rate) :
+    super(cfg->dev_id),
+    config(cfg),
+    event_period_us(1.0e6 / event_rate),
+    next_event_us(0) {
+    assert(event_rate > 0);
+    circ_buffer.reset(new EKitSimCircBuffer(cfg->dev_buffer_len, sizeof(uint64_t), sizeof(TimeTrackerStatus)));
+    stream_read = true;
+    status.first_event_ts = UINT64_MAX;
+    status.event_number = 0;
+    status.status = TIMETRACKERDEV_STATUS_STOPPED;
+}
+
+EKitSimTimeTrackerDev::~EKitSimTimeTrackerDev() {
+}
+
+void EKitSimTimeTrackerDev::advance(uint64_t now) {
+    while (status.status == TIMETRACKERDEV_STATUS_STARTED && next_event_us <= now) {
+        uint64_t ts = static_cast<uint64_t>(next_event_us * config->tick_freq / 1.0e6);
+        uint8_t* block = circ_buffer->reserve_block();
+        if (block == nullptr) {
+            // Events are lost while buffer is full
+            next_event_us += event_period_us * (1 + static_cast<uint64_t>((now - next_event_us) / event_period_us));
+            break;
+        }
+
+        memcpy(block, &ts, sizeof(ts));
+        circ_buffer->commit_block();
+        status.event_number++;
+        if (status.first_event_ts == UINT64_MAX) {
+            status.first_event_ts = ts;
+        }
+        next_event_us += event_period_us;
+    }
+
+    super::advance(now);
+}
+
+uint8_t EKitSimTimeTrackerDev::on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) {
+    switch (cmd_byte & COMM_CMDBYTE_SPECIFIC_MASK) {
+        case TIMETRACKERDEV_START:
+            if (status.status != TIMETRACKERDEV_STATUS_STARTED) {
+                next_event_us = now_us + event_period_us;
+            }
+            status.status = TIMETRACKERDEV_STATUS_STARTED;
+            return COMM_STATUS_OK;
+
+        case TIMETRACKERDEV_STOP:
+            status.status = TIMETRACKERDEV_STATUS_STOPPED;
+            return COMM_STATUS_OK;
+
+        case TIMETRACKERDEV_RESET:
+            if (status.status != TIMETRACKERDEV_STATUS_STOPPED) break;
+            circ_buffer->reset();
+            status.event_number = 0;
+            status.first_event_ts = UINT64_MAX;
+            return COMM_STATUS_OK;
+    }
+
+    return COMM_STATUS_FAIL;
+}
+
+uint8_t EKitSimTimeTrackerDev::on_sync(uint8_t cmd_byte, size_t length) {
+    status.event_number = circ_buffer->len() / sizeof(uint64_t);
+    memcpy(circ_buffer->get_status(), &status, sizeof(status));
+    return COMM_STATUS_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimCanDev
+//------------------------------------------------------------------------------------
+EKitSimCanDev::EKitSimCanDev(const CANConfig* cfg, double message_rate) :
+    super(cfg->dev_id),
+    config(cfg),
+    message_period_us(1.0e6 / message_rate),
+    message_index(0),
+    next_message_us(0) {
+    assert(message_rate > 0);
+    circ_buffer.reset(new EKitSimCircBuffer(cfg->dev_buffer_len, sizeof(CanRecvMessage), sizeof(CanStatus)));
+    memset(&status, 0, sizeof(status));
+    status.data_len = circ_buffer->total_len();
+    set_generator(nullptr);
+}
+
+EKitSimCanDev::~EKitSimCanDev() {
+}
+
+void EKitSimCanDev::set_generator(EKitSimCanGenerator gen) {
+    if (gen) {
+        generator = std::move(gen);
+    } else {
+        generator = [](uint64_t index, CanRecvMessage& msg) {
+            msg.id = index & 0x7FF;
+            msg.extra = CAN_MSG_MAX_DATA_LEN;
+            msg.fmi = 0;
+            for (size_t i = 0; i < CAN_MSG_MAX_DATA_LEN; i++) {
+                msg.data[i] = static_cast<uint8_t>(index + i);
+            }
+        };
+    }
+}
+
+void EKitSimCanDev::advance(uint64_t now) {
+    while ((status.state & CAN_STATE_STARTED) != 0 && next_message_us <= now) {
+        CanRecvMessage* msg = reinterpret_cast<CanRecvMessage*>(circ_buffer->reserve_block());
+        if (msg == nullptr) {
+            status.state |= CAN_ERROR_OVERFLOW;
+            status.state &= ~CAN_STATE_STARTED;
+            break;
+        }
+
+        generator(message_index++, *msg);
+        circ_buffer->commit_block();
+        status.data_len = circ_buffer->total_len();
+        next_message_us += message_period_us;
+    }
+
+    super::advance(now);
+}
+
+uint8_t EKitSimCanDev::on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) {
+    bool started = (status.state & CAN_STATE_STARTED) != 0;
+
+    switch (cmd_byte & COMM_CMDBYTE_DEV_SPECIFIC_MASK) {
+        case CAN_START:
+            if (length != 0 || started) break;
+            circ_buffer->reset();
+            memset(&status, 0, sizeof(status));
+            status.data_len = circ_buffer->total_len();
+            status.state = CAN_STATE_STARTED;
+            next_message_us = now_us + message_period_us;
+            return COMM_STATUS_OK;
+
+        case CAN_STOP:
+            if (length != 0 || !started) break;
+            status.state &= ~CAN_STATE_STARTED;
+            return COMM_STATUS_OK;
+
+        case CAN_FILTER:
+            if (length < sizeof(CanFilterCommand) || started) break;
+            return COMM_STATUS_OK;
+
+        case CAN_SEND:
+            if (length < sizeof(CanSendCommand) || !started) break;
+            sent.emplace_back(data, data + length);
+            return COMM_STATUS_OK;
+    }
+
+    return COMM_STATUS_FAIL;
+}
+
+uint8_t EKitSimCanDev::on_sync(uint8_t cmd_byte, size_t length) {
+    memcpy(circ_buffer->get_status(), &status, sizeof(status));
+    return COMM_STATUS_OK;
+}
+
+uint8_t EKitSimCanDev::on_read_done(size_t length) {
+    circ_buffer->stop_read(length);
+    circ_buffer->clear_ovf();
+    status.data_len = circ_buffer->total_len();
+    return COMM_STATUS_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimSPIDACDev
+//------------------------------------------------------------------------------------
+EKitSimSPIDACDev::EKitSimSPIDACDev(const SPIDACConfig* cfg) :
+    super(cfg->dev_id),
+    config(cfg),
+    sample_size(cfg->frame_size * cfg->frames_per_sample),
+    status_buffer(sizeof(SPIDACStatus) + cfg->channel_count * sizeof(SPIDACChannelSamplingInfo)),
+    default_sample(cfg->channel_count * sample_size),
+    positions(cfg->channel_count),
+    continuous(false),
+    samples_sent(0),
+    next_sample_us(0) {
+    status = reinterpret_cast<SPIDACStatus*>(status_buffer.data());
+    status->status = STOPPED;
+    buffer = status_buffer.data();
+    bytes_available = sizeof(SPIDACStatus);
+}
+
+EKitSimSPIDACDev::~EKitSimSPIDACDev() {
+}
+
+double EKitSimSPIDACDev::sample_period_us() const {
+    return 1.0e6 * (status->start_info.prescaler + 1.0) * (status->start_info.period + 1.0) / config->timer_freq;
+}
+
+void EKitSimSPIDACDev::advance(uint64_t now) {
+    double sp = sample_period_us();
+
+    while (status->status == WAITING && next_sample_us <= now) {
+        bool wrapped = false;
+
+        for (size_t ch = 0; ch < config->channel_count; ch++) {
+            const SPIDACChannelSamplingInfo& info = status->start_info.channel_info[ch];
+            size_t count = std::max<size_t>(info.loaded_samples_number, 1);
+            positions[ch] += std::max<size_t>(info.phase.phase_increment, 1);
+            if (positions[ch] >= count) {
+                positions[ch] %= count;
+                wrapped = true;
+            }
+        }
+
+        samples_sent++;
+        next_sample_us += sp;
+
+        if (wrapped && !continuous) {
+            status->status = STOPPED;
+        }
+    }
+
+    super::advance(now);
+}
+
+uint8_t EKitSimSPIDACDev::on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) {
+    size_t start_info_len = sizeof(SPIDACStartInfo) + config->channel_count * sizeof(SPIDACChannelSamplingInfo);
+    size_t upd_phase_len = config->channel_count * sizeof(SPIDACChannelPhaseInfo);
+    bool stopped = status->status == STOPPED || status->status == STOPPED_ABNORMAL;
+    uint8_t command = cmd_byte & COMM_CMDBYTE_DEV_SPECIFIC_MASK;
+
+    if (command == UPD_PHASE && length == upd_phase_len) {
+        if (status->status != WAITING) return COMM_STATUS_FAIL;
+        const SPIDACChannelPhaseInfo* phase = reinterpret_cast<const SPIDACChannelPhaseInfo*>(data);
+        for (size_t ch = 0; ch < config->channel_count; ch++) {
+            SPIDACChannelSamplingInfo& info = status->start_info.channel_info[ch];
+            size_t count = std::max<size_t>(info.loaded_samples_number, 1);
+            positions[ch] = (positions[ch] + phase[ch].phase) % count;
+            info.phase.phase_increment = phase[ch].phase_increment;
+        }
+    } else if ((command == START || command == START_PERIOD) && length == start_info_len) {
+        if (!stopped) return COMM_STATUS_FAIL;
+        memcpy(&status->start_info, data, length);
+        for (size_t ch = 0; ch < config->channel_count; ch++) {
+            const SPIDACChannelSamplingInfo& info = status->start_info.channel_info[ch];
+            positions[ch] = info.loaded_samples_number ? info.phase.phase % info.loaded_samples_number : 0;
+        }
+        continuous = (command == START);
+        status->status = WAITING;
+        next_sample_us = now_us;
+    } else if (command == SETDEFAULT && length == default_sample.size()) {
+        memcpy(default_sample.data(), data, length);
+        status->status = STOPPED;
+    } else if (command == DATA_START || command == DATA) {
+        size_t offset = (command == DATA_START) ? 0 : samples.size();
+        if (!stopped || length % sample_size != 0 || offset + length > config->max_sample_count * sample_size) {
+            return COMM_STATUS_FAIL;
+        }
+        samples.resize(offset + length);
+        memcpy(samples.data() + offset, data, length);
+    } else if (command == STOP) {
+        status->status = STOPPED;
+    } else {
+        return COMM_STATUS_FAIL;
+    }
+
+    return COMM_STATUS_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimStepMotorDev
+//------------------------------------------------------------------------------------
+EKitSimStepMotorDev::EKitSimStepMotorDev(const StepMotorConfig* cfg) :
+    super(cfg->dev_id),
+    config(cfg),
+    motors(cfg->motor_count),
+    status_buffer(sizeof(StepMotorDevStatus) + cfg->motor_count * sizeof(StepMotorStatus)) {
+    status = reinterpret_cast<StepMotorDevStatus*>(status_buffer.data());
+    status->status = STEP_MOTOR_DEV_STATUS_IDLE;
+    buffer = status_buffer.data();
+    bytes_available = status_buffer.size();
+
+    for (size_t m = 0; m < cfg->motor_count; m++) {
+        reset_motor(m);
+    }
+}
+
+EKitSimStepMotorDev::~EKitSimStepMotorDev() {
+}
+
+void EKitSimStepMotorDev::reset_motor(size_t mindex) {
+    const StepMotorDescriptor* desc = config->motor_descriptor[mindex];
+    StepMotorStatus& ms = status->mstatus[mindex];
+    SimMotor& m = motors[mindex];
+
+    ms.pos = 0;
+    ms.cw_sft_limit = desc->cw_sft_limit;
+    ms.ccw_sft_limit = desc->ccw_sft_limit;
+    ms.motor_state = desc->config_flags;
+    ms.bytes_remain = 0;
+    ms.reserved = 0;
+
+    m.commands.clear();
+    m.cmd_pos = 0;
+    m.step_wait = desc->default_speed;
+    m.steps_left = 0;
+    m.next_us = now_us;
+}
+
+void EKitSimStepMotorDev::step_motor(size_t mindex) {
+    const StepMotorDescriptor* desc = config->motor_descriptor[mindex];
+    StepMotorStatus& ms = status->mstatus[mindex];
+    SimMotor& m = motors[mindex];
+    uint8_t ms_value = STEP_MOTOR_MICROSTEP_STATUS_TO_VALUE(ms.motor_state);
+    uint8_t shift = sim_microstep_tables[desc->motor_driver][ms_value];
+    int64_t delta = STEP_MOTOR_MICROSTEP_DELTA(shift == STEP_MOTOR_BAD_STEP ? STEP_MOTOR_FULL_STEP : shift);
+    bool cw = (ms.motor_state & STEP_MOTOR_DIRECTION_CW) != 0;
+    uint64_t wait = std::max<uint64_t>(m.step_wait, 1);
+
+    // Number of the steps which fit into elapsed time and don't cross software limits
+    uint64_t steps = std::min<uint64_t>(m.steps_left, static_cast<uint64_t>((now_us - m.next_us) / wait) + 1);
+    int64_t room = cw ? (ms.cw_sft_limit - ms.pos) / delta : (ms.pos - ms.ccw_sft_limit) / delta;
+    if (room <= 0) {
+        m.steps_left = 0;
+        return;
+    }
+    if (static_cast<uint64_t>(room) < steps) {
+        steps = room;
+        m.steps_left = steps;
+    }
+
+    ms.pos += (cw ? delta : -delta) * static_cast<int64_t>(steps);
+    m.steps_left -= steps;
+    m.next_us += static_cast<double>(steps * wait);
+}
+
+void EKitSimStepMotorDev::run_motor(size_t mindex) {
+    StepMotorStatus& ms = status->mstatus[mindex];
+    SimMotor& m = motors[mindex];
+
+    while (m.next_us <= now_us) {
+        if (m.steps_left > 0) {
+            step_motor(mindex);
+            continue;
+        }
+
+        if (m.cmd_pos >= m.commands.size()) {
+            ms.motor_state |= STEP_MOTOR_DONE;
+            break;
+        }
+
+        // Fetch command and parameter
+        uint8_t cmd = m.commands[m.cmd_pos];
+        size_t param_len = 0;
+        uint64_t param = 0;
+        switch (cmd & STEP_MOTOR_PARAM_MASK) {
+            case STEP_MOTOR_PARAM_8:  param_len = sizeof(uint8_t); break;
+            case STEP_MOTOR_PARAM_16: param_len = sizeof(uint16_t); break;
+            case STEP_MOTOR_PARAM_64: param_len = sizeof(uint64_t); break;
+            default: param = cmd & STEP_MOTOR_ARG_MASK;
+        }
+        if (m.cmd_pos + 1 + param_len > m.commands.size()) {
+            ms.motor_state |= STEP_MOTOR_ERROR;
+            m.cmd_pos = m.commands.size();
+            break;
+        }
+        memcpy(&param, m.commands.data() + m.cmd_pos + 1, param_len);   // little endian
+        m.cmd_pos += 1 + param_len;
+        ms.bytes_remain = m.commands.size() - m.cmd_pos;
+
+        switch (cmd & (STEP_MOTOR_CMD_MASK | STEP_MOTOR_ARG_MASK)) {
+            case STEP_MOTOR_GENERAL | STEP_MOTOR_GENERAL_ENABLE:   ms.motor_state &= ~STEP_MOTOR_DISABLE_DEFAULT; break;
+            case STEP_MOTOR_GENERAL | STEP_MOTOR_GENERAL_DISABLE:  ms.motor_state |= STEP_MOTOR_DISABLE_DEFAULT; break;
+            case STEP_MOTOR_GENERAL | STEP_MOTOR_GENERAL_SLEEP:    ms.motor_state &= ~STEP_MOTOR_WAKEUP_DEFAULT; break;
+            case STEP_MOTOR_GENERAL | STEP_MOTOR_GENERAL_WAKEUP:   ms.motor_state |= STEP_MOTOR_WAKEUP_DEFAULT; break;
+            case STEP_MOTOR_GENERAL | STEP_MOTOR_GENERAL_RESET:    break;
+            case STEP_MOTOR_GENERAL | STEP_MOTOR_GENERAL_WAIT:     m.next_us += param; break;
+            case STEP_MOTOR_GENERAL | STEP_MOTOR_GENERAL_CONFIG:
+                ms.motor_state = (ms.motor_state & ~STEP_MOTOR_CONFIG_MASK) | STEP_MOTOR_CONFIG_BYTE_TO_FLAGS(param);
+                break;
+            case STEP_MOTOR_SET | STEP_MOTOR_SET_DIR_CCW:          ms.motor_state &= ~STEP_MOTOR_DIRECTION_CW; break;
+            case STEP_MOTOR_SET | STEP_MOTOR_SET_DIR_CW:           ms.motor_state |= STEP_MOTOR_DIRECTION_CW; break;
+            case STEP_MOTOR_SET | STEP_MOTOR_SET_MICROSTEP:
+                ms.motor_state = (ms.motor_state & ~STEP_MOTOR_MICROSTEP_VALUE_TO_STATUS(0xFF)) |
+                                 STEP_MOTOR_MICROSTEP_VALUE_TO_STATUS(param);
+                break;
+            case STEP_MOTOR_SET | STEP_MOTOR_SET_STEP_WAIT:        m.step_wait = param; break;
+            case STEP_MOTOR_SET | STEP_MOTOR_SET_CW_SFT_LIMIT:     ms.cw_sft_limit = static_cast<int64_t>(param); break;
+            case STEP_MOTOR_SET | STEP_MOTOR_SET_CCW_SFT_LIMIT:    ms.ccw_sft_limit = static_cast<int64_t>(param); break;
+            default:
+                if ((cmd & STEP_MOTOR_CMD_MASK) == STEP_MOTOR_MOVE) {
+                    m.steps_left = param;
+                } else if ((cmd & STEP_MOTOR_CMD_MASK) == STEP_MOTOR_MOVE_NON_STOP) {
+                    m.steps_left = UINT64_MAX;
+                } else {
+                    ms.motor_state |= STEP_MOTOR_ERROR;
+                }
+        }
+    }
+}
+
+void EKitSimStepMotorDev::advance(uint64_t now) {
+    super::advance(now);
+
+    if (status->status != STEP_MOTOR_DEV_STATUS_RUN) {
+        return;
+    }
+
+    bool done = true;
+    for (size_t m = 0; m < config->motor_count; m++) {
+        run_motor(m);
+        done = done && (status->mstatus[m].motor_state & STEP_MOTOR_DONE) != 0;
+    }
+
+    if (done) {
+        status->status = STEP_MOTOR_DEV_STATUS_IDLE;
+    }
+}
+
+uint8_t EKitSimStepMotorDev::on_command(uint8_t cmd_byte, const uint8_t* data, size_t length) {
+    size_t mindex = 0;
+
+    switch (cmd_byte & COMM_CMDBYTE_DEV_SPECIFIC_MASK) {
+        case STEP_MOTOR_START:
+            if (status->status == STEP_MOTOR_DEV_STATUS_RUN) return COMM_STATUS_FAIL;
+            for (size_t m = 0; m < config->motor_count; m++) {
+                status->mstatus[m].motor_state &= ~STEP_MOTOR_DONE;
+                motors[m].next_us = now_us;
+            }
+            status->status = STEP_MOTOR_DEV_STATUS_RUN;
+            return COMM_STATUS_OK;
+
+        case STEP_MOTOR_STOP:
+            for (size_t m = 0; m < config->motor_count; m++) {
+                int64_t pos = status->mstatus[m].pos;
+                reset_motor(m);
+                status->mstatus[m].pos = pos;
+            }
+            status->status = STEP_MOTOR_DEV_STATUS_IDLE;
+            return COMM_STATUS_OK;
+
+        case STEP_MOTOR_NONE:
+            // Feed motor command buffers
+            for (size_t i = 0; i < length; i++) {
+                if ((data[i] & STEP_MOTOR_SELECT) != 0) {
+                    mindex = data[i] & ~STEP_MOTOR_SELECT;
+                    if (mindex >= config->motor_count) return COMM_STATUS_FAIL;
+                    continue;
+                }
+
+                SimMotor& m = motors[mindex];
+                if (m.cmd_pos == m.commands.size()) {
+                    m.commands.clear();
+                    m.cmd_pos = 0;
+                }
+                if (m.commands.size() - m.cmd_pos >= config->motor_descriptor[mindex]->buffer_size) {
+                    return COMM_STATUS_FAIL;
+                }
+                m.commands.push_back(data[i]);
+                status->mstatus[mindex].bytes_remain = m.commands.size() - m.cmd_pos;
+            }
+            return COMM_STATUS_OK;
+    }
+
+    return COMM_STATUS_FAIL;
+}
@@ -0,0 +1,595 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Simulated firmware bus implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "ekit_sim_firmware.hpp"
+#include "tools.hpp"
+
+constexpr size_t EKitSimFirmwareBus::default_comm_buffer_length;
+constexpr uint32_t EKitSimFirmwareBus::default_bus_speed;
+
+EKitSimCircBuffer::EKitSimCircBuffer(size_t length, size_t bs, size_t status_size) :
+    buffer(length - length % bs),
+    status(status_size),
+    block_size(bs) {
+    assert(bs > 0 && buffer.size() > 0);
+    reset();
+}
+
+void EKitSimCircBuffer::reset() {
+    get_pos = 0;
+    data_len = 0;
+    ovf = false;
+}
+
+uint8_t* EKitSimCircBuffer::reserve_block() {
+    if (data_len + block_size > buffer.size()) {
+        ovf = true;
+        return nullptr;
+    }
+
+    return buffer.data() + (get_pos + data_len) % buffer.size();
+}
+
+void EKitSimCircBuffer::commit_block() {
+    assert(data_len + block_size <= buffer.size());
+    data_len += block_size;
+}
+
+void EKitSimCircBuffer::copy(uint8_t* dst, size_t offset, size_t length) const {
+    assert(offset + length <= total_len());
+    size_t status_size = status.size();
+
+    if (offset < status_size) {
+        size_t n = std::min(length, status_size - offset);
+        memcpy(dst, status.data() + offset, n);
+        dst += n;
+        offset += n;
+        length -= n;
+    }
+
+    // Buffer length is multiple of the block size, so block never wraps, but read may
+    size_t pos = (get_pos + offset - status_size) % buffer.size();
+    while (length > 0) {
+        size_t n = std::min(length, buffer.size() - pos);
+        memcpy(dst, buffer.data() + pos, n);
+        dst += n;
+        length -= n;
+        pos = 0;
+    }
+}
+
+void EKitSimCircBuffer::stop_read(size_t num_bytes) {
+    if (num_bytes <= status.size()) {
+        return;
+    }
+
+    num_bytes = std::min(num_bytes - status.size(), data_len);
+    get_pos = (get_pos + num_bytes) % buffer.size();
+    data_len -= num_bytes;
+}
+
+EKitSimDevice::EKitSimDevice(uint8_t id) :
+    dev_id(id),
+    now_us(0),
+    buffer(nullptr),
+    bytes_available(0),
+    stream_read(false),
+    stream_status(nullptr) {
+    assert(id <= COMM_MAX_DEV_ADDR);
+}
+
+EKitSimDevice::~EKitSimDevice() {
+}
+
+void EKitSimDevice::advance(uint64_t now) {
+    now_us = now;
+}
+
+uint8_t EKitSimDevice::on_sync(uint8_t cmd_byte, size_t length) {
+    return COMM_STATUS_OK;
+}
+
+uint8_t EKitSimDevice::on_read_done(size_t length) {
+    return COMM_STATUS_OK;
+}
+
+EKitSimFirmwareBus::EKitSimFirmwareBus(int addr, size_t comm_buffer_len, bool rt) :
+    super(BUS_I2C),
+    firmware_addr(addr),
+    comm_buffer_length(comm_buffer_len),
+    realtime(rt),
+    start_time(std::chrono::steady_clock::now()),
+    recv_buffer(comm_buffer_len) {
+}
+
+EKitSimFirmwareBus::~EKitSimFirmwareBus() {
+}
+
+void EKitSimFirmwareBus::add_device(std::shared_ptr<EKitSimDevice> dev) {
+    std::lock_guard<std::mutex> lock(sim_lock);
+    uint8_t id = dev->get_dev_id();
+    dev->advance(now());
+    devices[id] = std::move(dev);
+}
+
+void EKitSimFirmwareBus::advance_time(uint64_t us) {
+    std::lock_guard<std::mutex> lock(sim_lock);
+    if (!realtime) {
+        sim_time_us += us;
+    }
+}
+
+uint64_t EKitSimFirmwareBus::get_time() {
+    std::lock_guard<std::mutex> lock(sim_lock);
+    return now();
+}
+
+void EKitSimFirmwareBus::set_command_latency(uint64_t us) {
+    std::lock_guard<std::mutex> lock(sim_lock);
+    command_latency_us = us;
+}
+
+void EKitSimFirmwareBus::set_bus_speed(uint32_t hz) {
+    std::lock_guard<std::mutex> lock(sim_lock);
+    bus_speed = hz;
+}
+
+void EKitSimFirmwareBus::set_crc16_support(bool enable) {
+    std::lock_guard<std::mutex> lock(sim_lock);
+    crc16_support = enable;
+}
+
+uint64_t EKitSimFirmwareBus::now() {
+    if (realtime) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    return sim_time_us;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimFirmwareBus::process
+// Purpose: Advances models and processes command if it is due, mirrors i2c_check_command() of the firmware
+// uint64_t t: current simulated time
+//------------------------------------------------------------------------------------
+void EKitSimFirmwareBus::process(uint64_t t) {
+    uint8_t status;
+
+    for (auto& dev : devices) {
+        if (dev) dev->advance(t);
+    }
+
+    if (cmd_type == SIM_CMD_NONE || t < cmd_due_us) {
+        return;
+    }
+
+    EKitSimDevice* dev = devices[device_id].get();
+    assert(dev != nullptr);
+
+    switch (cmd_type) {
+        case SIM_CMD_READ:
+            status = dev->on_read_done(cmd_length);
+        break;
+
+        case SIM_CMD_WRITE:
+            status = dev->on_command(cmd_byte, recv_buffer.data(), cmd_length);
+        break;
+
+        case SIM_CMD_SYNC:
+            status = dev->on_sync(cmd_byte, cmd_length);
+        break;
+
+        case SIM_CMD_BATCH:
+            status = dispatch_batch();
+        break;
+
+        default:
+            assert(false);
+            status = COMM_STATUS_FAIL;
+    }
+
+    comm_status = status & (~COMM_MAX_DEV_ADDR);
+    cmd_type = SIM_CMD_NONE;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimFirmwareBus::dispatch_batch
+// Purpose: Passes batch frame records to the models in order, mirrors i2c_dispatch_batch() of the firmware
+// Returns: Combination of the statuses returned by models, or COMM_STATUS_FAIL if batch is malformed
+//------------------------------------------------------------------------------------
+uint8_t EKitSimFirmwareBus::dispatch_batch() {
+    uint8_t status = COMM_STATUS_OK;
+    CommBatchRecord rec;
+    size_t size;
+
+    for (size_t pos = 0; pos < cmd_length; pos += size) {
+        if (cmd_length - pos < sizeof(rec)) {
+            return COMM_STATUS_FAIL;
+        }
+
+        memcpy(&rec, recv_buffer.data() + pos, sizeof(rec));
+        size = COMM_BATCH_RECORD_SIZE(rec.length);
+        if (size > cmd_length - pos || rec.reserved != 0 || !devices[rec.command_byte & COMM_MAX_DEV_ADDR]) {
+            return COMM_STATUS_FAIL;
+        }
+    }
+
+    for (size_t pos = 0; pos < cmd_length; pos += size) {
+        memcpy(&rec, recv_buffer.data() + pos, sizeof(rec));
+        size = COMM_BATCH_RECORD_SIZE(rec.length);
+        status |= devices[rec.command_byte & COMM_MAX_DEV_ADDR]->on_command(rec.command_byte,
+                                                                            recv_buffer.data() + pos + sizeof(rec),
+                                                                            rec.length);
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimFirmwareBus::receive
+// Purpose: Handles written message as firmware does: receives command header and data, checks them at STOP
+// const uint8_t* data: message data
+// size_t length: length of the message
+//------------------------------------------------------------------------------------
+void EKitSimFirmwareBus::receive(const uint8_t* data, size_t length) {
+    CommCommandHeader hdr;
+    uint8_t* phdr = reinterpret_cast<uint8_t*>(&hdr);
+    size_t total_pos = 0;
+    size_t data_pos = 0;
+
+    crc = COMM_CRC_INIT_VALUE;
+    crc16 = COMM_CRC16_INIT_VALUE;
+
+    if ((comm_status & COMM_STATUS_BUSY) != 0) {
+        // Do not do anything until BUSY flag is not cleared by device
+        return;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t b = data[i];
+
+        if (total_pos < sizeof(CommCommandHeader)) {
+            phdr[total_pos++] = b;
+
+            if (total_pos == COMM_COMMAND_BYTE_OFFSET + 1) {
+                if ((b & COMM_MAX_DEV_ADDR) != device_id) {
+                    // Status returned by the previous device doesn't belong to this one
+                    comm_status = COMM_STATUS_OK;
+                }
+                device_id = b & COMM_MAX_DEV_ADDR;
+            }
+
+            // Calculated control sum (except for control_crc byte)
+            if (total_pos != COMM_CRC_OFFSET + 1) {
+                crc ^= b;
+            }
+            crc16 = tools::crc16_update(crc16, &b, 1);
+        } else if (data_pos < comm_buffer_length) {
+            recv_buffer[data_pos++] = b;
+            total_pos++;
+            crc ^= b;
+            crc16 = tools::crc16_update(crc16, &b, 1);
+        } else {
+            comm_status |= COMM_STATUS_FAIL;
+        }
+    }
+
+    if (!devices[device_id]) {
+        // There is no such device in the firmware
+        comm_status |= COMM_STATUS_FAIL;
+        return;
+    }
+
+    // STOP condition
+    if (total_pos >= sizeof(CommCommandHeader)) {
+        if (crc16_support && (hdr.length & COMM_CRC16_FLAG) != 0) {
+            if ((hdr.length & COMM_LENGTH_MASK) + COMM_CRC16_SIZE != data_pos) {
+                comm_status |= COMM_STATUS_FAIL;
+                return;
+            }
+
+            // CRC-16 of the frame followed by its CRC-16 is zero
+            if (crc16 != 0) {
+                comm_status |= COMM_STATUS_CRC;
+                return;
+            }
+
+            data_pos -= COMM_CRC16_SIZE;
+            crc16 = static_cast<uint16_t>((recv_buffer[data_pos] << 8) | recv_buffer[data_pos + 1]);
+            crc16_mode = true;
+        } else {
+            // Firmware without CRC-16 support treats COMM_CRC16_FLAG as a part of the length
+            uint16_t length_mask = crc16_support ? COMM_LENGTH_MASK : static_cast<uint16_t>(~COMM_BATCH_FLAG);
+
+            if ((hdr.length & length_mask) != data_pos) {
+                comm_status |= COMM_STATUS_FAIL;
+                return;
+            }
+
+            if (hdr.control_crc != crc) {
+                comm_status |= COMM_STATUS_CRC;
+                return;
+            }
+            crc16_mode = false;
+        }
+
+        cmd_type = (hdr.length & COMM_BATCH_FLAG) != 0 ? SIM_CMD_BATCH : SIM_CMD_WRITE;
+        cmd_length = data_pos;
+    } else {
+        cmd_type = SIM_CMD_SYNC;
+        cmd_length = total_pos;
+    }
+
+    cmd_byte = hdr.command_byte;
+    cmd_due_us = now() + command_latency_us;
+    comm_status |= COMM_STATUS_BUSY;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimFirmwareBus::transmit
+// Purpose: Handles read message as firmware does: sends response header followed by virtual device data
+// EKitBusSegment* segments: segments of the message
+// size_t count: number of the segments
+//------------------------------------------------------------------------------------
+void EKitSimFirmwareBus::transmit(EKitBusSegment* segments, size_t count) {
+    CommResponseHeader hdr;
+    const uint8_t* phdr = reinterpret_cast<const uint8_t*>(&hdr);
+    EKitSimDevice* dev = devices[device_id].get();
+    size_t total = 0;
+    size_t dev_pos = 0;
+
+    hdr.last_crc = crc16_mode ? static_cast<uint8_t>(crc16) : crc;
+    hdr.dummy = crc16_mode ? static_cast<uint8_t>(crc16 >> 8) : COMM_DUMMY_BYTE;
+    hdr.comm_status = comm_status | device_id;
+    hdr.length = 0;
+    crc = COMM_CRC_INIT_VALUE;
+    crc16 = COMM_CRC16_INIT_VALUE;
+
+    if (dev == nullptr) {
+        hdr.comm_status |= COMM_STATUS_FAIL;
+    } else if (dev->circ_buffer) {
+        // Live status is taken before length of the data
+        if (dev->stream_read && dev->stream_status != nullptr) {
+            memcpy(dev->circ_buffer->get_status(), dev->stream_status, dev->circ_buffer->get_status_size());
+        }
+        hdr.length = dev->circ_buffer->total_len();
+        if (dev->circ_buffer->get_ovf()) {
+            hdr.comm_status |= COMM_STATUS_OVF;
+        }
+    } else {
+        hdr.length = dev->bytes_available;
+    }
+
+    for (size_t s = 0; s < count; s++) {
+        uint8_t* dst = static_cast<uint8_t*>(segments[s].buffer);
+        size_t len = segments[s].length;
+
+        // Response header
+        while (len > 0 && total < sizeof(CommResponseHeader)) {
+            *dst++ = phdr[total++];
+            len--;
+        }
+
+        // Device data
+        size_t n = std::min(len, hdr.length - dev_pos);
+        if (n > 0) {
+            if (dev->circ_buffer) {
+                dev->circ_buffer->copy(dst, dev_pos, n);
+            } else {
+                memcpy(dst, dev->buffer + dev_pos, n);
+            }
+            dst += n;
+            len -= n;
+            dev_pos += n;
+            total += n;
+        }
+
+        // No more data
+        memset(dst, COMM_BAD_BYTE, len);
+        total += len;
+
+        for (size_t i = 0; i < segments[s].length; i++) {
+            crc ^= static_cast<uint8_t*>(segments[s].buffer)[i];
+        }
+        crc16 = tools::crc16_update(crc16, segments[s].buffer, segments[s].length);
+    }
+
+    // STOP condition, status is reported once response header is read completely
+    if ((hdr.comm_status & COMM_STATUS_BUSY) == 0 && total >= sizeof(CommResponseHeader)) {
+        comm_status = COMM_STATUS_OK;
+    }
+
+    if ((hdr.comm_status & COMM_STATUS_BUSY) == 0 && dev_pos > 0 && dev->stream_read) {
+        // Only whole blocks are committed
+        size_t status_size = dev->circ_buffer->get_status_size();
+        if (dev_pos > status_size) {
+            dev_pos -= (dev_pos - status_size) % dev->circ_buffer->get_block_size();
+        }
+        dev->circ_buffer->stop_read(dev_pos);
+    } else if ((hdr.comm_status & COMM_STATUS_BUSY) == 0 && dev_pos > 0) {
+        cmd_type = SIM_CMD_READ;
+        cmd_length = dev_pos;
+        cmd_due_us = now() + command_latency_us;
+        comm_status |= COMM_STATUS_BUSY;
+    }
+}
+
+EKIT_ERROR EKitSimFirmwareBus::open(EKitTimeout& to) {
+    BusLocker blocker(this, firmware_addr, to);
+
+    if (state != BUS_CLOSED) {
+        return EKIT_ALREADY_CONNECTED;
+    }
+
+    state = BUS_OPENED;
+    return EKIT_OK;
+}
+
+EKIT_ERROR EKitSimFirmwareBus::close() {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    if (state == BUS_CLOSED) return EKIT_DISCONNECTED;
+
+    state = BUS_CLOSED;
+    return EKIT_OK;
+}
+
+EKIT_ERROR EKitSimFirmwareBus::lock(EKitTimeout& to) {
+    assert(false); // This method shouldn't be used because this bus require address
+    return EKIT_NOT_SUPPORTED;
+}
+
+EKIT_ERROR EKitSimFirmwareBus::lock(int addr, EKitTimeout& to) {
+    EKIT_ERROR res;
+    auto start = std::chrono::steady_clock::now();
+
+    res = arbitrate(addr, to);
+    if (res != EKIT_OK) {
+        goto done;
+    }
+
+    lock_bus(__builtin_return_address(0));
+    address = addr;
+
+    if (metrics) {
+        metrics->add_lock(addr, EKitBusMetrics::elapsed_us(start));
+    }
+done:
+    return res;
+}
+
+EKIT_ERROR EKitSimFirmwareBus::unlock() {
+    address = -1;
+    super::unlock();
+    release_arbiter();
+    return EKIT_OK;
+}
+
+EKIT_ERROR EKitSimFirmwareBus::read(void* ptr, size_t len, EKitTimeout& to) {
+    EKitBusSegment segment = {ptr, len, BUS_SEGMENT_READ | BUS_SEGMENT_STOP};
+    return transaction(&segment, 1, to);
+}
+
+EKIT_ERROR EKitSimFirmwareBus::read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    return EKIT_NOT_SUPPORTED;
+}
+
+EKIT_ERROR EKitSimFirmwareBus::write(const void* ptr, size_t len, EKitTimeout& to) {
+    EKitBusSegment segment = {const_cast<void*>(ptr), len, BUS_SEGMENT_WRITE | BUS_SEGMENT_STOP};
+    return transaction(&segment, 1, to);
+}
+
+EKIT_ERROR EKitSimFirmwareBus::write_read(const uint8_t* wbuf,
+                                          size_t wlen,
+                                          uint8_t* rbuf,
+                                          size_t rlen,
+                                          EKitTimeout& to) {
+    EKitBusSegment segments[2] = {
+        {const_cast<uint8_t*>(wbuf), wlen, BUS_SEGMENT_WRITE},
+        {rbuf, rlen, BUS_SEGMENT_READ | BUS_SEGMENT_STOP}};
+
+    return transaction(segments, 2, to);
+}
+
+//------------------------------------------------------------------------------------
+// EKitSimFirmwareBus::transaction
+// Purpose: Executes several write and read segments as a single bus transaction
+// EKitBusSegment* segments: segments to be executed
+// size_t count: number of segments
+// Returns: corresponding EKIT_ERROR code
+// Note: Segments are grouped into messages the same way EKitI2CBus does, then messages are passed to the simulated
+//       firmware one by one. Simulated time is updated before every message.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitSimFirmwareBus::transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) {
+    EKIT_ERROR err = EKIT_OK;
+    size_t bytes_out = 0;
+    size_t bytes_in = 0;
+    bool has_write = false;
+    auto start = std::chrono::steady_clock::now();
+
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    for (size_t i = 0; i < count; i++) {
+        bool readop = (segments[i].flags & BUS_SEGMENT_READ) != 0;
+        (readop ? bytes_in : bytes_out) += segments[i].length;
+        has_write = has_write || (!readop && segments[i].length > 0);
+    }
+
+    if (state == BUS_CLOSED) {
+        err = EKIT_NOT_OPENED;
+    } else if (state == BUS_PAUSED) {
+        err = EKIT_SUSPENDED;
+    } else if (address != firmware_addr) {
+        // Nobody acknowledges the address
+        err = has_write ? EKIT_WRITE_FAILED : EKIT_READ_FAILED;
+    } else {
+        std::lock_guard<std::mutex> lock(sim_lock);
+        size_t first = 0;
+
+        while (first < count) {
+            // Find the last segment of the message
+            bool readop = (segments[first].flags & BUS_SEGMENT_READ) != 0;
+            size_t last = first;
+            size_t length = segments[first].length;
+            while (last + 1 < count && (segments[last + 1].flags & BUS_SEGMENT_CONTINUE) != 0) {
+                if (readop != ((segments[last + 1].flags & BUS_SEGMENT_READ) != 0)) {
+                    return EKIT_BAD_PARAM;  // Message may be continued with the same direction only
+                }
+                last++;
+                length += segments[last].length;
+            }
+
+            if (length > 0) {
+                process(now());
+
+                if (readop) {
+                    transmit(segments + first, last + 1 - first);
+                } else {
+                    message.clear();
+                    for (size_t i = first; i <= last; i++) {
+                        const uint8_t* p = static_cast<const uint8_t*>(segments[i].buffer);
+                        message.insert(message.end(), p, p + segments[i].length);
+                    }
+                    receive(message.data(), message.size());
+                }
+
+                // START condition, address and data bytes, 9 bits each
+                if (!realtime && bus_speed > 0) {
+                    sim_time_us += ((length + 1) * 9 * 1000000ULL + bus_speed - 1) / bus_speed;
+                }
+            }
+
+            first = last + 1;
+        }
+    }
+
+    if (metrics) {
+        metrics->add_transaction(address, bytes_out, bytes_in, err, EKitBusMetrics::elapsed_us(start));
+    }
+
+    return err;
+}
@@ -30,6 +30,34 @@
 #include "ekit_helper.hpp"
 #include "tools.hpp"
 
+EKitSPITransaction& EKitSPITransaction::add(const void* tx,
+                                            void* rx,
+                                            size_t len,
+                                            bool cs_change,
+                                            uint16_t delay_us,
+                                            uint32_t speed_hz) {
+    struct spi_ioc_transfer xfr;
+    memset(&xfr, 0, sizeof(xfr));
+
+    xfr.tx_buf = reinterpret_cast<std::uintptr_t>(tx);
+    xfr.rx_buf = reinterpret_cast<std::uintptr_t>(rx);
+    xfr.len = static_cast<uint32_t>(len);
+    xfr.cs_change = cs_change;
+    xfr.delay_usecs = delay_us;
+    xfr.speed_hz = speed_hz;
+    transfers.push_back(xfr);
+
+    return *this;
+}
+
+void EKitSPITransaction::clear() {
+    transfers.clear();
+}
+
+size_t EKitSPITransaction::size() const {
+    return transfers.size();
+}
+
 //------------------------------------------------------------------------------------
 // EKitSPIBus::EKitSPIBus
 // Purpose: EKitSPIBus class constructor
@@ -351,8 +379,6 @@ EKIT_ERROR EKitSPIBus::write_read(const uint8_t* wbuf,
                                  size_t rlen,
                                  EKitTimeout& to) {
     EKIT_ERROR err;
-    int res;
-    int ern;
     struct spi_ioc_transfer xfr;
 
     // Special handling for write only operation
@@ -377,6 +403,37 @@ EKIT_ERROR EKitSPIBus::write_read(const uint8_t* wbuf,
     // This statement checks if there were an attempt to use IO operation without locking bus first.
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
+    // Fill msgs structure
+    xfr.tx_buf = reinterpret_cast<std::uintptr_t>(wbuf);
+    xfr.rx_buf = reinterpret_cast<std::uintptr_t>(rbuf);
+    xfr.len = wlen;
+    xfr.cs_change = cs_change;
+
+    err = spi_message(&xfr, 1, to);
+
+done:
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitSPIBus::spi_message
+// Purpose: Submits transfers to the kernel by single ioctl
+// struct spi_ioc_transfer* xfr: array of transfers
+// size_t count: number of transfers
+// Returns: corresponding EKIT_ERROR code
+// Note: Request is restarted on EINTR and EAGAIN at most max_interrupted_retries times, EKIT_TIMEOUT is returned if
+//       timeout expires while it is restarted. Busy adapter (EAGAIN) is given growing delay before restart.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitSPIBus::spi_message(struct spi_ioc_transfer* xfr, size_t count, EKitTimeout& to) {
+    EKIT_ERROR err;
+    int res;
+    int ern;
+    bool again;
+    size_t retries = 0;
+    std::chrono::steady_clock::time_point start;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    assert(count > 0 && count <= EKitSPITransaction::max_transfers);
+
     if (state == BUS_CLOSED) {
         err = EKIT_NOT_OPENED;
         goto done;
@@ -387,27 +444,102 @@ EKIT_ERROR EKitSPIBus::write_read(const uint8_t* wbuf,
         goto done;
     }
 
-    // Fill msgs structure
-    xfr.tx_buf = reinterpret_cast<std::uintptr_t>(wbuf);
-    xfr.rx_buf = reinterpret_cast<std::uintptr_t>(rbuf);
-    xfr.len = wlen;
-    xfr.cs_change = cs_change;
-
+    start = std::chrono::steady_clock::now();
     do {
-        res = ioctl(spi_descriptor, SPI_IOC_MESSAGE(1), &xfr);
+        res = ioctl(spi_descriptor, SPI_IOC_MESSAGE(count), xfr);
         ern = errno;
-    } while (res < 0 && (ern == EINTR || ern == EAGAIN || ern == EWOULDBLOCK));
-
-    if (res >= 1) {
-        // just sent something
-        assert(res == wlen);
-        miso_read_offset = 0;
-        miso_data_size = 0;
+        again = res < 0 && (ern == EINTR || ern == EAGAIN || ern == EWOULDBLOCK) &&
+                retries < max_interrupted_retries && !to.expired();
+        if (again) {
+            retries++;
+            if (metrics) metrics->add_retry(0, EKIT_WRITE_FAILED);
+            if (ern != EINTR) busy_delay(retries, to);
+        }
+    } while (again);
+
+    // Data received by the latest transaction is either discarded or placed directly into caller memory
+    miso_read_offset = 0;
+    miso_data_size = 0;
+
+    if (res >= 0) {
         err = EKIT_OK;
+    } else if ((ern == EINTR || ern == EAGAIN || ern == EWOULDBLOCK) && to.expired()) {
+        err = EKIT_TIMEOUT;
     } else {
-        err = EKIT_FAIL;
+        err = ERRNO_TO_EKIT_ERROR(ern);
+    }
+
+    if (metrics) {
+        size_t bytes_out = 0;
+        size_t bytes_in = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (xfr[i].tx_buf != 0) bytes_out += xfr[i].len;
+            if (xfr[i].rx_buf != 0) bytes_in += xfr[i].len;
+        }
+        metrics->add_transaction(0, bytes_out, bytes_in, err, EKitBusMetrics::elapsed_us(start));
+        metrics->add_operation_retries(0, retries, err);
     }
 
 done:
     return err;
 }
+
+//------------------------------------------------------------------------------------
+// EKitSPIBus::transaction
+// Purpose: Executes bus segments by single ioctl
+// EKitBusSegment* segments: array of the segments
+// size_t count: number of the segments
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitSPIBus::transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    segment_trans.clear();
+    for (size_t i = 0; i < count; i++) {
+        EKitBusSegment& seg = segments[i];
+        if (seg.length == 0) {
+            // Keep deselection requested by the skipped segment
+            if ((seg.flags & BUS_SEGMENT_STOP) != 0 && segment_trans.size() > 0) {
+                segment_trans.transfers.back().cs_change = 1;
+            }
+            continue;
+        }
+
+        bool read_seg = (seg.flags & BUS_SEGMENT_READ) != 0;
+        segment_trans.add(read_seg ? nullptr : seg.buffer,
+                          read_seg ? seg.buffer : nullptr,
+                          seg.length,
+                          (seg.flags & BUS_SEGMENT_STOP) != 0);
+    }
+
+    // Device is deselected at the end of transaction, cs_change on the last transfer would keep it selected
+    if (segment_trans.size() > 0) {
+        segment_trans.transfers.back().cs_change = 0;
+    }
+
+    return execute(segment_trans, to);
+}
+
+//------------------------------------------------------------------------------------
+// EKitSPIBus::execute
+// Purpose: Executes SPI transaction by single ioctl
+// EKitSPITransaction& trans: transaction to be executed
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitSPIBus::execute(EKitSPITransaction& trans, EKitTimeout& to) {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+
+    if (trans.transfers.empty()) {
+        return EKIT_OK;
+    }
+
+    if (trans.transfers.size() > EKitSPITransaction::max_transfers) {
+        return EKIT_OVERFLOW;
+    }
+
+    if (to.expired()) {
+        return EKIT_TIMEOUT;
+    }
+
+    return spi_message(trans.transfers.data(), trans.transfers.size(), to);
+}
@@ -0,0 +1,659 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus trace recorder and replay bus implementation
+ *   \author Oleh Sharuda
+ */
+
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ekit_trace_bus.hpp"
+#include "tools.hpp"
+
+constexpr const char* EKitTraceBus::trace_magic;
+constexpr uint16_t EKitTraceBus::trace_version;
+
+//------------------------------------------------------------------------------------
+// EKitTraceBus::EKitTraceBus
+// Purpose: EKitTraceBus class constructor. Creates trace file
+// std::shared_ptr<EKitBus> ebus: bus to be wrapped
+// const std::string& file_name: name of the trace file
+//------------------------------------------------------------------------------------
+EKitTraceBus::EKitTraceBus(std::shared_ptr<EKitBus> ebus, const std::string& file_name) :
+    super(ebus->get_bus_type()),
+    bus(std::move(ebus)),
+    trace_error(EKIT_OK),
+    trace_start(std::chrono::steady_clock::now()) {
+    static const char* const func_name = "EKitTraceBus::EKitTraceBus";
+
+    trace_descriptor = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_descriptor < 0) {
+        throw EKitException(func_name, ERRNO_TO_EKIT_ERROR(errno), "failed to create trace file " + file_name);
+    }
+
+    EKitTraceHeader hdr;
+    memcpy(hdr.magic, trace_magic, sizeof(hdr.magic));
+    hdr.version = trace_version;
+    hdr.bus_type = static_cast<uint8_t>(get_bus_type());
+    hdr.reserved = 0;
+
+    trace_buffer.reserve(flush_threshold + sizeof(EKitTraceRecord));
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&hdr);
+    trace_buffer.insert(trace_buffer.end(), p, p + sizeof(hdr));
+}
+
+//------------------------------------------------------------------------------------
+// EKitTraceBus::~EKitTraceBus
+// Purpose: EKitTraceBus class destructor. Writes buffered records and closes trace file
+//------------------------------------------------------------------------------------
+EKitTraceBus::~EKitTraceBus() {
+    EKIT_ERROR err = flush();
+    assert(err == EKIT_OK);
+    (void)err;
+    ::close(trace_descriptor);
+}
+
+std::shared_ptr<EKitBus> EKitTraceBus::get_bus() const {
+    return bus;
+}
+
+//------------------------------------------------------------------------------------
+// EKitTraceBus::append_record
+// Purpose: Appends record to the trace buffer, flushes buffer if it is large enough
+//------------------------------------------------------------------------------------
+void EKitTraceBus::append_record(uint8_t op,
+                                 std::chrono::steady_clock::time_point start,
+                                 EKIT_ERROR result,
+                                 int32_t arg,
+                                 int32_t value,
+                                 const void* data1,
+                                 size_t len1,
+                                 const void* data2,
+                                 size_t len2) {
+    auto now = std::chrono::steady_clock::now();
+    EKitTraceRecord rec;
+    rec.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - trace_start).count();
+    rec.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    rec.op = op;
+    rec.result = result;
+    rec.arg = arg;
+    rec.value = value;
+    rec.length = static_cast<uint32_t>(len1 + len2);
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&rec);
+    trace_buffer.insert(trace_buffer.end(), p, p + sizeof(rec));
+    if (len1 != 0) {
+        p = reinterpret_cast<const uint8_t*>(data1);
+        trace_buffer.insert(trace_buffer.end(), p, p + len1);
+    }
+    if (len2 != 0) {
+        p = reinterpret_cast<const uint8_t*>(data2);
+        trace_buffer.insert(trace_buffer.end(), p, p + len2);
+    }
+
+    if (trace_buffer.size() >= flush_threshold) {
+        flush_internal();
+    }
+}
+
+//------------------------------------------------------------------------------------
+// EKitTraceBus::flush_internal
+// Purpose: Writes buffered records to file
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitTraceBus::flush_internal() {
+    size_t offset = 0;
+
+    while (offset < trace_buffer.size() && trace_error == EKIT_OK) {
+        ssize_t res = ::write(trace_descriptor, trace_buffer.data() + offset, trace_buffer.size() - offset);
+        if (res < 0) {
+            if (errno != EINTR) {
+                trace_error = ERRNO_TO_EKIT_ERROR(errno);
+            }
+        } else {
+            offset += res;
+        }
+    }
+
+    // Data is dropped in the case of error, trace is broken anyway
+    trace_buffer.clear();
+    return trace_error;
+}
+
+EKIT_ERROR EKitTraceBus::flush() {
+    std::lock_guard<std::mutex> lock(trace_lock);
+    return flush_internal();
+}
+
+EKIT_ERROR EKitTraceBus::open(EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->open(to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_OPEN, start, err);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::close() {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->close();
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_CLOSE, start, err);
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitTraceBus::lock
+// Purpose: Locks wrapped bus, lock record is written after lock is taken (or failed),
+//          so records of the different threads are ordered by bus lock.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitTraceBus::lock(EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->lock(to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_LOCK, start, err);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::lock(int addr, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->lock(addr, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_LOCK_ADDR, start, err, addr);
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitTraceBus::unlock
+// Purpose: Unlocks wrapped bus, trace_lock is owned while bus is unlocked, so unlock record
+//          is written before lock record of the next owner.
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitTraceBus::unlock() {
+    std::lock_guard<std::mutex> lock(trace_lock);
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->unlock();
+    append_record(TRACE_OP_UNLOCK, start, err);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::suspend(EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->suspend(to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_SUSPEND, start, err);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::resume(EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->resume(to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_RESUME, start, err);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::set_opt(int opt, int value, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->set_opt(opt, value, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_SET_OPT, start, err, opt, value);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::get_opt(int opt, int& value, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->get_opt(opt, value, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_GET_OPT, start, err, opt, value);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::write(const void* ptr, size_t len, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->write(ptr, len, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_WRITE, start, err, 0, 0, ptr, len);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::read(void* ptr, size_t len, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->read(ptr, len, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_READ, start, err, 0, 0, ptr, len);
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->read_all(buffer, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_READ_ALL, start, err, 0, 0, buffer.data(), buffer.size());
+    return err;
+}
+
+EKIT_ERROR EKitTraceBus::write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Read buffer may be the same as write one, so written data is saved before call. segment_data is guarded by
+    // bus lock.
+    segment_data.assign(wbuf, wbuf + wlen);
+    EKIT_ERROR err = bus->write_read(wbuf, wlen, rbuf, rlen, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+    append_record(TRACE_OP_WRITE_READ, start, err, static_cast<int32_t>(wlen), 0,
+                  segment_data.data(), wlen, rbuf, rbuf == nullptr ? 0 : rlen);
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitTraceBus::transaction
+// Purpose: Passes transaction to the wrapped bus, records all segments
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitTraceBus::transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) {
+    auto start = std::chrono::steady_clock::now();
+    EKIT_ERROR err = bus->transaction(segments, count, to);
+    std::lock_guard<std::mutex> lock(trace_lock);
+
+    segment_data.clear();
+    for (size_t i = 0; i < count; i++) {
+        const EKitBusSegment& seg = segments[i];
+        uint32_t len = static_cast<uint32_t>(seg.length);
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&len);
+        segment_data.push_back(seg.flags);
+        segment_data.insert(segment_data.end(), p, p + sizeof(len));
+        p = reinterpret_cast<const uint8_t*>(seg.buffer);
+        segment_data.insert(segment_data.end(), p, p + seg.length);
+    }
+
+    append_record(TRACE_OP_TRANSACTION, start, err, static_cast<int32_t>(count), 0,
+                  segment_data.data(), segment_data.size());
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitReplayBus::EKitReplayBus
+// Purpose: EKitReplayBus class constructor
+// const std::string& file_name: name of the trace file
+// bool rt: true to reproduce recorded durations
+//------------------------------------------------------------------------------------
+EKitReplayBus::EKitReplayBus(const std::string& file_name, bool rt) :
+    EKitReplayBus(load_trace(file_name), rt) {
+}
+
+EKitReplayBus::EKitReplayBus(std::vector<uint8_t>&& data, bool rt) :
+    super(trace_bus_type(data)),
+    trace(std::move(data)),
+    cursor(0),
+    mismatches(0),
+    realtime(rt) {
+    static const char* const func_name = "EKitReplayBus::EKitReplayBus";
+    size_t offset = sizeof(EKitTraceHeader);
+
+    while (offset < trace.size()) {
+        const EKitTraceRecord* rec = reinterpret_cast<const EKitTraceRecord*>(trace.data() + offset);
+        if (offset + sizeof(EKitTraceRecord) > trace.size() ||
+            offset + sizeof(EKitTraceRecord) + rec->length > trace.size()) {
+            throw EKitException(func_name, EKIT_PROTOCOL, "trace file is truncated");
+        }
+
+        records.push_back(offset);
+        offset += sizeof(EKitTraceRecord) + rec->length;
+    }
+
+    // Bus is opened by replayed open() call
+    state = BUS_CLOSED;
+}
+
+EKitReplayBus::~EKitReplayBus() {
+}
+
+std::vector<uint8_t> EKitReplayBus::load_trace(const std::string& file_name) {
+    static const char* const func_name = "EKitReplayBus::load_trace";
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    ssize_t res;
+
+    int fd = ::open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw EKitException(func_name, ERRNO_TO_EKIT_ERROR(errno), "failed to open trace file " + file_name);
+    }
+
+    do {
+        res = ::read(fd, chunk, sizeof(chunk));
+        if (res > 0) {
+            data.insert(data.end(), chunk, chunk + res);
+        }
+    } while (res > 0 || (res < 0 && errno == EINTR));
+
+    EKIT_ERROR err = (res < 0) ? ERRNO_TO_EKIT_ERROR(errno) : EKIT_OK;
+    ::close(fd);
+
+    if (err != EKIT_OK) {
+        throw EKitException(func_name, err, "failed to read trace file " + file_name);
+    }
+
+    return data;
+}
+
+EKitBusType EKitReplayBus::trace_bus_type(const std::vector<uint8_t>& data) {
+    static const char* const func_name = "EKitReplayBus::trace_bus_type";
+    const EKitTraceHeader* hdr = reinterpret_cast<const EKitTraceHeader*>(data.data());
+
+    if (data.size() < sizeof(EKitTraceHeader) ||
+        memcmp(hdr->magic, EKitTraceBus::trace_magic, sizeof(hdr->magic)) != 0 ||
+        hdr->version != EKitTraceBus::trace_version) {
+        throw EKitException(func_name, EKIT_PROTOCOL, "not a trace file");
+    }
+
+    return static_cast<EKitBusType>(hdr->bus_type);
+}
+
+size_t EKitReplayBus::remaining() {
+    std::lock_guard<std::mutex> lock(replay_lock);
+    return records.size() - cursor;
+}
+
+size_t EKitReplayBus::get_mismatches() {
+    std::lock_guard<std::mutex> lock(replay_lock);
+    return mismatches;
+}
+
+uint64_t EKitReplayBus::get_recorded_time(uint8_t op) {
+    uint64_t res = 0;
+    for (size_t offset : records) {
+        const EKitTraceRecord* rec = reinterpret_cast<const EKitTraceRecord*>(trace.data() + offset);
+        if (rec->op == op) {
+            res += rec->duration_ns;
+        }
+    }
+
+    return res;
+}
+
+//------------------------------------------------------------------------------------
+// EKitReplayBus::next_record
+// Purpose: Takes the next record if it describes expected operation
+// uint8_t op: expected operation
+// const EKitTraceRecord*& rec: returns pointer to the record header
+// const uint8_t*& data: returns pointer to the record data
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitReplayBus::next_record(uint8_t op, const EKitTraceRecord*& rec, const uint8_t*& data) {
+    if (cursor >= records.size()) {
+        return EKIT_NO_DATA;
+    }
+
+    rec = reinterpret_cast<const EKitTraceRecord*>(trace.data() + records[cursor]);
+    if (rec->op != op) {
+        return EKIT_PROTOCOL;
+    }
+
+    data = reinterpret_cast<const uint8_t*>(rec + 1);
+    cursor++;
+
+    if (realtime) {
+        tools::sleep_us(rec->duration_ns / 1000);
+    }
+
+    return EKIT_OK;
+}
+
+void EKitReplayBus::compare(const void* expected, const void* actual, size_t len) {
+    if (actual != nullptr && memcmp(expected, actual, len) != 0) {
+        mismatches++;
+    }
+}
+
+EKIT_ERROR EKitReplayBus::replay_simple(uint8_t op, int32_t arg) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(op, rec, data);
+    if (err == EKIT_OK) {
+        if (rec->arg != arg) {
+            mismatches++;
+        }
+        err = rec->result;
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::open(EKitTimeout& to) {
+    EKIT_ERROR err = replay_simple(TRACE_OP_OPEN);
+    if (err == EKIT_OK) state = BUS_OPENED;
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::close() {
+    EKIT_ERROR err = replay_simple(TRACE_OP_CLOSE);
+    if (err == EKIT_OK) state = BUS_CLOSED;
+    return err;
+}
+
+//------------------------------------------------------------------------------------
+// EKitReplayBus::take_bus_lock
+// Purpose: Takes bus lock, waits with backoff while it is owned by other thread
+// const void* site: call site to be reported by lock order verifier (see EKitBus::lock_bus())
+// EKitTimeout& to: timeout counting object
+// Returns: EKIT_OK if bus lock is taken, EKIT_TIMEOUT if timeout is expired
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitReplayBus::take_bus_lock(const void* site, EKitTimeout& to) {
+    for (size_t retries = 0; !SAFE_MUTEX_TRY_LOCK_FROM(bus_lock, site); retries++) {
+        if (to.expired()) {
+            return EKIT_TIMEOUT;
+        }
+        busy_delay(retries, to);
+    }
+    return EKIT_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitReplayBus::lock
+// Purpose: Takes bus lock and replays lock record. Lock is released if recorded lock has failed
+// Returns: corresponding EKIT_ERROR code
+// Note: Lock record is not replayed if bus lock is not taken within timeout.
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitReplayBus::lock(EKitTimeout& to) {
+    EKIT_ERROR err = take_bus_lock(__builtin_return_address(0), to);
+    if (err != EKIT_OK) {
+        return err;
+    }
+
+    err = replay_simple(TRACE_OP_LOCK);
+    if (err != EKIT_OK) {
+        bus_lock.unlock();
+    }
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::lock(int addr, EKitTimeout& to) {
+    EKIT_ERROR err = take_bus_lock(__builtin_return_address(0), to);
+    if (err != EKIT_OK) {
+        return err;
+    }
+
+    err = replay_simple(TRACE_OP_LOCK_ADDR, addr);
+    if (err != EKIT_OK) {
+        bus_lock.unlock();
+    }
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::unlock() {
+    EKIT_ERROR err = replay_simple(TRACE_OP_UNLOCK);
+    bus_lock.unlock();
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::suspend(EKitTimeout& to) {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    return replay_simple(TRACE_OP_SUSPEND);
+}
+
+EKIT_ERROR EKitReplayBus::resume(EKitTimeout& to) {
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    return replay_simple(TRACE_OP_RESUME);
+}
+
+EKIT_ERROR EKitReplayBus::set_opt(int opt, int value, EKitTimeout& to) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(TRACE_OP_SET_OPT, rec, data);
+    if (err == EKIT_OK) {
+        if (rec->arg != opt) return EKIT_PROTOCOL;
+        if (rec->value != value) mismatches++;
+        err = rec->result;
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::get_opt(int opt, int& value, EKitTimeout& to) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(TRACE_OP_GET_OPT, rec, data);
+    if (err == EKIT_OK) {
+        if (rec->arg != opt) return EKIT_PROTOCOL;
+        value = rec->value;
+        err = rec->result;
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::write(const void* ptr, size_t len, EKitTimeout& to) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(TRACE_OP_WRITE, rec, data);
+    if (err == EKIT_OK) {
+        if (rec->length != len) return EKIT_PROTOCOL;
+        compare(data, ptr, len);
+        err = rec->result;
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::read(void* ptr, size_t len, EKitTimeout& to) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(TRACE_OP_READ, rec, data);
+    if (err == EKIT_OK) {
+        if (rec->length != len) return EKIT_PROTOCOL;
+        memcpy(ptr, data, len);
+        err = rec->result;
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(TRACE_OP_READ_ALL, rec, data);
+    if (err == EKIT_OK) {
+        buffer.assign(data, data + rec->length);
+        err = rec->result;
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(TRACE_OP_WRITE_READ, rec, data);
+    if (err == EKIT_OK) {
+        size_t recorded_rlen = rec->length - rec->arg;
+        if (static_cast<size_t>(rec->arg) != wlen || (rbuf != nullptr && recorded_rlen != rlen)) {
+            return EKIT_PROTOCOL;
+        }
+
+        compare(data, wbuf, wlen);
+        if (rbuf != nullptr) {
+            memcpy(rbuf, data + wlen, rlen);
+        }
+        err = rec->result;
+    }
+
+    return err;
+}
+
+EKIT_ERROR EKitReplayBus::transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) {
+    const EKitTraceRecord* rec;
+    const uint8_t* data;
+    CHECK_SAFE_MUTEX_LOCKED(bus_lock);
+    std::lock_guard<std::mutex> lock(replay_lock);
+
+    EKIT_ERROR err = next_record(TRACE_OP_TRANSACTION, rec, data);
+    if (err != EKIT_OK) {
+        return err;
+    }
+
+    if (static_cast<size_t>(rec->arg) != count) {
+        return EKIT_PROTOCOL;
+    }
+
+    const uint8_t* end = data + rec->length;
+    for (size_t i = 0; i < count; i++) {
+        EKitBusSegment& seg = segments[i];
+        uint32_t len;
+
+        if (data + 1 + sizeof(len) > end) return EKIT_PROTOCOL;
+        uint8_t flags = *data;
+        memcpy(&len, data + 1, sizeof(len));
+        data += 1 + sizeof(len);
+
+        if (flags != seg.flags || len != seg.length || data + len > end) {
+            return EKIT_PROTOCOL;
+        }
+
+        if ((seg.flags & BUS_SEGMENT_READ) != 0) {
+            memcpy(seg.buffer, data, len);
+        } else {
+            compare(data, seg.buffer, len);
+        }
+        data += len;
+    }
+
+    return rec->result;
+}
@@ -16,29 +16,50 @@
  */
 
 /*!  \file
- *   \brief SPI bus implementation
+ *   \brief UART bus implementation
  *   \author Oleh Sharuda
  */
 
 #include "ekit_uart_bus.hpp"
 
 #include <fcntl.h>
-#include <linux/spi/spidev.h>
-#include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
 #include <unistd.h>
 
+#include <cstring>
+
 #include "ekit_helper.hpp"
 #include "tools.hpp"
 
 //------------------------------------------------------------------------------------
 // EKitUARTBus::EKitUARTBus
 // Purpose: EKitUARTBus class constructor
+// const std::string& file_name: device file name
+// size_t rx_size: size of the receive buffer
 //------------------------------------------------------------------------------------
-EKitUARTBus::EKitUARTBus(const std::string& file_name)
+EKitUARTBus::EKitUARTBus(const std::string& file_name, size_t rx_size)
     : super(EKitBusType::BUS_UART),
-      bus_name(file_name) {
-    uart_descriptor = 0;
+      bus_name(file_name),
+      rx_buffer(rx_size) {
+    assert(rx_size > 0);
+    uart_descriptor = -1;
+    epoll_descriptor = -1;
+    stop_descriptor = -1;
     state = BUS_CLOSED;
+
+    baud_rate = 115200;
+    data_bits = 8;
+    parity = UART_PARITY_NONE;
+    stop_bits = 1;
+    flow_control = UART_FLOW_NONE;
+
+    rx_head = 0;
+    rx_count = 0;
+    rx_overflow = false;
+    rx_error = EKIT_OK;
 }
 
 //------------------------------------------------------------------------------------
@@ -53,11 +74,12 @@ EKitUARTBus::~EKitUARTBus() {
 
 //------------------------------------------------------------------------------------
 // EKitUARTBus::open_internal
-// Purpose: opens bus handle internally. Private, for internal use only
+// Purpose: opens bus handle internally, applies port parameters and starts reader thread. Private, for internal use only
 // Returns: corresponding EKIT_ERROR code
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitUARTBus::open_internal(EKitTimeout& to) {
-    EKIT_ERROR res = EKIT_FAIL;
+    EKIT_ERROR res = EKIT_OK;
+    struct epoll_event ev;
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
 
     if (state == BUS_OPENED) {
@@ -65,15 +87,246 @@ EKIT_ERROR EKitUARTBus::open_internal(EKitTimeout& to) {
         goto done;
     }
 
-    if ((uart_descriptor = ::open(bus_name.c_str(), O_RDWR)) < 0) {
+    if ((uart_descriptor = ::open(bus_name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
         res = ERRNO_TO_EKIT_ERROR(errno);
         goto done;
     }
 
+    res = apply_termios();
+    if (res != EKIT_OK) {
+        goto failed;
+    }
+
+    if ((stop_descriptor = eventfd(0, EFD_NONBLOCK)) < 0 ||
+        (epoll_descriptor = epoll_create1(0)) < 0) {
+        res = ERRNO_TO_EKIT_ERROR(errno);
+        goto failed;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = uart_descriptor;
+    if (epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, uart_descriptor, &ev) < 0) {
+        res = ERRNO_TO_EKIT_ERROR(errno);
+        goto failed;
+    }
+
+    ev.data.fd = stop_descriptor;
+    if (epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, stop_descriptor, &ev) < 0) {
+        res = ERRNO_TO_EKIT_ERROR(errno);
+        goto failed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(rx_lock);
+        rx_head = 0;
+        rx_count = 0;
+        rx_overflow = false;
+        rx_error = EKIT_OK;
+    }
+
+    reader_thread = std::thread(&EKitUARTBus::reader_func, this);
+    goto done;
+
+failed:
+    close_internal();
+
 done:
     return res;
 }
 
+//------------------------------------------------------------------------------------
+// EKitUARTBus::close_internal
+// Purpose: stops reader thread and closes descriptors. Private, for internal use only
+//------------------------------------------------------------------------------------
+void EKitUARTBus::close_internal() {
+    if (reader_thread.joinable()) {
+        uint64_t v = 1;
+        ssize_t res = ::write(stop_descriptor, &v, sizeof(v));
+        assert(res == sizeof(v));
+        (void)res;
+        reader_thread.join();
+    }
+
+    if (epoll_descriptor >= 0) ::close(epoll_descriptor);
+    if (stop_descriptor >= 0) ::close(stop_descriptor);
+    if (uart_descriptor >= 0) ::close(uart_descriptor);
+
+    epoll_descriptor = -1;
+    stop_descriptor = -1;
+    uart_descriptor = -1;
+}
+
+//------------------------------------------------------------------------------------
+// baud_to_speed
+// Purpose: Converts baud rate to termios speed constant
+// int baud: baud rate
+// speed_t& speed: termios speed constant
+// Returns: true if baud rate is supported, otherwise false
+//------------------------------------------------------------------------------------
+static bool baud_to_speed(int baud, speed_t& speed) {
+    switch (baud) {
+        case 1200:    speed = B1200;    break;
+        case 2400:    speed = B2400;    break;
+        case 4800:    speed = B4800;    break;
+        case 9600:    speed = B9600;    break;
+        case 19200:   speed = B19200;   break;
+        case 38400:   speed = B38400;   break;
+        case 57600:   speed = B57600;   break;
+        case 115200:  speed = B115200;  break;
+        case 230400:  speed = B230400;  break;
+        case 460800:  speed = B460800;  break;
+        case 921600:  speed = B921600;  break;
+        case 1000000: speed = B1000000; break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------------
+// EKitUARTBus::apply_termios
+// Purpose: Sets port parameters. Private, for internal use only
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
+EKIT_ERROR EKitUARTBus::apply_termios() {
+    struct termios tty;
+    speed_t speed;
+
+    if (!baud_to_speed(baud_rate, speed)) {
+        return EKIT_BAD_PARAM;
+    }
+
+    if (tcgetattr(uart_descriptor, &tty) < 0) {
+        return ERRNO_TO_EKIT_ERROR(errno);
+    }
+
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+
+    tty.c_cflag |= CLOCAL | CREAD;
+
+    tty.c_cflag &= ~CSIZE;
+    switch (data_bits) {
+        case 5: tty.c_cflag |= CS5; break;
+        case 6: tty.c_cflag |= CS6; break;
+        case 7: tty.c_cflag |= CS7; break;
+        default: tty.c_cflag |= CS8; break;
+    }
+
+    tty.c_cflag &= ~(PARENB | PARODD);
+    if (parity == UART_PARITY_ODD) {
+        tty.c_cflag |= PARENB | PARODD;
+    } else if (parity == UART_PARITY_EVEN) {
+        tty.c_cflag |= PARENB;
+    }
+
+    if (stop_bits == 2) {
+        tty.c_cflag |= CSTOPB;
+    } else {
+        tty.c_cflag &= ~CSTOPB;
+    }
+
+    tty.c_cflag &= ~CRTSCTS;
+    tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+    if (flow_control == UART_FLOW_RTSCTS) {
+        tty.c_cflag |= CRTSCTS;
+    } else if (flow_control == UART_FLOW_XONXOFF) {
+        tty.c_iflag |= IXON | IXOFF;
+    }
+
+    // Non-blocking descriptor is used, reads are driven by epoll
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+
+    if (tcsetattr(uart_descriptor, TCSANOW, &tty) < 0) {
+        return ERRNO_TO_EKIT_ERROR(errno);
+    }
+
+    return EKIT_OK;
+}
+
+//------------------------------------------------------------------------------------
+// EKitUARTBus::reader_func
+// Purpose: Reader thread function. Waits for incoming data and puts it into receive buffer
+//------------------------------------------------------------------------------------
+void EKitUARTBus::reader_func() {
+    uint8_t chunk[256];
+    struct epoll_event events[2];
+    EKIT_ERROR err = EKIT_OK;
+    bool stop = false;
+
+    while (!stop) {
+        int n = epoll_wait(epoll_descriptor, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            err = ERRNO_TO_EKIT_ERROR(errno);
+            break;
+        }
+
+        for (int i = 0; i < n && !stop; i++) {
+            if (events[i].data.fd == stop_descriptor) {
+                stop = true;
+                break;
+            }
+
+            // Read everything available
+            while (true) {
+                ssize_t res = ::read(uart_descriptor, chunk, sizeof(chunk));
+                if (res < 0 && errno == EINTR) continue;
+                if (res == 0 || (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) break;
+                if (res < 0) {
+                    err = EKIT_READ_FAILED;
+                    stop = true;
+                    break;
+                }
+
+                std::lock_guard<std::mutex> lock(rx_lock);
+                size_t size = rx_buffer.size();
+                for (ssize_t j = 0; j < res; j++) {
+                    if (rx_count == size) {
+                        // Discard the oldest byte
+                        rx_head = (rx_head + 1) % size;
+                        rx_count--;
+                        rx_overflow = true;
+                    }
+                    rx_buffer[(rx_head + rx_count) % size] = chunk[j];
+                    rx_count++;
+                }
+                rx_cond.notify_all();
+            }
+
+            if (!stop && (events[i].events & (EPOLLHUP | EPOLLERR)) != 0) {
+                err = EKIT_DISCONNECTED;
+                stop = true;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(rx_lock);
+    rx_error = (err == EKIT_OK) ? EKIT_NOT_OPENED : err;
+    rx_cond.notify_all();
+}
+
+//------------------------------------------------------------------------------------
+// EKitUARTBus::rx_take
+// Purpose: Takes data from receive buffer. Private, must be called with rx_lock owned
+// uint8_t* ptr: memory to copy data to
+// size_t len: number of bytes to take
+//------------------------------------------------------------------------------------
+void EKitUARTBus::rx_take(uint8_t* ptr, size_t len) {
+    size_t size = rx_buffer.size();
+    assert(len <= rx_count);
+
+    size_t first = std::min(len, size - rx_head);
+    memcpy(ptr, rx_buffer.data() + rx_head, first);
+    memcpy(ptr + first, rx_buffer.data(), len - first);
+
+    rx_head = (rx_head + len) % size;
+    rx_count -= len;
+}
+
 //------------------------------------------------------------------------------------
 // EKitUARTBus::open
 // Purpose: opens bus
@@ -104,7 +357,7 @@ EKIT_ERROR EKitUARTBus::close() {
     if (state == BUS_CLOSED) return EKIT_DISCONNECTED;
 
     if (state == BUS_OPENED) {
-        ::close(uart_descriptor);
+        close_internal();
     }
 
     state = BUS_CLOSED;
@@ -115,48 +368,121 @@ EKIT_ERROR EKitUARTBus::close() {
 //------------------------------------------------------------------------------------
 // EKitUARTBus::read
 // Purpose: Bus read operation
-// uint8_t addr: bus address
-// void* ptr: buffer to read data into. Buffer should be resized to appropriate
-// amount of bytes to read Returns: corresponding EKIT_ERROR code
+// void* ptr: buffer to read data into
+// size_t len: amount of bytes to read
+// Returns: corresponding EKIT_ERROR code
+// Note: Waits until required amount of data is received, reader thread signals rx_cond when data is received.
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitUARTBus::read(void* ptr, size_t len, EKitTimeout& to) {
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
-    return EKIT_NOT_SUPPORTED;
+
+    if (state == BUS_CLOSED) return EKIT_NOT_OPENED;
+    if (state == BUS_PAUSED) return EKIT_SUSPENDED;
+
+    std::unique_lock<std::mutex> lock(rx_lock);
+    auto ready = [this, len]() { return rx_count >= len || rx_error != EKIT_OK; };
+    int left = to.remaining();
+
+    if (left == 0) {
+        rx_cond.wait(lock, ready);
+    } else if (!rx_cond.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(left), ready)) {
+        return EKIT_TIMEOUT;
+    }
+
+    if (rx_count < len) {
+        return rx_error;
+    }
+
+    rx_take((uint8_t*)ptr, len);
+
+    if (rx_overflow) {
+        rx_overflow = false;
+        return EKIT_OVERFLOW;
+    }
+
+    return EKIT_OK;
 }
 
 //------------------------------------------------------------------------------------
 // EKitUARTBus::read_all
-// Purpose: Bus read operation
-// uint8_t addr: bus address
-// std::vector<uint8_t>& buffer: buffer to read data into. Buffer should be
-// resized to appropriate amount of bytes to read Returns: corresponding
-// EKIT_ERROR code
+// Purpose: Reads all the data received so far
+// std::vector<uint8_t>& buffer: buffer to read data into, it is resized to the amount of data read
+// Returns: corresponding EKIT_ERROR code
+// Note: Data is taken from receive buffer, no system calls are made.
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitUARTBus::read_all(std::vector<uint8_t>& buffer,
                                  EKitTimeout& to) {
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
-    return EKIT_NOT_SUPPORTED;
+
+    if (state == BUS_CLOSED) return EKIT_NOT_OPENED;
+    if (state == BUS_PAUSED) return EKIT_SUSPENDED;
+
+    std::lock_guard<std::mutex> lock(rx_lock);
+    buffer.resize(rx_count);
+    rx_take(buffer.data(), rx_count);
+
+    if (rx_overflow) {
+        rx_overflow = false;
+        return EKIT_OVERFLOW;
+    }
+
+    return (buffer.empty() && rx_error != EKIT_OK) ? rx_error : EKIT_OK;
 }
 
 //------------------------------------------------------------------------------------
 // EKitUARTBus::write
 // Purpose: Bus write operation
-// uint8_t addr: bus address
-// const void* ptr: buffer to write data from. Function writes all bytes
-// allocated in buffer Returns: corresponding EKIT_ERROR code
+// const void* ptr: buffer to write data from
+// size_t len: amount of bytes to write
+// Returns: corresponding EKIT_ERROR code
 //------------------------------------------------------------------------------------
 EKIT_ERROR EKitUARTBus::write(const void* ptr, size_t len, EKitTimeout& to) {
+    const uint8_t* data = (const uint8_t*)ptr;
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
-    return EKIT_NOT_SUPPORTED;
+
+    if (state == BUS_CLOSED) return EKIT_NOT_OPENED;
+    if (state == BUS_PAUSED) return EKIT_SUSPENDED;
+
+    while (len > 0) {
+        ssize_t res = ::write(uart_descriptor, data, len);
+        if (res > 0) {
+            data += res;
+            len -= res;
+            continue;
+        }
+
+        if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return EKIT_WRITE_FAILED;
+        }
+
+        if (to.expired()) {
+            return EKIT_TIMEOUT;
+        }
+
+        // Driver buffer is full, wait until it accepts data or timeout expires
+        int left = to.remaining();
+        struct pollfd pfd = {uart_descriptor, POLLOUT, 0};
+        poll(&pfd, 1, (left == 0) ? -1 : left);
+    }
+
+    return EKIT_OK;
 }
 
+//------------------------------------------------------------------------------------
+// EKitUARTBus::write_read
+// Purpose: Writes data and reads response
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
 EKIT_ERROR EKitUARTBus::write_read(const uint8_t* wbuf,
                                   size_t wlen,
                                   uint8_t* rbuf,
                                   size_t rlen,
                                   EKitTimeout& to) {
-    static const char* const func_name = "EKitUARTBus::write_read";
-    return EKIT_NOT_SUPPORTED;
+    EKIT_ERROR err = write(wbuf, wlen, to);
+    if (err == EKIT_OK) {
+        err = read(rbuf, rlen, to);
+    }
+    return err;
 }
 
 //------------------------------------------------------------------------------------
@@ -171,7 +497,7 @@ EKIT_ERROR EKitUARTBus::suspend(EKitTimeout& to) {
 
     if (state == BUS_PAUSED) return EKIT_SUSPENDED;
 
-    ::close(uart_descriptor);
+    close_internal();
     state = BUS_PAUSED;
 
     return EKIT_OK;
@@ -199,12 +525,82 @@ EKIT_ERROR EKitUARTBus::resume(EKitTimeout& to) {
     return err;
 }
 
+//------------------------------------------------------------------------------------
+// EKitUARTBus::set_opt
+// Purpose: Sets port parameter, applies it immediately if bus is opened
+// int opt: option, one of the EKitUARTOptions values
+// int value: option value
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
 EKIT_ERROR EKitUARTBus::set_opt(int opt, int value, EKitTimeout& to) {
+    int* param;
+    int prev;
+    EKIT_ERROR err = EKIT_OK;
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
-    return EKIT_NOT_SUPPORTED;
+
+    switch (opt) {
+        case UART_OPT_BAUD_RATE:
+            param = &baud_rate;
+            break;
+        case UART_OPT_DATA_BITS:
+            if (value < 5 || value > 8) return EKIT_BAD_PARAM;
+            param = &data_bits;
+            break;
+        case UART_OPT_PARITY:
+            if (value != UART_PARITY_NONE && value != UART_PARITY_ODD && value != UART_PARITY_EVEN) return EKIT_BAD_PARAM;
+            param = &parity;
+            break;
+        case UART_OPT_STOP_BITS:
+            if (value != 1 && value != 2) return EKIT_BAD_PARAM;
+            param = &stop_bits;
+            break;
+        case UART_OPT_FLOW_CONTROL:
+            if (value != UART_FLOW_NONE && value != UART_FLOW_RTSCTS && value != UART_FLOW_XONXOFF) return EKIT_BAD_PARAM;
+            param = &flow_control;
+            break;
+        default:
+            return EKIT_NOT_SUPPORTED;
+    }
+
+    prev = *param;
+    *param = value;
+
+    if (state == BUS_OPENED) {
+        err = apply_termios();
+    } else if (opt == UART_OPT_BAUD_RATE) {
+        // Validate baud rate without opened port
+        speed_t speed;
+        if (!baud_to_speed(value, speed)) {
+            err = EKIT_BAD_PARAM;
+        }
+    }
+
+    if (err != EKIT_OK) {
+        *param = prev;
+    }
+
+    return err;
 }
 
+//------------------------------------------------------------------------------------
+// EKitUARTBus::get_opt
+// Purpose: Returns port parameter
+// int opt: option, one of the EKitUARTOptions values
+// int& value: option value
+// Returns: corresponding EKIT_ERROR code
+//------------------------------------------------------------------------------------
 EKIT_ERROR EKitUARTBus::get_opt(int opt, int& value, EKitTimeout& to) {
     CHECK_SAFE_MUTEX_LOCKED(bus_lock);
-    return EKIT_NOT_SUPPORTED;
+
+    switch (opt) {
+        case UART_OPT_BAUD_RATE:    value = baud_rate;    break;
+        case UART_OPT_DATA_BITS:    value = data_bits;    break;
+        case UART_OPT_PARITY:       value = parity;       break;
+        case UART_OPT_STOP_BITS:    value = stop_bits;    break;
+        case UART_OPT_FLOW_CONTROL: value = flow_control; break;
+        default:
+            return EKIT_NOT_SUPPORTED;
+    }
+
+    return EKIT_OK;
 }
@@ -40,7 +40,7 @@ SPIProxyDev::~SPIProxyDev() {
 }
 
 EKIT_ERROR SPIProxyDev::lock(EKitTimeout& to) {
-    bus_lock.lock();
+    lock_bus(__builtin_return_address(0));
     return std::dynamic_pointer_cast<EKitFirmware>(bus)->lock(get_addr(), to);
 }
 
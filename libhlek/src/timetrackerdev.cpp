@@ -24,6 +24,9 @@
 #include "timetrackerdev.hpp"
 #include "ekit_firmware.hpp"
 #include <math.h>
+#include <algorithm>
+
+constexpr size_t TimeTrackerDev::max_timestamps_per_i2c_transaction;
 
 TimeTrackerDev::TimeTrackerDev(std::shared_ptr<EKitBus>& ebus, const TimeTrackerDevConfig* cfg) :
     super(ebus, cfg->dev_id, cfg->dev_name),
@@ -133,46 +136,61 @@ size_t TimeTrackerDev::get_status(bool& running, uint64_t& reset_ts) {
     return dev_status->event_number;
 }
 
-void TimeTrackerDev::read_all(std::vector<uint64_t>& data, bool relative) {
+size_t TimeTrackerDev::stream_priv(EKitTimeout& to, bool& ovf) {
+    static const char* const func_name = "TimeTrackerDev::stream_priv";
+    size_t max_count = std::min(max_timestamps_per_i2c_transaction, config->dev_buffer_len / sizeof(uint64_t));
+    size_t len;
+    EKIT_ERROR err;
+
+    auto fw = std::dynamic_pointer_cast<EKitFirmware>(bus);
+
+    // Streaming read returns status followed by data available, read is committed by firmware immediately
+    ovf = false;
+    err = fw->read_stream(raw_buffer.data(), sizeof(TimeTrackerStatus) + max_count*sizeof(uint64_t), len, to);
+    if (err == EKIT_OVERFLOW) {
+        ovf = true;
+    } else
+    if (err != EKIT_OK) {
+        throw EKitException(func_name, err, "read_stream() failed");
+    }
+
+    assert(len >= sizeof(TimeTrackerStatus));
+    return (len - sizeof(TimeTrackerStatus)) / sizeof(uint64_t);
+}
+
+void TimeTrackerDev::read_all_priv(const std::function<void(uint64_t start_point, size_t n)>& cb, bool relative) {
     bool ovf;
     EKitTimeout to(get_timeout());
     BusLocker          blocker(bus, get_addr(), to);
-
+    size_t max_count = std::min(max_timestamps_per_i2c_transaction, config->dev_buffer_len / sizeof(uint64_t));
     size_t n;
 
-    do {
-        get_priv(0, to, ovf);
-        uint64_t start_point = relative ? dev_status->first_event_ts: 0;
-        n = dev_status->event_number;
+    // Refresh status once, the rest is read back to back without synchronization with device
+    get_priv(0, to, ovf);
+    uint64_t start_point = relative ? dev_status->first_event_ts: 0;
 
-        if (n>=max_timestamps_per_i2c_transaction) n=max_timestamps_per_i2c_transaction;
-        get_priv(n, to, ovf);
+    do {
+        n = stream_priv(to, ovf);
+        cb(start_point, n);
+    } while (n == max_count);
+}
 
+void TimeTrackerDev::read_all(std::vector<uint64_t>& data, bool relative) {
+    read_all_priv([this, &data](uint64_t start_point, size_t n) {
         for (size_t i=0; i<n; i++) {
             data.push_back(data_buffer[i] - start_point);
         }
-    } while (n>0);
+    }, relative);
 }
 
 void TimeTrackerDev::read_all(std::vector<double>& data, bool relative) {
-    EKitTimeout to(get_timeout());
-    bool ovf;
-    BusLocker          blocker(bus, get_addr(), to);
     double tick_freq = static_cast<double>(this->config->tick_freq);
-    size_t n;
-
-    do {
-        get_priv(0, to, ovf);
-        uint64_t start_point = relative ? dev_status->first_event_ts: 0;
-        n = dev_status->event_number;
-
-        if (n>=max_timestamps_per_i2c_transaction) n=max_timestamps_per_i2c_transaction;
-        get_priv(n, to, ovf);
 
+    read_all_priv([this, &data, tick_freq](uint64_t start_point, size_t n) {
         for (size_t i=0; i<n; i++) {
             data.push_back((double) (data_buffer[i] - start_point) / tick_freq);
         }
-    } while (n>0);
+    }, relative);
 }
 
 void read_all(std::vector<double>& data);
\ No newline at end of file
@@ -35,6 +35,12 @@
 #include <fcntl.h>
 #include <signal.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #ifdef __PYTHON_MODULE__
 #include <Python.h>
 #endif
@@ -119,25 +125,206 @@ std::string get_backtrace() {
 
 #ifndef NDEBUG
 
-static tools::GlobalMutexVerifier g_mtx_verif;
+/// \brief Thread local variable to track which mutexes are currently owned by the thread
+static thread_local tools::TLSMutexVerifier tls_mtx_verif;
+
+//------------------------------------------------------------------------------------
+// site_name
+// Purpose: Resolves call site address to symbol name (for reports only)
+// const void* site: code address
+// Returns: symbol name
+//------------------------------------------------------------------------------------
+static std::string site_name(const void* site) {
+    void* addr = const_cast<void*>(site);
+    char** strings = backtrace_symbols(&addr, 1);
+    std::string res = strings!=nullptr ? strings[0] : "?";
+    free(strings);
+    return res;
+}
+
+//------------------------------------------------------------------------------------
+// append_format
+// Purpose: Appends printf formatted text to the string (for reports only)
+// std::string& s: string to append to
+// const char* format: printf format specifier
+//------------------------------------------------------------------------------------
+static void append_format(std::string& s, const char* format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    s += buffer;
+}
 
-tools::GlobalMutexVerifier::GlobalMutexVerifier(){
+tools::GlobalMutexVerifier::GlobalMutexVerifier() : next_id(1), violations(0) {
+    handler = [](const std::string& report) {
+        fputs(report.c_str(), stderr);
+        fflush(stderr);
+    };
 }
 
 tools::GlobalMutexVerifier::~GlobalMutexVerifier(){
 }
 
-void tools::GlobalMutexVerifier::new_mutex(std::mutex::native_handle_type nh, const std::string& where){
+tools::GlobalMutexVerifier& tools::GlobalMutexVerifier::instance() {
+    // Function local static is used to be constructed before (and destroyed after) any static safe_mutex
+    static GlobalMutexVerifier verifier;
+    return verifier;
+}
+
+uint32_t tools::GlobalMutexVerifier::new_mutex(){
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+void tools::GlobalMutexVerifier::delete_mutex(uint32_t id){
+    std::lock_guard<std::mutex> lock(graph_lock);
+
+    auto succ = successors.find(id);
+    if (succ!=successors.end()) {
+        for (uint32_t to : succ->second) {
+            edges.erase(edge_key(id, to));
+            std::vector<uint32_t>& p = predecessors[to];
+            p.erase(std::remove(p.begin(), p.end(), id), p.end());
+        }
+        successors.erase(succ);
+    }
+
+    auto pred = predecessors.find(id);
+    if (pred!=predecessors.end()) {
+        for (uint32_t from : pred->second) {
+            edges.erase(edge_key(from, id));
+            std::vector<uint32_t>& s = successors[from];
+            s.erase(std::remove(s.begin(), s.end(), id), s.end());
+        }
+        predecessors.erase(pred);
+    }
+}
+
+//------------------------------------------------------------------------------------
+// GlobalMutexVerifier::find_path
+// Purpose: Depth first search in lock order graph, graph_lock must be owned
+// uint32_t from: first mutex of the path
+// uint32_t to: last mutex of the path
+// std::vector<uint32_t>& path: receives path (from ... to)
+// Returns: true if path is found
+//------------------------------------------------------------------------------------
+bool tools::GlobalMutexVerifier::find_path(uint32_t from, uint32_t to, std::vector<uint32_t>& path) {
+    std::set<uint32_t> visited;
+    std::vector<std::pair<uint32_t, size_t>> stack; // (node, index of the next successor to visit)
+
+    stack.emplace_back(from, 0);
+    visited.insert(from);
+
+    while (!stack.empty()) {
+        uint32_t node = stack.back().first;
+        if (node==to) {
+            path.clear();
+            for (const auto& n : stack) {
+                path.push_back(n.first);
+            }
+            return true;
+        }
+
+        auto succ = successors.find(node);
+        size_t& next = stack.back().second;
+        if (succ==successors.end() || next>=succ->second.size()) {
+            stack.pop_back();
+            continue;
+        }
+
+        uint32_t child = succ->second[next++];
+        if (visited.insert(child).second) {
+            stack.emplace_back(child, 0);
+        }
+    }
+
+    return false;
 }
 
-void tools::GlobalMutexVerifier::delete_mutex(std::mutex::native_handle_type nh, const std::string& where){
+void tools::GlobalMutexVerifier::report_violation(const std::string& report) {
+    ViolationHandler h;
+    {
+        std::lock_guard<std::mutex> lock(graph_lock);
+        violations++;
+        h = handler;
+    }
+
+    h(report + "Backtrace:\n" + get_backtrace());
 }
 
-void tools::GlobalMutexVerifier::lock_mutex(std::mutex::native_handle_type nh, const std::string& where){
+//------------------------------------------------------------------------------------
+// GlobalMutexVerifier::lock_mutex
+// Purpose: Adds edges from the owned mutexes to the mutex being locked, reports lock
+//          order violation if any of the new edges closes a cycle
+// const MutexEntry& me: mutex being locked
+// const std::vector<MutexEntry>& owned: mutexes owned by the thread
+//------------------------------------------------------------------------------------
+void tools::GlobalMutexVerifier::lock_mutex(const MutexEntry& me, const std::vector<MutexEntry>& owned){
+    if (owned.empty()) {
+        return;
+    }
+
+    std::string report;
+    {
+        std::lock_guard<std::mutex> lock(graph_lock);
+        std::vector<uint32_t> path;
+
+        for (const MutexEntry& o : owned) {
+            if (o.id==me.id) {
+                append_format(report, "Mutex #%u is locked recursively at %s, previously locked at %s\n",
+                              me.id,
+                              site_name(me.site).c_str(),
+                              site_name(o.site).c_str());
+                continue;
+            }
+
+            uint64_t key = edge_key(o.id, me.id);
+            if (edges.find(key)!=edges.end()) {
+                continue; // known lock order
+            }
+
+            if (find_path(me.id, o.id, path)) {
+                append_format(report, "Lock order violation: mutex #%u is locked at %s while mutex #%u is owned (locked at %s). Reverse order was seen:\n",
+                              me.id,
+                              site_name(me.site).c_str(),
+                              o.id,
+                              site_name(o.site).c_str());
+                for (size_t i=1; i<path.size(); i++) {
+                    const Edge& e = edges[edge_key(path[i-1], path[i])];
+                    append_format(report, "    #%u (locked at %s) -> #%u (locked at %s)\n",
+                                  path[i-1],
+                                  site_name(e.from_site).c_str(),
+                                  path[i],
+                                  site_name(e.to_site).c_str());
+                }
+            }
+
+            // Edge is added even if it closes a cycle, so the same violation is reported once
+            Edge e;
+            e.from_site = o.site;
+            e.to_site = me.site;
+            edges.emplace(key, e);
+            successors[o.id].push_back(me.id);
+            predecessors[me.id].push_back(o.id);
+        }
+    }
+
+    if (!report.empty()) {
+        report_violation(report);
+    }
 }
 
+size_t tools::GlobalMutexVerifier::get_violations() {
+    std::lock_guard<std::mutex> lock(graph_lock);
+    return violations;
+}
 
-void tools::GlobalMutexVerifier::unlock_mutex(std::mutex::native_handle_type nh, const std::string& where){
+tools::GlobalMutexVerifier::ViolationHandler tools::GlobalMutexVerifier::set_violation_handler(ViolationHandler h) {
+    assert(h);
+    std::lock_guard<std::mutex> lock(graph_lock);
+    std::swap(handler, h);
+    return h;
 }
 
 tools::TLSMutexVerifier::TLSMutexVerifier(){
@@ -148,74 +335,301 @@ tools::TLSMutexVerifier::~TLSMutexVerifier(){
     
 }
 
-void tools::TLSMutexVerifier::lock_mutex(std::mutex::native_handle_type nh, const std::string& where){
-    auto ins_res = locked_mutexes.insert(nh);
-    assert(ins_res.first != locked_mutexes.end());
-    assert(ins_res.second);
-    MutexEntry me;
-    me.nh = nh;
-    me.back_trace = where;
-    lock_trace.push(std::move(me));
+void tools::TLSMutexVerifier::lock_mutex(const MutexEntry& me){
+    assert(!is_locked(me.id));
+    owned.push_back(me);
 }
 
-void tools::TLSMutexVerifier::unlock_mutex(std::mutex::native_handle_type nh, const std::string& where){
-    size_t n_removed = locked_mutexes.erase(nh);
-    assert(n_removed==1); // must be already locked
-    assert(!lock_trace.empty()); // check lock trace is not empty (obviously)
-    assert(lock_trace.top().nh==nh); // check for correct order of unlock calls
-    lock_trace.pop();
+void tools::TLSMutexVerifier::unlock_mutex(uint32_t id){
+    assert(!owned.empty()); // must be already locked
+    assert(owned.back().id==id); // check for correct order of unlock calls
+    owned.pop_back();
 }
 
-bool tools::TLSMutexVerifier::is_locked(std::mutex::native_handle_type nh){
-    return locked_mutexes.find(nh)!=locked_mutexes.end();
+bool tools::TLSMutexVerifier::is_locked(uint32_t id) const {
+    for (const MutexEntry& me : owned) {
+        if (me.id==id) {
+            return true;
+        }
+    }
+    return false;
 }
 
 tools::safe_mutex::safe_mutex() : std::mutex() {
-    std::string bt = get_backtrace();
-    hndl = super::native_handle();
-    g_mtx_verif.new_mutex(hndl, bt);
+    id = GlobalMutexVerifier::instance().new_mutex();
 }
 
 tools::safe_mutex::~safe_mutex() {
-    std::string bt = get_backtrace();
-    g_mtx_verif.delete_mutex(hndl, bt);
+    GlobalMutexVerifier::instance().delete_mutex(id);
 }
 
-
 void tools::safe_mutex::lock() {
-    std::string bt = get_backtrace();
+    lock(__builtin_return_address(0));
+}
+
+void tools::safe_mutex::lock(const void* site) {
+    MutexEntry me;
+    me.id = id;
+    me.site = site;
+
+    // Lock order is verified before locking, so potential deadlock is reported even if it happens
+    GlobalMutexVerifier::instance().lock_mutex(me, tls_mtx_verif.get_owned());
     super::lock();
-    tls_mtx_verif.lock_mutex(hndl,bt);
-    g_mtx_verif.lock_mutex(hndl,bt);
+    tls_mtx_verif.lock_mutex(me);
+}
+
+bool tools::safe_mutex::try_lock() {
+    return try_lock(__builtin_return_address(0));
+}
+
+bool tools::safe_mutex::try_lock(const void* site) {
+    MutexEntry me;
+    me.id = id;
+    me.site = site;
+
+    if (!super::try_lock()) {
+        return false;
+    }
+
+    tls_mtx_verif.lock_mutex(me);
+    return true;
 }
 
 void tools::safe_mutex::unlock() {
-    std::string bt = get_backtrace();
-    g_mtx_verif.unlock_mutex(hndl, bt);
-    tls_mtx_verif.unlock_mutex(hndl, bt);
+    tls_mtx_verif.unlock_mutex(id);
     super::unlock();
 }
 
 // This method is not accessible in release build, so it should be called with conditional compilation check
 void tools::safe_mutex::check_locked() {
-    assert(tls_mtx_verif.is_locked(hndl));
+    assert(tls_mtx_verif.is_locked(id));
 }
 
 #endif
 
-uint8_t tools::calc_contol_sum(uint8_t* buffer, size_t length, size_t exclude_byte) {
-    uint8_t crc = COMM_CRC_INIT_VALUE;
-    for (size_t i = 0; i<length; i++) {
+uint8_t tools::calc_contol_sum(const uint8_t* buffer, size_t length, size_t exclude_byte) {
+    uint8_t crc = COMM_CRC_INIT_VALUE ^ xor_reduce(buffer, length);
 
-        if (i==exclude_byte) {
-            // skip this byte, it is CRC
-        } else {
-            crc ^= buffer[i];
+    // skip this byte, it is CRC
+    if (exclude_byte < length) {
+        crc ^= buffer[exclude_byte];
+    }
+    return crc;
+}
+
+//------------------------------------------------------------------------------------
+// fold_word
+// Purpose: XORs bytes of the 64-bit word
+//------------------------------------------------------------------------------------
+static inline uint8_t fold_word(uint64_t w) {
+    w ^= w >> 32;
+    w ^= w >> 16;
+    w ^= w >> 8;
+    return static_cast<uint8_t>(w);
+}
+
+uint8_t tools::xor_reduce(const void* buffer, size_t length) {
+    const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    uint8_t res = 0;
+    uint64_t w0 = 0, w1 = 0, w2 = 0, w3 = 0;
+
+    // Head: bytes up to word boundary
+    while (length > 0 && (reinterpret_cast<uintptr_t>(p) & (sizeof(uint64_t) - 1)) != 0) {
+        res ^= *p++;
+        length--;
+    }
+
+    // Body: aligned words, memcpy() is compiled into plain loads
+    for (; length >= 4 * sizeof(uint64_t); length -= 4 * sizeof(uint64_t), p += 4 * sizeof(uint64_t)) {
+        uint64_t w[4];
+        memcpy(w, p, sizeof(w));
+        w0 ^= w[0];
+        w1 ^= w[1];
+        w2 ^= w[2];
+        w3 ^= w[3];
+    }
+
+    for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        w0 ^= w;
+    }
+
+    // Tail
+    while (length > 0) {
+        res ^= *p++;
+        length--;
+    }
+
+    return res ^ fold_word(w0 ^ w1 ^ w2 ^ w3);
+}
+
+uint8_t tools::copy_xor_reduce(void* dst, const void* src, size_t length) {
+    const uint8_t* s = static_cast<const uint8_t*>(src);
+    uint8_t* d = static_cast<uint8_t*>(dst);
+    uint8_t res = 0;
+    uint64_t w0 = 0, w1 = 0;
+
+    // Source is aligned, destination may be not (payload follows 4 bytes header)
+    while (length > 0 && (reinterpret_cast<uintptr_t>(s) & (sizeof(uint64_t) - 1)) != 0) {
+        res ^= *s;
+        *d++ = *s++;
+        length--;
+    }
+
+    for (; length >= 2 * sizeof(uint64_t); length -= 2 * sizeof(uint64_t)) {
+        uint64_t w[2];
+        memcpy(w, s, sizeof(w));
+        memcpy(d, w, sizeof(w));
+        w0 ^= w[0];
+        w1 ^= w[1];
+        s += sizeof(w);
+        d += sizeof(w);
+    }
+
+    while (length > 0) {
+        res ^= *s;
+        *d++ = *s++;
+        length--;
+    }
+
+    return res ^ fold_word(w0 ^ w1);
+}
+
+tools::ControlSum::ControlSum() :
+    sum(COMM_CRC_INIT_VALUE) {
+}
+
+void tools::ControlSum::reset() {
+    sum = COMM_CRC_INIT_VALUE;
+}
+
+/// \brief Slicing-by-8 tables: table[k][b] is CRC-16 of the byte b followed by k zero bytes (zero initial value).
+struct CRC16Tables {
+    uint16_t table[8][256];
+
+    CRC16Tables() {
+        for (unsigned b = 0; b < 256; b++) {
+            uint16_t crc = static_cast<uint16_t>(b << 8);
+            for (int i = 0; i < 8; i++) {
+                crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ COMM_CRC16_POLY : (crc << 1));
+            }
+            table[0][b] = crc;
+        }
+
+        for (int k = 1; k < 8; k++) {
+            for (unsigned b = 0; b < 256; b++) {
+                uint16_t crc = table[k - 1][b];
+                table[k][b] = static_cast<uint16_t>((crc << 8) ^ table[0][crc >> 8]);
+            }
         }
     }
+};
+
+static const CRC16Tables crc16_tables;
+
+uint16_t tools::crc16_update(uint16_t crc, const void* buffer, size_t length) {
+    const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    const uint16_t (*t)[256] = crc16_tables.table;
+
+    // CRC-16 is XORed into the first two bytes, the rest of the bytes are independent lookups
+    for (; length >= 8; length -= 8, p += 8) {
+        crc = t[7][p[0] ^ (crc >> 8)] ^ t[6][p[1] ^ (crc & 0xFF)] ^ t[5][p[2]] ^ t[4][p[3]] ^
+              t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+
+    while (length > 0) {
+        crc = static_cast<uint16_t>((crc << 8) ^ t[0][(crc >> 8) ^ *p++]);
+        length--;
+    }
+
     return crc;
 }
 
+tools::CRC16::CRC16() :
+    crc(COMM_CRC16_INIT_VALUE) {
+}
+
+void tools::CRC16::reset() {
+    crc = COMM_CRC16_INIT_VALUE;
+}
+
+//------------------------------------------------------------------------------------
+// tools::scale_u16
+// Purpose: Converts unsigned 16-bit values to float by multiplication and addition
+// Note: Values are widened to 32-bit integers and converted exactly, so vector and scalar paths give the same result.
+//------------------------------------------------------------------------------------
+void tools::scale_u16(const uint16_t* src, size_t count, float scale, float offset, float* dst) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 vs = _mm_set1_ps(scale);
+    const __m128 vo = _mm_set1_ps(offset);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(lo, vs), vo));
+        _mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_mul_ps(hi, vs), vo));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t vs = vdupq_n_f32(scale);
+    const float32x4_t vo = vdupq_n_f32(offset);
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t v = vld1q_u16(src + i);
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(v)));
+        vst1q_f32(dst + i, vaddq_f32(vmulq_f32(lo, vs), vo));
+        vst1q_f32(dst + i + 4, vaddq_f32(vmulq_f32(hi, vs), vo));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = static_cast<float>(src[i]) * scale + offset;
+    }
+}
+
+//------------------------------------------------------------------------------------
+// tools::scale_u16
+// Purpose: Converts unsigned 16-bit values to double by multiplication and addition
+//------------------------------------------------------------------------------------
+void tools::scale_u16(const uint16_t* src, size_t count, double scale, double offset, double* dst) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128d vs = _mm_set1_pd(scale);
+    const __m128d vo = _mm_set1_pd(offset);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi16(v, zero);
+        __m128i hi = _mm_unpackhi_epi16(v, zero);
+        _mm_storeu_pd(dst + i, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(lo), vs), vo));
+        _mm_storeu_pd(dst + i + 2, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(lo, lo)), vs), vo));
+        _mm_storeu_pd(dst + i + 4, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(hi), vs), vo));
+        _mm_storeu_pd(dst + i + 6, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(hi, hi)), vs), vo));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float64x2_t vs = vdupq_n_f64(scale);
+    const float64x2_t vo = vdupq_n_f64(offset);
+    for (; i + 8 <= count; i += 8) {
+        // 16-bit values are exact in float, so they are widened to double through float
+        uint16x8_t v = vld1q_u16(src + i);
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(v)));
+        vst1q_f64(dst + i, vaddq_f64(vmulq_f64(vcvt_f64_f32(vget_low_f32(lo)), vs), vo));
+        vst1q_f64(dst + i + 2, vaddq_f64(vmulq_f64(vcvt_high_f64_f32(lo), vs), vo));
+        vst1q_f64(dst + i + 4, vaddq_f64(vmulq_f64(vcvt_f64_f32(vget_low_f32(hi)), vs), vo));
+        vst1q_f64(dst + i + 6, vaddq_f64(vmulq_f64(vcvt_high_f64_f32(hi), vs), vo));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = static_cast<double>(src[i]) * scale + offset;
+    }
+}
+
 int tools::stm32_timer_params(uint32_t freq, double delay_s, uint16_t& prescaller, uint16_t& period, double& eff_s) {
     static const char* const func_name = "EKitVirtualDevice::get_timer_params";
     double us_delay = delay_s * 1.0e6;
@@ -96,7 +96,7 @@ EKIT_ERROR UARTProxyDev::write_read(const uint8_t* wbuf, size_t wlen, uint8_t* r
 }
 
 EKIT_ERROR UARTProxyDev::lock(EKitTimeout& to) {
-    bus_lock.lock();
+    lock_bus(__builtin_return_address(0));
     return std::dynamic_pointer_cast<EKitFirmware>(bus)->lock(get_addr(), to);
 }
 
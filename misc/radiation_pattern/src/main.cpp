@@ -25,12 +25,14 @@
 #include <thread>
 #include <chrono>
 #include <functional>
+#include <limits>
 #include "main.hpp"
 #include "ekit_i2c_bus.hpp"
 #include "ekit_firmware.hpp"
 #include "info_dev.hpp"
 #include "step_motor.hpp"
 #include "adcdev.hpp"
+#include "adc_dsp.hpp"
 
 const uint8_t ADC_DEV_ID = 1;
 const uint8_t STEP_MOT_DEV_ID = 2;
@@ -63,22 +65,30 @@ double read_adc(std::shared_ptr<ADCDev>& adc) {
     static std::once_flag once;
     static size_t input_count = 0;
     static size_t samples_count = 0;
+    static std::unique_ptr<DSPPipeline> dsp;
+    static ADCBlock block;
 
     std::call_once(once, [&]() {
         input_count = adc->get_input_count();
         samples_count = adc->get_descriptor(0)->dev_buffer_len / (input_count*sizeof(uint16_t));
+
+        // Whole device buffer is averaged into one sample
+        dsp.reset(new DSPPipeline(input_count, samples_count));
+        dsp->add(std::make_shared<DSPDecimator>(samples_count));
+        block.first_sample = 0;
+        block.stride = samples_count;
+        block.gap = true; // sampling is restarted for every measurement
+        block.values.resize(input_count * samples_count);
     });
 
-    std::vector<std::vector<double>> values;
-    bool ovf = false;
-    adc->stop(true);
-    adc->start(samples_count, 0);
+    adc->stop();
+    adc->start(samples_count);
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    adc->get(values, ovf);
+    block.samples = adc->get(block.values.data(), samples_count);
 
-    double result = 0.0L;
-    for (auto x : values[0]) result += x;
-    return result / samples_count;
+    // Device hasn't filled buffer yet: no measurement
+    const ADCBlock& avg = dsp->process(block);
+    return avg.samples > 0 ? avg.channel(0)[0] : std::numeric_limits<double>::quiet_NaN();
 }
 
 int main(int argc, char* argv[]) {
@@ -32,6 +32,7 @@
 #include <libhlek/spwm.hpp>
 #include <libhlek/timetrackerdev.hpp>
 #include <libhlek/adcdev.hpp>
+#include <libhlek/adc_dsp.hpp>
 
 #include <libtestbench/info_conf.hpp>
 #include <libtestbench/spwm_conf.hpp>
@@ -68,46 +69,46 @@ void adc_thread_func(std::shared_ptr<ADCDev> adc) {
     constexpr double value_error = 0.5l / 2.0l;
     constexpr double min_val = mean_value - value_error;
     constexpr double max_val = mean_value + value_error;
+    constexpr size_t sample_count = 8; // 8 samples with 1ms period are taken within 10ms
 
     std::map<size_t, uint8_t> sampling_info;
     sampling_info[0]=ADC_SampleTime_28Cycles5;
-    std::vector<std::vector<double>> samples;
 
+    // Minimum, maximum and mean of the samples are calculated by DSPWindowStats: channel 0 gives output channels
+    // 0 (minimum), 1 (maximum) and 2 (mean).
+    size_t input_count = adc->get_input_count();
+    DSPPipeline dsp(input_count, sample_count);
+    dsp.add(std::make_shared<DSPWindowStats>(sample_count));
+
+    ADCBlock samples;
+    samples.first_sample = 0;
+    samples.stride = sample_count;
+    samples.gap = true; // sampling is restarted for every measurement, so samples are not contiguous with previous
+    samples.values.resize(input_count * sample_count);
 
     while (!g_exit.load()) {
         adc->stop();
         adc->reset();
         adc->configure(0.001, 1, sampling_info);
-        adc->start(0);
+        adc->start(sample_count);
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        adc->get(samples);
+        samples.samples = adc->get(samples.values.data(), sample_count);
         adc->stop();
 
         // Check all values for reasonable value
-        size_t n = samples.size();
+        const ADCBlock& stats = dsp.process(samples);
 
-        if (n==0) {
-            print_result("ADCDev", n, 0.0L, 0.0L, 0.0L, 'U', "V");
+        if (stats.samples==0) {
+            print_result("ADCDev", 0, 0.0L, 0.0L, 0.0L, 'U', "V");
         } else {
-            double acc = 0.0l;
-            double min_x = std::numeric_limits<double>::max();
-            double max_x = 0.0l;
-
-            for (auto v: samples) {
-                double x = v[0];
-                min_x = std::min(x, min_x);
-                max_x = std::max(x, max_x);
-                assert( x >= min_val);
-                assert( x <= max_val);
-                acc += x / (double)n;
-            }
+            double min_x = stats.channel(0)[0];
+            double max_x = stats.channel(1)[0];
+            double acc = stats.channel(2)[0];
+            assert( min_x >= min_val);
+            assert( max_x <= max_val);
 
-            //std::cout << "[ADCDev] Uₘₑₐₙ=" << acc << " N=" << n << " Uₘᵢₙ=" << min_x << " Uₘₐₓ=" << max_x << std::endl;
-            print_result("ADCDev      ", n, acc, min_x, max_x, 'U', "V");
+            print_result("ADCDev      ", samples.samples, acc, min_x, max_x, 'U', "V");
         }
-
-
-        samples.clear();
     }
 }
 
@@ -0,0 +1,121 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Bus broker daemon: serves I2C and SPI buses to several processes (see EKitBusBroker).
+ *   \author Oleh Sharuda
+ *
+ *   Usage: broker <socket path> <name>=i2c:<device> [<name>=spi:<device> ...]
+ *   Example: broker /run/hlek/broker.sock i2c=i2c:/dev/i2c-0 spi=spi:/dev/spidev0.0
+ */
+
+#include <signal.h>
+#include <iostream>
+#include <memory>
+#include <libhlek/ekit_i2c_bus.hpp>
+#include <libhlek/ekit_spi_bus.hpp>
+#include <libhlek/ekit_broker.hpp>
+#include <libhlek/tools.hpp>
+#include <libhlek/texttools.hpp>
+#include <libhlek/ekit_error.hpp>
+
+//------------------------------------------------------------------------------------
+// open_bus
+// Purpose: Opens bus described by "i2c:<device>" or "spi:<device>"
+// Returns: Opened bus, empty pointer if bus description is wrong
+//------------------------------------------------------------------------------------
+std::shared_ptr<EKitBus> open_bus(const std::string& descr) {
+    std::shared_ptr<EKitBus> bus;
+    EKitTimeout to(0);
+
+    if (tools::check_prefix(descr, std::string("i2c:"))) {
+        bus.reset(new EKitI2CBus(descr.substr(4)));
+    } else if (tools::check_prefix(descr, std::string("spi:"))) {
+        bus.reset(new EKitSPIBus(descr.substr(4)));
+    } else {
+        return bus;
+    }
+
+    EKIT_ERROR err = bus->open(to);
+    if (err != EKIT_OK) {
+        throw EKitException(__PRETTY_FUNCTION__, err, "Failed to open " + descr);
+    }
+
+    return bus;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cout << "Usage: " << argv[0] << " <socket path> <name>=i2c:<device> [<name>=spi:<device> ...]" << std::endl;
+        return 1;
+    }
+
+    // Create a pid file
+    bool singlton = tools::make_pid_file();
+    if (!singlton) {
+        std::cout << "This program is already running." << std::endl;
+        return 1;
+    }
+
+    // Signals are handled by main thread only, broker threads inherit blocked mask
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    int res = 0;
+    try {
+        EKitBusBroker broker(argv[1]);
+
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            size_t pos = arg.find('=');
+            std::shared_ptr<EKitBus> bus;
+            if (pos != std::string::npos) {
+                bus = open_bus(arg.substr(pos + 1));
+            }
+
+            if (!bus) {
+                std::cout << "Wrong bus description: " << arg << std::endl;
+                res = 1;
+                goto done;
+            }
+
+            broker.add_bus(arg.substr(0, pos), bus);
+        }
+
+        EKIT_ERROR err = broker.start();
+        if (err != EKIT_OK) {
+            std::cout << "Failed to listen " << argv[1] << ": " << errname(err) << std::endl;
+            res = 1;
+            goto done;
+        }
+
+        int sig;
+        sigwait(&sigs, &sig);
+        broker.stop();
+    } catch (EKitException& e) {
+        std::cout << e.what() << std::endl;
+        res = 1;
+    }
+
+done:
+    tools::delete_pid_file();
+    return res;
+}
@@ -0,0 +1,65 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Converts capture file (see EKitCaptureReader) to CSV written to standard output.
+ *   \author Oleh Sharuda
+ *
+ *   Usage: capture2csv <capture file> [<first record> [<record count>]]
+ *   Example: capture2csv adc.hlekcap 1000000 5000 > adc.csv
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <libhlek/ekit_capture.hpp>
+#include <libhlek/ekit_error.hpp>
+
+/// Output buffer, output is written by large blocks, not by line
+static char out_buf[1024*1024];
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 4) {
+        std::cout << "Usage: " << argv[0] << " <capture file> [<first record> [<record count>]]" << std::endl;
+        return 1;
+    }
+
+    uint64_t first = (argc > 2) ? strtoull(argv[2], nullptr, 0) : 0;
+    uint64_t count = (argc > 3) ? strtoull(argv[3], nullptr, 0) : UINT64_MAX;
+
+    try {
+        EKitCaptureReader rd(argv[1]);
+        const EKitCaptureHeader& hdr = rd.get_header();
+
+        std::cerr << std::string(hdr.dev_name, strnlen(hdr.dev_name, sizeof(hdr.dev_name))) << ": " << rd.get_records() << " records in " << rd.get_chunk_count() << " chunks";
+        if (rd.is_recovered()) {
+            std::cerr << " (index is missing, file was not closed)";
+        }
+        std::cerr << std::endl;
+
+        setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+        rd.write_csv(stdout, first, count);
+        fflush(stdout);
+    } catch (EKitException& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
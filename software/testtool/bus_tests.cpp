@@ -0,0 +1,1356 @@
+#include "bus_tests.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <testtool.hpp>
+#include "ekit_uart_bus.hpp"
+#include "ekit_trace_bus.hpp"
+#include "ekit_sim_devices.hpp"
+#include "ekit_firmware.hpp"
+#include "ekit_metrics.hpp"
+#include "ekit_drain.hpp"
+#include "ekit_broker.hpp"
+#include "ekit_arbiter.hpp"
+#include "adcdev.hpp"
+#include "adc_acquisition.hpp"
+#include "ekit_capture.hpp"
+#include "step_motor.hpp"
+#include "timetrackerdev.hpp"
+
+void test_uart_bus() {
+    DECLARE_TEST(test_uart_bus)
+
+    // Pseudo terminal pair is used instead of serial port
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    assert(master >= 0);
+    assert(grantpt(master) == 0);
+    assert(unlockpt(master) == 0);
+    std::string slave_name = ptsname(master);
+
+    REPORT_CASE
+    {
+        EKitUARTBus uart(slave_name, 16);
+        EKitTimeout to(1000);
+        BusLocker blocker(&uart, to);
+        int value;
+
+        assert(uart.set_opt(EKitUARTBus::UART_OPT_BAUD_RATE, 12345, to) == EKIT_BAD_PARAM);
+        assert(uart.set_opt(EKitUARTBus::UART_OPT_BAUD_RATE, 9600, to) == EKIT_OK);
+        assert(uart.set_opt(EKitUARTBus::UART_OPT_PARITY, EKitUARTBus::UART_PARITY_EVEN, to) == EKIT_OK);
+        assert(uart.open(to) == EKIT_OK);
+        assert(uart.get_opt(EKitUARTBus::UART_OPT_BAUD_RATE, value, to) == EKIT_OK && value == 9600);
+        assert(uart.get_opt(EKitUARTBus::UART_OPT_PARITY, value, to) == EKIT_OK &&
+               value == EKitUARTBus::UART_PARITY_EVEN);
+        assert(uart.set_opt(EKitUARTBus::UART_OPT_PARITY, EKitUARTBus::UART_PARITY_NONE, to) == EKIT_OK);
+
+        // Write
+        const char* cmd = "AT\r";
+        char buf[16] = {0};
+        assert(uart.write(cmd, 3, to) == EKIT_OK);
+        ssize_t n = 0;
+        while (n < 3) {
+            ssize_t r = read(master, buf + n, sizeof(buf) - n);
+            assert(r > 0);
+            n += r;
+        }
+        assert(memcmp(buf, cmd, 3) == 0);
+
+        // Read fixed amount of data
+        assert(write(master, "OK\r\n", 4) == 4);
+        assert(uart.read(buf, 4, to) == EKIT_OK);
+        assert(memcmp(buf, "OK\r\n", 4) == 0);
+
+        // Nothing to read
+        std::vector<uint8_t> data;
+        assert(uart.read_all(data, to) == EKIT_OK);
+        assert(data.empty());
+        EKitTimeout short_to(10);
+        assert(uart.read(buf, 1, short_to) == EKIT_TIMEOUT);
+
+        // Read all, no overflow
+        assert(write(master, "0123456789", 10) == 10);
+        tools::sleep_ms(50);
+        assert(uart.read_all(data, to) == EKIT_OK);
+        assert(data == std::vector<uint8_t>({'0','1','2','3','4','5','6','7','8','9'}));
+
+        // Overflow, the oldest data is discarded
+        assert(write(master, "ABCDEFGHIJKLMNOPQRST", 20) == 20);
+        tools::sleep_ms(50);
+        assert(uart.read_all(data, to) == EKIT_OVERFLOW);
+        assert(std::string(data.begin(), data.end()) == "EFGHIJKLMNOPQRST");
+
+        assert(uart.close() == EKIT_OK);
+    }
+
+    close(master);
+}
+
+// Bus which returns written data back
+class LoopbackBus final : public EKitBus {
+    std::vector<uint8_t> data;
+public:
+    LoopbackBus() : EKitBus(BUS_I2C) {}
+
+    EKIT_ERROR write(const void* ptr, size_t len, EKitTimeout& to) override {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(ptr);
+        data.insert(data.end(), p, p + len);
+        return EKIT_OK;
+    }
+
+    EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override {
+        if (len > data.size()) return EKIT_NO_DATA;
+        memcpy(ptr, data.data(), len);
+        data.erase(data.begin(), data.begin() + len);
+        return EKIT_OK;
+    }
+
+    EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override {
+        buffer.swap(data);
+        data.clear();
+        return EKIT_OK;
+    }
+
+    EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) override {
+        EKIT_ERROR err = write(wbuf, wlen, to);
+        return err == EKIT_OK ? read(rbuf, rlen, to) : err;
+    }
+};
+
+void test_trace_bus() {
+    DECLARE_TEST(test_trace_bus)
+
+    char file_name[] = "/tmp/ekit_trace_XXXXXX";
+    int fd = mkstemp(file_name);
+    assert(fd >= 0);
+    close(fd);
+
+    // The same sequence of calls is used for recording and replay
+    auto session = [](EKitBus* bus, uint8_t tag) {
+        EKitTimeout to(0);
+        uint8_t buf[8] = {0};
+        std::vector<uint8_t> all;
+        uint8_t wr[3] = {tag, 2, 3};
+        uint8_t rd[3] = {0};
+        EKitBusSegment segs[2] = {{wr, sizeof(wr), BUS_SEGMENT_WRITE}, {rd, sizeof(rd), BUS_SEGMENT_READ}};
+
+        assert(bus->lock(to) == EKIT_OK);
+        assert(bus->open(to) == EKIT_OK);
+        assert(bus->write("hello", 5, to) == EKIT_OK);
+        assert(bus->read(buf, 5, to) == EKIT_OK && memcmp(buf, "hello", 5) == 0);
+        assert(bus->read(buf, 1, to) == EKIT_NO_DATA);
+        assert(bus->set_opt(1, 2, to) == EKIT_NOT_SUPPORTED);
+        assert(bus->transaction(segs, 2, to) == EKIT_OK);
+        assert(memcmp(rd, "\x07\x02\x03", 3) == 0);
+        assert(bus->write_read(reinterpret_cast<const uint8_t*>("abcd"), 4, buf, 2, to) == EKIT_OK);
+        assert(memcmp(buf, "ab", 2) == 0);
+        assert(bus->read_all(all, to) == EKIT_OK);
+        assert(all == std::vector<uint8_t>({'c', 'd'}));
+        assert(bus->close() == EKIT_OK);
+        assert(bus->unlock() == EKIT_OK);
+    };
+
+    REPORT_CASE
+    {
+        std::shared_ptr<EKitBus> loopback(new LoopbackBus());
+        EKitTraceBus trace(loopback, file_name);
+        session(&trace, 7);
+        assert(trace.flush() == EKIT_OK);
+    }
+
+    REPORT_CASE
+    {
+        EKitReplayBus replay(file_name);
+        EKitTimeout to(0);
+        assert(replay.get_bus_type() == BUS_I2C);
+        assert(replay.remaining() == 11);
+        session(&replay, 7);
+        assert(replay.remaining() == 0);
+        assert(replay.get_mismatches() == 0);
+        assert(replay.get_recorded_time(TRACE_OP_WRITE) > 0);
+
+        // Trace is over
+        assert(replay.lock(to) == EKIT_NO_DATA);
+    }
+
+    REPORT_CASE
+    {
+        // Different data written is counted, different sequence of calls is detected
+        EKitReplayBus replay(file_name);
+        EKitTimeout to(0);
+        uint8_t buf[8];
+        assert(replay.lock(to) == EKIT_OK);
+        assert(replay.open(to) == EKIT_OK);
+        assert(replay.write("HELLO", 5, to) == EKIT_OK);
+        assert(replay.get_mismatches() == 1);
+        assert(replay.write(buf, 5, to) == EKIT_PROTOCOL);
+        assert(replay.unlock() == EKIT_PROTOCOL);
+    }
+
+    REPORT_CASE
+    {
+        // Lock respects timeout if bus is locked by other thread, lock record is not consumed
+        EKitReplayBus replay(file_name);
+        EKitTimeout to(0);
+        assert(replay.lock(to) == EKIT_OK);
+        std::thread t([&replay]() {
+            EKitTimeout to(20);
+            assert(replay.lock(to) == EKIT_TIMEOUT && to.expired());
+        });
+        t.join();
+        assert(replay.remaining() == 10);
+        assert(replay.unlock() == EKIT_PROTOCOL);
+    }
+
+    unlink(file_name);
+}
+
+static const ADCInput sim_adc_inputs[] = {
+    {"in0", "ADC_Channel_0", ADC_SampleTime_1Cycles5},
+    {"in1", "ADC_Channel_1", ADC_SampleTime_1Cycles5}};
+static const ADCConfig sim_adc_config = {1, "sim_adc", 64, 2, 4, 72000000, 4095, sim_adc_inputs};
+static const ADCConfig sim_adc2_config = {2, "sim_adc2", 64, 2, 4, 72000000, 4095, sim_adc_inputs};
+
+static const StepMotorDescriptor sim_motor = {0, 64, 1000, STEP_MOTOR_DRIVER_DRV8825, 1000000, -1000000, "m0", 200};
+static const StepMotorDescriptor* sim_motors[] = {&sim_motor};
+static const StepMotorConfig sim_stepper_config = {"sim_stepper", sim_motors, 1, 2};
+
+static const TimeTrackerDevConfig sim_tt_config = {3, "sim_tt", 8192, 1000000};
+static const TimeTrackerDevConfig sim_tt2_config = {4, "sim_tt2", 8192, 1000000};
+
+void test_sim_firmware_bus() {
+    DECLARE_TEST(test_sim_firmware_bus)
+    const int fw_addr = 0x2A;
+
+    REPORT_CASE
+    {
+        // Firmware side of the protocol
+        EKitSimFirmwareBus sim(fw_addr, 8, false);
+        sim.add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+        EKitTimeout to(1000);
+        CommResponseHeader hdr;
+        uint8_t cmd[sizeof(CommCommandHeader) + 16] = {1 | ADCDEV_STOP, 0, 0, 0};
+        CommCommandHeader* phdr = reinterpret_cast<CommCommandHeader*>(cmd);
+
+        assert(sim.open(to) == EKIT_OK);
+        {
+            BusLocker blocker(&sim, fw_addr + 1, to);
+            assert(sim.write(cmd, sizeof(CommCommandHeader), to) == EKIT_WRITE_FAILED);
+        }
+
+        BusLocker blocker(&sim, fw_addr, to);
+
+        // Control sum mismatch
+        phdr->control_crc = 0x55;
+        assert(sim.write(cmd, sizeof(CommCommandHeader), to) == EKIT_OK);
+        assert(sim.read(&hdr, sizeof(hdr), to) == EKIT_OK);
+        assert(hdr.dummy == COMM_DUMMY_BYTE && hdr.comm_status == (COMM_STATUS_CRC | 1));
+        assert(hdr.last_crc == (1 | ADCDEV_STOP));
+
+        // Length mismatch
+        phdr->length = 1;
+        phdr->control_crc = tools::calc_contol_sum(cmd, sizeof(CommCommandHeader), COMM_CRC_OFFSET);
+        assert(sim.write(cmd, sizeof(CommCommandHeader), to) == EKIT_OK);
+        assert(sim.read(&hdr, sizeof(hdr), to) == EKIT_OK);
+        assert((hdr.comm_status & COMM_STATUS_FAIL) != 0);
+
+        // Command buffer overrun
+        phdr->length = 16;
+        phdr->control_crc = tools::calc_contol_sum(cmd, sizeof(cmd), COMM_CRC_OFFSET);
+        assert(sim.write(cmd, sizeof(cmd), to) == EKIT_OK);
+        assert(sim.read(&hdr, sizeof(hdr), to) == EKIT_OK);
+        assert((hdr.comm_status & COMM_STATUS_FAIL) != 0);
+
+        // Accepted command keeps device busy until it is processed
+        sim.set_command_latency(2000);
+        phdr->length = 0;
+        phdr->control_crc = tools::calc_contol_sum(cmd, sizeof(CommCommandHeader), COMM_CRC_OFFSET);
+        assert(sim.write(cmd, sizeof(CommCommandHeader), to) == EKIT_OK);
+        assert(sim.read(&hdr, sizeof(hdr), to) == EKIT_OK);
+        assert((hdr.comm_status & COMM_STATUS_BUSY) != 0);
+        assert(sim.write(cmd, sizeof(CommCommandHeader), to) == EKIT_OK);    // ignored
+        sim.advance_time(2000);
+        assert(sim.read(&hdr, sizeof(hdr), to) == EKIT_OK);
+        assert(hdr.comm_status == 1 && hdr.length == sizeof(uint16_t));
+        assert(sim.close() == EKIT_OK);
+    }
+
+    REPORT_CASE
+    {
+        // ADCDev with the model
+        std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+        std::shared_ptr<EKitBus> sim_bus = sim;
+        std::shared_ptr<EKitBus> firmware(new EKitFirmware(sim_bus, fw_addr));
+        EKitTimeout to(1000);
+        std::vector<std::vector<double>> values;
+        uint16_t flags;
+        size_t ovf = 0;
+
+        sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+        sim->set_command_latency(100);
+        assert(sim->open(to) == EKIT_OK);
+        ADCDev adc(firmware, &sim_adc_config);
+        adc.set_ovf_callback([&ovf]() { ovf++; return EKIT_OK; });
+
+        adc.start(5);
+        sim->advance_time(10000);
+        assert(adc.status(flags) == 5 * sim_adc_config.input_count);
+        assert((flags & ADCDEV_STATUS_STARTED) == 0);
+        adc.get(values);
+        assert(values.size() == 5);
+        for (size_t s = 0; s < values.size(); s++) {
+            for (size_t ch = 0; ch < sim_adc_config.input_count; ch++) {
+                double expected = 3.3 * ((s * 16 + ch * 256) % 4096) / 4095.0;
+                assert(fabs(values[s][ch] - expected) < 1e-9);
+            }
+        }
+        assert(adc.status(flags) == 0 && ovf == 0);
+
+        // Flat buffers are filled channel by channel, samples beyond max_samples remain in device buffer. Generator
+        // continues with sample 5.
+        float fvalues[2 * 4];
+        double dvalues[2 * 8];
+        adc.start(7);
+        sim->advance_time(10000);
+        assert(adc.get(fvalues, 4) == 4);
+        assert(adc.get(dvalues, 8) == 3);
+        for (size_t ch = 0; ch < sim_adc_config.input_count; ch++) {
+            for (size_t s = 0; s < 7; s++) {
+                double expected = 3.3 * (((s + 5) * 16 + ch * 256) % 4096) / 4095.0;
+                double v = (s < 4) ? fvalues[ch * 4 + s] : dvalues[ch * 8 + s - 4];
+                assert(fabs(v - expected) < ((s < 4) ? 1e-5 : 1e-9));
+            }
+        }
+
+        // Raw measurements without conversion
+        adc.start(3);
+        sim->advance_time(10000);
+        ADCRawSamples raw = adc.get_raw();
+        assert(raw.samples == 3 && raw.channels == sim_adc_config.input_count);
+        assert(raw.size() == static_cast<size_t>(raw.end() - raw.begin()));
+        for (size_t s = 0; s < raw.samples; s++) {
+            for (size_t ch = 0; ch < raw.channels; ch++) {
+                assert(raw.data[s * raw.channels + ch] == ((s + 12) * 16 + ch * 256) % 4096);
+            }
+        }
+        assert(adc.status(flags) == 0 && ovf == 0);
+
+        // Sampling is stopped on overflow: buffer fits 16 samples
+        adc.start(0);
+        sim->advance_time(100000);
+        assert(adc.status(flags) == 16 * sim_adc_config.input_count);
+        assert((flags & ADCDEV_STATUS_STARTED) == 0);
+        adc.get(values);
+        assert(values.size() == 16 && ovf != 0);
+        adc.reset();
+        ovf = 0;
+        adc.get(values);
+        assert(values.empty() && ovf == 0);
+    }
+
+    REPORT_CASE
+    {
+        // Status and samples are read by single transaction (after device selection by lock), status is up to date
+        // without synchronization
+        std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+        std::shared_ptr<EKitBus> sim_bus = sim;
+        std::shared_ptr<EKitFirmware> fw(new EKitFirmware(sim_bus, fw_addr));
+        std::shared_ptr<EKitBus> firmware = fw;
+        std::shared_ptr<EKitBusMetrics> metrics(new EKitBusMetrics("sim"));
+        std::vector<EKitMetricsSnapshot> snap;
+        EKitTimeout to(1000);
+        float fvalues[2 * 16];
+        uint16_t flags;
+
+        sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+        assert(sim->open(to) == EKIT_OK);
+        ADCDev adc(firmware, &sim_adc_config);
+        auto transactions = [&metrics, &snap]() {
+            snap.clear();
+            metrics->snapshot(snap);
+            return snap.empty() ? 0 : snap[0].transactions;
+        };
+
+        adc.start(0);
+        sim->advance_time(3500);
+        sim_bus->set_metrics(metrics);
+        assert(adc.get(fvalues, 16) >= 3 && transactions() == 2);
+        assert((adc.last_status() & ADCDEV_STATUS_STARTED) != 0);
+        adc.status(flags);
+        assert((flags & ADCDEV_STATUS_STARTED) != 0 && transactions() == 4);
+        sim_bus->set_metrics(nullptr);
+
+        // Stop is seen by the next read without synchronization
+        adc.stop();
+        sim->advance_time(1000);
+        metrics.reset(new EKitBusMetrics("sim"));
+        sim_bus->set_metrics(metrics);
+        adc.get(fvalues, 16);
+        assert((adc.last_status() & ADCDEV_STATUS_STARTED) == 0 && transactions() == 2);
+        sim_bus->set_metrics(nullptr);
+
+        // Device busy with command is synchronized before read
+        sim->set_command_latency(2000);
+        adc.start(0);
+        adc.status(flags);
+        assert((flags & ADCDEV_STATUS_STARTED) != 0);
+        adc.stop();
+        sim->set_command_latency(0);
+
+        // Partially read sample is not removed from device buffer
+        uint8_t buf[sizeof(uint16_t) + 6];
+        size_t len = 0;
+        size_t available = 0;
+        adc.reset();
+        adc.start(4);
+        sim->advance_time(10000);
+        {
+            BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+            assert(fw->read_stream(buf, sizeof(buf), len, to, &available) == EKIT_OK);
+        }
+        assert(len == sizeof(buf) && available == sizeof(uint16_t) + 4 * 4);
+        ADCRawSamples raw = adc.get_raw();
+        uint16_t first;
+        memcpy(&first, buf + sizeof(uint16_t), sizeof(first));
+        assert(raw.samples == 3 && raw.data[0] == (first + 16) % 4096);
+
+        // Buffer reused by read_all() is shrunk to data, but not reallocated
+        std::vector<uint8_t> all;
+        all.reserve(256);
+        const uint8_t* all_data = all.data();
+        adc.reset();
+        adc.start(4);
+        sim->advance_time(10000);
+        {
+            BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+            assert(fw->read_all(all, to) == EKIT_OK && all.size() == sizeof(uint16_t) + 4 * 4);
+            assert(fw->read_all(all, to) == EKIT_OK && all.size() == sizeof(uint16_t));
+        }
+        assert(all.data() == all_data);
+    }
+
+    REPORT_CASE
+    // CRC-16 framing is negotiated by the first command, firmware without CRC-16 support falls back to control sum
+    for (bool support : {true, false}) {
+        std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+        std::shared_ptr<EKitBus> sim_bus = sim;
+        std::shared_ptr<EKitBus> firmware(new EKitFirmware(sim_bus, fw_addr));
+        EKitTimeout to(1000);
+        std::vector<std::vector<double>> values;
+        uint16_t flags;
+        int crc16 = -1;
+
+        sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+        sim->set_command_latency(100);
+        sim->set_crc16_support(support);
+        assert(sim->open(to) == EKIT_OK);
+        ADCDev adc(firmware, &sim_adc_config);
+        {
+            BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+            assert(firmware->set_opt(EKitFirmware::FIRMWARE_OPT_CRC16, 1, to) == EKIT_OK);
+            assert(firmware->get_opt(EKitFirmware::FIRMWARE_OPT_CRC16, crc16, to) == EKIT_OK && crc16 == 0);
+        }
+
+        adc.start(5);
+        sim->advance_time(10000);
+        assert(adc.status(flags) == 5 * sim_adc_config.input_count);
+        adc.get(values);
+        assert(values.size() == 5);
+        assert(fabs(values[4][1] - 3.3 * ((4 * 16 + 256) % 4096) / 4095.0) < 1e-9);
+        {
+            BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+            assert(firmware->get_opt(EKitFirmware::FIRMWARE_OPT_CRC16, crc16, to) == EKIT_OK);
+            assert(crc16 == (support ? 1 : 0));
+        }
+    }
+
+    REPORT_CASE
+    {
+        // StepMotorDev with the model
+        std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+        std::shared_ptr<EKitBus> sim_bus = sim;
+        std::shared_ptr<EKitBus> firmware(new EKitFirmware(sim_bus, fw_addr));
+        EKitTimeout to(1000);
+        std::vector<StepMotorStatus> mstatus;
+
+        sim->add_device(std::make_shared<EKitSimStepMotorDev>(&sim_stepper_config));
+        assert(sim->open(to) == EKIT_OK);
+        StepMotorDev stepper(firmware, &sim_stepper_config);
+
+        stepper.dir(0, true);
+        stepper.move(0, 10);
+        stepper.dir(0, false);
+        stepper.move(0, 3);
+        stepper.feed();
+        stepper.start();
+        assert(stepper.status(mstatus) == STEP_MOTOR_DEV_STATUS_RUN);
+        sim->advance_time(20000);
+        assert(stepper.status(mstatus) == STEP_MOTOR_DEV_STATUS_IDLE);
+        assert(mstatus[0].pos == 7 * STEP_MOTOR_MICROSTEP_DELTA(STEP_MOTOR_FULL_STEP));
+        assert((mstatus[0].motor_state & STEP_MOTOR_DONE) != 0 && mstatus[0].bytes_remain == 0);
+    }
+
+    REPORT_CASE
+    {
+        // Commands of two devices by single batch frame
+        std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+        std::shared_ptr<EKitBus> sim_bus = sim;
+        std::shared_ptr<EKitFirmware> fw(new EKitFirmware(sim_bus, fw_addr));
+        std::shared_ptr<EKitBus> firmware = fw;
+        std::shared_ptr<EKitBusMetrics> metrics(new EKitBusMetrics("sim"));
+        std::vector<EKitMetricsSnapshot> snap;
+        EKitTimeout to(1000);
+        EKitFirmwareBatch batch;
+        ADCDevCommand cmd;
+        uint16_t flags;
+
+        sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+        sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc2_config, 1000.0));
+        sim->set_command_latency(100);
+        assert(sim->open(to) == EKIT_OK);
+        ADCDev adc1(firmware, &sim_adc_config);
+        ADCDev adc2(firmware, &sim_adc2_config);
+
+        memset(&cmd, 0, sizeof(cmd));
+        assert(batch.empty() && fw->write_batch(batch, to) == EKIT_OK);
+        assert(batch.add(COMM_MAX_DEV_ADDR + 1, 0, nullptr, 0) == EKIT_BAD_PARAM);
+        assert(batch.add(1, 1, nullptr, 0) == EKIT_BAD_PARAM);
+        cmd.sample_count = 5;
+        assert(batch.add(1, ADCDEV_START, &cmd, sizeof(cmd)) == EKIT_OK);
+        cmd.sample_count = 3;
+        assert(batch.add(2, ADCDEV_START, &cmd, sizeof(cmd)) == EKIT_OK);
+        assert(batch.size() == 2 && batch.data_length() == 2 * COMM_BATCH_RECORD_SIZE(sizeof(cmd)));
+
+        // Batch must fit firmware command buffer together with CRC-16
+        EKitFirmwareBatch small_batch(COMM_BATCH_RECORD_SIZE(sizeof(cmd)) + COMM_CRC16_SIZE);
+        assert(small_batch.add(1, ADCDEV_START, &cmd, sizeof(cmd)) == EKIT_OK);
+        assert(small_batch.add(2, 0, nullptr, 0) == EKIT_OVERFLOW);
+        assert(small_batch.size() == 1);
+
+        // Single lock and single write on the underlying bus
+        sim_bus->set_metrics(metrics);
+        assert(fw->write_batch(batch, to) == EKIT_OK);
+        sim_bus->set_metrics(nullptr);
+        metrics->snapshot(snap);
+        assert(snap.size() == 1 && snap[0].locks == 1);
+        assert(snap[0].bytes_out == sizeof(CommCommandHeader) + batch.data_length());
+
+        sim->advance_time(10000);
+        assert(adc1.status(flags) == 5 * sim_adc_config.input_count);
+        assert(adc2.status(flags) == 3 * sim_adc2_config.input_count);
+
+        // Batch is rejected as a whole if any record addresses missing device
+        adc1.reset();
+        batch.clear();
+        cmd.sample_count = 2;
+        assert(batch.add(1, ADCDEV_START, &cmd, sizeof(cmd)) == EKIT_OK);
+        assert(batch.add(5, 0, nullptr, 0) == EKIT_OK);
+        assert(batch.add(2, 0, nullptr, 0) == EKIT_OK);
+        assert(fw->write_batch(batch, to) == EKIT_FAIL);
+        sim->advance_time(10000);
+        assert(adc1.status(flags) == 0 && (flags & ADCDEV_STATUS_STARTED) == 0);
+    }
+
+    REPORT_CASE
+    {
+        // TimeTrackerDev drains device by back to back streaming reads
+        std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+        std::shared_ptr<EKitBus> sim_bus = sim;
+        std::shared_ptr<EKitBus> firmware(new EKitFirmware(sim_bus, fw_addr));
+        EKitTimeout to(1000);
+        std::vector<uint64_t> data;
+        uint64_t first_ts;
+        bool running;
+
+        sim->add_device(std::make_shared<EKitSimTimeTrackerDev>(&sim_tt_config, 1000.0));
+        assert(sim->open(to) == EKIT_OK);
+        TimeTrackerDev tt(firmware, &sim_tt_config);
+
+        tt.start();
+        sim->advance_time(900000);
+        tt.stop();
+        size_t n = tt.get_status(running, first_ts);
+        assert(!running && n > 512 && n < 1024 && first_ts != UINT64_MAX);
+
+        // Several chunks, the last one is not full
+        tt.read_all(data, true);
+        assert(data.size() == n);
+        for (size_t i = 0; i < data.size(); i++) {
+            assert(data[i] == i * 1000);
+        }
+        assert(tt.get_status(running, first_ts) == 0);
+    }
+}
+
+void test_drain_scheduler() {
+    DECLARE_TEST(test_drain_scheduler)
+    const int fw_addr = 0x2A;
+
+    REPORT_CASE
+    {
+        // Slow and fast TimeTrackerDev are drained in simulated time without data loss
+        std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+        std::shared_ptr<EKitBus> sim_bus = sim;
+        std::shared_ptr<EKitBus> firmware(new EKitFirmware(sim_bus, fw_addr));
+        EKitTimeout to(1000);
+        std::vector<uint64_t> slow_ts;
+        std::vector<uint64_t> fast_ts;
+        EKitDrainScheduler sched(0.75, 5000, 1000000, 1000);
+
+        sim->add_device(std::make_shared<EKitSimTimeTrackerDev>(&sim_tt_config, 100.0));
+        sim->add_device(std::make_shared<EKitSimTimeTrackerDev>(&sim_tt2_config, 2000.0));
+        sim->set_bus_speed(400000);
+        assert(sim->open(to) == EKIT_OK);
+        TimeTrackerDev slow(firmware, &sim_tt_config);
+        TimeTrackerDev fast(firmware, &sim_tt2_config);
+
+        int slow_id = sched.add("slow", sim_tt_config.dev_buffer_len, [&slow, &slow_ts](bool& ovf) {
+            size_t n = slow_ts.size();
+            slow.read_all(slow_ts, false);
+            return (slow_ts.size() - n) * sizeof(uint64_t);
+        });
+        int fast_id = sched.add("fast", sim_tt2_config.dev_buffer_len, [&fast, &fast_ts](bool& ovf) {
+            size_t n = fast_ts.size();
+            fast.read_all(fast_ts, false);
+            return (fast_ts.size() - n) * sizeof(uint64_t);
+        });
+
+        slow.start();
+        fast.start();
+        uint64_t next = sched.poll(sim->get_time());
+        while (sim->get_time() < 3000000) {
+            uint64_t now = sim->get_time();
+            if (next > now) {
+                sim->advance_time(next - now);
+            }
+            next = sched.poll(sim->get_time());
+        }
+
+        // Fast device fills 75% of the buffer in about 384 ms, slow one is drained with maximal period. Polling with fixed
+        // 10 ms period would require 300 drains of each device.
+        EKitDrainStats slow_stats = sched.get_stats(slow_id);
+        EKitDrainStats fast_stats = sched.get_stats(fast_id);
+        assert(fast_ts.size() > 5900 && slow_ts.size() > 200);
+        assert(fast_stats.overflows == 0 && fast_stats.max_bytes < sim_tt2_config.dev_buffer_len);
+        assert(fast_stats.period_us > 350000 && fast_stats.period_us < 400000);
+        assert(slow_stats.period_us == 1000000);
+        assert(fast_stats.drains < 20 && slow_stats.drains < 10);
+        for (size_t i = 1; i < fast_ts.size(); i++) {
+            assert(fast_ts[i] - fast_ts[i-1] == 500);
+        }
+        for (size_t i = 1; i < slow_ts.size(); i++) {
+            assert(slow_ts[i] - slow_ts[i-1] == 10000);
+        }
+
+        sched.remove(slow_id);
+        sched.remove(fast_id);
+        assert(sched.poll(sim->get_time()) == UINT64_MAX);
+    }
+
+    REPORT_CASE
+    {
+        // Thread drains sources in time, errors are passed to handler
+        EKitDrainScheduler sched(0.5, 1000, 20000, 500);
+        std::atomic<size_t> drained(0);
+        std::atomic<size_t> errors(0);
+
+        sched.set_error_handler([&errors](int id, std::exception_ptr e) { errors++; });
+        sched.start();
+        int id = sched.add("counter", 1024, [&drained](bool& ovf) { drained++; return size_t(0); });
+        sched.add("faulty", 1024, [](bool& ovf) -> size_t { throw EKitException("faulty", EKIT_FAIL); });
+        while (drained < 3 || errors < 3) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        sched.stop();
+
+        // Empty source is drained with maximal period
+        assert(sched.get_stats(id).period_us == 20000);
+    }
+
+    REPORT_CASE
+    {
+        // Drain function and error handler may call scheduler, remove() waits for running drain of another thread
+        EKitDrainScheduler sched(0.5, 1000, 20000, 500);
+        std::atomic<bool> running(false);
+        std::atomic<bool> finished(false);
+        int self_id = -1;
+        int added_id = -1;
+
+        self_id = sched.add("self", 1024, [&sched, &self_id, &added_id](bool& ovf) {
+            sched.remove(self_id);
+            added_id = sched.add("added", 1024, [](bool& ovf) { return size_t(0); });
+            return size_t(0);
+        });
+        sched.add("faulty", 1024, [](bool& ovf) -> size_t { throw EKitException("faulty", EKIT_FAIL); });
+        sched.set_error_handler([&sched](int id, std::exception_ptr e) { sched.remove(id); });
+        assert(sched.poll(0) == 0);
+        assert(sched.poll(0) == 1000);
+        assert(added_id >= 0 && sched.get_stats(added_id).drains == 1);
+
+        int slow_id = sched.add("slow", 1024, [&running, &finished](bool& ovf) {
+            running = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            finished = true;
+            return size_t(0);
+        });
+        std::thread t([&sched]() { sched.poll(2000); });
+        while (!running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        sched.remove(slow_id);
+        assert(finished);
+        t.join();
+    }
+}
+
+void test_bus_broker() {
+    DECLARE_TEST(test_bus_broker)
+    const int fw_addr = 0x2A;
+    const std::string path = "/tmp/hlek_broker_test." + std::to_string(getpid());
+
+    std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+    EKitTimeout to(1000);
+    sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+    sim->add_device(std::make_shared<EKitSimTimeTrackerDev>(&sim_tt_config, 1000.0));
+    sim->set_command_latency(100);
+    assert(sim->open(to) == EKIT_OK);
+
+    EKitBusBroker broker(path);
+    broker.add_bus("sim", sim);
+    assert(broker.start() == EKIT_OK);
+
+    REPORT_CASE
+    {
+        // Bus is selected by name and type
+        EKitRemoteBus wrong_name(path, "none", BUS_I2C);
+        EKitRemoteBus wrong_type(path, "sim", BUS_SPI);
+        EKitRemoteBus no_broker(path + ".none", "sim", BUS_I2C);
+        assert(wrong_name.open(to) == EKIT_NOT_OPENED);
+        assert(wrong_type.open(to) == EKIT_WRONG_DEVICE);
+        assert(no_broker.open(to) == EKIT_CANT_CONNECT);
+    }
+
+    REPORT_CASE
+    {
+        // Devices of two clients share the same firmware
+        std::shared_ptr<EKitBus> bus1(new EKitRemoteBus(path, "sim", BUS_I2C));
+        std::shared_ptr<EKitBus> bus2(new EKitRemoteBus(path, "sim", BUS_I2C));
+        assert(bus1->open(to) == EKIT_OK && bus2->open(to) == EKIT_OK);
+        std::shared_ptr<EKitBus> firmware1(new EKitFirmware(bus1, fw_addr));
+        std::shared_ptr<EKitBus> firmware2(new EKitFirmware(bus2, fw_addr));
+        ADCDev adc(firmware1, &sim_adc_config);
+        TimeTrackerDev tt(firmware2, &sim_tt_config);
+        std::vector<std::vector<double>> values;
+        std::vector<uint64_t> data;
+        uint64_t first_ts;
+        bool running;
+        uint16_t flags;
+
+        adc.start(5);
+        tt.start();
+        sim->advance_time(900000);
+        tt.stop();
+        assert(adc.status(flags) == 5 * sim_adc_config.input_count);
+        adc.get(values);
+        assert(values.size() == 5);
+
+        // Streaming reads are larger than inline payload and passed through shared memory
+        size_t n = tt.get_status(running, first_ts);
+        assert(!running && n > 512);
+        tt.read_all(data, true);
+        assert(data.size() == n);
+        for (size_t i = 0; i < data.size(); i++) {
+            assert(data[i] == i * 1000);
+        }
+    }
+
+    REPORT_CASE
+    {
+        // Lock is granted in order of requests and released if owner disconnects
+        EKitRemoteBus bus1(path, "sim", BUS_I2C);
+        EKitRemoteBus bus2(path, "sim", BUS_I2C);
+        EKitTimeout to_short(50);
+        CommResponseHeader hdr;
+        assert(bus1.open(to) == EKIT_OK && bus2.open(to) == EKIT_OK);
+
+        assert(bus1.lock(fw_addr, to) == EKIT_OK);
+        assert(bus2.lock(fw_addr, to_short) == EKIT_TIMEOUT);
+        assert(bus1.read(&hdr, sizeof(hdr), to) == EKIT_OK);
+        assert(hdr.dummy == COMM_DUMMY_BYTE);
+
+        std::atomic<bool> locked(false);
+        std::thread t([&bus2, &locked, fw_addr]() {
+            EKitTimeout to_long(5000);
+            assert(bus2.lock(fw_addr, to_long) == EKIT_OK);
+            locked = true;
+            bus2.unlock();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        assert(!locked);
+        assert(bus1.close() == EKIT_OK);
+        t.join();
+        assert(locked);
+        bus1.unlock();
+    }
+
+    REPORT_CASE
+    {
+        // Arbiter is acquired and released once per addressable lock
+        EKitRemoteBus bus(path, "sim", BUS_I2C);
+        std::shared_ptr<EKitBusArbiter> arbiter(new EKitBusArbiter(2, 0));
+        assert(bus.open(to) == EKIT_OK);
+        bus.set_arbiter(arbiter);
+        assert(bus.lock(fw_addr, to) == EKIT_OK);
+        assert(bus.unlock() == EKIT_OK);
+        assert(bus.lock(fw_addr, to) == EKIT_OK);
+        assert(bus.unlock() == EKIT_OK);
+    }
+
+    REPORT_CASE
+    {
+        // Shared memory which may be resized by client is rejected
+        const std::string name = "sim";
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        assert(connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+        int shm_fd = memfd_create("hlek_broker_test", MFD_CLOEXEC);
+        assert(shm_fd >= 0 && ftruncate(shm_fd, 2 * broker_default_shm_size) == 0);
+
+        std::vector<uint8_t> msg(sizeof(EKitBrokerRequest) + name.length());
+        EKitBrokerRequest req;
+        memset(&req, 0, sizeof(req));
+        req.op = BROKER_OP_HELLO;
+        req.arg = BUS_I2C;
+        req.value = broker_default_shm_size;
+        req.length = name.length();
+        memcpy(msg.data(), &req, sizeof(req));
+        memcpy(msg.data() + sizeof(req), name.c_str(), name.length());
+
+        char cbuf[CMSG_SPACE(sizeof(int))];
+        struct iovec iov = {msg.data(), msg.size()};
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &shm_fd, sizeof(int));
+        assert(sendmsg(sock, &mh, 0) == static_cast<ssize_t>(msg.size()));
+
+        // Broker disconnects without response
+        uint8_t resp[64];
+        assert(recv(sock, resp, sizeof(resp), 0) == 0);
+        close(sock);
+        close(shm_fd);
+
+        // Broker keeps serving other clients
+        EKitRemoteBus bus(path, "sim", BUS_I2C);
+        assert(bus.open(to) == EKIT_OK);
+    }
+
+    REPORT_CASE
+    {
+        // Transaction with segment lengths which overflow request or response is rejected
+        const std::string name = "sim";
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        assert(connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+        int shm_fd = memfd_create("hlek_broker_test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        assert(shm_fd >= 0 && ftruncate(shm_fd, 2 * broker_default_shm_size) == 0);
+        assert(fcntl(shm_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == 0);
+
+        std::vector<uint8_t> msg(sizeof(EKitBrokerRequest) + name.length());
+        EKitBrokerRequest req;
+        EKitBrokerResponse resp;
+        uint8_t rbuf[sizeof(resp) + broker_inline_payload];
+        memset(&req, 0, sizeof(req));
+        req.op = BROKER_OP_HELLO;
+        req.arg = BUS_I2C;
+        req.value = broker_default_shm_size;
+        req.length = name.length();
+        memcpy(msg.data(), &req, sizeof(req));
+        memcpy(msg.data() + sizeof(req), name.c_str(), name.length());
+
+        char cbuf[CMSG_SPACE(sizeof(int))];
+        struct iovec iov = {msg.data(), msg.size()};
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &shm_fd, sizeof(int));
+        assert(sendmsg(sock, &mh, 0) == static_cast<ssize_t>(msg.size()));
+        close(shm_fd);
+
+        auto request = [&](const EKitBrokerRequest& r, const std::vector<EKitBrokerSegment>& segs) -> EKIT_ERROR {
+            std::vector<uint8_t> m(sizeof(r) + r.length);
+            memcpy(m.data(), &r, sizeof(r));
+            if (!segs.empty()) {
+                memcpy(m.data() + sizeof(r), segs.data(), segs.size() * sizeof(EKitBrokerSegment));
+            }
+            assert(send(sock, m.data(), m.size(), 0) == static_cast<ssize_t>(m.size()));
+            assert(recv(sock, rbuf, sizeof(rbuf), 0) >= static_cast<ssize_t>(sizeof(resp)));
+            memcpy(&resp, rbuf, sizeof(resp));
+            return static_cast<EKIT_ERROR>(resp.err);
+        };
+
+        assert(recv(sock, rbuf, sizeof(rbuf), 0) == static_cast<ssize_t>(sizeof(resp)));
+        memcpy(&resp, rbuf, sizeof(resp));
+        assert(resp.err == EKIT_OK);
+
+        memset(&req, 0, sizeof(req));
+        req.op = BROKER_OP_LOCK;
+        req.arg = fw_addr;
+        req.timeout_ms = 1000;
+        assert(request(req, {}) == EKIT_OK);
+
+        // Sums of the write or read lengths wrap to the expected values with 32-bit size_t
+        req.op = BROKER_OP_TRANSACTION;
+        req.arg = 2;
+        req.length = 2 * sizeof(EKitBrokerSegment) + 16;
+        std::vector<EKitBrokerSegment> segs(2);
+        segs[0] = {UINT32_MAX - 2 * static_cast<uint32_t>(sizeof(EKitBrokerSegment)) + 1, 0};
+        segs[1] = {req.length, 0};
+        std::vector<EKitBrokerSegment> wsegs = segs;
+        wsegs.resize(4);
+        assert(request(req, wsegs) == EKIT_BAD_PARAM);
+
+        req.length = 2 * sizeof(EKitBrokerSegment);
+        segs[0] = {UINT32_MAX, BUS_SEGMENT_READ};
+        segs[1] = {1, BUS_SEGMENT_READ | BUS_SEGMENT_STOP};
+        assert(request(req, segs) == EKIT_BAD_PARAM);
+
+        // Number of the segments which wraps segment table size to the request length with 32-bit size_t
+        req.arg = 0x20000001;
+        req.length = sizeof(EKitBrokerSegment);
+        segs.resize(1);
+        segs[0] = {1, BUS_SEGMENT_READ | BUS_SEGMENT_STOP};
+        assert(request(req, segs) == EKIT_BAD_PARAM);
+
+        // Valid transaction is still served by the same connection
+        CommResponseHeader hdr;
+        req.arg = 1;
+        segs[0] = {sizeof(hdr), BUS_SEGMENT_READ | BUS_SEGMENT_STOP};
+        assert(request(req, segs) == EKIT_OK && resp.length == sizeof(hdr));
+        memcpy(&hdr, rbuf + sizeof(resp), sizeof(hdr));
+        assert(hdr.dummy == COMM_DUMMY_BYTE);
+
+        req.op = BROKER_OP_UNLOCK;
+        req.arg = 0;
+        req.length = 0;
+        assert(send(sock, &req, sizeof(req), 0) == static_cast<ssize_t>(sizeof(req)));
+        close(sock);
+    }
+
+    broker.stop();
+    EKitRemoteBus late(path, "sim", BUS_I2C);
+    assert(late.open(to) == EKIT_CANT_CONNECT);
+}
+
+// Bus which forwards requests to another bus, or fails them while device is wedged
+class WedgedBus final : public EKitBus {
+    std::shared_ptr<EKitBus> bus;
+public:
+    bool wedged = false;
+    size_t failed = 0;
+    size_t fail_transactions = 0;   // Number of the next transactions failed without being forwarded
+    size_t lose_response_at = 0;    // Transaction (counting from 1) failed after the first segments are forwarded
+    size_t lose_segments = 1;       // Number of the segments forwarded by transaction which loses response
+    EKIT_ERROR lose_error = EKIT_READ_FAILED;   // Error returned by transactions which lose response
+    size_t writes = 0;              // Number of the writes forwarded
+
+    explicit WedgedBus(std::shared_ptr<EKitBus> b) : EKitBus(BUS_I2C), bus(b) {}
+
+    EKIT_ERROR lock(int addr, EKitTimeout& to) override {
+        return bus->lock(addr, to);
+    }
+
+    EKIT_ERROR unlock() override {
+        return bus->unlock();
+    }
+
+    EKIT_ERROR write(const void* ptr, size_t len, EKitTimeout& to) override {
+        if (wedged) { failed++; return EKIT_WRITE_FAILED; }
+        writes++;
+        return bus->write(ptr, len, to);
+    }
+
+    EKIT_ERROR read(void* ptr, size_t len, EKitTimeout& to) override {
+        if (wedged) { failed++; return EKIT_READ_FAILED; }
+        return bus->read(ptr, len, to);
+    }
+
+    EKIT_ERROR read_all(std::vector<uint8_t>& buffer, EKitTimeout& to) override {
+        return bus->read_all(buffer, to);
+    }
+
+    EKIT_ERROR write_read(const uint8_t* wbuf, size_t wlen, uint8_t* rbuf, size_t rlen, EKitTimeout& to) override {
+        if (wedged) { failed++; return EKIT_WRITE_FAILED; }
+        return bus->write_read(wbuf, wlen, rbuf, rlen, to);
+    }
+
+    EKIT_ERROR transaction(EKitBusSegment* segments, size_t count, EKitTimeout& to) override {
+        if (wedged || fail_transactions > 0) {
+            if (fail_transactions > 0) fail_transactions--;
+            failed++;
+            return (segments[0].flags & BUS_SEGMENT_READ) != 0 ? EKIT_READ_FAILED : EKIT_WRITE_FAILED;
+        }
+        if ((segments[0].flags & BUS_SEGMENT_READ) == 0) {
+            writes++;
+        }
+        if (lose_response_at > 0 && --lose_response_at == 0) {
+            failed++;
+            bus->transaction(segments, std::min(lose_segments, count), to);
+            return lose_error;
+        }
+        return bus->transaction(segments, count, to);
+    }
+};
+
+void test_bus_deadlines() {
+    DECLARE_TEST(test_bus_deadlines)
+
+    const int fw_addr = 0x2A;
+    std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+    std::shared_ptr<WedgedBus> wedge(new WedgedBus(sim));
+    std::shared_ptr<EKitBus> wedge_bus = wedge;
+    std::shared_ptr<EKitFirmware> fw(new EKitFirmware(wedge_bus, fw_addr));
+    std::shared_ptr<EKitBus> firmware = fw;
+    EKitMetricsRegistry registry;
+    std::vector<EKitMetricsSnapshot> snap;
+    CommResponseHeader hdr;
+    EKitTimeout to(1000);
+    int max_retries = -1;
+
+    sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+    assert(sim->open(to) == EKIT_OK);
+    firmware->set_metrics(registry.add_bus("fw"));
+    ADCDev adc(firmware, &sim_adc_config);
+
+    REPORT_CASE
+    // Retries are bounded even if timeout is infinite
+    {
+        EKitTimeout no_timeout(0);
+        BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+        assert(firmware->get_opt(EKitFirmware::FIRMWARE_OPT_MAX_RETRIES, max_retries, to) == EKIT_OK);
+        assert(max_retries == 16);
+
+        wedge->wedged = true;
+        assert(fw->get_status(hdr, false, no_timeout) == EKIT_READ_FAILED);
+        assert(wedge->failed == 17);
+        wedge->wedged = false;
+        assert(fw->get_status(hdr, false, no_timeout) == EKIT_OK);
+    }
+    registry.snapshot(snap);
+    assert(snap.size() == 1 && snap[0].read_retries == 16 && snap[0].timeouts == 0);
+    assert(snap[0].retry_hist[EKitBusMetrics::bucket(16)] == 1);
+
+    REPORT_CASE
+    // Operation with unlimited retries is abandoned when timeout expires
+    {
+        BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+        assert(firmware->set_opt(EKitFirmware::FIRMWARE_OPT_MAX_RETRIES, 0, to) == EKIT_OK);
+        assert(firmware->set_opt(EKitFirmware::FIRMWARE_OPT_MAX_RETRIES, -1, to) == EKIT_BAD_PARAM);
+
+        EKitTimeout deadline(30);
+        wedge->wedged = true;
+        wedge->failed = 0;
+        assert(fw->get_status(hdr, false, deadline) == EKIT_TIMEOUT);
+        assert(deadline.measure() >= 30 && deadline.measure() < 1000);
+        assert(wedge->failed > 1);
+        wedge->wedged = false;
+    }
+    registry.snapshot(snap);
+    assert(snap.size() == 1 && snap[0].timeouts == 1);
+
+    REPORT_CASE
+    // Command to the wedged device fails, device works again once it recovers
+    {
+        BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+        assert(firmware->set_opt(EKitFirmware::FIRMWARE_OPT_MAX_RETRIES, 2, to) == EKIT_OK);
+        wedge->wedged = true;
+        wedge->failed = 0;
+        assert(fw->sync_vdev(hdr, false, to) != EKIT_OK);
+        assert(wedge->failed == 3);
+        wedge->wedged = false;
+        assert(fw->sync_vdev(hdr, false, to) == EKIT_OK);
+    }
+
+    REPORT_CASE
+    // Command of the failed transaction is written again
+    {
+        uint16_t flags;
+        wedge->failed = 0;
+        wedge->fail_transactions = 1;
+        adc.start(0);
+        assert(wedge->failed == 1);
+        adc.status(flags);
+        assert((flags & ADCDEV_STATUS_STARTED) != 0);
+        adc.stop();
+    }
+
+    REPORT_CASE
+    // Command delivered by failed transaction is not written again, response header is read again
+    {
+        uint16_t flags;
+        size_t writes;
+        wedge->writes = 0;
+        adc.start(0);
+        writes = wedge->writes;
+        adc.stop();
+        assert(writes >= 2);
+
+        // The first transaction selects device, the second one starts it
+        for (EKIT_ERROR err : {EKIT_READ_FAILED, EKIT_WRITE_FAILED}) {
+            for (size_t at = 1; at <= 2; at++) {
+                wedge->failed = 0;
+                wedge->writes = 0;
+                wedge->lose_error = err;
+                wedge->lose_response_at = at;
+                adc.start(0);
+                assert(wedge->failed == 1 && wedge->writes == writes);
+                adc.status(flags);
+                assert((flags & ADCDEV_STATUS_STARTED) != 0);
+                adc.stop();
+                adc.reset();
+            }
+        }
+    }
+
+    REPORT_CASE
+    // Stream read is not retried if trailing response header is lost: data is already committed by firmware
+    {
+        uint8_t buf[sizeof(uint16_t) + 4 * 4];
+        size_t len = 0;
+        uint16_t first;
+        uint16_t next;
+        adc.start(0);
+        sim->advance_time(10000);
+        {
+            BusLocker blocker(firmware, sim_adc_config.dev_id, to);
+            assert(fw->read_stream(buf, sizeof(buf), len, to) == EKIT_OK && len == sizeof(buf));
+            memcpy(&first, buf + sizeof(uint16_t), sizeof(first));
+
+            wedge->failed = 0;
+            wedge->lose_error = EKIT_READ_FAILED;
+            wedge->lose_segments = 2;
+            wedge->lose_response_at = 1;
+            assert(fw->read_stream(buf, sizeof(buf), len, to) == EKIT_DATA_LOST && len == 0);
+            assert(wedge->failed == 1);
+            wedge->lose_segments = 1;
+
+            // The next read continues after the lost chunk
+            assert(fw->read_stream(buf, sizeof(buf), len, to) == EKIT_OK && len == sizeof(buf));
+            memcpy(&next, buf + sizeof(uint16_t), sizeof(next));
+            assert(next == (first + 8 * 16) % 4096);
+        }
+        adc.stop();
+        adc.reset();
+    }
+}
+
+void test_adc_acquisition() {
+    DECLARE_TEST(test_adc_acquisition)
+    const int fw_addr = 0x2A;
+    const size_t block_samples = 4;
+    std::shared_ptr<EKitSimFirmwareBus> sim(new EKitSimFirmwareBus(fw_addr, 64, false));
+    std::shared_ptr<EKitBus> sim_bus = sim;
+    std::shared_ptr<EKitBus> firmware(new EKitFirmware(sim_bus, fw_addr));
+    std::shared_ptr<EKitDrainScheduler> sched(new EKitDrainScheduler(0.5, 1000, 1000000, 1000));
+    EKitTimeout to(1000);
+
+    // Device samples 1000 times per second, buffer keeps 16 samples
+    sim->add_device(std::make_shared<EKitSimADCDev>(&sim_adc_config, 1000.0));
+    sim->set_bus_speed(400000);
+    assert(sim->open(to) == EKIT_OK);
+    std::shared_ptr<ADCDev> adc = std::make_shared<ADCDev>(firmware, &sim_adc_config);
+
+    auto run = [&sim, &sched](uint64_t duration_us) {
+        uint64_t end = sim->get_time() + duration_us;
+        uint64_t next = sched->poll(sim->get_time());
+        while (sim->get_time() < end) {
+            uint64_t now = sim->get_time();
+            sim->advance_time(std::min(next, end) > now ? std::min(next, end) - now : 1000);
+            next = sched->poll(sim->get_time());
+        }
+    };
+
+    auto check_block = [](const ADCBlock& b, uint64_t generator_index) {
+        assert(b.samples > 0 && b.samples <= b.stride);
+        for (size_t ch = 0; ch < sim_adc_config.input_count; ch++) {
+            const float* v = b.channel(ch);
+            for (size_t s = 0; s < b.samples; s++) {
+                double expected = 3.3 * (((generator_index + s) * 16 + ch * 256) % 4096) / 4095.0;
+                assert(fabs(v[s] - expected) < 1e-5);
+            }
+        }
+    };
+
+    REPORT_CASE
+    {
+        // Samples are contiguous across blocks, consumer keeps up with the device
+        ADCAcquisition acq(adc, sched, block_samples, 8);
+        uint64_t next_sample = 0;
+        acq.start();
+        assert(acq.is_started());
+        for (int i = 0; i < 50; i++) {
+            run(10000);
+            for (const ADCBlock* b = acq.front(); b != nullptr; b = acq.front()) {
+                assert(b->first_sample == next_sample && !b->gap);
+                check_block(*b, next_sample);
+                next_sample += b->samples;
+                acq.pop();
+            }
+        }
+        acq.stop();
+        assert(!acq.is_started());
+
+        ADCAcquisitionStats stats = acq.get_stats();
+        assert(next_sample > 450 && stats.samples == next_sample);
+        assert(stats.gaps == 0 && stats.too_fast == 0 && stats.ring_full == 0);
+    }
+
+    REPORT_CASE
+    {
+        // Device buffer overflows while scheduler is not polled: sampling is restarted and gap is reported
+        ADCAcquisition acq(adc, sched, block_samples, 16);
+        uint64_t next_sample = 0;
+        size_t gap_blocks = 0;
+        acq.start();
+        run(20000);
+        sim->advance_time(100000);
+        run(20000);
+        acq.stop();
+
+        for (const ADCBlock* b = acq.front(); b != nullptr; b = acq.front()) {
+            assert(b->first_sample == next_sample);
+            next_sample += b->samples;
+            gap_blocks += b->gap ? 1 : 0;
+            acq.pop();
+        }
+
+        ADCAcquisitionStats stats = acq.get_stats();
+        assert(stats.gaps == 1 && gap_blocks == 1 && stats.too_fast == 0);
+        assert(stats.samples == next_sample);
+    }
+
+    REPORT_CASE
+    {
+        // Full ring is not overwritten, samples remain in device buffer until it overflows
+        ADCAcquisition acq(adc, sched, block_samples, 2);
+        acq.start();
+        while (acq.get_stats().ring_full == 0) {
+            run(1000);
+        }
+        run(50000);
+        assert(acq.size() == 2 && acq.get_stats().gaps == 0);
+        const ADCBlock* b = acq.front();
+        uint64_t next_sample = b->samples;
+        assert(b->first_sample == 0 && !b->gap);
+        acq.pop();
+        b = acq.front();
+        next_sample += b->samples;
+        assert(b->first_sample == next_sample - b->samples && !b->gap);
+        acq.pop();
+
+        // Consumer releases blocks, buffered samples are received and gap is reported after them
+        bool gap = false;
+        while (!gap) {
+            run(1000);
+            for (b = acq.front(); b != nullptr; b = acq.front()) {
+                assert(b->first_sample == next_sample);
+                gap = b->gap;
+                next_sample += b->samples;
+                acq.pop();
+            }
+        }
+        acq.stop();
+        assert(next_sample > 16 && acq.get_stats().gaps >= 1);
+    }
+
+    REPORT_CASE
+    {
+        // Callback receives blocks instead of the ring
+        ADCAcquisition acq(adc, sched, block_samples, 2);
+        uint64_t next_sample = 0;
+        acq.set_callback([&next_sample](const ADCBlock& b) {
+            assert(b.first_sample == next_sample && !b.gap);
+            next_sample += b.samples;
+        });
+        acq.start();
+        run(200000);
+        acq.stop();
+        assert(acq.size() == 0 && next_sample > 180);
+        assert(acq.get_stats().samples == next_sample && acq.get_stats().ring_full == 0);
+    }
+
+    REPORT_CASE
+    {
+        // Callback stops acquisition, no more blocks are passed
+        ADCAcquisition acq(adc, sched, block_samples, 2);
+        size_t calls = 0;
+        acq.set_callback([&acq, &calls](const ADCBlock& b) {
+            calls++;
+            acq.stop();
+        });
+        acq.start();
+        run(200000);
+        assert(calls == 1 && !acq.is_started());
+    }
+
+    REPORT_CASE
+    {
+        // Raw callback archives measurements without conversion
+        const std::string path = "/tmp/hlek_acq_capture." + std::to_string(getpid());
+        ADCAcquisition acq(adc, sched, block_samples, 2);
+        uint64_t next_sample = 0;
+        {
+            EKitCaptureWriter cap(path, EKitCaptureWriter::make_header(*adc, 1000.0), 4096);
+            acq.set_raw_callback([&cap, &next_sample](const ADCRawSamples& raw, uint64_t first_sample, bool gap) {
+                assert(first_sample == next_sample && !gap && raw.channels == sim_adc_config.input_count);
+                cap.append_at(first_sample, raw.data, raw.samples);
+                next_sample += raw.samples;
+            });
+            acq.start();
+            run(100000);
+            acq.stop();
+        }
+        assert(acq.size() == 0 && next_sample > 90 && acq.get_stats().samples == next_sample);
+
+        EKitCaptureReader rd(path);
+        std::vector<uint16_t> raw(next_sample * sim_adc_config.input_count);
+        assert(rd.get_records() == next_sample && rd.read(0, next_sample, raw.data()) == next_sample);
+        // Generator of the simulated device is not reset by acquisition start
+        for (size_t s = 0; s < next_sample; s++) {
+            for (size_t ch = 0; ch < sim_adc_config.input_count; ch++) {
+                assert(raw[s * sim_adc_config.input_count + ch] == (raw[0] + s * 16 + ch * 256) % 4096);
+            }
+        }
+        unlink(path.c_str());
+    }
+
+    assert(sched->poll(sim->get_time()) == UINT64_MAX);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+void test_uart_bus();
+void test_trace_bus();
+void test_sim_firmware_bus();
+void test_drain_scheduler();
+void test_bus_broker();
+void test_bus_deadlines();
+void test_adc_acquisition();
@@ -0,0 +1,674 @@
+#include "i2c_bus_tests.hpp"
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+#include "testtool.hpp"
+#include "i2c_mock.hpp"
+#include "utools.h"
+#include "i2c_bus.h"
+
+// Firmware communication counters (i2c_bus.c)
+extern volatile uint32_t g_cmd_count;
+extern volatile uint32_t g_processed_cmd_count;
+extern volatile uint8_t g_returned_comm_status;
+
+#define I2C_TEST_LIN_DEV_ID     1
+#define I2C_TEST_CIRC_DEV_ID    2
+#define I2C_TEST_LIN_SIZE       64
+#define I2C_TEST_CIRC_SIZE      128
+#define I2C_TEST_FRAME_POOL     4096
+
+//------------------------------------------------------------------------------------
+// Master side of the I2C bus. Sets peripheral flags and calls firmware interrupt handlers
+// the way STM32 I2C peripheral does in slave mode without clock stretching.
+//------------------------------------------------------------------------------------
+static size_t i2c_isr_calls = 0;
+
+static void i2c_master_ev() {
+    i2c_isr_calls++;
+    i2c_mock_ev_isr();
+}
+
+static void i2c_master_write(const uint8_t* data, size_t len) {
+    g_i2c_mock.sr2 = I2C_SR2_BUSY;
+    g_i2c_mock.SR1 = I2C_SR1_ADDR;
+    i2c_master_ev();
+    assert(g_i2c_mock.SR1 == 0);
+
+    for (size_t i = 0; i < len; i++) {
+        g_i2c_mock.rx = data[i];
+        g_i2c_mock.SR1 |= I2C_SR1_RXNE;
+        i2c_master_ev();
+        assert(g_i2c_mock.SR1 == 0);
+    }
+
+    g_i2c_mock.SR1 |= I2C_SR1_STOPF;
+    i2c_master_ev();
+    assert(g_i2c_mock.SR1 == 0);
+    g_i2c_mock.sr2 = 0;
+}
+
+static void i2c_master_read(uint8_t* data, size_t len, bool addr_txe) {
+    assert(len > 0);
+    g_i2c_mock.sr2 = I2C_SR2_BUSY | I2C_SR2_TRA;
+    g_i2c_mock.SR1 = addr_txe ? (I2C_SR1_ADDR | I2C_SR1_TXE) : I2C_SR1_ADDR;
+    i2c_master_ev();
+
+    for (size_t i = 0; ; i++) {
+        assert(g_i2c_mock.shift_full); // Underrun
+        data[i] = g_i2c_mock.shift;
+        g_i2c_mock.shift_full = false;
+        if (i + 1 == len) break;
+
+        // Data register goes to shift register, firmware must preload the next byte
+        assert(g_i2c_mock.tx_full);
+        g_i2c_mock.shift = g_i2c_mock.tx;
+        g_i2c_mock.shift_full = true;
+        g_i2c_mock.tx_full = false;
+        g_i2c_mock.SR1 |= I2C_SR1_TXE;
+        i2c_master_ev();
+    }
+
+    // The last byte is not acknowledged, byte preloaded into data register is discarded
+    assert(g_i2c_mock.tx_full);
+    g_i2c_mock.SR1 |= I2C_SR1_AF;
+    i2c_isr_calls++;
+    i2c_mock_er_isr();
+    assert(g_i2c_mock.SR1 == 0);
+    g_i2c_mock.tx_full = false;
+    g_i2c_mock.sr2 = 0;
+}
+
+//------------------------------------------------------------------------------------
+// Virtual devices: linear buffer device stores data of the last command, circular buffer device
+// appends data of the commands to the circular buffer.
+//------------------------------------------------------------------------------------
+static uint8_t lin_buffer[I2C_TEST_LIN_SIZE];
+static uint8_t circ_data[I2C_TEST_CIRC_SIZE];
+static struct CircBuffer circ;
+static struct DeviceContext lin_ctx;
+static struct DeviceContext circ_ctx;
+
+static size_t  dev_command_count;
+static uint8_t dev_command_status;
+static size_t  dev_sync_count;
+static size_t  dev_read_done_count;
+static uint8_t dev_last_cmd_byte;
+static size_t  dev_last_length;
+static std::vector<uint8_t> dev_last_data;
+
+static uint8_t lin_on_command(uint8_t cmd_byte, uint8_t* data, uint16_t length) {
+    dev_command_count++;
+    dev_last_cmd_byte = cmd_byte;
+    dev_last_data.assign(data, data + length);
+    lin_ctx.bytes_available = std::min<uint16_t>(length, sizeof(lin_buffer));
+    memcpy(lin_buffer, data, lin_ctx.bytes_available);
+    return dev_command_status;
+}
+
+static uint8_t circ_on_command(uint8_t cmd_byte, uint8_t* data, uint16_t length) {
+    dev_command_count++;
+    dev_last_cmd_byte = cmd_byte;
+    dev_last_data.assign(data, data + length);
+    for (uint16_t i = 0; i < length; i++) {
+        circbuf_put_byte(&circ, data[i]);
+    }
+    return 0;
+}
+
+static uint8_t lin_on_read_done(uint8_t device_id, uint16_t length) {
+    assert(device_id == I2C_TEST_LIN_DEV_ID);
+    dev_read_done_count++;
+    dev_last_length = length;
+    return 0;
+}
+
+static uint8_t circ_on_read_done(uint8_t device_id, uint16_t length) {
+    assert(device_id == I2C_TEST_CIRC_DEV_ID);
+    dev_read_done_count++;
+    dev_last_length = length;
+    circbuf_stop_read(&circ, length);
+    circbuf_clear_ovf(&circ);
+    return 0;
+}
+
+static uint8_t dev_on_sync(uint8_t cmd_byte, uint16_t length) {
+    dev_sync_count++;
+    dev_last_cmd_byte = cmd_byte;
+    dev_last_length = length;
+    return 0;
+}
+
+static void i2c_firmware_init() {
+    memset(&g_i2c_mock, 0, sizeof(g_i2c_mock));
+    memset(&lin_ctx, 0, sizeof(lin_ctx));
+    memset(&circ_ctx, 0, sizeof(circ_ctx));
+    dev_command_count = dev_sync_count = dev_read_done_count = 0;
+    dev_command_status = 0;
+    g_returned_comm_status = 0;
+
+    i2c_bus_init();
+    circbuf_init(&circ, circ_data, sizeof(circ_data));
+
+    lin_ctx.device_id = I2C_TEST_LIN_DEV_ID;
+    lin_ctx.buffer = lin_buffer;
+    lin_ctx.on_command = lin_on_command;
+    lin_ctx.on_read_done = lin_on_read_done;
+    lin_ctx.on_sync = dev_on_sync;
+    comm_register_device(&lin_ctx);
+
+    circ_ctx.device_id = I2C_TEST_CIRC_DEV_ID;
+    circ_ctx.circ_buffer = &circ;
+    circ_ctx.on_command = circ_on_command;
+    circ_ctx.on_read_done = circ_on_read_done;
+    circ_ctx.on_sync = dev_on_sync;
+    comm_register_device(&circ_ctx);
+}
+
+// Main loop iteration
+static void i2c_firmware_main_loop() {
+    i2c_check_command();
+    assert(g_cmd_count == g_processed_cmd_count);
+}
+
+//------------------------------------------------------------------------------------
+// Randomized frames
+//------------------------------------------------------------------------------------
+enum I2CFrameKind {
+    I2C_FRAME_COMMAND,
+    I2C_FRAME_CRC16,
+    I2C_FRAME_BAD_CRC,
+    I2C_FRAME_BAD_CRC16,
+    I2C_FRAME_BAD_LENGTH,
+    I2C_FRAME_OVERRUN,
+    I2C_FRAME_SYNC,
+    I2C_FRAME_READ
+};
+
+struct I2CFrame {
+    I2CFrameKind kind;          // Frame kind
+    uint8_t dev_id;             // Virtual device id
+    bool addr_txe;              // Read starts with ADDR and TXE flags set
+    size_t length;              // Number of bytes to read (I2C_FRAME_READ only)
+    std::vector<uint8_t> data;  // Bytes to write
+};
+
+static void i2c_make_frame(std::mt19937& rng, I2CFrame& f) {
+    std::uniform_int_distribution<int> percent(0, 99);
+    int p = percent(rng);
+    f.kind = p < 45 ? I2C_FRAME_READ :
+             p < 70 ? I2C_FRAME_COMMAND :
+             p < 80 ? I2C_FRAME_CRC16 :
+             p < 83 ? I2C_FRAME_BAD_CRC :
+             p < 85 ? I2C_FRAME_BAD_CRC16 :
+             p < 90 ? I2C_FRAME_BAD_LENGTH :
+             p < 93 ? I2C_FRAME_OVERRUN : I2C_FRAME_SYNC;
+    f.dev_id = (rng() & 1) ? I2C_TEST_LIN_DEV_ID : I2C_TEST_CIRC_DEV_ID;
+    f.addr_txe = (rng() & 1) != 0;
+    f.data.clear();
+
+    if (f.kind == I2C_FRAME_READ) {
+        f.length = 1 + rng() % (sizeof(CommResponseHeader) + I2C_TEST_CIRC_SIZE + 8);
+        return;
+    }
+
+    uint8_t cmd_byte = f.dev_id | (uint8_t)(rng() & ~COMM_MAX_DEV_ADDR);
+    if (f.kind == I2C_FRAME_SYNC) {
+        f.data.resize(1 + rng() % (sizeof(CommCommandHeader) - 1));
+        f.data[0] = cmd_byte;
+        for (size_t i = 1; i < f.data.size(); i++) f.data[i] = (uint8_t)rng();
+        return;
+    }
+
+    bool crc16 = (f.kind == I2C_FRAME_CRC16 || f.kind == I2C_FRAME_BAD_CRC16);
+    size_t len = (percent(rng) < 80) ? rng() % 33 : rng() % (COMM_BUFFER_LENGTH + 1 - (crc16 ? COMM_CRC16_SIZE : 0));
+    if (f.kind == I2C_FRAME_OVERRUN) {
+        len = COMM_BUFFER_LENGTH + 1 + rng() % 8;
+    }
+
+    f.data.resize(sizeof(CommCommandHeader) + len);
+    CommCommandHeader* hdr = reinterpret_cast<CommCommandHeader*>(f.data.data());
+    hdr->command_byte = cmd_byte;
+    hdr->length = (uint16_t)len | (crc16 ? COMM_CRC16_FLAG : 0);
+    for (size_t i = sizeof(CommCommandHeader); i < f.data.size(); i++) f.data[i] = (uint8_t)rng();
+    if (f.kind == I2C_FRAME_BAD_LENGTH) {
+        hdr->length += 1 + rng() % 4;
+    }
+    hdr->control_crc = tools::calc_contol_sum(f.data.data(), f.data.size(), COMM_CRC_OFFSET);
+    if (f.kind == I2C_FRAME_BAD_CRC) {
+        hdr->control_crc ^= 1 + rng() % 255;
+    }
+
+    if (crc16) {
+        uint16_t crc = tools::crc16_update(COMM_CRC16_INIT_VALUE, f.data.data(), f.data.size());
+        f.data.push_back((uint8_t)(crc >> 8));
+        f.data.push_back((uint8_t)crc);
+        if (f.kind == I2C_FRAME_BAD_CRC16) {
+            size_t bit = rng() % (f.data.size() * 8);
+            f.data[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------
+// Reference model of the firmware state visible to software
+//------------------------------------------------------------------------------------
+struct I2CReference {
+    uint8_t crc = COMM_CRC_INIT_VALUE;  // Control sum of the last operation
+    uint16_t crc16 = COMM_CRC16_INIT_VALUE; // CRC-16 of the last operation
+    bool crc16_mode = false;            // CRC-16 mode is selected by the last accepted command
+    uint8_t dev_id = 0;                 // Device selected by the last write
+    std::vector<uint8_t> lin;           // Linear buffer device data
+    std::deque<uint8_t> circ;           // Circular buffer device data
+    bool circ_ovf = false;              // Circular buffer overflow
+};
+
+static void i2c_check_write(const I2CFrame& f, I2CReference& ref) {
+    size_t commands = dev_command_count;
+    size_t syncs = dev_sync_count;
+
+    i2c_master_write(f.data.data(), f.data.size());
+    i2c_firmware_main_loop();
+
+    // Firmware control sum skips control_crc byte and bytes which don't fit into receive buffer
+    ref.dev_id = f.data[0] & COMM_MAX_DEV_ADDR;
+    size_t crc_len = std::min<size_t>(f.data.size(), sizeof(CommCommandHeader) + COMM_BUFFER_LENGTH);
+    ref.crc = COMM_CRC_INIT_VALUE;
+    for (size_t i = 0; i < crc_len; i++) {
+        if (i != COMM_CRC_OFFSET) ref.crc ^= f.data[i];
+    }
+    ref.crc16 = tools::crc16_update(COMM_CRC16_INIT_VALUE, f.data.data(), crc_len);
+
+    if (f.kind == I2C_FRAME_SYNC) {
+        assert(dev_sync_count == syncs + 1 && dev_command_count == commands);
+        assert(dev_last_cmd_byte == f.data[0]);
+    } else if (f.kind == I2C_FRAME_COMMAND || f.kind == I2C_FRAME_CRC16) {
+        // CRC-16 is not passed to device, CRC-16 of the frame without it is reported
+        size_t data_len = f.data.size() - sizeof(CommCommandHeader);
+        ref.crc16_mode = (f.kind == I2C_FRAME_CRC16);
+        if (ref.crc16_mode) {
+            data_len -= COMM_CRC16_SIZE;
+            ref.crc16 = tools::crc16_update(COMM_CRC16_INIT_VALUE, f.data.data(), f.data.size() - COMM_CRC16_SIZE);
+        }
+
+        assert(dev_command_count == commands + 1 && dev_sync_count == syncs);
+        assert(dev_last_cmd_byte == f.data[0]);
+        assert(dev_last_data.size() == data_len);
+        assert(std::equal(dev_last_data.begin(), dev_last_data.end(), f.data.begin() + sizeof(CommCommandHeader)));
+
+        if (f.dev_id == I2C_TEST_LIN_DEV_ID) {
+            ref.lin.assign(dev_last_data.begin(), dev_last_data.begin() + std::min(dev_last_data.size(), sizeof(lin_buffer)));
+        } else {
+            for (uint8_t b : dev_last_data) {
+                if (ref.circ.size() < sizeof(circ_data)) {
+                    ref.circ.push_back(b);
+                } else {
+                    ref.circ_ovf = true;
+                }
+            }
+        }
+    } else {
+        // Rejected by firmware
+        assert(dev_command_count == commands && dev_sync_count == syncs);
+    }
+}
+
+static void i2c_check_read(const I2CFrame& f, I2CReference& ref) {
+    std::vector<uint8_t> buf(f.length);
+    size_t read_done = dev_read_done_count;
+
+    // Device is selected by the previous write
+    if (ref.dev_id != f.dev_id) {
+        uint8_t sync = f.dev_id;
+        i2c_master_write(&sync, sizeof(sync));
+        i2c_firmware_main_loop();
+        ref.crc = COMM_CRC_INIT_VALUE ^ sync;
+        ref.crc16 = tools::crc16_update(COMM_CRC16_INIT_VALUE, &sync, sizeof(sync));
+        ref.dev_id = f.dev_id;
+    }
+
+    bool circular = (f.dev_id == I2C_TEST_CIRC_DEV_ID);
+    size_t available = circular ? ref.circ.size() : ref.lin.size();
+    uint8_t status = f.dev_id | ((circular && ref.circ_ovf) ? COMM_STATUS_OVF : 0);
+
+    i2c_master_read(buf.data(), buf.size(), f.addr_txe);
+    i2c_firmware_main_loop();
+
+    CommResponseHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(&hdr, buf.data(), std::min(buf.size(), sizeof(hdr)));
+    if (ref.crc16_mode) {
+        assert(hdr.last_crc == (uint8_t)ref.crc16);
+        if (buf.size() > 1) assert(hdr.dummy == (uint8_t)(ref.crc16 >> 8));
+    } else {
+        assert(hdr.last_crc == ref.crc);
+        if (buf.size() > 1) assert(hdr.dummy == COMM_DUMMY_BYTE);
+    }
+    if (buf.size() > 2) assert(hdr.comm_status == status);
+    if (buf.size() >= sizeof(hdr)) assert(hdr.length == available);
+
+    size_t dev_bytes = 0;
+    for (size_t i = sizeof(hdr); i < buf.size(); i++) {
+        size_t pos = i - sizeof(hdr);
+        if (pos < available) {
+            assert(buf[i] == (circular ? ref.circ[pos] : ref.lin[pos]));
+            dev_bytes++;
+        } else {
+            assert(buf[i] == COMM_BAD_BYTE);
+        }
+    }
+
+    if (dev_bytes > 0) {
+        assert(dev_read_done_count == read_done + 1 && dev_last_length == dev_bytes);
+        if (circular) {
+            ref.circ.erase(ref.circ.begin(), ref.circ.begin() + dev_bytes);
+            ref.circ_ovf = false;
+        }
+    } else {
+        assert(dev_read_done_count == read_done);
+    }
+
+    ref.crc = COMM_CRC_INIT_VALUE;
+    for (uint8_t b : buf) ref.crc ^= b;
+    ref.crc16 = tools::crc16_update(COMM_CRC16_INIT_VALUE, buf.data(), buf.size());
+}
+
+//------------------------------------------------------------------------------------
+// Batch frames
+//------------------------------------------------------------------------------------
+static void i2c_batch_add(std::vector<uint8_t>& frame, uint8_t cmd_byte, const std::vector<uint8_t>& data) {
+    size_t pos = frame.size();
+    CommBatchRecord rec = {cmd_byte, 0, (uint16_t)data.size()};
+
+    if (pos == 0) {
+        frame.resize(sizeof(CommCommandHeader));
+        pos = frame.size();
+    }
+    frame.resize(pos + COMM_BATCH_RECORD_SIZE(data.size()));
+    memcpy(frame.data() + pos, &rec, sizeof(rec));
+    std::copy(data.begin(), data.end(), frame.begin() + pos + sizeof(rec));
+}
+
+static void i2c_batch_finish(std::vector<uint8_t>& frame, uint8_t dev_id) {
+    CommCommandHeader* hdr = reinterpret_cast<CommCommandHeader*>(frame.data());
+    hdr->command_byte = dev_id;
+    hdr->length = (uint16_t)(frame.size() - sizeof(CommCommandHeader)) | COMM_BATCH_FLAG;
+    hdr->control_crc = tools::calc_contol_sum(frame.data(), frame.size(), COMM_CRC_OFFSET);
+}
+
+static uint8_t i2c_read_comm_status() {
+    CommResponseHeader hdr;
+    i2c_master_read(reinterpret_cast<uint8_t*>(&hdr), sizeof(hdr), false);
+    i2c_firmware_main_loop();
+    return hdr.comm_status;
+}
+
+void test_i2c_bus_firmware() {
+    DECLARE_TEST(test_i2c_bus_firmware)
+
+    REPORT_CASE
+    {
+        // Explicit sequence: command, read of the data back, bad control sum
+        I2CReference ref;
+        I2CFrame f;
+        i2c_firmware_init();
+
+        f.kind = I2C_FRAME_COMMAND;
+        f.dev_id = I2C_TEST_LIN_DEV_ID;
+        f.data = {I2C_TEST_LIN_DEV_ID, 3, 0, 0, 0x11, 0x22, 0x33};
+        f.data[COMM_CRC_OFFSET] = tools::calc_contol_sum(f.data.data(), f.data.size(), COMM_CRC_OFFSET);
+        i2c_check_write(f, ref);
+        assert(lin_ctx.bytes_available == 3 && lin_buffer[2] == 0x33);
+
+        f.kind = I2C_FRAME_READ;
+        f.length = sizeof(CommResponseHeader) + 5;
+        f.addr_txe = false;
+        i2c_check_read(f, ref);
+        assert(dev_read_done_count == 1 && dev_last_length == 3);
+
+        f.kind = I2C_FRAME_BAD_CRC;
+        f.data[COMM_CRC_OFFSET] ^= 0xFF;
+        i2c_check_write(f, ref);
+        assert(dev_command_count == 1);
+    }
+
+    REPORT_CASE
+    {
+        // Batch frame: records are passed to devices in order, device of the header is selected
+        std::vector<uint8_t> frame;
+        i2c_firmware_init();
+
+        i2c_batch_add(frame, I2C_TEST_LIN_DEV_ID | COMM_CMDBYTE_DEV_SPECIFIC_4, {0x11, 0x22, 0x33});
+        i2c_batch_add(frame, I2C_TEST_CIRC_DEV_ID | COMM_CMDBYTE_DEV_SPECIFIC_5, {0x44, 0x55, 0x66, 0x77});
+        i2c_batch_add(frame, I2C_TEST_CIRC_DEV_ID, {});
+        i2c_batch_finish(frame, I2C_TEST_CIRC_DEV_ID | COMM_CMDBYTE_DEV_SPECIFIC_7);
+        i2c_master_write(frame.data(), frame.size());
+        i2c_firmware_main_loop();
+        assert(dev_command_count == 3 && dev_last_cmd_byte == I2C_TEST_CIRC_DEV_ID && dev_last_data.empty());
+        assert(lin_ctx.bytes_available == 3 && lin_buffer[0] == 0x11 && lin_buffer[2] == 0x33);
+        assert(circbuf_total_len(&circ) == 4);
+        assert(i2c_read_comm_status() == I2C_TEST_CIRC_DEV_ID);
+
+        // Batch is rejected as a whole if any record addresses missing device or exceeds data
+        frame.clear();
+        i2c_batch_add(frame, I2C_TEST_LIN_DEV_ID, {0x01});
+        i2c_batch_add(frame, 7, {0x02});
+        i2c_batch_finish(frame, I2C_TEST_LIN_DEV_ID);
+        i2c_master_write(frame.data(), frame.size());
+        i2c_firmware_main_loop();
+        assert(dev_command_count == 3 && lin_buffer[0] == 0x11);
+        assert(i2c_read_comm_status() == (I2C_TEST_LIN_DEV_ID | COMM_STATUS_FAIL));
+
+        frame.clear();
+        i2c_batch_add(frame, I2C_TEST_LIN_DEV_ID, {0x01});
+        i2c_batch_add(frame, I2C_TEST_CIRC_DEV_ID, {0x02});
+        frame[frame.size() - COMM_BATCH_RECORD_SIZE(1) + offsetof(CommBatchRecord, length)] = 5;
+        i2c_batch_finish(frame, I2C_TEST_LIN_DEV_ID);
+        i2c_master_write(frame.data(), frame.size());
+        i2c_firmware_main_loop();
+        assert(dev_command_count == 3);
+        assert(i2c_read_comm_status() == (I2C_TEST_LIN_DEV_ID | COMM_STATUS_FAIL));
+
+        // Reserved byte of the record must be zero
+        frame.clear();
+        i2c_batch_add(frame, I2C_TEST_LIN_DEV_ID, {0x01});
+        frame[sizeof(CommCommandHeader) + offsetof(CommBatchRecord, reserved)] = 1;
+        i2c_batch_finish(frame, I2C_TEST_LIN_DEV_ID);
+        i2c_master_write(frame.data(), frame.size());
+        i2c_firmware_main_loop();
+        assert(dev_command_count == 3);
+        assert(i2c_read_comm_status() == (I2C_TEST_LIN_DEV_ID | COMM_STATUS_FAIL));
+    }
+
+    REPORT_CASE
+    {
+        // Status returned by device is reported once, and only for this device
+        std::vector<uint8_t> cmd = {I2C_TEST_LIN_DEV_ID, 1, 0, 0, 0x11};
+        uint8_t sync = I2C_TEST_CIRC_DEV_ID;
+        i2c_firmware_init();
+        circ_ctx.on_sync = 0;
+        cmd[COMM_CRC_OFFSET] = tools::calc_contol_sum(cmd.data(), cmd.size(), COMM_CRC_OFFSET);
+
+        dev_command_status = COMM_STATUS_FAIL;
+        i2c_master_write(cmd.data(), cmd.size());
+        i2c_firmware_main_loop();
+        assert(i2c_read_comm_status() == (I2C_TEST_LIN_DEV_ID | COMM_STATUS_FAIL));
+        assert(i2c_read_comm_status() == I2C_TEST_LIN_DEV_ID);
+
+        // Device B is selected without command, failure of device A is not reported for it
+        i2c_master_write(cmd.data(), cmd.size());
+        i2c_firmware_main_loop();
+        i2c_master_write(&sync, sizeof(sync));
+        i2c_firmware_main_loop();
+        assert(dev_command_count == 2 && dev_sync_count == 0);
+        assert(i2c_read_comm_status() == I2C_TEST_CIRC_DEV_ID);
+    }
+
+    REPORT_CASE
+    {
+        // Streaming read: reads are committed on STOP, so they go back to back without main loop
+        uint8_t buf[sizeof(CommResponseHeader) + 4];
+        CommResponseHeader* hdr = reinterpret_cast<CommResponseHeader*>(buf);
+        uint8_t crc;
+        std::vector<uint8_t> cmd = {I2C_TEST_CIRC_DEV_ID, 10, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        i2c_firmware_init();
+        circ_ctx.i2c_stream_read = 1;
+
+        cmd[COMM_CRC_OFFSET] = tools::calc_contol_sum(cmd.data(), cmd.size(), COMM_CRC_OFFSET);
+        i2c_master_write(cmd.data(), cmd.size());
+        i2c_firmware_main_loop();
+
+        for (size_t i = 0; i < 3; i++) {
+            i2c_master_read(buf, sizeof(buf), false);
+            assert(hdr->comm_status == I2C_TEST_CIRC_DEV_ID && hdr->length == 10 - i*4);
+            assert(g_cmd_count == g_processed_cmd_count);
+            for (size_t j = 0; j < std::min<size_t>(4, hdr->length); j++) {
+                assert(buf[sizeof(CommResponseHeader) + j] == i*4 + j + 1);
+            }
+            crc = tools::calc_contol_sum(buf, sizeof(buf), -1);
+        }
+
+        assert(buf[sizeof(CommResponseHeader) + 2] == COMM_BAD_BYTE);
+        assert(dev_read_done_count == 0 && circbuf_len(&circ) == 0);
+
+        // The last chunk is verified by the next read
+        i2c_master_read(buf, sizeof(CommResponseHeader), false);
+        assert(hdr->last_crc == crc && hdr->length == 0);
+    }
+
+    REPORT_CASE
+    {
+        // Streaming read of blocks: live status is latched on read, partially read block is not committed
+        uint8_t buf[sizeof(CommResponseHeader) + 2 + 6];
+        CommResponseHeader* hdr = reinterpret_cast<CommResponseHeader*>(buf);
+        uint8_t* data = buf + sizeof(CommResponseHeader);
+        uint8_t status[2] = {0, 0};
+        volatile uint8_t live_status[2] = {0x5A, 0xA5};
+        i2c_firmware_init();
+        circbuf_init_status(&circ, status, sizeof(status));
+        circbuf_init_block_mode(&circ, 4);
+        circ_ctx.i2c_stream_read = 1;
+        circ_ctx.i2c_stream_status = live_status;
+
+        for (uint8_t b = 0; b < 3; b++) {
+            volatile uint8_t* block = static_cast<volatile uint8_t*>(circbuf_reserve_block(&circ));
+            for (uint8_t i = 0; i < 4; i++) block[i] = b*4 + i;
+            circbuf_commit_block(&circ);
+        }
+
+        i2c_master_read(buf, sizeof(buf), false);
+        assert(hdr->comm_status == I2C_TEST_CIRC_DEV_ID && hdr->length == 2 + 12);
+        assert(data[0] == 0x5A && data[1] == 0xA5 && data[2] == 0 && data[7] == 5);
+        assert(circbuf_len(&circ) == 8);
+
+        live_status[0] = 0;
+        i2c_master_read(buf, sizeof(buf), false);
+        assert(hdr->length == 2 + 8 && data[0] == 0 && data[2] == 4 && data[7] == 9);
+        assert(circbuf_len(&circ) == 4 && dev_read_done_count == 0);
+    }
+
+    REPORT_CASE
+    {
+        // CRC-16 frames: command is acknowledged by CRC-16, reads report CRC-16 until command without CRC-16
+        uint8_t buf[sizeof(CommResponseHeader) + 3];
+        CommResponseHeader* hdr = reinterpret_cast<CommResponseHeader*>(buf);
+        std::vector<uint8_t> cmd = {I2C_TEST_LIN_DEV_ID, 3, 0, 0, 0x11, 0x22, 0x33};
+        uint16_t crc;
+        i2c_firmware_init();
+
+        reinterpret_cast<CommCommandHeader*>(cmd.data())->length |= COMM_CRC16_FLAG;
+        crc = tools::crc16_update(COMM_CRC16_INIT_VALUE, cmd.data(), cmd.size());
+        cmd.push_back((uint8_t)(crc >> 8));
+        cmd.push_back((uint8_t)crc);
+        i2c_master_write(cmd.data(), cmd.size());
+        i2c_firmware_main_loop();
+        assert(dev_command_count == 1 && dev_last_data.size() == 3 && lin_ctx.bytes_available == 3);
+
+        i2c_master_read(buf, sizeof(buf), true);
+        i2c_firmware_main_loop();
+        assert((hdr->last_crc | (hdr->dummy << 8)) == crc && hdr->comm_status == I2C_TEST_LIN_DEV_ID);
+        assert(buf[sizeof(CommResponseHeader)] == 0x11 && buf[sizeof(CommResponseHeader) + 2] == 0x33);
+
+        // Read is verified by the next read
+        crc = tools::crc16_update(COMM_CRC16_INIT_VALUE, buf, sizeof(buf));
+        i2c_master_read(buf, sizeof(CommResponseHeader), false);
+        i2c_firmware_main_loop();
+        assert((hdr->last_crc | (hdr->dummy << 8)) == crc);
+
+        // Corrupted frame is rejected, so it is not acknowledged
+        cmd[5] ^= 0x04;
+        i2c_master_write(cmd.data(), cmd.size());
+        i2c_firmware_main_loop();
+        i2c_master_read(buf, sizeof(CommResponseHeader), false);
+        assert(dev_command_count == 1);
+        assert((hdr->last_crc | (hdr->dummy << 8)) != tools::crc16_update(COMM_CRC16_INIT_VALUE, cmd.data(), 7));
+
+        // Command without CRC-16 switches firmware back to control sum
+        cmd = {I2C_TEST_LIN_DEV_ID, 0, 0, 0};
+        cmd[COMM_CRC_OFFSET] = tools::calc_contol_sum(cmd.data(), cmd.size(), COMM_CRC_OFFSET);
+        i2c_master_write(cmd.data(), cmd.size());
+        i2c_firmware_main_loop();
+        i2c_master_read(buf, sizeof(CommResponseHeader), false);
+        assert(hdr->last_crc == cmd[COMM_CRC_OFFSET] && hdr->dummy == COMM_DUMMY_BYTE);
+    }
+
+    REPORT_CASE
+    {
+        // Randomized frames
+        std::mt19937 rng(12345);
+        I2CReference ref;
+        I2CFrame f;
+        i2c_firmware_init();
+
+        for (size_t i = 0; i < 200000; i++) {
+            i2c_make_frame(rng, f);
+            if (f.kind == I2C_FRAME_READ) {
+                i2c_check_read(f, ref);
+            } else {
+                i2c_check_write(f, ref);
+            }
+        }
+    }
+}
+
+void benchmark_i2c_bus_firmware() {
+    DECLARE_TEST(benchmark_i2c_bus_firmware)
+
+    REPORT_CASE
+    {
+        const size_t frame_count = 1000000;
+        std::mt19937 rng(54321);
+        std::vector<I2CFrame> pool(I2C_TEST_FRAME_POOL);
+        std::vector<uint8_t> buf(sizeof(CommResponseHeader) + I2C_TEST_CIRC_SIZE + 8);
+        size_t bytes = 0;
+
+        for (auto& f : pool) {
+            i2c_make_frame(rng, f);
+        }
+        i2c_firmware_init();
+        i2c_isr_calls = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < frame_count; i++) {
+            const I2CFrame& f = pool[i % pool.size()];
+            if (f.kind == I2C_FRAME_READ) {
+                i2c_master_write(&f.dev_id, sizeof(f.dev_id));
+                i2c_firmware_main_loop();
+                i2c_master_read(buf.data(), f.length, f.addr_txe);
+                bytes += f.length + 1;
+            } else {
+                i2c_master_write(f.data.data(), f.data.size());
+                bytes += f.data.size();
+            }
+            i2c_firmware_main_loop();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        tools::debug_print("%zu frames, %zu bytes, %zu ISR calls: %.1f ns/ISR, %.1f ns/byte, %.0f frames/s, %.2f MB/s",
+                           frame_count, bytes, i2c_isr_calls, ns / i2c_isr_calls, ns / bytes,
+                           frame_count * 1e9 / ns, bytes * 1e3 / ns);
+    }
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+void test_i2c_bus_firmware();
+
+void benchmark_i2c_bus_firmware();
@@ -0,0 +1,146 @@
+/**
+ *   Copyright 2021 Oleh Sharuda <oleh.sharuda@gmail.com>
+ *
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*!  \file
+ *   \brief Mock of the I2C peripheral registers used to build firmware i2c_bus.c for host.
+ *   \author Oleh Sharuda
+ *
+ *   Firmware source is compiled as C++ (see i2c_bus_host.cpp), so registers with side effects on access are modelled
+ *   by proxy classes:
+ *   - SR2 read clears ADDR flag (SR1 then SR2 read sequence). In transmitter mode TXE is set if DR is empty.
+ *   - DR read clears RXNE flag.
+ *   - DR write puts byte into shift register if it is empty (TXE remains set), otherwise into DR (TXE is cleared).
+ *   - CR1 write clears STOPF flag (SR1 read then CR1 write sequence).
+ *   SR1 is a plain register, master side (see i2c_bus_tests.cpp) sets flags and calls interrupt handlers.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+/// Firmware macros use C11 static assertions
+#define _Static_assert static_assert
+
+/// Firmware configuration for host build
+#define ENABLE_SYSTICK                0
+#define COMM_BUFFER_LENGTH            256
+#define I2C_BUS_PERIPH                (&g_i2c_mock)
+#define I2C_BUS_EV_ISR                i2c_mock_ev_isr
+#define I2C_BUS_ER_ISR                i2c_mock_er_isr
+
+/// I2C_SR1 register bits (as defined by CMSIS)
+#define I2C_SR1_SB                    ((uint16_t)0x0001)
+#define I2C_SR1_ADDR                  ((uint16_t)0x0002)
+#define I2C_SR1_BTF                   ((uint16_t)0x0004)
+#define I2C_SR1_ADD10                 ((uint16_t)0x0008)
+#define I2C_SR1_STOPF                 ((uint16_t)0x0010)
+#define I2C_SR1_RXNE                  ((uint16_t)0x0040)
+#define I2C_SR1_TXE                   ((uint16_t)0x0080)
+#define I2C_SR1_BERR                  ((uint16_t)0x0100)
+#define I2C_SR1_ARLO                  ((uint16_t)0x0200)
+#define I2C_SR1_AF                    ((uint16_t)0x0400)
+#define I2C_SR1_OVR                   ((uint16_t)0x0800)
+#define I2C_SR1_PECERR                ((uint16_t)0x1000)
+#define I2C_SR1_TIMEOUT               ((uint16_t)0x4000)
+#define I2C_SR1_SMBALERT              ((uint16_t)0x8000)
+
+/// I2C_SR2 register bits (as defined by CMSIS)
+#define I2C_SR2_MSL                   ((uint16_t)0x0001)
+#define I2C_SR2_BUSY                  ((uint16_t)0x0002)
+#define I2C_SR2_TRA                   ((uint16_t)0x0004)
+
+/// \class I2CMockSR2
+/// \brief SR2 register proxy.
+class I2CMockSR2 {
+public:
+    inline operator uint16_t() const;
+};
+
+/// \class I2CMockDR
+/// \brief DR register proxy.
+class I2CMockDR {
+public:
+    inline operator uint16_t() const;
+    inline I2CMockDR& operator=(uint16_t v);
+};
+
+/// \class I2CMockCR1
+/// \brief CR1 register proxy.
+class I2CMockCR1 {
+public:
+    inline I2CMockCR1& operator|=(uint16_t v);
+};
+
+/// \struct I2CMockPeriph
+/// \brief Mock of the I2C peripheral. Register members are named as CMSIS I2C_TypeDef members.
+struct I2CMockPeriph {
+    volatile uint16_t SR1;  ///< SR1 register.
+    I2CMockSR2 SR2;         ///< SR2 register.
+    I2CMockDR  DR;          ///< DR register.
+    I2CMockCR1 CR1;         ///< CR1 register.
+
+    uint16_t sr2;           ///< SR2 flags.
+    uint8_t  rx;            ///< Byte received from master.
+    uint8_t  shift;         ///< Shift register (transmitter).
+    uint8_t  tx;            ///< Data register (transmitter).
+    bool     shift_full;    ///< true if shift register is loaded.
+    bool     tx_full;       ///< true if data register is loaded.
+};
+
+/// \brief I2C peripheral mock used by firmware code.
+extern I2CMockPeriph g_i2c_mock;
+
+/// \brief Firmware I2C event interrupt handler.
+void i2c_mock_ev_isr(void);
+
+/// \brief Firmware I2C error interrupt handler.
+void i2c_mock_er_isr(void);
+
+I2CMockSR2::operator uint16_t() const {
+    if ((g_i2c_mock.SR1 & I2C_SR1_ADDR) != 0) {
+        g_i2c_mock.SR1 &= ~I2C_SR1_ADDR;
+        if ((g_i2c_mock.sr2 & I2C_SR2_TRA) != 0 && !g_i2c_mock.tx_full) {
+            g_i2c_mock.SR1 |= I2C_SR1_TXE;
+        }
+    }
+    return g_i2c_mock.sr2;
+}
+
+I2CMockDR::operator uint16_t() const {
+    g_i2c_mock.SR1 &= ~I2C_SR1_RXNE;
+    return g_i2c_mock.rx;
+}
+
+I2CMockDR& I2CMockDR::operator=(uint16_t v) {
+    if (!g_i2c_mock.shift_full) {
+        g_i2c_mock.shift = (uint8_t)v;
+        g_i2c_mock.shift_full = true;
+    } else {
+        assert(!g_i2c_mock.tx_full); // Data register is overwritten
+        g_i2c_mock.tx = (uint8_t)v;
+        g_i2c_mock.tx_full = true;
+        g_i2c_mock.SR1 &= ~I2C_SR1_TXE;
+    }
+    return *this;
+}
+
+I2CMockCR1& I2CMockCR1::operator|=(uint16_t v) {
+    (void)v;
+    g_i2c_mock.SR1 &= ~I2C_SR1_STOPF;
+    return *this;
+}
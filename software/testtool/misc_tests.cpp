@@ -1,6 +1,19 @@
 #include "testtool.hpp"
 #include "misc_tests.hpp"
 #include "tools.hpp"
+#include "ekit_poll.hpp"
+#include "ekit_metrics.hpp"
+#include "adc_dsp.hpp"
+#include "ekit_capture.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include "i2c_proto.h"
 
 void test_append_vector() {
     DECLARE_TEST(test_append_vector)
@@ -73,4 +86,643 @@ void test_reverse_bits() {
     }
 
 
-}
\ No newline at end of file
+}
+
+void test_poll_strategy() {
+    DECLARE_TEST(test_poll_strategy)
+
+    REPORT_CASE
+    EKitBackoffPoll backoff(10, 100);
+    assert(backoff.delay_us(1) == 10);
+    assert(backoff.delay_us(2) == 20);
+    assert(backoff.delay_us(3) == 40);
+    assert(backoff.delay_us(4) == 80);
+    assert(backoff.delay_us(5) == 100);
+    assert(backoff.delay_us(1000) == 100);
+
+    REPORT_CASE
+    EKitSpinPoll spin;
+    spin.end(1, 3, 30);
+    spin.end(1, 5, 10);
+    EKitPollStats stats = spin.get_stats(1);
+    assert(stats.commands == 2);
+    assert(stats.polls == 8);
+    assert(stats.max_polls == 5);
+    assert(stats.total_us == 40);
+    assert(stats.max_us == 30);
+    assert(spin.get_stats(0).commands == 0);
+    spin.reset_stats();
+    assert(spin.get_stats(1).commands == 0);
+
+    REPORT_CASE
+    EKitPredictedPoll predicted(10, 100);
+    assert(predicted.predicted_us(2) == 0);
+    predicted.end(2, 1, 800);
+    assert(predicted.predicted_us(2) == 600);
+    predicted.end(2, 1, 0);
+    assert(predicted.predicted_us(2) == 525);
+
+    REPORT_CASE
+    // Delays are limited by remaining time of the timeout, predicted delay is limited by maximum delay
+    {
+        EKitBackoffPoll slow(2000000, 2000000);
+        EKitPredictedPoll slow_predicted(10, 1000);
+        tools::StopWatch<std::chrono::milliseconds> sw(0);
+        slow.wait(1, 1, false, 5);
+        slow_predicted.begin(1, 2000000, 0);
+        assert(sw.measure() < 500);
+    }
+}
+
+void test_metrics() {
+    DECLARE_TEST(test_metrics)
+
+    REPORT_CASE
+    assert(EKitBusMetrics::bucket(0) == 0);
+    assert(EKitBusMetrics::bucket(1) == 0);
+    assert(EKitBusMetrics::bucket(2) == 1);
+    assert(EKitBusMetrics::bucket(1000) == 9);
+    assert(EKitBusMetrics::bucket(UINT64_MAX) == EKitBusMetrics::histogram_buckets - 1);
+
+    REPORT_CASE
+    EKitMetricsRegistry registry;
+    std::shared_ptr<EKitBusMetrics> i2c = registry.add_bus("i2c");
+    std::shared_ptr<EKitBusMetrics> fw = registry.add_bus("fw");
+    std::vector<EKitMetricsSnapshot> snap;
+
+    i2c->add_lock(0x5A, 3);
+    i2c->add_transaction(0x5A, 10, 4, EKIT_OK, 100);
+    i2c->add_transaction(0x5A, 10, 4, EKIT_WRITE_FAILED, 50);
+    fw->add_transaction(7, 0, 16, EKIT_OK, 1000);
+    fw->add_retry(7, EKIT_WRITE_FAILED);
+    fw->add_retry(7, EKIT_READ_FAILED);
+    fw->add_retry(7, EKIT_READ_FAILED);
+    fw->add_busy_polls(7, 5);
+
+    registry.snapshot(snap);
+    assert(snap.size() == 2);
+    assert(snap[0].bus == "i2c" && snap[0].addr == 0x5A);
+    assert(snap[0].bytes_out == 10 && snap[0].bytes_in == 4);
+    assert(snap[0].transactions == 2 && snap[0].errors == 1);
+    assert(snap[0].locks == 1 && snap[0].lock_wait_us == 3 && snap[0].lock_wait_hist[1] == 1);
+    assert(snap[0].transaction_us == 150);
+    assert(snap[0].transaction_hist[6] == 1 && snap[0].transaction_hist[5] == 1);
+    assert(snap[1].bus == "fw" && snap[1].addr == 7);
+    assert(snap[1].bytes_in == 16 && snap[1].write_retries == 1 && snap[1].read_retries == 2);
+    assert(snap[1].busy_polls == 5);
+    assert(EKitMetricsRegistry::format(snap).find("fw[7]: out=0 in=16") != std::string::npos);
+
+    registry.reset();
+    registry.snapshot(snap);
+    assert(snap.empty());
+
+    REPORT_CASE
+    std::atomic<int> dumps(0);
+    fw->add_transaction(1, 1, 1, EKIT_OK, 1);
+    registry.start_dump([&dumps](const std::vector<EKitMetricsSnapshot>& s) {
+        assert(s.size() == 1);
+        dumps++;
+    }, 5);
+    while (dumps < 2) {
+        tools::sleep_ms(1);
+    }
+    registry.stop_dump();
+}
+
+// Byte by byte control sum, as it was implemented before word at a time version
+static uint8_t control_sum_bytewise(const uint8_t* buffer, size_t length, size_t exclude_byte) {
+    uint8_t crc = COMM_CRC_INIT_VALUE;
+    for (size_t i = 0; i<length; i++) {
+        if (i!=exclude_byte) {
+            crc ^= buffer[i];
+        }
+    }
+    return crc;
+}
+
+void test_control_sum() {
+    DECLARE_TEST(test_control_sum)
+    std::mt19937 rng(12345);
+    std::vector<uint8_t> src(300);
+    std::vector<uint8_t> dst(300);
+    for (auto& b : src) b = static_cast<uint8_t>(rng());
+
+    REPORT_CASE
+    // All the alignments and tails
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t len = 0; len < 200; len++) {
+            const uint8_t* p = src.data() + offset;
+            assert(tools::calc_contol_sum(p, len, COMM_CRC_OFFSET) == control_sum_bytewise(p, len, COMM_CRC_OFFSET));
+            assert(tools::calc_contol_sum(p, len, -1) == control_sum_bytewise(p, len, -1));
+            assert((tools::xor_reduce(p, len) ^ COMM_CRC_INIT_VALUE) == control_sum_bytewise(p, len, -1));
+        }
+    }
+
+    REPORT_CASE
+    // Copy with control sum, destination is not aligned
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t len = 0; len < 200; len++) {
+            std::fill(dst.begin(), dst.end(), 0);
+            uint8_t crc = tools::copy_xor_reduce(dst.data() + 4, src.data() + offset, len);
+            assert(crc == tools::xor_reduce(src.data() + offset, len));
+            assert(memcmp(dst.data() + 4, src.data() + offset, len) == 0);
+            assert(dst[3] == 0 && dst[4 + len] == 0);
+        }
+    }
+
+    REPORT_CASE
+    // Accumulator gives the same value as a single pass over assembled frame
+    tools::ControlSum crc;
+    std::fill(dst.begin(), dst.end(), 0);
+    crc.update(src.data(), COMM_CRC_OFFSET);
+    crc.copy(dst.data() + 4, src.data() + 17, 33);
+    crc.copy(dst.data() + 4 + 33, src.data() + 100, 150);
+    memcpy(dst.data(), src.data(), COMM_CRC_OFFSET);
+    assert(crc.value() == control_sum_bytewise(dst.data(), 4 + 33 + 150, COMM_CRC_OFFSET));
+    crc.reset();
+    assert(crc.value() == COMM_CRC_INIT_VALUE);
+}
+
+void benchmark_control_sum() {
+    DECLARE_TEST(benchmark_control_sum)
+
+    REPORT_CASE
+    {
+        std::mt19937 rng(54321);
+        std::vector<uint8_t> src(65536 + sizeof(CommCommandHeader));
+        std::vector<uint8_t> frame(src.size());
+        for (auto& b : src) b = static_cast<uint8_t>(rng());
+
+        for (size_t len = 16; len <= 65536; len *= 4) {
+            const size_t total = 64 * 1024 * 1024;
+            const size_t iterations = total / len;
+            volatile uint8_t sink = 0;
+            const size_t frame_len = len + sizeof(CommCommandHeader);
+
+            // Frame is assembled first, then control sum is calculated
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                memcpy(frame.data() + sizeof(CommCommandHeader), src.data(), len);
+                sink = sink ^ control_sum_bytewise(frame.data(), frame_len, COMM_CRC_OFFSET);
+            }
+            double bytewise_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                memcpy(frame.data() + sizeof(CommCommandHeader), src.data(), len);
+                sink = sink ^ tools::calc_contol_sum(frame.data(), frame_len, COMM_CRC_OFFSET);
+            }
+            double word_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            // Control sum is calculated while data is copied into the frame
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                tools::ControlSum crc;
+                crc.update(frame.data(), COMM_CRC_OFFSET);
+                crc.copy(frame.data() + sizeof(CommCommandHeader), src.data(), len);
+                sink = sink ^ crc.value();
+            }
+            double incremental_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            // CRC-16 framing: frame is assembled first, then CRC-16 is calculated
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                memcpy(frame.data() + sizeof(CommCommandHeader), src.data(), len);
+                sink = sink ^ static_cast<uint8_t>(tools::crc16_update(COMM_CRC16_INIT_VALUE, frame.data(), frame_len));
+            }
+            double crc16_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            tools::debug_print("%6zu bytes: bytewise %.3f ns/byte, word %.3f ns/byte, incremental %.3f ns/byte, "
+                               "crc16 %.3f ns/byte",
+                               len, bytewise_ns / total, word_ns / total, incremental_ns / total, crc16_ns / total);
+        }
+    }
+}
+
+static uint16_t crc16_bitwise(const uint8_t* buffer, size_t length) {
+    uint16_t crc = COMM_CRC16_INIT_VALUE;
+    for (size_t i = 0; i<length; i++) {
+        crc ^= static_cast<uint16_t>(buffer[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ COMM_CRC16_POLY : (crc << 1));
+        }
+    }
+    return crc;
+}
+
+void test_crc16() {
+    DECLARE_TEST(test_crc16)
+    std::mt19937 rng(12345);
+    std::vector<uint8_t> src(300);
+    for (auto& b : src) b = static_cast<uint8_t>(rng());
+
+    REPORT_CASE
+    // CRC-16/CCITT-FALSE check value
+    {
+        const char check[] = "123456789";
+        assert(tools::crc16_update(COMM_CRC16_INIT_VALUE, check, 9) == 0x29B1);
+        assert(crc16_bitwise(reinterpret_cast<const uint8_t*>(check), 9) == 0x29B1);
+    }
+
+    REPORT_CASE
+    // Slicing-by-8 for all the alignments and tails
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t len = 0; len < 200; len++) {
+            const uint8_t* p = src.data() + offset;
+            assert(tools::crc16_update(COMM_CRC16_INIT_VALUE, p, len) == crc16_bitwise(p, len));
+        }
+    }
+
+    REPORT_CASE
+    // Accumulator gives the same value as a single pass, frame followed by its CRC-16 has zero CRC-16
+    {
+        tools::CRC16 crc;
+        crc.update(src.data(), 3);
+        crc.update(src.data() + 3, 101);
+        crc.update(src.data() + 104, 150);
+        uint16_t v = crc.value();
+        assert(v == crc16_bitwise(src.data(), 254));
+
+        src[254] = static_cast<uint8_t>(v >> 8);
+        src[255] = static_cast<uint8_t>(v);
+        assert(tools::crc16_update(COMM_CRC16_INIT_VALUE, src.data(), 256) == 0);
+
+        // Any single bit error is detected
+        for (size_t bit = 0; bit < 256 * 8; bit++) {
+            src[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+            assert(tools::crc16_update(COMM_CRC16_INIT_VALUE, src.data(), 256) != 0);
+            src[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+        }
+
+        crc.reset();
+        assert(crc.value() == COMM_CRC16_INIT_VALUE);
+    }
+}
+
+void test_scale_u16() {
+    DECLARE_TEST(test_scale_u16)
+    std::mt19937 rng(777);
+    std::vector<uint16_t> src(100);
+    std::vector<float> fdst(110);
+    std::vector<double> ddst(110);
+    for (auto& v : src) v = static_cast<uint16_t>(rng());
+    src[0] = 0;
+    src[1] = UINT16_MAX;
+
+    REPORT_CASE
+    // Vector and scalar parts give the same values for all the alignments and tails
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t len = 0; len < 90; len++) {
+            const uint16_t* p = src.data() + offset;
+            std::fill(fdst.begin(), fdst.end(), -1.0f);
+            std::fill(ddst.begin(), ddst.end(), -1.0);
+            tools::scale_u16(p, len, 3.3f / 4095.0f, -1.65f, fdst.data() + offset);
+            tools::scale_u16(p, len, 3.3 / 4095.0, -1.65, ddst.data() + offset);
+            for (size_t i = 0; i < fdst.size(); i++) {
+                bool inside = i >= offset && i < offset + len;
+                float fexpected = inside ? static_cast<float>(p[i - offset]) * (3.3f / 4095.0f) + -1.65f : -1.0f;
+                double dexpected = inside ? static_cast<double>(p[i - offset]) * (3.3 / 4095.0) + -1.65 : -1.0;
+                assert(fabs(fdst[i] - fexpected) <= 1e-6f * fabs(fexpected) + 1e-6f);
+                assert(fabs(ddst[i] - dexpected) <= 1e-15 * fabs(dexpected) + 1e-15);
+            }
+        }
+    }
+}
+
+// Splits signal of the channels into blocks of the specified sizes, processes them and collects output channels
+static std::vector<std::vector<float>> dsp_run(DSPPipeline& dsp,
+                                               const std::vector<std::vector<float>>& signal,
+                                               const std::vector<size_t>& sizes,
+                                               size_t gap_block = SIZE_MAX) {
+    size_t stride = *std::max_element(sizes.begin(), sizes.end());
+    ADCBlock in{0, 0, stride, false, std::vector<float>(signal.size() * stride)};
+    std::vector<std::vector<float>> res(dsp.get_output_channels());
+    uint64_t next_out = 0;
+    size_t pos = 0;
+
+    for (size_t b = 0; b < sizes.size(); b++) {
+        in.samples = sizes[b];
+        in.gap = (b == gap_block);
+        for (size_t ch = 0; ch < signal.size(); ch++) {
+            std::copy(signal[ch].begin() + pos, signal[ch].begin() + pos + in.samples, in.values.begin() + ch * stride);
+        }
+        in.first_sample = pos;
+        pos += in.samples;
+
+        const ADCBlock& out = dsp.process(in);
+        assert(out.first_sample == next_out);
+        next_out += out.samples;
+        for (size_t ch = 0; ch < res.size(); ch++) {
+            res[ch].insert(res[ch].end(), out.channel(ch), out.channel(ch) + out.samples);
+        }
+    }
+
+    return res;
+}
+
+void test_dsp_pipeline() {
+    DECLARE_TEST(test_dsp_pipeline)
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    const size_t len = 200;
+    const std::vector<size_t> sizes = {7, 1, 33, 16, 5, 64, 20, 29, 25};
+    std::vector<std::vector<float>> signal(2, std::vector<float>(len));
+    for (auto& ch : signal) {
+        for (auto& v : ch) v = dist(rng);
+    }
+
+    REPORT_CASE
+    // Decimator averages groups across block boundaries
+    {
+        DSPPipeline dsp(2, 64);
+        dsp.add(std::make_shared<DSPDecimator>(6));
+        auto res = dsp_run(dsp, signal, sizes);
+        assert(res.size() == 2 && res[0].size() == len / 6);
+        for (size_t ch = 0; ch < 2; ch++) {
+            for (size_t i = 0; i < res[ch].size(); i++) {
+                double expected = 0.0;
+                for (size_t k = 0; k < 6; k++) expected += signal[ch][i * 6 + k];
+                assert(fabs(res[ch][i] - expected / 6.0) < 1e-5);
+            }
+        }
+    }
+
+    REPORT_CASE
+    // FIR filter keeps history between blocks
+    {
+        const std::vector<float> coeffs = {0.5f, 0.25f, -0.125f, 0.0625f, 0.3f};
+        DSPPipeline dsp(2, 64);
+        dsp.add(std::make_shared<DSPFIRFilter>(coeffs));
+        auto res = dsp_run(dsp, signal, sizes);
+        for (size_t ch = 0; ch < 2; ch++) {
+            assert(res[ch].size() == len);
+            for (size_t i = 0; i < len; i++) {
+                double expected = 0.0;
+                for (size_t k = 0; k < coeffs.size() && k <= i; k++) expected += coeffs[k] * signal[ch][i - k];
+                assert(fabs(res[ch][i] - expected) < 1e-5);
+            }
+        }
+    }
+
+    REPORT_CASE
+    // Biquad: block split does not change output, low pass passes DC and suppresses high frequency
+    {
+        DSPPipeline dsp1(2, 64);
+        DSPPipeline dsp2(2, len);
+        dsp1.add(DSPBiquad::lowpass(1000.0, 50.0));
+        dsp2.add(DSPBiquad::lowpass(1000.0, 50.0));
+        auto res1 = dsp_run(dsp1, signal, sizes);
+        auto res2 = dsp_run(dsp2, signal, {len});
+        assert(res1 == res2);
+
+        std::vector<std::vector<float>> tones(2, std::vector<float>(len));
+        for (size_t i = 0; i < len; i++) {
+            tones[0][i] = 1.0f;
+            tones[1][i] = static_cast<float>(sin(2.0 * M_PI * 400.0 * i / 1000.0));
+        }
+        DSPPipeline lp(2, len);
+        DSPPipeline hp(2, len);
+        lp.add(DSPBiquad::lowpass(1000.0, 50.0));
+        hp.add(DSPBiquad::highpass(1000.0, 50.0));
+        auto lres = dsp_run(lp, tones, {len});
+        auto hres = dsp_run(hp, tones, {len});
+        for (size_t i = 150; i < len; i++) {
+            assert(fabs(lres[0][i] - 1.0f) < 1e-3 && fabs(lres[1][i]) < 0.03);
+            assert(fabs(hres[0][i]) < 1e-3);
+        }
+    }
+
+    REPORT_CASE
+    // Moving average and RMS
+    {
+        DSPPipeline dsp(2, 64);
+        dsp.add(std::make_shared<DSPMovingAverage>(10));
+        auto avg = dsp_run(dsp, signal, sizes);
+        DSPPipeline dsp_rms(2, 64);
+        dsp_rms.add(std::make_shared<DSPMovingAverage>(10, true));
+        auto rms = dsp_run(dsp_rms, signal, sizes);
+        for (size_t ch = 0; ch < 2; ch++) {
+            for (size_t i = 0; i < len; i++) {
+                double s = 0.0, sq = 0.0;
+                size_t n = std::min<size_t>(i + 1, 10);
+                for (size_t k = 0; k < n; k++) {
+                    s += signal[ch][i - k];
+                    sq += signal[ch][i - k] * signal[ch][i - k];
+                }
+                assert(fabs(avg[ch][i] - s / n) < 1e-5);
+                assert(fabs(rms[ch][i] - sqrt(sq / n)) < 1e-5);
+            }
+        }
+    }
+
+    REPORT_CASE
+    // Window statistics: three output channels per input channel
+    {
+        DSPPipeline dsp(2, 64);
+        dsp.add(std::make_shared<DSPWindowStats>(13));
+        auto res = dsp_run(dsp, signal, sizes);
+        assert(res.size() == 6 && res[0].size() == len / 13);
+        for (size_t ch = 0; ch < 2; ch++) {
+            for (size_t i = 0; i < res[0].size(); i++) {
+                auto first = signal[ch].begin() + i * 13;
+                double mean = 0.0;
+                for (auto it = first; it != first + 13; ++it) mean += *it;
+                assert(res[ch * 3][i] == *std::min_element(first, first + 13));
+                assert(res[ch * 3 + 1][i] == *std::max_element(first, first + 13));
+                assert(fabs(res[ch * 3 + 2][i] - mean / 13.0) < 1e-5);
+            }
+        }
+    }
+
+    REPORT_CASE
+    // Trigger with hysteresis after decimation, reported sample index is decimated one
+    {
+        std::vector<std::vector<float>> saw(1, std::vector<float>(len));
+        std::vector<uint64_t> events;
+        for (size_t i = 0; i < len; i++) {
+            saw[0][i] = static_cast<float>(i % 50) / 50.0f;
+        }
+        DSPPipeline dsp(1, 64);
+        auto trigger = std::make_shared<DSPTrigger>(0, 0.5f, 0.1f, true,
+                                                    [&events](uint64_t s) { events.push_back(s); });
+        dsp.add(std::make_shared<DSPDecimator>(2));
+        dsp.add(trigger);
+        auto res = dsp_run(dsp, saw, sizes);
+        assert(res[0].size() == len / 2);
+        assert(trigger->get_events() == 4 && events.size() == 4);
+        for (size_t i = 0; i < events.size(); i++) {
+            assert(events[i] == 25 * i + 13);
+            assert(res[0][events[i]] >= 0.5f && res[0][events[i] - 1] < 0.5f);
+        }
+    }
+
+    REPORT_CASE
+    // Gap clears state: output after gap matches pipeline started at the gap
+    {
+        const std::vector<float> coeffs = {0.5f, 0.5f, 0.5f};
+        DSPPipeline dsp1(2, 64);
+        DSPPipeline dsp2(2, 64);
+        dsp1.add(std::make_shared<DSPFIRFilter>(coeffs));
+        dsp1.add(std::make_shared<DSPDecimator>(4));
+        dsp2.add(std::make_shared<DSPFIRFilter>(coeffs));
+        dsp2.add(std::make_shared<DSPDecimator>(4));
+        auto res1 = dsp_run(dsp1, signal, {20, 30, 40}, 1);
+
+        std::vector<std::vector<float>> tail(2);
+        for (size_t ch = 0; ch < 2; ch++) tail[ch].assign(signal[ch].begin() + 20, signal[ch].begin() + 90);
+        auto res2 = dsp_run(dsp2, tail, {30, 40});
+        assert(res1[0].size() == 5 + res2[0].size());
+        for (size_t ch = 0; ch < 2; ch++) {
+            assert(std::equal(res2[ch].begin(), res2[ch].end(), res1[ch].begin() + 5));
+        }
+    }
+
+    REPORT_CASE
+    // Connected callback receives only non-empty blocks
+    {
+        DSPPipeline dsp(1, 8);
+        ADCBlock in{0, 8, 8, false, std::vector<float>(8, 1.0f)};
+        size_t calls = 0;
+        dsp.add(std::make_shared<DSPDecimator>(16));
+        auto clb = dsp.connect([&calls](const ADCBlock& b) { calls++; assert(b.samples == 1 && b.values[0] == 1.0f); });
+        for (int i = 0; i < 6; i++) clb(in);
+        assert(calls == 3);
+    }
+}
+
+static EKitCaptureHeader capture_test_header() {
+    EKitCaptureHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = EKIT_CAPTURE_ADC;
+    hdr.channels = 2;
+    hdr.record_size = 2 * sizeof(uint16_t);
+    hdr.tick_freq = 1000.0;
+    hdr.adc_maxval = 4095;
+    strcpy(hdr.channel[0].name, "IN0");
+    hdr.channel[0].max = 4.095;
+    strcpy(hdr.channel[1].name, "IN1");
+    hdr.channel[1].min = -1.0;
+    hdr.channel[1].max = 3.095;
+    return hdr;
+}
+
+void test_capture_file() {
+    DECLARE_TEST(test_capture_file)
+    const std::string path = "/tmp/hlek_capture_test." + std::to_string(getpid());
+    const size_t total = 5000;
+    const size_t gap_at = 2500;
+    const size_t chunk_records = (4096 - sizeof(EKitCaptureChunk)) / (2 * sizeof(uint16_t));
+    std::vector<uint16_t> data(total * 2);
+    for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<uint16_t>((i * 7) % 4096);
+
+    REPORT_CASE
+    // Records span several chunks and mapped extents, gap starts new chunk
+    {
+        EKitCaptureWriter cap(path, capture_test_header(), 4096, 3 * 4096);
+        for (size_t i = 0; i < total;) {
+            size_t n = std::min<size_t>(300, (i < gap_at ? gap_at : total) - i);
+            cap.append(data.data() + i * 2, n, i == gap_at);
+            i += n;
+        }
+        cap.close();
+        assert(cap.get_records() == total);
+
+        EKitCaptureReader rd(path);
+        assert(!rd.is_recovered() && rd.get_records() == total);
+        assert(rd.get_header().chunk_size == 4096 && strcmp(rd.get_header().channel[1].name, "IN1") == 0);
+        assert(rd.get_chunk_count() == (gap_at + chunk_records - 1) / chunk_records +
+                                       (total - gap_at + chunk_records - 1) / chunk_records);
+        assert(rd.is_gap(gap_at) && !rd.is_gap(0) && !rd.is_gap(gap_at + 1) && !rd.is_gap(chunk_records));
+
+        std::mt19937 rng(777);
+        std::vector<uint16_t> buf(600 * 2);
+        for (int k = 0; k < 100; k++) {
+            uint64_t first = rng() % total;
+            size_t n = rd.read(first, 1 + rng() % 600, buf.data());
+            assert(n > 0 && first + n <= total);
+            assert(memcmp(buf.data(), data.data() + first * 2, n * 2 * sizeof(uint16_t)) == 0);
+        }
+        assert(rd.read(total - 2, 10, buf.data()) == 2 && rd.read(total, 1, buf.data()) == 0);
+    }
+
+    REPORT_CASE
+    // Index is rebuilt if file is not closed
+    {
+        EKitCaptureWriter cap(path, capture_test_header(), 4096, 4 * 4096);
+        cap.append(data.data(), 1500);
+        cap.append(data.data() + 1500 * 2, 100, true);
+        {
+            EKitCaptureReader rd(path);
+            assert(rd.is_recovered() && rd.get_records() == 1600 && rd.get_chunk_count() == 3);
+            assert(rd.is_gap(1500) && !rd.is_gap(chunk_records));
+            std::vector<uint16_t> buf(1600 * 2);
+            assert(rd.read(0, 1600, buf.data()) == 1600 && memcmp(buf.data(), data.data(), buf.size() * 2) == 0);
+        }
+        cap.close();
+        {
+            EKitCaptureReader rd(path);
+            assert(!rd.is_recovered() && rd.get_records() == 1600);
+        }
+
+        // Damaged index entry is not trusted, index is rebuilt from the chunk headers
+        uint32_t bad_records = 0x7FFFFFFF;
+        int fd = open(path.c_str(), O_WRONLY);
+        assert(fd >= 0);
+        assert(pwrite(fd, &bad_records, sizeof(bad_records),
+                      4096 + 3 * 4096 + sizeof(EKitCaptureIndexEntry) + offsetof(EKitCaptureIndexEntry, records)) ==
+               sizeof(bad_records));
+        close(fd);
+        EKitCaptureReader rd(path);
+        assert(rd.is_recovered() && rd.get_records() == 1600 && rd.get_chunk_count() == 3);
+    }
+
+    REPORT_CASE
+    // CSV conversion, time is calculated from absolute sample index
+    {
+        {
+            EKitCaptureWriter cap(path, capture_test_header(), 4096);
+            cap.append_at(0, data.data(), 2);
+            cap.append_at(10, data.data() + 2 * 2, 1);
+            assert(cap.get_next_sample() == 11);
+        }
+
+        EKitCaptureReader rd(path);
+        assert(rd.get_chunk_count() == 2 && rd.is_gap(2) && rd.get_sample(1) == 1 && rd.get_sample(2) == 10);
+        FILE* f = tmpfile();
+        char line[128];
+        rd.write_csv(f, 1, 10);
+        rewind(f);
+        assert(fgets(line, sizeof(line), f) && strcmp(line, "Sample,Time,\"IN0\",\"IN1\",Gap\n") == 0);
+        assert(fgets(line, sizeof(line), f) && strcmp(line, "1,0.001000000,0.014000,-0.979000,0\n") == 0);
+        assert(fgets(line, sizeof(line), f) && strcmp(line, "2,0.010000000,0.028000,-0.965000,1\n") == 0);
+        assert(fgets(line, sizeof(line), f) == nullptr);
+        fclose(f);
+    }
+
+    REPORT_CASE
+    // Timestamps are converted to seconds since the first timestamp
+    {
+        const uint64_t ts[3] = {1000, 1500, 3000};
+        EKitCaptureHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.type = EKIT_CAPTURE_TIMESTAMP;
+        hdr.channels = 1;
+        hdr.record_size = sizeof(uint64_t);
+        hdr.tick_freq = 1000.0;
+        {
+            EKitCaptureWriter cap(path, hdr);
+            cap.append(ts, 3);
+        }
+
+        EKitCaptureReader rd(path);
+        FILE* f = tmpfile();
+        char line[128];
+        rd.write_csv(f, 2, 1);
+        rewind(f);
+        assert(fgets(line, sizeof(line), f) && strcmp(line, "N,Ticks,Seconds,Gap\n") == 0);
+        assert(fgets(line, sizeof(line), f) && strcmp(line, "2,3000,2.000000000,0\n") == 0);
+        fclose(f);
+    }
+
+    unlink(path.c_str());
+}
@@ -2,4 +2,18 @@
 
 void test_append_vector();
 
-void test_reverse_bits();
\ No newline at end of file
+void test_reverse_bits();
+
+void test_poll_strategy();
+
+void test_metrics();
+
+void test_control_sum();
+
+void benchmark_control_sum();
+
+
+void test_crc16();
+void test_scale_u16();
+void test_dsp_pipeline();
+void test_capture_file();
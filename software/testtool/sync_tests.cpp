@@ -3,6 +3,12 @@
 #include <testtool.hpp>
 
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include "ekit_async.hpp"
+#include "ekit_arbiter.hpp"
+#include "ekit_sim_firmware.hpp"
+#include "tools.hpp"
 #define SEQ_LOCK_TEST 1
 #include "synchronization.h"
 
@@ -79,4 +85,464 @@ void test_safe_mutex() {
         b.unlock();
         a.unlock();
     }
-}
\ No newline at end of file
+
+#ifndef NDEBUG
+    REPORT_CASE
+    {
+        // Lock order violation is reported even if deadlock doesn't happen
+        tools::GlobalMutexVerifier& verifier = tools::GlobalMutexVerifier::instance();
+        std::string report;
+        auto prev_handler = verifier.set_violation_handler([&report](const std::string& r) { report = r; });
+        size_t violations = verifier.get_violations();
+
+        tools::safe_mutex a;
+        tools::safe_mutex b;
+        tools::safe_mutex c;
+
+        for (int i=0; i<2; i++) {
+            a.lock();
+            b.lock();
+            b.unlock();
+            a.unlock();
+        }
+        assert(verifier.get_violations() == violations);
+
+        b.lock();
+        a.lock();
+        a.unlock();
+        b.unlock();
+        assert(verifier.get_violations() == violations + 1);
+        assert(report.find("Lock order violation") != std::string::npos);
+
+        // Known (even if wrong) order is reported once
+        b.lock();
+        a.lock();
+        a.unlock();
+        b.unlock();
+        assert(verifier.get_violations() == violations + 1);
+
+        // Cycle through three mutexes: b->c, c->a and a->b
+        b.lock();
+        c.lock();
+        c.unlock();
+        b.unlock();
+        assert(verifier.get_violations() == violations + 1);
+
+        c.lock();
+        a.lock();
+        a.unlock();
+        c.unlock();
+        assert(verifier.get_violations() == violations + 2);
+
+        verifier.set_violation_handler(prev_handler);
+    }
+
+    REPORT_CASE
+    {
+        // Bus locks are reported at the code which locks the bus, not inside EKitBus::lock() implementation
+        tools::GlobalMutexVerifier& verifier = tools::GlobalMutexVerifier::instance();
+        std::string report;
+        std::vector<std::string> sites;
+        auto prev_handler = verifier.set_violation_handler([&report](const std::string& r) { report = r; });
+        size_t violations = verifier.get_violations();
+        EKitSimFirmwareBus bus(0x2A, 64, false);
+        EKitTimeout to(0);
+        tools::safe_mutex a;
+
+        a.lock();
+        assert(bus.lock(0x2A, to) == EKIT_OK);
+        bus.unlock();
+        a.unlock();
+
+        assert(bus.lock(0x2A, to) == EKIT_OK);
+        a.lock();
+        a.unlock();
+        bus.unlock();
+        assert(verifier.get_violations() == violations + 1);
+
+        // Sites: a and bus of the violation, a and bus of the reverse order edge, then backtrace
+        for (size_t p = report.find('['); p != std::string::npos; p = report.find('[', p + 1)) {
+            sites.push_back(report.substr(p, report.find(']', p) - p));
+        }
+        assert(sites.size() >= 4 && sites[1] != sites[3]);
+
+        verifier.set_violation_handler(prev_handler);
+    }
+
+    REPORT_CASE
+    {
+        // Lock order of destroyed mutexes is forgotten
+        tools::GlobalMutexVerifier& verifier = tools::GlobalMutexVerifier::instance();
+        size_t violations = verifier.get_violations();
+        tools::safe_mutex a;
+        {
+            tools::safe_mutex b;
+            a.lock();
+            b.lock();
+            b.unlock();
+            a.unlock();
+        }
+        tools::safe_mutex b;
+        b.lock();
+        a.lock();
+        a.unlock();
+        b.unlock();
+        assert(verifier.get_violations() == violations);
+    }
+#endif
+}
+
+void test_async_executor() {
+    DECLARE_TEST(test_async_executor)
+
+    REPORT_CASE
+    {
+        // Requests are executed in submission order by single thread
+        EKitAsyncExecutor executor(std::shared_ptr<EKitBus>(), 2);
+        std::vector<int> order;
+        std::vector<std::future<int>> results;
+        std::thread::id caller = std::this_thread::get_id();
+
+        for (int i = 0; i < 16; i++) {
+            results.push_back(executor.submit([i, &order, caller]() {
+                assert(std::this_thread::get_id() != caller);
+                order.push_back(i);
+                return i * 2;
+            }));
+        }
+
+        for (int i = 0; i < 16; i++) {
+            assert(results[i].get() == i * 2);
+            assert(order[i] == i);
+        }
+    }
+
+    REPORT_CASE
+    {
+        // Exceptions are passed to the caller
+        EKitAsyncExecutor executor(std::shared_ptr<EKitBus>(), 4);
+        std::future<void> f = executor.submit([]() {
+            throw EKitException("test_async_executor", EKIT_FAIL, "expected");
+        });
+
+        bool thrown = false;
+        try {
+            f.get();
+        } catch (EKitException& e) {
+            thrown = (e.ekit_error == EKIT_FAIL);
+        }
+        assert(thrown);
+    }
+
+    REPORT_CASE
+    {
+        // Callback completion, pending requests are executed on destruction
+        std::atomic<int> completed(0);
+        {
+            EKitAsyncExecutor executor(std::shared_ptr<EKitBus>(), 8);
+            EKitTimeout to(0);
+            for (int i = 0; i < 8; i++) {
+                EKIT_ERROR err = executor.post([]() { tools::sleep_ms(1); },
+                                               [&completed](std::exception_ptr ex) {
+                                                   assert(!ex);
+                                                   completed++;
+                                               },
+                                               to);
+                assert(err == EKIT_OK);
+            }
+        }
+        assert(completed.load() == 8);
+    }
+
+    REPORT_CASE
+    {
+        // Exception thrown by completion callback is passed to error handler, full queue times out
+        EKitAsyncExecutor executor(std::shared_ptr<EKitBus>(), 1);
+        std::atomic<int> handled(0);
+        EKitTimeout to(0);
+        executor.set_error_handler([&handled](std::exception_ptr ex) { if (ex) handled++; });
+        assert(executor.post([]() {},
+                             [](std::exception_ptr ex) { throw EKitException("test_async_executor", EKIT_FAIL); },
+                             to) == EKIT_OK);
+        assert(executor.post([]() { tools::sleep_ms(100); }, nullptr, to) == EKIT_OK);
+        assert(executor.post([]() {}, nullptr, to) == EKIT_OK);
+
+        EKitTimeout to_short(20);
+        auto start = std::chrono::steady_clock::now();
+        assert(executor.post([]() {}, nullptr, to_short) == EKIT_TIMEOUT);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        assert(elapsed.count() >= 15 && elapsed.count() < 90);
+        assert(handled == 1 && executor.get_error_count() == 1);
+    }
+}
+
+void test_bus_group() {
+    DECLARE_TEST(test_bus_group)
+
+    REPORT_CASE
+    {
+        // Requests for different buses are executed concurrently, for the same bus - in submission order
+        std::shared_ptr<EKitBus> bus1(new EKitSimFirmwareBus(0x2A, 64, false));
+        std::shared_ptr<EKitBus> bus2(new EKitSimFirmwareBus(0x2B, 64, false));
+        std::shared_ptr<EKitBus> bus3(new EKitSimFirmwareBus(0x2C, 64, false));
+        EKitBusGroup group(2);
+        std::mutex order_lock;
+        std::vector<std::pair<int, int>> order;
+        std::thread::id threads[2];
+        std::vector<std::future<int>> results;
+        EKitTimeout to(0);
+
+        group.add_bus(bus1);
+        group.add_bus(bus2);
+        assert(group.size() == 2);
+        assert(group.post(bus3, []() {}, nullptr, to) == EKIT_BAD_PARAM);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 4; i++) {
+            for (int b = 0; b < 2; b++) {
+                results.push_back(group.submit(b == 0 ? bus1 : bus2, [i, b, &order_lock, &order, &threads]() {
+                    tools::sleep_ms(30);
+                    std::lock_guard<std::mutex> lock(order_lock);
+                    assert(i == 0 || threads[b] == std::this_thread::get_id());
+                    threads[b] = std::this_thread::get_id();
+                    order.emplace_back(b, i);
+                    return i + b * 10;
+                }));
+            }
+        }
+
+        assert(group.join(to) == EKIT_OK);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        assert(elapsed.count() >= 120 && elapsed.count() < 220);
+        assert(group.pending() == 0 && threads[0] != threads[1]);
+        assert(order.size() == 8);
+        int next[2] = {0, 0};
+        for (auto& o : order) {
+            assert(o.second == next[o.first]++);
+        }
+        for (size_t r = 0; r < results.size(); r++) {
+            assert(results[r].get() == static_cast<int>(r / 2) + static_cast<int>(r % 2) * 10);
+        }
+    }
+
+    REPORT_CASE
+    {
+        // Join times out while requests are pending, exceptions are passed to completion
+        std::shared_ptr<EKitBus> bus(new EKitSimFirmwareBus(0x2A, 64, false));
+        EKitBusGroup group;
+        std::atomic<int> failed(0);
+        EKitTimeout to(0);
+        EKitTimeout to_short(10);
+
+        group.add_bus(bus);
+        assert(group.post(bus, []() { tools::sleep_ms(50); }, nullptr, to) == EKIT_OK);
+        assert(group.post(bus,
+                          []() { throw EKitException("test_bus_group", EKIT_FAIL, "expected"); },
+                          [&failed](std::exception_ptr ex) { if (ex) failed++; },
+                          to) == EKIT_OK);
+        assert(group.join(to_short) == EKIT_TIMEOUT);
+        assert(group.join(to) == EKIT_OK);
+        assert(failed == 1);
+    }
+}
+
+void test_bus_arbiter() {
+    DECLARE_TEST(test_bus_arbiter)
+
+    REPORT_CASE
+    {
+        // Higher priority goes first, FIFO within the same priority
+        EKitBusArbiter arbiter(3, 0);
+        std::mutex order_lock;
+        std::vector<int> order;
+        std::vector<std::thread> threads;
+        EKitTimeout to(0);
+
+        arbiter.set_priority(10, 0);
+        arbiter.set_priority(20, 2);
+        assert(arbiter.get_priority(10) == 0);
+        assert(arbiter.get_priority(20) == 2);
+        assert(arbiter.get_priority(30) == 0);
+
+        assert(arbiter.acquire(10, to) == EKIT_OK);
+
+        // Start waiters one by one, so they are queued in known order
+        int addrs[] = {10, 20, 10, 20};
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&arbiter, &order_lock, &order, i, &addrs]() {
+                EKitTimeout wto(0);
+                EKIT_ERROR err = arbiter.acquire(addrs[i], wto);
+                assert(err == EKIT_OK);
+                {
+                    std::lock_guard<std::mutex> lock(order_lock);
+                    order.push_back(i);
+                }
+                arbiter.release();
+            });
+            tools::sleep_ms(20);
+        }
+
+        arbiter.release();
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        assert(order == std::vector<int>({1, 3, 0, 2}));
+
+        std::vector<size_t> h = arbiter.get_histogram(2);
+        size_t total = 0;
+        for (size_t v : h) total += v;
+        assert(h.size() == EKitBusArbiter::histogram_buckets);
+        assert(total == 2);
+    }
+
+    REPORT_CASE
+    {
+        // Waiter leaves the queue once timeout is expired
+        EKitBusArbiter arbiter(2, 0);
+        EKitTimeout to(0);
+        assert(arbiter.acquire(1, to) == EKIT_OK);
+
+        EKIT_ERROR err = EKIT_OK;
+        std::thread waiter([&arbiter, &err]() {
+            EKitTimeout wto(10);
+            err = arbiter.acquire(1, wto);
+        });
+        waiter.join();
+        assert(err == EKIT_TIMEOUT);
+
+        arbiter.release();
+        assert(arbiter.acquire(1, to) == EKIT_OK);
+        arbiter.release();
+    }
+
+    REPORT_CASE
+    {
+        // Earlier deadline goes first within the same priority, infinite timeout goes last
+        EKitBusArbiter arbiter(2, 0);
+        std::mutex order_lock;
+        std::vector<int> order;
+        std::vector<std::thread> threads;
+        EKitTimeout to(0);
+
+        assert(arbiter.acquire(1, to) == EKIT_OK);
+
+        int timeouts[] = {5000, 1000, 0, 1000};
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&arbiter, &order_lock, &order, i, &timeouts]() {
+                EKitTimeout wto(timeouts[i]);
+                EKIT_ERROR err = arbiter.acquire(1, wto);
+                assert(err == EKIT_OK);
+                {
+                    std::lock_guard<std::mutex> lock(order_lock);
+                    order.push_back(i);
+                }
+                arbiter.release();
+            });
+            tools::sleep_ms(20);
+        }
+
+        arbiter.release();
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        assert(order == std::vector<int>({1, 3, 0, 2}));
+    }
+
+    REPORT_CASE
+    {
+        // Admission rejects request which can't get bus before deadline without waiting
+        EKitBusArbiter arbiter(2, 0);
+        EKitTimeout to(0);
+        arbiter.set_admission(true);
+
+        // Nothing is known about ownership time yet, request is admitted and times out
+        assert(arbiter.acquire(1, to) == EKIT_OK);
+        {
+            EKitTimeout wto(10);
+            assert(arbiter.acquire(1, wto) == EKIT_TIMEOUT && wto.measure() >= 10);
+        }
+        tools::sleep_ms(50);
+        arbiter.release();
+        assert(arbiter.get_rejected() == 0);
+
+        assert(arbiter.acquire(1, to) == EKIT_OK);
+        {
+            EKitTimeout wto(10);
+            assert(arbiter.acquire(1, wto) == EKIT_TIMEOUT && wto.measure() < 10);
+        }
+        assert(arbiter.get_rejected() == 1);
+
+        EKIT_ERROR err = EKIT_FAIL;
+        std::thread waiter([&arbiter, &err]() {
+            EKitTimeout wto(1000);
+            err = arbiter.acquire(1, wto);
+            if (err == EKIT_OK) arbiter.release();
+        });
+        tools::sleep_ms(20);
+        arbiter.release();
+        waiter.join();
+        assert(err == EKIT_OK && arbiter.get_rejected() == 1);
+
+        arbiter.reset_histograms();
+        assert(arbiter.get_rejected() == 0);
+    }
+}
+
+void test_spsc_ring() {
+    DECLARE_TEST(test_spsc_ring)
+
+    REPORT_CASE
+    // Single thread: capacity, order and slots reused in place
+    {
+        tools::SPSCRing<std::vector<int>> ring(3, std::vector<int>(4));
+        assert(ring.capacity() == 3 && ring.size() == 0 && ring.front() == nullptr);
+        for (int round = 0; round < 5; round++) {
+            for (int i = 0; i < 3; i++) {
+                std::vector<int>* slot = ring.back();
+                assert(slot != nullptr && slot->size() == 4);
+                (*slot)[0] = round * 10 + i;
+                ring.push();
+            }
+            assert(ring.back() == nullptr && ring.size() == 3);
+            for (int i = 0; i < 3; i++) {
+                assert((*ring.front())[0] == round * 10 + i);
+                ring.pop();
+            }
+            assert(ring.front() == nullptr && ring.size() == 0);
+        }
+    }
+
+    REPORT_CASE
+    // Producer and consumer threads: every value is received once and in order
+    {
+        const uint64_t count = 200000;
+        tools::SPSCRing<uint64_t> ring(16, 0);
+        std::thread producer([&ring, count]() {
+            for (uint64_t v = 1; v <= count; ) {
+                uint64_t* slot = ring.back();
+                if (slot == nullptr) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                *slot = v++;
+                ring.push();
+            }
+        });
+
+        uint64_t expected = 1;
+        while (expected <= count) {
+            uint64_t* slot = ring.front();
+            if (slot == nullptr) {
+                std::this_thread::yield();
+                continue;
+            }
+            assert(*slot == expected);
+            expected++;
+            ring.pop();
+        }
+        producer.join();
+        assert(ring.size() == 0);
+    }
+}
@@ -1,4 +1,8 @@
 #pragma once
 
 void test_seq_lock_multithread();
-void test_safe_mutex();
\ No newline at end of file
+void test_safe_mutex();
+void test_async_executor();
+void test_bus_group();
+void test_bus_arbiter();
+void test_spsc_ring();
@@ -28,6 +28,8 @@
 #include "circbuffer_tests.hpp"
 #include "sync_tests.hpp"
 #include "misc_tests.hpp"
+#include "bus_tests.hpp"
+#include "i2c_bus_tests.hpp"
 
 jmp_buf jmpbuf;
 int g_assert_param_count = 0;
@@ -51,6 +53,10 @@ int main()
     test_seq_lock_multithread();
     test_safe_mutex();
     test_circ_buffer_multithreaded();
+    test_async_executor();
+    test_bus_group();
+    test_bus_arbiter();
+    test_spsc_ring();
 
     /// Circular buffer tests
     test_circbuffer_initialization();
@@ -84,9 +90,30 @@ int main()
     test_stm32_timer_params();
     test_StopWatch();
 
+    /// Bus tests
+    test_uart_bus();
+    test_trace_bus();
+    test_sim_firmware_bus();
+    test_drain_scheduler();
+    test_bus_broker();
+    test_bus_deadlines();
+    test_adc_acquisition();
+
+    /// Firmware I2C bus tests
+    test_i2c_bus_firmware();
+    benchmark_i2c_bus_firmware();
+
     /// Miscellaneous tests
     test_reverse_bits();
     test_append_vector();
+    test_poll_strategy();
+    test_metrics();
+    test_control_sum();
+    benchmark_control_sum();
+    test_crc16();
+    test_scale_u16();
+    test_dsp_pipeline();
+    test_capture_file();
 
     std::cout << std::endl << "[    S U C C E S S    ]" << std::endl;
     return 0;